@@ -0,0 +1,180 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#ifndef __COLORCOMPOSITOR_H__
+#define __COLORCOMPOSITOR_H__
+
+#include "FitsLiberator.h"
+#include "Stretch.h"
+#include "ImageCube.hpp"
+#include "ProgressModel.h"
+#include "tiffio.h"
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Combines several grayscale planes into a single RGB TIFF. Each input
+		plane is stretched with its own Stretch, scaled to [0;1] between its
+		black and white levels and added to the output in its own colour; the
+		sums are saturated at white. The planes must have the same width and
+		height and may come from different images.
+
+		The output is produced strip by strip in a single pass: a strip of
+		every input is read, stretched and composited, and written to the
+		file before its buffers are reused, so only the strips in flight are
+		in memory regardless of the size of the images.
+		*/
+		class ColorCompositor
+		{
+		public:
+			/** An input plane and the colour it is painted in. */
+			struct Layer
+			{
+				const ImageCube*	cube;
+				UInt				plane;
+				Stretch				stretch;
+				Bool				encoded;	///< The plane is read in its stored encoding.
+				ImageCube::Encoding	encoding;
+				Double				red;
+				Double				green;
+				Double				blue;
+			};
+
+			ColorCompositor();
+
+			/**
+			Adds an input plane.
+			@param cube the image the plane belongs to.
+			@param plane index of the plane in the cube.
+			@param stretch the stretch of the plane; its black and white levels
+			map to no colour and the full colour.
+			@param red weight of the red channel in [0;1].
+			@param green weight of the green channel in [0;1].
+			@param blue weight of the blue channel in [0;1].
+			@throws Exception if the plane does not have the size of the planes
+			added before it.
+			*/
+			Void addLayer( const ImageCube* cube, UInt plane, const Stretch& stretch,
+				Double red, Double green, Double blue );
+
+			/**
+			Sets the file run() writes.
+			@param fileName name of the TIFF file.
+			@param bitDepth bits per channel, 8 or 16.
+			@param flipped true if the image should be marked as flipped.
+			@param metaData the XMP packet written to the file.
+			*/
+			Void setExport( const String& fileName, Short bitDepth, Bool flipped, const String& metaData );
+
+			/**
+			Composites the layers and writes the TIFF file.
+			@param progressModel incremented once per strip; may be NULL.
+			@return ImageTile::AllocOk, ImageTile::AllocErr if a strip could not
+			be allocated or ImageTile::OperationCanceled if the user canceled.
+			@throws Exception if no layers were added or the file could not be
+			written.
+			*/
+			Int run( FitsLiberator::Modelling::ProgressModel* progressModel );
+
+			/** Returns the number of strips run() writes, i.e. the number of
+				times it increments the progress model. */
+			UInt getNumberOfStrips() const;
+
+			/**
+			The buffers of a single strip of the output. Public so the pipeline
+			stages in the implementation can use it.
+			*/
+			struct StripBuffer
+			{
+				UInt				strip;
+				UInt				row;
+				UInt				rows;
+				Vector<Byte*>		rawPixels;		///< One per layer.
+				Vector<Byte*>		nullPixels;		///< One per layer, NULL if the strip has no nulls.
+				Double*				pixels;			///< Stretched pixels of the layer being composited.
+				Double*				colors;			///< Interleaved red, green and blue sums.
+				Byte*				output;
+				String				error;
+
+				StripBuffer( UInt strip, UInt row, UInt rows, const ColorCompositor& compositor );
+				~StripBuffer();
+			private:
+				Void release();
+			};
+
+			Void readStrip( StripBuffer& buffer ) const;
+			Void compositeStrip( StripBuffer& buffer, Int nCpus ) const;
+			Void writeStrip( const StripBuffer& buffer );
+
+		private:
+			template<typename O> Void convertStrip( StripBuffer& buffer, O maxValue ) const;
+			UInt getRowsPerStrip() const;
+			Void open();
+			Void close();
+
+			Vector<Layer>	layers;
+			UInt			width;
+			UInt			height;
+			UInt			rowsPerStrip;
+
+			String			fileName;
+			Short			bitDepth;
+			Bool			flipped;
+			String			metaData;
+			TIFF*			file;			///< The file being written.
+		};
+	}
+}
+
+#endif
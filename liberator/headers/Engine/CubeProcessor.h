@@ -0,0 +1,179 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __CUBEPROCESSOR_H__
+#define __CUBEPROCESSOR_H__
+
+#include "FitsLiberator.h"
+#include "Stretch.h"
+#include "ImageCube.hpp"
+#include "ProgressModel.h"
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Statistics of a single plane as computed by CubeProcessor. The values
+		are the same as TileControl::doStatistics3 produces for the plane.
+		*/
+		struct PlaneStatistics
+		{
+			Double			min;
+			Double			max;
+			Double			mean;
+			Double			median;
+			Double			stdev;
+			Double			maxBinCount;
+			UInt			pixelCount;
+			Vector<Double>	histogram;
+		};
+
+		/**
+		Processes every plane of a 3D image in a single pass over the file.
+		The planes are read one at a time in index order, which for FITS and
+		PDS band sequential images is the order they are stored on disk, so
+		each byte of the image is read exactly once. While the next planes are
+		being read the planes already in memory are stretched, their statistics
+		and histograms are computed and, if requested, they are written to a
+		TIFF file of their own.
+		*/
+		class CubeProcessor
+		{
+		public:
+			/**
+			@param cube the image cube to process.
+			@param stretch the stretch applied to the pixels before the statistics
+			are computed.
+			@param binCount the number of bins in each plane's histogram.
+			@param maxMemUsage the number of bytes the planes in memory may use,
+			e.g. the budget of the TileControl. At least one plane is always
+			kept in memory.
+			*/
+			CubeProcessor( const ImageCube* cube, const Stretch& stretch, UInt binCount,
+				UInt maxMemUsage );
+
+			/**
+			Makes run() write each plane to a TIFF file. The file name of a plane
+			is the given file name with the one-based plane number inserted in
+			front of the extension, e.g. "m31.tif" becomes "m31_001.tif".
+			@param fileName the base file name.
+			@param bitDepth the export bit depth (8, 16 or 32).
+			@param flipped true if the planes should be marked as flipped.
+			@param metaData the XMP packet written to each file.
+			*/
+			Void setExport( const String& fileName, Short bitDepth, Bool flipped, const String& metaData );
+
+			/**
+			Reads and processes all planes.
+			@param progressModel incremented once per plane; may be NULL.
+			@return ImageTile::AllocOk, ImageTile::AllocErr if a plane could not
+			be allocated or ImageTile::OperationCanceled if the user canceled.
+			@throws Exception if a TIFF file could not be written.
+			*/
+			Int run( FitsLiberator::Modelling::ProgressModel* progressModel );
+
+			/** Returns the statistics of a plane. Only valid after run() succeeded. */
+			const PlaneStatistics& getStatistics( UInt plane ) const;
+
+			/** Returns the name of the TIFF file a plane is exported to. */
+			String getFileName( UInt plane ) const;
+
+			/** Returns the number of threads used for processing the planes. */
+			Int getNumberOfThreads() const;
+
+			/**
+			The buffers of a single plane. Public so the pipeline stages in the
+			implementation can use it.
+			*/
+			struct PlaneBuffer
+			{
+				UInt	plane;
+				Byte*	rawPixels;
+				Byte*	nullPixels;
+				Double*	stretchedPixels;
+				Bool	hasNulls;
+				String	error;
+
+				PlaneBuffer( UInt plane, const ImageCube* cube );
+				~PlaneBuffer();
+
+				/** Returns the number of bytes the buffers of a plane use. */
+				static UInt64 SizeOf( const ImageCube* cube );
+			};
+
+			Void readPlane( PlaneBuffer& buffer ) const;
+			Void processPlane( PlaneBuffer& buffer, Int nCpus );
+
+		private:
+			template<typename O> Void writePlane( const PlaneBuffer& buffer, O maxValue );
+
+			const ImageCube*		cube;
+			Bool					encoded;	///< Planes are read in their stored encoding.
+			ImageCube::Encoding		encoding;
+			Stretch					stretch;
+			Stretch					exportStretch;
+			UInt					binCount;
+			UInt					maxMemUsage;
+			Vector<PlaneStatistics>	statistics;
+
+			String					fileName;
+			Short					bitDepth;
+			Bool					flipped;
+			String					metaData;
+			Bool					doExport;
+		};
+	}
+}
+
+#endif
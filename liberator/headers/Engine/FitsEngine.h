@@ -57,6 +57,8 @@
 #include "FitsLiberator.h"
 #include "Stretch.h"
 #include "ImageCube.hpp"
+#include "StretchTable.h"
+#include "StretchChain.h"
 
 namespace FitsLiberator {
     namespace Engine {
@@ -70,13 +72,52 @@ namespace FitsLiberator {
                 @param stretch Stretch to apply
                 @param bitDepth Bit depth of the pixels
                 @param rawPixels Pixel data
-                @param nullPixels Null map, used to bypass processing when it is not needed.
+                @param nullPixels Bit-packed null map as produced by ImageCube::Read or NULL if the
+                    pixels contain no nulls. Pixels flagged as null are set to NaN.
                 @param out The output array
-                @param count Number of pixels to process; rawPixels, nullPixels and out must contain atleast this number of elements.
+                @param count Number of pixels to process; rawPixels and out must contain atleast this number 
+                    of elements, nullPixels ImageCube::NullMapSize(count) bytes.
 				@param nCpus the number of cpus to use when processing in parallel
 				*/
             static Void stretch(const Stretch& stretch, ImageCube::PixelFormat bitDepth,
 				Void* rawPixels, Byte* nullPixels, Double* out, UInt count, Int nCpus );
+            /** Stretches pixels as they are stored in the file, see ImageCube::ReadEncoded. Byte 
+                order, blank values and the BSCALE/BZERO scaling are handled in the same pass as 
+                the stretch, so the pixels need not be converted beforehand. Blank pixels are 
+                set to NaN.
+                @param stretch Stretch to apply
+                @param encoding Encoding of the stored samples as returned by ImageCube::Encoded.
+                @param rawPixels Stored samples
+                @param out The output array
+                @param count Number of pixels to process
+                @param nCpus the number of cpus to use when processing in parallel */
+            static Void stretchEncoded(const Stretch& stretch, const ImageCube::Encoding& encoding,
+                const Void* rawPixels, Double* out, UInt count, Int nCpus );
+            /** Stretches an array of pixels with a chain of primitive steps, see StretchChain. 
+                The chain is evaluated by the same kernels as the built-in stretch functions.
+                @param chain Chain to apply
+                @param bitDepth Bit depth of the pixels
+                @param rawPixels Pixel data
+                @param nullPixels Bit-packed null map or NULL. Pixels flagged as null are set to NaN.
+                @param out The output array
+                @param count Number of pixels to process
+                @param nCpus the number of cpus to use when processing in parallel */
+            static Void stretchChain(const StretchChain& chain, ImageCube::PixelFormat bitDepth,
+				Void* rawPixels, Byte* nullPixels, Double* out, UInt count, Int nCpus );
+            /** Returns the lookup table of a stretch for 8- and 16-bit samples. Both stretch and 
+                stretchEncoded look up pixels of such images instead of evaluating the stretch 
+                function for each of them. The table is built the first time a stretch is used.
+                @param stretch Stretch to apply
+                @param format Format of the samples.
+                @param encoding Encoding of stored samples or NULL for pixels read with ImageCube::Read.
+                @return The table or an empty pointer if the samples are wider than 16 bits. */
+            static StretchTable::Pointer getTable(const Stretch& stretch, ImageCube::PixelFormat format,
+                const ImageCube::Encoding* encoding);
+            /** Sets every pixel flagged in a bit-packed null map to NaN.
+                @param nullMap Null map with one bit per pixel.
+                @param out Array of stretched pixels.
+                @param count Number of pixels in out. */
+            static Void applyNullMap(const Byte* nullMap, Double* out, UInt count);
             /** Scales an array of pixels inplace.
                 @param stretch This method uses only blackLevel, whiteLevel and outputMax.
                 @param pixels Pixel array.
@@ -95,6 +136,25 @@ namespace FitsLiberator {
 			static Double getLinearVal(const Stretch&, Double);
 			static Double getLinearValWithoutStretch(const Stretch&, Double);
             static Double linearValStretch( const Stretch&, Double val, Bool doStretch );
+            /** Returns the linear values of an array of stretched values, the batch form of 
+                getLinearVal. The inverse of the stretch function is selected once for the 
+                whole array.
+                @param stretch the given stretch to use in the process
+                @param in Stretched values
+                @param out Linear values, may be the same array as in
+                @param count Number of values */
+            static Void getLinearValues(const Stretch& stretch, const Double* in, Double* out, UInt count);
+            /** Batch form of getLinearValWithoutStretch, which undoes the stretch function 
+                but not the scaling. */
+            static Void getLinearValuesWithoutStretch(const Stretch& stretch, const Double* in, Double* out, UInt count);
+            /** Returns the derivatives of a stretch at an array of linear values, i.e. the 
+                stretched width of a unit interval. Dividing the counts of a histogram of 
+                stretched values by the derivative gives their density in linear space.
+                @param stretch the given stretch to use in the process
+                @param in Linear values
+                @param out Derivatives, may be the same array as in
+                @param count Number of values */
+            static Void getStretchDerivatives(const Stretch& stretch, const Double* in, Double* out, UInt count);
 
             static inline Double applyPreStretch( Double pixel, Double scale, Double offset, Double scaleBackground ) {
                 return (scale * ( pixel - offset ) + scaleBackground);
@@ -108,14 +168,30 @@ namespace FitsLiberator {
             /** Internal method, which does the actual stretching. This is a template function to allow the
                 compiler to optimize the code for each datatype.
                 @param stretch Stretch to apply
-                @param rawPixels Pixel data
-                @param nullPixels Null map, used to bypass processing when it is not needed.
+                @param rawPixels Pointer to the pixel data or any type indexed like one, e.g. a 
+                    reader of stored samples.
+                @param nullPixels Bit-packed null map or NULL. The kernels themselves never look at
+                    the map, it is applied in a separate pass using applyNullMap.
                 @param out The output array
-                @param count Number of pixels to process; rawPixels, nullPixels and out must contain
+                @param count Number of pixels to process; rawPixels and out must contain
                 atleast this number of elements. */
-            template<typename I>
-            static Void _stretch(const Stretch& stretch, I* rawPixels, Byte* nullPixels, 
+            template<typename Pixels>
+            static Void _stretch(const Stretch& stretch, Pixels rawPixels, Byte* nullPixels, 
 				Double* out, Int count, Int nCpus );
+            /** Stretches pixels of any format without a lookup table, see stretch. */
+            static Void _stretchFormat(const Stretch& stretch, ImageCube::PixelFormat bitDepth,
+				const Void* rawPixels, Byte* nullPixels, Double* out, UInt count, Int nCpus );
+            /** Stretches stored samples without a lookup table, see stretchEncoded. */
+            static Void _stretchEncoded(const Stretch& stretch, const ImageCube::Encoding& encoding,
+                const Void* rawPixels, Double* out, UInt count, Int nCpus );
+            /** Stretches 8- or 16-bit samples by looking them up in a table. */
+            static Void lookup(const StretchTable& table, const Void* rawPixels, Double* out, 
+                UInt count, Int nCpus );
+            /** Stretches stored samples of type T, see stretchEncoded. The stretch must have 
+                BSCALE and BZERO folded into it. */
+            template<typename T>
+            static Void _stretchStored(const Stretch& stretch, const ImageCube::Encoding& encoding,
+                const Void* rawPixels, Double* out, Int count, Int nCpus );
         };
     }
 }
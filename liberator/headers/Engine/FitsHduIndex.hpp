@@ -0,0 +1,118 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file defines the class Engine::FitsHduIndex.
+*/
+
+#ifndef __FITSHDUINDEX_H__
+#define __FITSHDUINDEX_H__
+
+#include <string>
+#include <vector>
+#include <fitsio.h>
+
+#include "Types.h"
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** Index of the HDUs of a FITS file. Moving CFITSIO to an HDU parses
+			its complete header into CFITSIO's own structures, which makes 
+			enumerating files with many extensions slow. The index instead 
+			reads the 2880-byte header blocks directly, only decodes the 
+			few keywords that determine the size and type of the data unit, 
+			and skips the data units without reading them. The header cards
+			are kept for FitsHeader. */
+		class FitsHduIndex {
+		public:
+			/** Location and image properties of one HDU. */
+			struct Hdu {
+				unsigned int number;	///< 1-based HDU number, as used by CFITSIO.
+				UInt64	headerStart;	///< Offset of the first header block.
+				UInt64	dataStart;		///< Offset of the first data block.
+				UInt64	dataSize;		///< Size of the data unit without padding.
+				bool	image;			///< Primary array, IMAGE extension or tile-compressed image.
+				bool	compressed;		///< Tile-compressed image stored in a binary table.
+				int		nAxis;			///< Number of image dimensions.
+				long	nAxes[4];		///< Size of the first four image dimensions.
+				int		bitDepth;		///< Equivalent data type, as returned by fits_get_img_equivtype.
+				std::string header;		///< Header cards, excluding the END card.
+			};
+			typedef std::vector<Hdu>::size_type		size_type;
+			typedef std::vector<Hdu>::const_iterator	const_iterator;
+
+			/** Scans a file from the first header to the end of the last 
+				complete HDU. Scanning stops silently at the first truncated 
+				or malformed header.
+				@param fileHandle CFITSIO handle used to read the file. Only 
+					the byte position of the handle is changed. */
+			FitsHduIndex(fitsfile* fileHandle);
+
+			size_type size() const;
+			const Hdu& operator[](size_type i) const;
+			const_iterator begin() const;
+			const_iterator end() const;
+		private:
+			/** Reads the header starting at an offset.
+				@param hdu Entry to fill in. Its number and header offset must
+					be set.
+				@return False if the header is truncated or malformed. */
+			bool ReadHeader(fitsfile* fileHandle, Hdu& hdu) const;
+
+			std::vector<Hdu> hdus;
+		};
+	}
+}
+
+#endif // __FITSHDUINDEX_H__
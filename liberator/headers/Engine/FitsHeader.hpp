@@ -0,0 +1,138 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file defines the class Engine::FitsHeader.
+*/
+
+#ifndef __FITSHEADER_H__
+#define __FITSHEADER_H__
+
+#include <iostream>
+#include <string>
+
+#include "Types.h"
+#ifdef WINDOWS
+	#include <hash_map>
+#else
+	#include <ext/hash_map>
+#endif
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** Keyword table of a FITS header. The header cards are parsed once
+			and the keywords indexed by name, so looking up a keyword does not
+			involve CFITSIO or the file. Values are returned the way 
+			fits_read_key returns them as strings: string values without 
+			quotes and trailing blanks, other values as written. */
+		class FitsHeader {
+		public:
+			FitsHeader();
+			/** Parses a header.
+				@param cards The 80-character header cards, excluding the END
+					card. */
+			explicit FitsHeader(const std::string& cards);
+
+			/** Retrieves the value of a keyword. Names are case insensitive
+				and may include the HIERARCH prefix.
+				@return The value or an empty string if the keyword is 
+					missing or has no value. */
+			std::string Value(const std::string& name) const;
+			/** Retrieves the value of a keyword as a number.
+				@param name Name of the keyword.
+				@param out Receives the value.
+				@return False if the keyword is missing or has no value. */
+			bool Number(const std::string& name, double* out) const;
+			/** Writes the header cards with trailing blanks removed, one 
+				card per line.
+				@param stream Stream to write to.
+				@param prefix Text written in front of each card. */
+			void Print(std::ostream& stream, const std::string& prefix) const;
+
+			/** Extracts the value of a header card, see Value.
+				@param card Header card.
+				@param start Offset of the first character after the value 
+					indicator. */
+			static std::string CardValue(const char* card, size_t start = 10);
+		private:
+			/** Value of a keyword with its numeric interpretation. */
+			struct Keyword {
+				std::string	value;
+				double		number;
+			};
+		#ifdef WINDOWS
+			typedef stdext::hash_map<String, Keyword> KeywordTable;
+		#else
+			/** Hash function for keyword names. HashFuncs.h is not used since
+				it depends on the modelling layer. */
+			struct KeyHash {
+				size_t operator()(const String& name) const {
+					return __gnu_cxx::__stl_hash_string(name.c_str());
+				}
+			};
+			typedef __gnu_cxx::hash_map<String, Keyword, KeyHash> KeywordTable;
+		#endif
+
+			/** Converts a keyword name to the form used as key in the 
+				table. */
+			static std::string Key(const std::string& name);
+			const Keyword* Find(const std::string& name) const;
+
+			std::string		cards;
+			KeywordTable	keywords;
+		};
+	}
+}
+
+#endif // __FITSHEADER_H__
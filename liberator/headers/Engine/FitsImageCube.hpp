@@ -60,6 +60,7 @@
 #define __FITSIMAGECUBE_H__
 
 #include "ImageCube.hpp"
+#include "FitsHeader.hpp"
 
 namespace FitsLiberator {
     namespace Engine {
@@ -74,36 +75,53 @@ namespace FitsLiberator {
 								//    ensure coordinates given to CFITSIO are
 								//    given properly.
 			unsigned int index;	//< FITS HDU index.
+			FitsHeader header;	//< Keywords of the HDU.
 		public:
 			/** Constructs a FitsImageCube object from the data extracted from the FITS header.
 				@param index Index of the HDU.
 				@param nAxis Number of dimensions in the image.
 				@param nAxes Size of each dimension.
 				@param bitDepth Bitdepth as reported by CFITSIO.
+				@param header Keywords of the HDU.
 				@param owner Owner object. */
-			FitsImageCube(unsigned int index, unsigned int nAxis, long* nAxes, int bitDepth, ImageReader* owner);
+			FitsImageCube(unsigned int index, unsigned int nAxis, long* nAxes, int bitDepth, 
+				const FitsHeader& header, ImageReader* owner);
 			/** Maps a CFITSIO bit depth to a PixelFormat value.
 				@param bitDepth CFITSIO bit depth. 
 				@returns A PixelFormat value. */
 			static PixelFormat Map(int bitDepth);
 			/** @see FitsLiberator::Engine::ImageCube::NeedsNullMap */
 			bool NeedsNullMap() const;
+			/** Tile-compressed images are stored in blocks of ZTILE1 x ZTILE2
+				pixels, uncompressed images row by row.
+				@see FitsLiberator::Engine::ImageCube::StorageBlock */
+			void StorageBlock(size_type* width, size_type* height) const;
 			/** Returns the HDU index of this image. */
 			unsigned int Index() const;
 			/** @see FitsLiberator::Engine::ImageCube::Property */
 			std::string Property(const std::string& name) const;
 			/** @see FitsLiberator::Engine::ImageCube::Properties */
             void Properties(std::ostream& stream, const std::string& prefix) const;
+			/** @see FitsLiberator::Engine::ImageCube::NumericProperty */
+			bool NumericProperty(const std::string& name, double* out) const;
 			/** @see FitsLiberator::Engine::ImageCube::RowOrder. */
 			ImageCube::RowOrdering RowOrder() const;
+			/** @see FitsLiberator::Engine::ImageCube::Access. */
+			void Access(ImageCube::AccessPattern pattern) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
 			void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
-			void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer, char* valid) const;
+			bool Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer, unsigned char* nullMap) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
 			void Read(ImageCube::size_type plane, void* buffer) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
-			void Read(ImageCube::size_type plane, void* buffer, char* valid) const;
+			bool Read(ImageCube::size_type plane, void* buffer, unsigned char* nullMap) const;
+			/** Uncompressed images are stored as big-endian samples of type 
+				BITPIX, scaled by BSCALE and BZERO.
+				@see FitsLiberator::Engine::ImageCube::Encoded. */
+			bool Encoded(Encoding* encoding) const;
+			/** @see FitsLiberator::Engine::ImageCube::ReadEncoded. */
+			void ReadEncoded(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer) const;
         };
     }
 }
@@ -60,6 +60,7 @@
 #define __FITSIMAGEREADER_H__
 
 #include <iostream>
+#include <map>
 #include <fitsio.h>
 
 #include "ImageReader.hpp"
@@ -77,11 +78,13 @@ namespace FitsLiberator {
         };
 
         class FitsImageCube;
+        class FitsTileDecoder;
 
 		class FitsImageReader : public ImageReader {
 			typedef ImageReader super;
 
 			fitsfile* fileHandle;	///< CFITSIO handle to the FITS file.
+			mutable std::map<unsigned int, FitsTileDecoder*> decoders;	///< Decoders of the tile-compressed HDUs read so far, NULL for other HDUs.
 
 			/** Move the CFITSIO fileHandle to the HDU which contains the image
 				at index. 
@@ -90,13 +93,40 @@ namespace FitsLiberator {
 			/** Maps a ImageCube::PixelFormat to a CFITSIO datatype.
 				@param format Value to map. */
 			static int Map(ImageCube::PixelFormat format);
+			/** Checks whether an image can contain null pixels at all. Floating
+				point images encode nulls as NaN and integer images need a BLANK
+				keyword to define the null value.
+				@param image Image to check. */
+			bool MayContainNulls(const FitsImageCube* image) const;
+			/** Returns the decoder of a tile-compressed image, creating it
+				the first time the image is read.
+				@param image Image to look up.
+				@return The decoder or NULL if the image is not compressed or 
+					CFITSIO must decompress it. */
+			const FitsTileDecoder* Decoder(const FitsImageCube* image) const;
+			/** Reads a block of a tile-compressed image using its decoder.
+				@return False if the image has no decoder or the decoder 
+					could not read the block. */
+			bool Decode(const FitsImageCube* image, ImageCube::size_type plane, 
+				const Rectangle& bounds, void* buffer, unsigned char* nullMap, bool* anyNulls);
+			std::string diskFile;	///< Name of the file if CFITSIO reads it from disk, empty for other drivers.
+			int scanFile;			///< Descriptor used for page cache hints during a sequential pass, or -1.
+			/** Hints the operating system after a block of an image has 
+				been read during a sequential pass, see ImageCube::Access. */
+			void Advise(const FitsImageCube* image, ImageCube::size_type plane, 
+				const Rectangle& bounds);
 		public:
 			FitsImageReader(const std::string& filename);
 			virtual ~FitsImageReader();
 			void Read(const FitsImageCube* image, ImageCube::size_type plane, const Rectangle& bounds, void* buffer);
-			void Read(const FitsImageCube* image, ImageCube::size_type plane, const Rectangle& bounds, void* buffer, char* valid);
+			bool Read(const FitsImageCube* image, ImageCube::size_type plane, const Rectangle& bounds, void* buffer, unsigned char* nullMap);
 			void Read(const FitsImageCube* image, ImageCube::size_type plane, void* buffer);
-			void Read(const FitsImageCube* image, ImageCube::size_type plane, void* buffer, char* valid);
+			bool Read(const FitsImageCube* image, ImageCube::size_type plane, void* buffer, unsigned char* nullMap);
+			/** Copies the stored samples of a block of an uncompressed image
+				straight from the file, see ImageCube::ReadEncoded. */
+			void ReadEncoded(const FitsImageCube* image, ImageCube::size_type plane, const Rectangle& bounds, void* buffer);
+			/** @see FitsLiberator::Engine::ImageCube::Access. */
+			void Access(ImageCube::AccessPattern pattern);
             /** Reads WCS mapping information from a specific HDU. 
                 @param image Image to read from. */
             bool ReadWCS(const FitsImageCube* image,
@@ -111,8 +141,6 @@ namespace FitsLiberator {
                 @param filename Path of the file to check.
                 @return True if the file can be read, false if it cannot. */
             static bool CanRead(const std::string& filename);
-			std::string Property(const FitsImageCube* image, const std::string& name) const;
-            void Properties(const FitsImageCube* image, std::ostream& stream, const std::string& prefix) const;
             /** @see ImageReader::header. */
             virtual void header(std::ostream& stream) const;
             /** @see ImageReader::format. */
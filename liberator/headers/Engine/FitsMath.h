@@ -55,6 +55,7 @@
 #define __FitsMath_H__
 
 #include <math.h>
+#include <limits>
 #include "FitsLiberator.h"
 
 namespace FitsLiberator {
@@ -126,6 +127,80 @@ namespace FitsLiberator {
 					return ( x <= DoubleMax && x >= -DoubleMax ); 
 				}    
 
+				/** Returns the logarithm to base 2 of a number. The mantissa
+					is reduced to [sqrt(1/2);sqrt(2)] and its logarithm 
+					evaluated as 2 atanh((m-1)/(m+1)), a rational function 
+					without table lookups. There are no branches either, so
+					loops calling it can be vectorised. The relative error
+					is below 1e-8. Zero gives -inf, negative numbers NaN.
+					@param x Number to take the logarithm of. */
+				static inline Double fastLog2( Double x )
+				{
+					// Denormals are scaled into the normal range first
+					Double denormal = ( x < 2.2250738585072014e-308 ) ? 1.0 : 0.0;
+					union { Double d; UInt64 i; } bits;
+					bits.d = x * ( 1.0 + denormal * 18014398509481983.0 );
+
+					Double exponent = (Double)( (Int)( bits.i >> 52 ) & 0x7FF ) - 1023.0 - denormal * 54.0;
+					bits.i = ( bits.i & ( ( (UInt64)1 << 52 ) - 1 ) ) | ( (UInt64)0x3FF << 52 );
+					Double big = ( bits.d > 1.4142135623730951 ) ? 1.0 : 0.0;
+					Double m   = bits.d * ( 1.0 - 0.5 * big );
+					exponent  += big;
+
+					Double t  = ( m - 1.0 ) / ( m + 1.0 );
+					Double t2 = t * t;
+					Double ln = 2.0 * t * ( 1.0 + t2 * ( 1.0/3.0 + t2 * ( 1.0/5.0 + t2 * ( 1.0/7.0 + t2 * ( 1.0/9.0 ) ) ) ) );
+					Double result = exponent + ln * 1.4426950408889634;
+
+					result = ( x > DoubleMax ) ? x : result;
+					result = ( x == 0.0 ) ? -std::numeric_limits<Double>::infinity() : result;
+					return ( x >= 0.0 ) ? result : std::numeric_limits<Double>::quiet_NaN();
+				}
+				/** Returns 2^y. The fraction of y is evaluated by a 
+					polynomial and the integer part is put directly into the
+					exponent. The relative error is below 1e-8. Results 
+					below the smallest normal number are flushed to zero.
+					@param y The exponent. */
+				static inline Double fastExp2( Double y )
+				{
+					Double clamped = ( y < -1022.0 ) ? -1022.0 : ( ( y > 1023.999 ) ? 1023.999 : y );
+					clamped = ( y == y ) ? clamped : 0.0;
+					Int n = (Int)( clamped + 1022.0 ) - 1022;
+					Double x = ( clamped - n ) * 0.6931471805599453;
+					Double p = 1.0 + x * ( 1.0 + x * ( 1.0/2.0 + x * ( 1.0/6.0 + x * ( 1.0/24.0 + x * ( 1.0/120.0 + 
+						x * ( 1.0/720.0 + x * ( 1.0/5040.0 + x * ( 1.0/40320.0 + x * ( 1.0/362880.0 ) ) ) ) ) ) ) ) );
+
+					union { Double d; UInt64 i; } bits;
+					bits.i = (UInt64)( n + 1023 ) << 52;
+					Double result = p * bits.d;
+
+					result = ( y < -1022.0 ) ? 0.0 : result;
+					result = ( y >= 1024.0 ) ? std::numeric_limits<Double>::infinity() : result;
+					return ( y == y ) ? result : y;
+				}
+				/** Approximates the natural logarithm, see fastLog2. */
+				static inline Double fastLog( Double x )
+				{
+					return fastLog2( x ) * 0.6931471805599453;
+				}
+				/** Approximates the logarithm to base 10, see fastLog2. */
+				static inline Double fastLog10( Double x )
+				{
+					return fastLog2( x ) * 0.3010299956639812;
+				}
+				/** Approximates e^x, see fastExp2. */
+				static inline Double fastExp( Double x )
+				{
+					return fastExp2( x * 1.4426950408889634 );
+				}
+				/** Approximates x^y for x >= 0, see fastLog2 and fastExp2. 
+					The relative error grows with |y log2(x)| and stays below
+					1e-8 for the roots and powers used by the stretches. */
+				static inline Double fastPower( Double x, Double y )
+				{
+					return fastExp2( y * fastLog2( x ) );
+				}
+
                 
         };
     }
@@ -98,6 +98,25 @@ namespace FitsLiberator
 				Double mean, Double min, Double invBinSize, 
 				Vector<Double>& histogram, Int nCpus );
 			
+			/** Counts how often each sample occurs among 8- or 16-bit pixels.
+				Together with a StretchTable the counts give the statistics of
+				the stretched pixels without stretching them.
+				@param pixels the samples
+				@param sampleBytes the size of a sample, 1 or 2
+				@param nPixels the number of samples
+				@param nullMap bit-packed null map or NULL, null pixels are not counted
+				@param counts the counts indexed like StretchTable, which are added to */
+			static Void countSamples( const Void* pixels, UInt sampleBytes, UInt nPixels,
+				const Byte* nullMap, Vector<UInt>& counts );
+			/** Accumulates range and mean like getRange for pixels given as
+				counts of the values of a StretchTable. */
+			static Void getRange( const Vector<UInt>& counts, const Double* table, UInt* pixelCnt,
+				Double* min, Double* max, Double* mean_acc );
+			/** Accumulates stdev and the histogram like getHistogram for pixels
+				given as counts of the values of a StretchTable. */
+			static Void getHistogram( const Vector<UInt>& counts, const Double* table, Double* stdev,
+				Double mean, Double min, Double invBinSize, Vector<Double>& histogram );
+
 			/**Method for scaling the histogram*/
 			static Void scaleHistogram( Vector<Double>& histogram, Double* median, Double min,
 				Double max, Double* maxBinCount, UInt pixelCount );
@@ -0,0 +1,175 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file defines the class Engine::FitsTileDecoder.
+*/
+
+#ifndef __FITSTILEDECODER_H__
+#define __FITSTILEDECODER_H__
+
+#include <fitsio.h>
+
+#include "FitsImageCube.hpp"
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** Decodes tile-compressed FITS images as written by fpack. CFITSIO 
+			presents these images as ordinary images, but decompresses the
+			tiles one at a time on the calling thread. This class only uses 
+			CFITSIO to fetch the compressed bytes of the tiles overlapping a 
+			request, and then decompresses and converts the tiles in parallel.
+
+			RICE_1 (with BYTEPIX 1, 2 or 4) and GZIP_1 compressed integer 
+			images are supported, as are floating point images quantized by 
+			fpack, with or without subtractive dithering. Other compression
+			schemes are left to CFITSIO. */
+		class FitsTileDecoder {
+		public:
+			typedef ImageCube::size_type size_type;
+
+			/** Supported compression algorithms. */
+			enum Compression {
+				Rice,
+				Gzip
+			};
+
+			/** Quantization methods for floating point images. */
+			enum Quantization {
+				NotQuantized,
+				NoDither,
+				SubtractiveDither1,
+				SubtractiveDither2
+			};
+
+			/** Creates a decoder for a tile-compressed image.
+				@param fileHandle CFITSIO handle, the current HDU must be the
+					HDU of the image.
+				@param image The image stored in the current HDU.
+				@return A new decoder or NULL if the image is not 
+					tile-compressed or uses a scheme that is not supported. */
+			static FitsTileDecoder* FromHDU(fitsfile* fileHandle, const FitsImageCube* image);
+			/** Checks whether the image defines a value for null pixels. */
+			bool HasBlank() const;
+			/** Reads a block of pixels from the image.
+				@param fileHandle CFITSIO handle, the current HDU must be the
+					HDU of the image.
+				@param plane Plane of the image to read from.
+				@param bounds Boundaries of the block to read.
+				@param buffer Buffer to write the pixels into.
+				@param nullMap Buffer for the bit-packed null map or NULL if
+					null pixels should not be reported. The map is only 
+					written if the block contains null pixels.
+				@param anyNulls Receives whether the block contains null pixels.
+				@return False if a tile could not be decoded, in which case 
+					the caller should let CFITSIO read the block. */
+			bool Read(fitsfile* fileHandle, size_type plane, const Rectangle& bounds,
+				void* buffer, unsigned char* nullMap, bool* anyNulls) const;
+
+			/** Decodes a RICE_1 compressed stream.
+				@param input Compressed bytes.
+				@param length Number of compressed bytes.
+				@param output Receives the decoded pixels.
+				@param count Number of pixels to decode.
+				@param blockSize Number of pixels per coding block.
+				@param bytePix Size of the original pixels, 1, 2 or 4 bytes.
+				@return False if the stream is corrupt. */
+			static bool RiceDecode(const unsigned char* input, size_type length,
+				int* output, size_type count, int blockSize, int bytePix);
+			/** Decodes a GZIP_1 compressed stream.
+				@param input Compressed bytes.
+				@param length Number of compressed bytes.
+				@param output Receives the decoded pixels.
+				@param count Number of pixels to decode.
+				@return False if the stream is corrupt. */
+			static bool GzipDecode(const unsigned char* input, size_type length,
+				int* output, size_type count);
+		private:
+			/** Compressed data and parameters of a single tile. */
+			struct Tile;
+			/** Decodes a range of tiles, used with TBB. */
+			struct DecodeBody;
+
+			FitsTileDecoder();
+			/** Decodes a tile and writes the part of it overlapping the 
+				requested block to the output buffer. */
+			bool DecodeTile(Tile& tile, size_type plane, const Rectangle& bounds,
+				void* buffer, bool reportNulls) const;
+			template<typename T>
+			void Store(Tile& tile, const int* pixels, size_type plane,
+				const Rectangle& bounds, T* buffer, bool reportNulls) const;
+
+			const FitsImageCube* image;
+			Compression compression;
+			Quantization quantization;
+			int blockSize;			///< Rice coding block size.
+			int bytePix;			///< Rice pixel size.
+			int ditherSeed;			///< ZDITHER0.
+			size_type tileSize[3];	///< ZTILEn.
+			size_type tileCount[3];	///< Number of tiles along each axis.
+
+			int dataColumn;			///< COMPRESSED_DATA.
+			int scaleColumn;		///< ZSCALE, or 0 if given as a keyword.
+			int zeroColumn;			///< ZZERO, or 0 if given as a keyword.
+			int blankColumn;		///< ZBLANK, or 0 if given as a keyword.
+
+			double scale;			///< BSCALE or ZSCALE.
+			double zero;			///< BZERO or ZZERO.
+			bool hasBlank;
+			int blank;				///< ZBLANK or BLANK.
+		};
+	}
+}
+
+#endif // __FITSTILEDECODER_H__
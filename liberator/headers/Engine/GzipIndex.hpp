@@ -0,0 +1,180 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file defines the class Engine::GzipIndex.
+*/
+
+#ifndef __GZIPINDEX_H__
+#define __GZIPINDEX_H__
+
+#include <string>
+#include <list>
+#include <vector>
+#include <stdio.h>
+#include <zlib.h>
+#include <boost/thread/mutex.hpp>
+
+#include "Types.h"
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** Random access to gzip-compressed files. CFITSIO inflates a 
+			compressed file completely into memory when it is opened. This 
+			class instead records access points every few megabytes while 
+			inflating the file once, keeping the 32 KB deflate window at each
+			point, so that any byte range can later be read by inflating 
+			from the nearest preceding point.
+
+			The index is exposed to CFITSIO as the I/O driver "gzindex://".
+			Indices are optionally written to a cache directory and reused
+			as long as the compressed file is unchanged. */
+		class GzipIndex {
+		public:
+			/** Prefix of the CFITSIO driver, see RegisterDriver. */
+			static const char Prefix[];
+
+			/** Checks whether a file starts with the gzip magic bytes. */
+			static bool IsGzip(const std::string& filename);
+			/** Inflates the beginning of a gzip-compressed file without 
+				building an index.
+				@param filename File to read.
+				@param buffer Receives the first length bytes of the data.
+				@param length Number of bytes to read.
+				@return False if the file is not a gzip file or is too short. */
+			static bool Peek(const std::string& filename, void* buffer, size_t length);
+			/** Opens a gzip-compressed file, loading its index from the 
+				cache directory or building it.
+				@return A new index or NULL if the file could not be read. */
+			static GzipIndex* Open(const std::string& filename);
+			/** Sets the directory indices are persisted in. An empty name,
+				the default, disables persistence. */
+			static void SetCacheDirectory(const std::string& directory);
+			/** Registers the "gzindex://" driver with CFITSIO. Files opened 
+				with fits_open_file("gzindex://<filename>") are then read 
+				through a GzipIndex. Safe to call more than once. */
+			static bool RegisterDriver();
+
+			~GzipIndex();
+			/** Size of the uncompressed data. */
+			Int64 Size() const;
+			/** Reads uncompressed bytes.
+				@param offset Position in the uncompressed data.
+				@param buffer Buffer to write the bytes into.
+				@param length Number of bytes to read.
+				@return False if the range extends beyond the end of the data
+					or the file is corrupt. */
+			bool Read(Int64 offset, void* buffer, size_t length);
+		private:
+			/** Access point in the compressed stream. */
+			struct Point {
+				Int64	out;	///< Offset in the uncompressed data.
+				Int64	in;		///< Offset of the first complete byte in the compressed file.
+				int		bits;	///< Number of bits of the preceding byte that belong to the point.
+			};
+			/** Decompressed block kept in the block cache. */
+			struct Block {
+				Int64	index;
+				std::vector<unsigned char> data;
+			};
+
+			GzipIndex(const std::string& filename, FILE* file);
+			/** Inflates the whole file once and records the access points. */
+			bool Build();
+			bool Load(const std::string& path);
+			void Save(const std::string& path) const;
+			/** Name of the cache file holding the index, or an empty string
+				if persistence is disabled. */
+			std::string CachePath() const;
+			/** Returns the decompressed block with the given index, inflating
+				it if it is not in the block cache. */
+			const Block* Fetch(Int64 index);
+			/** Moves the cursor to an uncompressed offset, restarting at the
+				nearest access point if the offset is behind the cursor or far
+				ahead of it. */
+			bool Position(Int64 offset);
+			/** Restarts the cursor at an access point. */
+			bool Restart(size_t point);
+			/** Inflates from the cursor.
+				@return Number of bytes written, less than length at the end 
+					of the data, or -1 if the stream is corrupt. */
+			long Inflate(unsigned char* output, size_t length);
+			/** Continues with the next gzip member after the end of a 
+				deflate stream.
+				@return False if there are no more members. */
+			bool NextMember();
+
+			std::string filename;
+			FILE* file;
+			Int64 compressedSize;
+			Int64 modified;			///< Modification time of the compressed file.
+			Int64 size;
+			std::vector<Point> points;
+			std::vector<unsigned char> windows;	///< Deflate windows, one per point.
+
+			z_stream stream;		///< Inflate state of the cursor.
+			bool streamReady;		///< The cursor has been positioned.
+			bool rawStream;			///< The cursor inflates raw deflate data, i.e. started at an access point.
+			Int64 cursor;			///< Uncompressed offset of the cursor.
+			Int64 inputPosition;	///< File offset of the end of the input buffer.
+			std::vector<unsigned char> input;
+			std::vector<unsigned char> scratch;
+
+			std::list<Block> blocks;	///< Block cache, most recently used first.
+			boost::mutex lock;
+		};
+	}
+}
+
+#endif // __GZIPINDEX_H__
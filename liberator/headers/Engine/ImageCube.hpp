@@ -96,6 +96,23 @@ namespace FitsLiberator {
 				TopDown,
 				BottomUp
 			};
+			/** Describes the order in which the pixels of an image are about
+				to be read. */
+			enum AccessPattern {
+				RandomAccess,		///< Tiles are read in any order, e.g. interactively.
+				SequentialAccess	///< The image is read once, from the first to the last row.
+			};
+			/** Describes how the pixels of an image are stored in its file,
+				see ImageCube::ReadEncoded. The value of a stored sample s is
+				scale * s + zero. */
+			struct Encoding {
+				PixelFormat	format;		///< Type of the stored samples.
+				bool		swap;		///< The samples are not in native byte order.
+				double		scale;
+				double		zero;
+				bool		hasBlank;	///< Stored samples equal to blank are null pixels.
+				long long	blank;
+			};
 		private:
 			size_type width;
 			size_type height;
@@ -125,6 +142,21 @@ namespace FitsLiberator {
 				calculations of dynamic range, mean and so on. Also the pixel 
 				should be rendered as transparent if possible. */
 			virtual bool NeedsNullMap() const = 0;
+			/** Returns the size of the blocks the pixels of a plane are stored
+				in. Reads covering whole blocks become large contiguous 
+				requests to the underlying library, so tiles should be aligned
+				to this grid. The default is row-major storage, i.e. blocks of 
+				one full row.
+				@param width Receives the width of a block in pixels.
+				@param height Receives the height of a block in pixels. */
+			virtual void StorageBlock(size_type* width, size_type* height) const;
+			/** Tells the image how the following reads will traverse it. 
+				During a sequential pass readers ask the operating system to
+				read ahead and to drop the pages behind the rows that have 
+				been read, so a pass over a large file does not flush the 
+				page cache. The default implementation ignores the hint.
+				@param pattern The new access pattern. */
+			virtual void Access(AccessPattern pattern) const;
 			/** Returns the required buffer size for a rectangular section of a plane.
 				@param width Width of the area of the interest.
 				@param height Height of the area of interest. */
@@ -144,6 +176,27 @@ namespace FitsLiberator {
 				@param width Width of the area of the interest.
 				@param height Height of the area of interest. */
 			static size_type SizeOf(ImageCube::PixelFormat format, size_type width, size_type height);
+			/** Returns the size in bytes of a null map covering a number of 
+				pixels. Null maps are bit-packed, one bit per pixel with the 
+				least significant bit of the first byte belonging to the first
+				pixel. A set bit marks a null pixel.
+				@param pixels Number of pixels covered by the map. */
+			static size_type NullMapSize(size_type pixels);
+			/** Checks if a pixel is marked as null in a bit-packed null map.
+				@param nullMap The null map.
+				@param pixel Index of the pixel. */
+			static inline bool IsNull(const unsigned char* nullMap, size_type pixel) {
+				return (nullMap[pixel >> 3] & (1 << (pixel & 7))) != 0;
+			}
+			/** Packs a byte-per-pixel null map, as returned by CFITSIO, into 
+				a bit-packed null map. Only set bits are written, so the 
+				destination must be cleared beforehand.
+				@param nulls Byte-per-pixel map, non-zero entries are null pixels.
+				@param count Number of entries in nulls.
+				@param nullMap Bit-packed destination map.
+				@param offset Index of the pixel in nullMap corresponding to nulls[0]. */
+			static void PackNullMap(const char* nulls, size_type count, 
+				unsigned char* nullMap, size_type offset);
 			/** Returns a reference to the image reader this image cube belongs to.
 				@returns A reference or NULL. */
 			ImageReader* Owner() const;
@@ -160,7 +213,7 @@ namespace FitsLiberator {
 				@param out Buffer to receive the value.
 				@return If out = 0 the return value is false. If the property cannot be found
 					or is not numeric the return value is false. Otherwise the return value is true. */
-			bool NumericProperty(const std::string& name, double* out) const;
+			virtual bool NumericProperty(const std::string& name, double* out) const;
 			/** Returns the row order for this image. */
 			virtual RowOrdering RowOrder() const = 0;
 			/** Reads a block of pixels from an image.
@@ -174,9 +227,12 @@ namespace FitsLiberator {
 					[0;image->Planes()[.
 				@param bounds Boundaries of the block to read. The pixels include [left;right[ x [top;bottom[.
 				@param buffer Buffer to write the pixels into.
-				@param valid  Buffer to write the null map into. One byte for 
-					each pixel. */
-			virtual void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer, char* valid) const = 0;
+				@param nullMap Buffer to write the bit-packed null map into. 
+					Must hold NullMapSize(bounds.getArea()) bytes.
+				@return True if the block contains null pixels. If false is 
+					returned the contents of nullMap are undefined and the 
+					map should be ignored. */
+			virtual bool Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer, unsigned char* nullMap) const = 0;
 			/** Reads the entire contents of the image.
 				@param plane Plane of the image to read from. Must be in the interval 
 					[0;image->Planes()[.
@@ -190,10 +246,41 @@ namespace FitsLiberator {
 				@param buffer Buffer to write the pixels into. The buffer is 
 					expected to be of size image->SizeOf(image->Width(), 
 					image->Height). 
-				@param valid  Buffer to write the null map into. One byte for 
-					each pixel. */
-			virtual void Read(ImageCube::size_type plane, void* buffer, char* valid) const = 0;
+				@param nullMap Buffer to write the bit-packed null map into. 
+					Must hold NullMapSize(PixelsPerPlane()) bytes.
+				@return True if the plane contains null pixels. If false is 
+					returned the contents of nullMap are undefined. */
+			virtual bool Read(ImageCube::size_type plane, void* buffer, unsigned char* nullMap) const = 0;
+			/** Checks whether the pixels can be read as they are stored in 
+				the file. Such reads skip the conversion to Format(), which
+				FitsEngine::stretchEncoded instead does while stretching. The
+				default implementation returns false.
+				@param encoding Receives the encoding of the stored samples.
+				@return True if ReadEncoded may be called. */
+			virtual bool Encoded(Encoding* encoding) const;
+			/** Reads a block of pixels without converting them, see Encoded.
+				Stored samples are never wider than those of Format(), so the
+				buffer sizes required by Read are sufficient. The default 
+				implementation throws an exception.
+				@param plane Plane of the image to read from. Must be in the interval 
+					[0;image->Planes()[.
+				@param bounds Boundaries of the block to read. The pixels include [left;right[ x [top;bottom[.
+				@param buffer Buffer to write the stored samples into. */
+			virtual void ReadEncoded(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer) const;
         };
+
+		/** Switches an image to sequential access for the lifetime of the 
+			object, see ImageCube::Access. */
+		class SequentialPass {
+			const ImageCube* cube;
+		public:
+			SequentialPass(const ImageCube* cube) : cube(cube) {
+				cube->Access(ImageCube::SequentialAccess);
+			}
+			~SequentialPass() {
+				cube->Access(ImageCube::RandomAccess);
+			}
+		};
     }
 }
 
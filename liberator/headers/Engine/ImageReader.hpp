@@ -109,7 +109,8 @@ namespace FitsLiberator {
             enum ImageFormat {
                 NONE = 0,
                 FITS = 1,
-                PDS  = 2
+                PDS  = 2,
+                PDS4 = 3
             };
 
 			virtual ~ImageReader();
@@ -88,7 +88,15 @@ namespace FitsLiberator
 			FitsLiberator::Engine::Stretch stretch;
 			Double* stretchedPixels;
 			Void* rawPixels;
-			char* nullPixels;
+			/** Bit-packed null map, see ImageCube::NullMapSize. Only allocated
+				for images that may contain null pixels. */
+			Byte* nullPixels;
+			/** True if the pixels currently loaded contain null pixels. When
+				false the contents of nullPixels are undefined. */
+			Bool hasNulls;
+			/** True if rawPixels hold the samples as they are stored in the
+				file, see ImageCube::ReadEncoded. */
+			Bool encoded;
 
 		
 			FitsLiberator::Rectangle bounds;
@@ -96,7 +104,8 @@ namespace FitsLiberator
 			Bool isAllocated();
 			const FitsLiberator::Rectangle getBounds();
 			const FitsLiberator::Rectangle& getEffBounds();
-			Int allocatePixels( Int bitDepth );
+			Int allocatePixels( Int bitDepth, Bool nullMap );
+			Byte* getNullMap();
 			Void deallocatePixels();
 
 			Bool isCurrent();
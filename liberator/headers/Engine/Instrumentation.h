@@ -0,0 +1,235 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __INSTRUMENTATION_H__
+#define __INSTRUMENTATION_H__
+
+#include "FitsLiberator.h"
+
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/** Counters maintained by the processing pipeline. */
+		enum InstrumentationCounter {
+			counterBytesRead,			///< Bytes of pixel data and null maps read from the image.
+			counterTilesLoaded,			///< Number of tiles loaded from the image.
+			counterTilesEvicted,		///< Number of tiles deallocated to make room for others.
+			counterPixelsStretched,		///< Number of pixels passed through FitsEngine::stretch.
+			counterPixelsScaled,		///< Number of pixels passed through FitsEngine::scale.
+			counterPixelsAnalyzed,		///< Number of pixels passed through the range and histogram functions.
+			counterTilesResampled,		///< Number of tiles resampled into the preview.
+			counterBytesWritten,		///< Bytes of pixel data written to TIFF files.
+			counterCount
+		};
+
+		/** Stages of the processing pipeline which are timed. Stages may nest,
+			e.g. an export includes the reading and stretching of the tiles, so 
+			the stage times are inclusive. */
+		enum InstrumentationStage {
+			stageRead,
+			stageStretch,
+			stageScale,
+			stageRange,
+			stageHistogram,
+			stagePreview,
+			stageExport,
+			stageCount
+		};
+
+		/** A copy of all counters and timers at a given time. */
+		struct InstrumentationSnapshot {
+			Int64	counters[counterCount];		///< Value of each counter.
+			Double	stageTime[stageCount];		///< Accumulated seconds spent in each stage.
+			UInt	stageCalls[stageCount];		///< Number of times each stage was entered.
+			std::map<String, Double> threadBusy;	///< Seconds each thread spent in timed scopes, nested scopes counted once.
+
+			InstrumentationSnapshot();
+			/** Writes the snapshot as a JSON object.
+				@param stream Stream to write to. */
+			Void toJSON( std::ostream& stream ) const;
+		};
+
+		/**
+			Lightweight counters and timers for the processing pipeline. 
+			Instrumentation is disabled by default, in which case all calls
+			return immediately. The counters are process wide and safe to 
+			update from several threads, they should however only be updated
+			once per tile or kernel invocation and never per pixel.
+		*/
+		class Instrumentation
+		{
+		public:
+			/** Enables or disables the collection of counters and timers. */
+			static Void setEnabled( Bool enabled );
+			static inline Bool isEnabled() { return enabled; }
+			/** Adds a value to a counter. */
+			static Void add( InstrumentationCounter counter, Int64 value );
+			/** Adds a time to a stage.
+				@param stage The stage the time was spent in.
+				@param seconds The time spent. */
+			static Void addTime( InstrumentationStage stage, Double seconds );
+			/** Marks the calling thread as busy. Calls may nest on a thread,
+				only the outermost call is timed.
+				@return True if this is the outermost call on the calling thread. */
+			static Bool enterBusy();
+			/** Ends a call to enterBusy.
+				@param outermost The value returned by the matching enterBusy.
+				@param seconds Time since the matching enterBusy, added to the
+				busy time of the calling thread if outermost is true. */
+			static Void leaveBusy( Bool outermost, Double seconds );
+			/** Returns a copy of the current counters and timers. */
+			static InstrumentationSnapshot snapshot();
+			/** Resets all counters and timers to zero. */
+			static Void reset();
+			/** Sets a file to which a JSON snapshot is appended every time 
+				operationFinished is called. An empty name disables the dump.
+				Setting a file also enables instrumentation. */
+			static Void setDumpFile( const String& fileName );
+			/** Called when a user level operation is finished. If a dump file
+				is set the counters are appended to it and reset.
+				@param operation Name of the finished operation. */
+			static Void operationFinished( const String& operation );
+			/** Returns the name of a stage as used in the JSON output. */
+			static const Char* stageName( InstrumentationStage stage );
+			/** Returns the name of a counter as used in the JSON output. */
+			static const Char* counterName( InstrumentationCounter counter );
+			/** Returns a monotonic wall clock time in seconds. */
+			static Double now();
+			/** Returns a string identifying the calling thread. */
+			static String threadId();
+		private:
+			static Bool enabled;
+		};
+
+		/**
+			Measures the time the calling thread spends in a scope and adds it
+			to the busy time of the thread, without attributing it to a stage.
+			Used in the bodies of parallel loops, so the worker threads of TBB
+			and OpenMP are accounted for. Scopes nested on the same thread are
+			only counted once.
+		*/
+		class BusyTimer
+		{
+		public:
+			BusyTimer();
+			~BusyTimer();
+		private:
+			Bool counted;
+			Bool outermost;
+			Double start;
+		};
+
+		/**
+			Measures the time spent in a scope and adds it to a stage of the
+			instrumentation when the scope is left. If tracing is enabled the
+			scope is recorded as a trace span as well.
+		*/
+		class ScopedTimer
+		{
+		public:
+			ScopedTimer( InstrumentationStage stage );
+			~ScopedTimer();
+		private:
+			BusyTimer busy;
+			InstrumentationStage stage;
+			Double start;
+		};
+
+		/**
+			Records time spans in the Chrome trace-event format, which can be
+			viewed in chrome://tracing or Perfetto. Tracing is opt-in; spans
+			are kept in memory until the next flush, which appends them to the
+			file. The file uses the array form of the format, which may be left
+			without its closing bracket.
+		*/
+		class TraceLog
+		{
+		public:
+			/** Sets the file the trace is written to and enables tracing. An 
+				empty name disables tracing and discards recorded spans. */
+			static Void setFile( const String& fileName );
+			static inline Bool isEnabled() { return enabled; }
+			/** Records a completed span on the calling thread.
+				@param name Name of the span.
+				@param category Category of the span, e.g. "operation", "flow" or "kernel".
+				@param start Start time as returned by Instrumentation::now.
+				@param end End time as returned by Instrumentation::now. */
+			static Void addSpan( const String& name, const Char* category, Double start, Double end );
+			/** Appends the spans recorded since the last flush to the trace file. */
+			static Void flush();
+		private:
+			static Bool enabled;
+		};
+
+		/**
+			Records the lifetime of a scope as a trace span.
+		*/
+		class TraceSpan
+		{
+		public:
+			TraceSpan( const Char* name, const Char* category = "flow" );
+			~TraceSpan();
+		private:
+			const Char* name;
+			const Char* category;
+			Double start;
+		};
+	}
+}
+
+#endif // __INSTRUMENTATION_H__
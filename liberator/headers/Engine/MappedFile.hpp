@@ -0,0 +1,151 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O 
+    libraries. This file defines the class Engine::MappedFile.
+*/
+
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <string>
+
+#include "Types.h"
+#include "Image.h"
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** Position of a 3-D array of samples in a file. All distances are
+			in bytes. */
+		struct ArrayLayout {
+			UInt64	offset;			///< Offset of the first sample.
+			UInt64	planeStride;	///< Distance between neighbouring planes.
+			UInt64	lineStride;		///< Distance between neighbouring lines.
+			UInt64	sampleStride;	///< Distance between neighbouring samples.
+			size_t	sampleBytes;
+			bool	swap;			///< The samples are not in native byte order.
+
+			/** Offset of the end of the last sample of an array.
+				@param width Number of samples per line.
+				@param height Number of lines per plane.
+				@param planes Number of planes. */
+			UInt64 Extent(UInt64 width, UInt64 height, UInt64 planes) const;
+		};
+
+		/** Read-only memory mapping of a complete file. Readers use it to 
+			copy uncompressed pixels straight from the page cache into the 
+			caller's buffer. */
+		class MappedFile {
+		public:
+			/** Maps a file into memory.
+				@param filename File to map.
+				@return A new mapping or NULL if the file could not be 
+					mapped, e.g. because it does not fit in the address space. */
+			static MappedFile* Open(const std::string& filename);
+			~MappedFile();
+			/** First byte of the file. */
+			const unsigned char* Data() const;
+			/** Size of the file in bytes. */
+			UInt64 Size() const;
+			/** Copies a block of samples of an array stored in the file into
+				a buffer in native byte order.
+				@param layout Position of the array, which must lie within 
+					the file.
+				@param plane Plane to read from.
+				@param bounds Block to read.
+				@param buffer Buffer to write the samples into.
+				@return False if the sample size is not 1, 2, 4 or 8 bytes. */
+			bool Read(const ArrayLayout& layout, UInt64 plane, 
+				const FitsLiberator::Rectangle& bounds, void* buffer) const;
+			/** Checks whether the machine stores numbers least significant 
+				byte first. */
+			static bool IsLittleEndian();
+			/** Switches between normal caching and a sequential pass over 
+				the file. During a pass, reads of whole rows of band 
+				sequential arrays drop the pages they have copied from the 
+				page cache and have the following rows read ahead.
+				@param enable True at the start of a pass, false at its end. */
+			void Sequential(bool enable) const;
+			/** Makes sequential passes over files mapped afterwards bypass 
+				the page cache, reading with O_DIRECT (F_NOCACHE on Mac OS X)
+				instead of through the mapping. Off by default; has no effect
+				on Windows. */
+			static void SetDirectIO(bool enable);
+		private:
+			MappedFile();
+			/** Hints the operating system after rows covering [begin;end[ 
+				have been read during a sequential pass. */
+			void Advise(UInt64 begin, UInt64 end) const;
+			/** Reads [begin;end[ with direct I/O.
+				@param storage Receives the buffer holding the bytes, which 
+					the caller must delete[].
+				@return Pointer to the byte at begin or NULL if direct I/O is
+					not available or the read failed. */
+			const unsigned char* ReadDirect(UInt64 begin, UInt64 end, unsigned char** storage) const;
+
+			const unsigned char* data;
+			UInt64 size;
+			mutable bool sequential;	///< A sequential pass is in progress.
+		#ifdef WINDOWS
+			void* file;		///< HANDLE of the file.
+			void* mapping;	///< HANDLE of the file mapping.
+		#else
+			int file;
+			int direct;		///< Descriptor opened for direct I/O or -1.
+		#endif
+		};
+	}
+}
+
+#endif // __MAPPEDFILE_H__
@@ -0,0 +1,133 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __PARALLELISM_H__
+#define __PARALLELISM_H__
+
+#include <stddef.h>
+
+#include "FitsLiberator.h"
+#include "Stretch.h"
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Cost model deciding whether a loop over pixels is worth running in
+		parallel and how finely to split it. Starting a parallel loop costs
+		about as much as a few ten thousand simple operations, so small loops,
+		such as single levels transferred between the histogram and the 
+		stretch or zoomed-in preview tiles, run serially on the calling thread.
+		Larger loops are split into tasks of at least Grain pixels. The 
+		break-even point is measured by Initialize, which the application 
+		calls from its main thread at startup, by timing an empty parallel 
+		loop against a serial loop of multiply-adds.
+		*/
+		class Parallelism
+		{
+		public:
+			/** Approximate cost of one pixel in units of a multiply-add. */
+			enum PixelCost
+			{
+				costCopy			= 1,	///< table lookups and scaling
+				costCompare			= 2,	///< minimum, maximum and sum
+				costRoot			= 8,	///< square roots, histogram bins
+				costTranscendental	= 40	///< logarithms and powers
+			};
+
+			/**
+			Returns whether count pixels of the given cost are worth 
+			processing in parallel.
+			*/
+			static inline Bool Worth( size_t count, UInt cost )
+			{
+				return count * cost >= serialWork;
+			}
+			/**
+			Returns the smallest number of pixels of the given cost worth a 
+			task of their own.
+			*/
+			static inline size_t Grain( UInt cost )
+			{
+				return cost < taskWork ? taskWork / cost : 1;
+			}
+			/**
+			Returns the cost of a pixel stretched with a stretch function.
+			*/
+			static UInt StretchCost( StretchFunction function );
+			/**
+			Makes sure the calling thread has a TBB scheduler. The scheduler
+			is kept until the thread ends instead of being started and shut 
+			down for every parallel loop. The first call measures the cost 
+			model, so it must not be made from inside a parallel loop; until
+			then Worth and Grain use defaults.
+			*/
+			static Void Initialize();
+
+		private:
+			/**
+			Measures serialWork and taskWork; called once by Initialize. 
+			Builds without TBB or OpenMP keep the defaults.
+			*/
+			static Void Measure();
+
+			/** Work below which a loop runs serially. */
+			static size_t serialWork;
+			/** Work of the smallest task of a parallel loop. */
+			static size_t taskWork;
+		};
+	}
+}
+
+#endif
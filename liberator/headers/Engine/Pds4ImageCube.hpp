@@ -0,0 +1,136 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party library
+    TinyXML. This file defines the class Engine::Pds4ImageCube.
+*/
+
+#ifndef __PDS4IMAGECUBE_H__
+#define __PDS4IMAGECUBE_H__
+
+#include "tinyxml.h"
+
+#include "FitsLiberator.h"
+#include "ImageCube.hpp"
+#include "MappedFile.hpp"
+
+namespace FitsLiberator {
+    namespace Engine {
+		/**
+		Implements the ImageCube for arrays described by a PDS4 label. The
+		layout of the array is resolved once from the label and the pixels
+		are copied straight from a memory mapping of the data file.
+		*/
+		class Pds4ImageCube : public ImageCube {
+			typedef ImageCube super;
+
+			const TiXmlElement* element;	///< Array element of the label.
+			const MappedFile*	file;		///< Mapping of the data file, owned by the reader.
+			ArrayLayout			layout;
+
+			Pds4ImageCube(const TiXmlElement* element, const MappedFile* file,
+				const ArrayLayout& layout, unsigned int width, 
+				unsigned int height, unsigned int planes, 
+				ImageCube::PixelFormat format, ImageReader* owner);
+
+			/** Maps a PDS4 data type to a Liberator data type.
+				@param dataType Value of the data_type element.
+				@param layout Layout to receive the sample size and byte order.
+				@returns The Liberator datatype or ImageCube::Invalid if no 
+					conversion exists. */
+			static ImageCube::PixelFormat MapDataType(const std::string& dataType,
+				ArrayLayout& layout);
+		public:
+			/** Creates an image from an Array element of a label.
+				@param owner Reader the image belongs to.
+				@param element Array element describing the image.
+				@param file Mapping of the data file the array is stored in.
+				@return The image or NULL if the array is not a supported 
+					2-D or 3-D array that lies within the data file. */
+			static Pds4ImageCube* FromElement(ImageReader* owner, 
+				const TiXmlElement* element, const MappedFile* file);
+			/** Returns the name of an element without its namespace prefix. */
+			static std::string LocalName(const TiXmlNode* node);
+			/** Returns the trimmed text content of an element. */
+			static std::string Text(const TiXmlElement* element);
+			/** Finds the first child element with the given local name.
+				@return The element or NULL if there is none. */
+			static const TiXmlElement* Child(const TiXmlNode* node, 
+				const std::string& name);
+
+			/** @see FitsLiberator::Engine::ImageCube::NeedsNullMap. */
+			bool NeedsNullMap() const;
+			/** @see FitsLiberator::Engine::ImageCube::Property. */
+			std::string Property(const std::string& name) const;
+			/** @see FitsLiberator::Engine::ImageCube::Properties. */
+			void Properties(std::ostream& stream, const std::string& prefix) const;
+			/** @see FitsLiberator::Engine::ImageCube::RowOrder. */
+			ImageCube::RowOrdering RowOrder() const;
+			/** @see FitsLiberator::Engine::ImageCube::Access. */
+			void Access(ImageCube::AccessPattern pattern) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, 
+				void* buffer) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			bool Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, 
+				void* buffer, unsigned char* nullMap) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			void Read(ImageCube::size_type plane, void* buffer) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			bool Read(ImageCube::size_type plane, void* buffer, unsigned char* nullMap) const;
+		};
+	}
+}
+
+#endif	// __PDS4IMAGECUBE_H__
@@ -0,0 +1,109 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party library
+    TinyXML. This file defines the class Engine::Pds4ImageReader.
+*/
+
+#ifndef __PDS4IMAGEREADER_H__
+#define __PDS4IMAGEREADER_H__
+
+#include <map>
+
+#include "tinyxml.h"
+
+#include "ImageReader.hpp"
+#include "Pds4ImageCube.hpp"
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** PDS4 file format parser. This class parses the XML label of a PDS4
+			product and memory maps the data files of the arrays it 
+			describes. */
+		class Pds4ImageReader : public ImageReader {
+			typedef ImageReader super;
+			typedef std::map<std::string, MappedFile*> FileMap;
+
+			TiXmlDocument	document;	///< The parsed label.
+			FileMap			files;		///< Mappings of the data files by path.
+
+			/** Returns the mapping of a data file, mapping it on first use.
+				@return The mapping or NULL if the file could not be mapped. */
+			MappedFile* Map(const std::string& path);
+			/** Writes the elements below a node as indented NAME = VALUE
+				lines. */
+			void Print(std::ostream& stream, const TiXmlNode* node, int level) const;
+		public:
+			/** The constructor parses a PDS4 label by filename.
+				@param filename File name of the label. */
+			Pds4ImageReader(const std::string& filename);
+			/** The destructor unmaps the data files. After calling the 
+				destructor, pointers to the images inside the file are no 
+				longer valid. */
+			virtual ~Pds4ImageReader();
+			/** Performs a fileformat check to see if the file can be read. 
+				Only the beginning of the file is inspected, so it does not 
+				mean the file contains readable images.
+				@param filename Path of the file to check.
+				@return True if the file looks like a PDS4 label. */
+			static bool CanRead(const std::string& filename);
+			/** @see ImageReader::header. */
+			virtual void header(std::ostream& stream) const;
+			/** @see ImageReader::format. */
+			virtual ImageReader::ImageFormat format() const;
+		};
+	}
+}
+
+#endif	// __PDS4IMAGEREADER_H__
@@ -58,18 +58,34 @@ extern "C" {
 	#include <oal.h>
 }
 
+#include <boost/thread/mutex.hpp>
+
 #include "FitsLiberator.h"
 #include "ImageCube.hpp"
 
 namespace FitsLiberator {
     namespace Engine {
+        class MappedFile;
+
 		/**
-		Implements the ImageCube for PDS files
+		Implements the ImageCube for PDS files. Uncompressed images are read
+		from a memory mapping of the data file; other images are decoded by
+		the PDS library line by line straight into the caller's buffer.
 		*/
 		class PdsImageCube : public ImageCube {
 			typedef ImageCube super;
 
+            /** Location of the pixels of an uncompressed image in its data 
+                file. */
+            struct Layout;
+
 			OBJDESC* imageNode;
+            Layout* layout;             ///< NULL if the image must be read by the PDS library.
+            mutable MappedFile* mapping;
+            mutable bool mappingOpened;
+            mutable OA_OBJECT handle;   ///< Image handle of the plane last read by the PDS library.
+            mutable ImageCube::size_type handlePlane;
+            mutable boost::mutex lock;
             /** The constructor is private because the passed in node may not 
                 belong to an image. Use the method FromObjectDescription 
                 instead.
@@ -91,9 +107,22 @@ namespace FitsLiberator {
                     conversion exists. */
 			static ImageCube::PixelFormat MapDataType(long sample_bits, 
                 int format, char* sample_type_str);
+            /** Returns the mapping of the data file, mapping it on the first
+                call.
+                @return NULL if the image is not mapped. */
+            const MappedFile* Mapping() const;
+            /** Copies pixels from the memory mapped data file.
+                @return False if the data file could not be mapped. */
+            bool ReadMapped(ImageCube::size_type plane, 
+                const FitsLiberator::Rectangle& bounds, void* buffer) const;
+            /** Decodes pixels with the PDS library, reusing the image handle
+                of the previous read of the same plane. */
+            void ReadDecoded(ImageCube::size_type plane, 
+                const FitsLiberator::Rectangle& bounds, void* buffer) const;
 		public:
 			static PdsImageCube* FromObjectDescription(ImageReader* owner, 
                 OBJDESC* imageNode);
+            virtual ~PdsImageCube();
 			/** @see FitsLiberator::Engine::ImageCube::NeedsNullMap. */
 			bool NeedsNullMap() const;
             /** Retrieves the PDS node associated with this image. */
@@ -104,16 +133,18 @@ namespace FitsLiberator {
             void Properties(std::ostream& stream, const std::string& prefix) const;
 			/** @see FitsLiberator::Engine::ImageCube::RowOrder. */
 			ImageCube::RowOrdering RowOrder() const;
+			/** @see FitsLiberator::Engine::ImageCube::Access. */
+			void Access(ImageCube::AccessPattern pattern) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
 			void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, 
                 void* buffer) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
-			void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, 
-                void* buffer, char* valid) const;
+			bool Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, 
+                void* buffer, unsigned char* nullMap) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
 			void Read(ImageCube::size_type plane, void* buffer) const;
 			/** @see FitsLiberator::Engine::ImageCube::Read. */
-			void Read(ImageCube::size_type plane, void* buffer, char* valid) const;
+			bool Read(ImageCube::size_type plane, void* buffer, unsigned char* nullMap) const;
         };
     }
 }
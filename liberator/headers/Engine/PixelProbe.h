@@ -0,0 +1,132 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __PIXELPROBE_H__
+#define __PIXELPROBE_H__
+
+#include "FitsLiberator.h"
+#include "ImageCube.hpp"
+#include "Plane.h"
+#include "Stretch.h"
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Reads the values of single pixels or small windows of an image at
+		full resolution, e.g. for the pixel value readout, which would 
+		otherwise show the resampled pixels of the preview when zoomed out. 
+		Only a block of blockWidth x blockHeight pixels around the window 
+		is read, and it is kept so the following queries, which tend to lie
+		close by as the mouse moves, need not read the image again. Images
+		whose samples can be read as stored, see ImageCube::Encoded, are 
+		kept in that form and converted while they are stretched. The 
+		stretch is applied to the pixels of the window only.
+
+		The image is read through the cube, which must not be read by
+		another thread at the same time.
+		*/
+		class PixelProbe
+		{
+		public:
+			PixelProbe();
+
+			/**
+			Reads the pixels of a window of an image.
+			@param cube The image.
+			@param plane The plane of the image.
+			@param window The pixels to read, right and bottom exclusive.
+			@param stretch The stretch to apply.
+			@param linear Receives the linear values of the pixels row by 
+			row, NaN for null pixels. 
+			@param stretched Receives the stretched values of the pixels. 
+			May be NULL.
+			@return False if the window does not lie within the image.
+			*/
+			Bool Read( const ImageCube* cube, const Plane& plane, const Rectangle& window,
+				const Stretch& stretch, Double* linear, Double* stretched );
+
+			/**
+			Reads a single pixel, see the Read above.
+			*/
+			Bool Read( const ImageCube* cube, const Plane& plane, Int x, Int y,
+				const Stretch& stretch, Double* linear, Double* stretched );
+
+			/**
+			Drops the pixels kept, e.g. when another file is opened.
+			*/
+			Void Clear();
+
+			/** The size of the blocks read around the windows. */
+			static const Int blockWidth = 256;
+			static const Int blockHeight = 16;
+
+		private:
+			Void Load( const ImageCube* cube, const Plane& plane, const Rectangle& window );
+
+			const ImageCube*	cube;
+			Plane				plane;
+			/** The pixels kept, empty if none. */
+			Rectangle			block;
+			Vector<Byte>		pixels;
+			Vector<Byte>		nullMap;
+			Bool				hasNulls;
+			/** The pixels kept are stored samples, see ImageCube::ReadEncoded. */
+			Bool				encoded;
+			ImageCube::Encoding	encoding;
+		};
+	}
+}
+
+#endif
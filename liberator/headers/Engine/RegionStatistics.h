@@ -0,0 +1,202 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __REGIONSTATISTICS_H__
+#define __REGIONSTATISTICS_H__
+
+#include "FitsLiberator.h"
+#include "ImageCube.hpp"
+#include "Plane.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Statistics of a rectangular region of an image, see RegionStatistics.
+		*/
+		struct RegionSummary
+		{
+			/** The number of pixels in the region that are not null. */
+			UInt	count;
+			Double	mean;
+			Double	variance;
+			Double	min;
+			Double	max;
+		};
+
+		/**
+		Answers statistics queries on arbitrary rectangles of an image in time
+		independent of their size. The tiles of the image are added as they
+		pass through the statistics, and for each one the summed-area tables
+		of the pixels and their squares are kept. The sums of a tile are taken
+		relative to its mean and accumulated in double precision, but stored
+		in single precision, so each entry is rounded once. The squares are
+		stored less their expected growth to keep them small. The minimum and
+		maximum come from a sparse table over blocks of blockSize x blockSize
+		pixels; only the pixels along the edges of a region that do not fill
+		a whole block are scanned. The pixels are kept in single precision
+		for that, so the minimum and maximum are single precision too.
+
+		The tables hold the linear values of the pixels, so they do not 
+		depend on the stretch and are only rebuilt when another plane is 
+		selected. The tables take about 12 bytes per pixel, plus 4 for the
+		tiles with null pixels. Images too large for memoryBudget are not 
+		tabulated, and Query then returns false.
+		*/
+		class RegionStatistics
+		{
+		public:
+			RegionStatistics();
+			~RegionStatistics();
+
+			/**
+			Starts collecting the tables of a plane. Returns false if the 
+			plane is too large to be tabulated, in which case Add does nothing.
+			*/
+			Bool Begin( const ImageCube* cube, const Plane& plane );
+			/**
+			Adds a tile to the tables. values are the linear values of the
+			pixels of bounds, with NaN for null pixels.
+			@param bounds The pixels of the tile, right and bottom exclusive.
+			*/
+			Void Add( const Rectangle& bounds, const Double* values );
+			/**
+			Completes the tables once all of the tiles have been added.
+			*/
+			Void Finish();
+			/**
+			Drops the tables, e.g. when collecting them was canceled.
+			*/
+			Void Clear();
+
+			/**
+			Returns true if the tables of the plane are complete.
+			*/
+			Bool IsValid( const ImageCube* cube, const Plane& plane ) const;
+			/**
+			Computes the statistics of a region of the image.
+			@param region The pixels of the region, right and bottom exclusive.
+			It is clipped to the image.
+			@param summary Receives the statistics. If the region has no 
+			pixels that are not null the count is 0 and the rest undefined.
+			@return False if the tables are not complete.
+			*/
+			Bool Query( const Rectangle& region, RegionSummary* summary ) const;
+
+			/** The size of the blocks of the min/max sparse table. */
+			static const UInt blockSize = 16;
+			/** The maximum number of bytes the tables may use. */
+			static const UInt64 memoryBudget = 256 * 1024 * 1024;
+
+		private:
+			/** The tables of a tile. */
+			struct Tile
+			{
+				Rectangle		bounds;
+				/** The mean of the tile which the sums are relative to. */
+				Double			reference;
+				/** The mean square deviation from reference; the squares are
+					stored less spread times the number of pixels. */
+				Double			spread;
+				/** The summed-area tables, (width+1) x (height+1) each. */
+				Vector<Float>	sums;
+				Vector<Float>	squares;
+				/** The summed-area table of the pixels that are not null.
+					Empty if the tile has no null pixels. */
+				Vector<UInt>	counts;
+			};
+
+			Void Accumulate( const Tile& tile, const Rectangle& region, 
+				UInt* count, Double* mean, Double* m2 ) const;
+			Void Scan( const Rectangle& region, Float* min, Float* max ) const;
+			Void BlockRange( UInt left, UInt top, UInt right, UInt bottom, 
+				Float* min, Float* max ) const;
+			Void Reset();
+
+			static UInt Log2( UInt value );
+			Float* Level( Vector<Float>& table, UInt kx, UInt ky );
+			const Float* Level( const Vector<Float>& table, UInt kx, UInt ky ) const;
+
+			const ImageCube*	cube;
+			Plane				plane;
+			Bool				collecting;
+			Bool				complete;
+			UInt				width;
+			UInt				height;
+			/** The bytes of the tables so far. */
+			UInt64				bytes;
+
+			Vector<Tile>		tiles;
+			/** The pixels, for scanning the edges of regions. */
+			Vector<Float>		values;
+
+			/** The blocks across and down the image. */
+			UInt				blocksX;
+			UInt				blocksY;
+			UInt				levelsX;
+			UInt				levelsY;
+			/** The sparse tables: level (kx,ky) holds the range of the
+				2^kx x 2^ky blocks starting at each block. */
+			Vector<Float>		blockMin;
+			Vector<Float>		blockMax;
+
+			/** Keeps queries out while the tables are built. */
+			mutable boost::mutex	mutex;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,161 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+/** @file
+    Contains definitions for the virtual image cube resampling an image onto
+    the WCS pixel grid of another. This file defines the class 
+    Engine::ReprojectedImageCube.
+*/
+
+#ifndef __REPROJECTEDIMAGECUBE_H__
+#define __REPROJECTEDIMAGECUBE_H__
+
+#include "ImageCube.hpp"
+#include "WcsMapper.hpp"
+
+#include <list>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace FitsLiberator {
+    namespace Engine {
+		/** An image resampled onto a common pixel grid, so images from 
+			different instruments can be combined pixel by pixel. The pixels
+			of the grid are mapped to WCS coordinates and from there to the
+			pixel coordinates of the source image, which is then interpolated.
+			Reads are served block by block: only the part of the source the
+			block maps to is read, and the mapped coordinates of the most 
+			recently read blocks are cached, so the planes of a tile share 
+			the transform. The cube has the planes of the source and can be
+			tiled and stretched like any other image.
+			
+			Pixels outside the source, or whose interpolation involves a 
+			null pixel, are null. */
+		class ReprojectedImageCube : public ImageCube {
+			typedef ImageCube super;
+		public:
+			/** Interpolation of the source pixels. */
+			enum Resampling {
+				Bilinear,	///< The 2 x 2 nearest pixels.
+				Lanczos3	///< The 6 x 6 nearest pixels, windowed sinc of three lobes.
+			};
+
+			/** Coordinates in the source of the pixels of a block. */
+			struct Coordinates {
+				FitsLiberator::Rectangle	bounds;		///< The block.
+				FitsLiberator::Rectangle	window;		///< Part of the source the block needs.
+				std::vector<double>			x;			///< Zero-based, NaN outside the source.
+				std::vector<double>			y;
+			};
+			typedef boost::shared_ptr<const Coordinates> CoordinatesPointer;
+
+			/** Resamples an image onto the grid of a reference image.
+				@param source Image to resample.
+				@param reference Image whose size, row order and WCS define the grid.
+				@param resampling Interpolation of the source pixels.
+				@throws Exception if either image has no WCS coordinates. */
+			ReprojectedImageCube(const ImageCube* source, const ImageCube* reference, Resampling resampling);
+			/** Resamples an image onto a grid.
+				@param source Image to resample.
+				@param grid WCS of the grid.
+				@param width Width of the grid in pixels.
+				@param height Height of the grid in pixels.
+				@param resampling Interpolation of the source pixels.
+				@throws Exception if either the source or the grid has no WCS coordinates. */
+			ReprojectedImageCube(const ImageCube* source, const WcsMapper& grid, 
+				size_type width, size_type height, Resampling resampling);
+
+			/** Returns the WCS of the grid. */
+			const WcsMapper& Grid() const;
+			/** Returns the resampled image. */
+			const ImageCube* Source() const;
+			/** Returns the source coordinates of the pixels of a block, from
+				the cache if the block was read recently. */
+			CoordinatesPointer Map(const FitsLiberator::Rectangle& bounds) const;
+
+			/** Resampled pixels may be null.
+				@see FitsLiberator::Engine::ImageCube::NeedsNullMap */
+			bool NeedsNullMap() const;
+			/** The properties are those of the source.
+				@see FitsLiberator::Engine::ImageCube::Property */
+			std::string Property(const std::string& name) const;
+			/** @see FitsLiberator::Engine::ImageCube::Properties */
+            void Properties(std::ostream& stream, const std::string& prefix) const;
+			/** @see FitsLiberator::Engine::ImageCube::NumericProperty */
+			bool NumericProperty(const std::string& name, double* out) const;
+			/** @see FitsLiberator::Engine::ImageCube::RowOrder. */
+			ImageCube::RowOrdering RowOrder() const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			void Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			bool Read(ImageCube::size_type plane, const FitsLiberator::Rectangle& bounds, void* buffer, unsigned char* nullMap) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			void Read(ImageCube::size_type plane, void* buffer) const;
+			/** @see FitsLiberator::Engine::ImageCube::Read. */
+			bool Read(ImageCube::size_type plane, void* buffer, unsigned char* nullMap) const;
+		private:
+			CoordinatesPointer Transform(const FitsLiberator::Rectangle& bounds) const;
+
+			const ImageCube*	source;
+			WcsMapper			sourceWcs;
+			WcsMapper			grid;
+			RowOrdering			rowOrder;
+			Resampling			resampling;
+
+			mutable boost::mutex					cacheMutex;
+			mutable std::list<CoordinatesPointer>	cache;	///< Most recently used first.
+        };
+    }
+}
+
+#endif	// __REPROJECTEDIMAGECUBE_H__
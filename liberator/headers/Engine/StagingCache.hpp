@@ -0,0 +1,119 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file defines the class Engine::StagingCache.
+*/
+
+#ifndef __STAGINGCACHE_H__
+#define __STAGINGCACHE_H__
+
+#include <string>
+
+#include "Types.h"
+
+namespace FitsLiberator {
+	namespace Engine {
+		/** Local copies of files on slow or network file systems. The first 
+			time such a file is opened it is copied to the cache directory in
+			large sequential chunks by a background thread. Until the copy is
+			complete the file is read through the CFITSIO driver "staged://", 
+			which serves reads from the part of the copy that has already 
+			been written and goes to the original file for the rest. Later 
+			opens read the local copy directly.
+
+			Copies are named after the path, size and modification time of
+			the original, so a changed file is staged again. When the cache
+			grows beyond its size limit the least recently used copies are
+			deleted. */
+		class StagingCache {
+		public:
+			/** Prefix of the CFITSIO driver, see RegisterDriver. */
+			static const char Prefix[];
+
+			/** Sets the directory copies are kept in. An empty name, the 
+				default, disables staging. */
+			static void SetCacheDirectory(const std::string& directory);
+			/** Sets the maximum number of bytes kept in the cache directory. 
+				Files larger than the limit are never staged. */
+			static void SetSizeLimit(Int64 bytes);
+			/** Sets the function deciding whether a file is on a slow file 
+				system and should be staged. By default no file is staged. */
+			static void SetSlowPathTest(bool (*test)(const std::string& filename));
+			/** Limits the rate at which original files are read. Used to 
+				simulate a slow file system with a local file; zero, the 
+				default, disables throttling. */
+			static void SetThrottle(Int64 bytesPerSecond);
+
+			/** Looks up the local copy of a file, starting to stage it if it
+				is on a slow file system and not yet staged.
+				@return The name of the complete local copy or filename if 
+					there is none. */
+			static std::string Lookup(const std::string& filename);
+			/** Checks whether a file is currently being copied to the cache. */
+			static bool IsStaging(const std::string& filename);
+			/** Registers the "staged://" driver with CFITSIO. Files opened 
+				with fits_open_file("staged://<filename>") while they are 
+				being staged are read from the staged ranges where possible.
+				Safe to call more than once. */
+			static bool RegisterDriver();
+			/** Stops all background copies and waits for them to end. The
+				incomplete copies are deleted and the bookkeeping of all 
+				staged files is released. */
+			static void Shutdown();
+		};
+	}
+}
+
+#endif // __STAGINGCACHE_H__
@@ -84,6 +84,13 @@ namespace FitsLiberator {
 		    stretchNoStretch
         };
 
+        /** Selects how FitsEngine evaluates the logarithms and powers of 
+            the stretch functions. */
+        enum StretchPrecision {
+            precisionExact,     ///< The C library, used for exported images.
+            precisionFast       ///< The approximations of FitsMath, used for the preview and statistics.
+        };
+
         /** Represents a stretch. */
         struct Stretch {
             StretchFunction function;
@@ -95,6 +102,7 @@ namespace FitsLiberator {
 		    Double scalePeakLevel;
 		    Double peakLevel;
 		    Double scaleBackground;
+            StretchPrecision precision;
 
             /** Default constructor, sets the parameters to safe values. */
             Stretch();
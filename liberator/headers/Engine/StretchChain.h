@@ -0,0 +1,178 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __STRETCHCHAIN_H__
+#define __STRETCHCHAIN_H__
+
+#include "FitsLiberator.h"
+#include "Stretch.h"
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Stretch function composed of primitive steps, e.g. an affine scaling
+		followed by a logarithm and a root. Chains make custom stretches
+		possible; every StretchFunction can be expressed as one, see the
+		constructor taking a Stretch. FitsEngine::stretchChain applies a chain
+		to pixels block by block, each step by a kernel generated from the
+		stretch function objects, so a block passes through the whole chain
+		while it is in the cache.
+		*/
+		class StretchChain
+		{
+		public:
+			/** The primitive steps of a chain. */
+			enum Operation
+			{
+				operationAffine,	///< a x + b
+				operationLog,		///< log10( x + 1 ), the logarithm of the log stretch
+				operationAsinh,		///< asinh( x )
+				operationPower,		///< sign( x ) |x|^a, the roots of the stretches
+				operationRaise,		///< x^a
+				operationExp,		///< e^x
+				operationClip		///< x limited to [a;b]
+			};
+
+			/** A step of a chain and its parameters. */
+			struct Step
+			{
+				Operation	operation;
+				Double		a;
+				Double		b;
+			};
+
+			/**
+			Creates the empty chain, the identity.
+			*/
+			StretchChain();
+			/**
+			Creates the chain of a stretch: its scale, offset and background 
+			as an affine step followed by the steps of its function. The 
+			precision is taken from the stretch as well.
+			*/
+			explicit StretchChain( const Stretch& stretch );
+
+			/** Appends the step a x + b. */
+			StretchChain& Affine( Double a, Double b );
+			/** Appends the step log10( x + 1 ). */
+			StretchChain& Log();
+			/** Appends the step asinh( x ). */
+			StretchChain& Asinh();
+			/** Appends the step sign( x ) |x|^exponent. */
+			StretchChain& Power( Double exponent );
+			/** Appends the step x^exponent, which is NaN for negative x unless
+				the exponent is an integer. */
+			StretchChain& Raise( Double exponent );
+			/** Appends the step e^x. */
+			StretchChain& Exp();
+			/** Appends a step limiting x to [low;high]. */
+			StretchChain& Clip( Double low, Double high );
+
+			/**
+			Selects how the logarithms and powers of the steps are evaluated
+			by FitsEngine::stretchChain. Chains are exact by default.
+			*/
+			Void SetPrecision( StretchPrecision precision );
+			StretchPrecision Precision() const;
+
+			UInt Size() const;
+			const Step& operator[]( UInt index ) const;
+
+			/**
+			Applies the chain to a single value.
+			*/
+			Double Forward( Double value ) const;
+			/**
+			Applies the inverse of the chain to a single value, i.e. maps a
+			stretched value back to the linear one. Values a Clip step has 
+			limited are returned as the limit.
+			*/
+			Double Inverse( Double value ) const;
+			/**
+			Returns the derivative of the chain at a linear value, i.e. by
+			how much a stretched value changes per linear unit.
+			*/
+			Double Derivative( Double value ) const;
+
+			/**
+			Applies the chain to an array of values. The steps are applied
+			one at a time to all of the values, so the step is selected once
+			per array rather than once per value. in and out may be the same
+			array.
+			*/
+			Void Forward( const Double* in, Double* out, UInt count ) const;
+			/**
+			Applies the inverse of the chain to an array of values, see the
+			scalar Inverse. in and out may be the same array.
+			*/
+			Void Inverse( const Double* in, Double* out, UInt count ) const;
+			/**
+			Computes the derivative of the chain at an array of linear values,
+			e.g. to correct the heights of histogram bins for the width a bin
+			of stretched values has in linear space. in and out may be the
+			same array.
+			*/
+			Void Derivative( const Double* in, Double* out, UInt count ) const;
+
+		private:
+			StretchChain& Append( Operation operation, Double a, Double b );
+
+			Vector<Step>		steps;
+			StretchPrecision	precision;
+		};
+	}
+}
+
+#endif
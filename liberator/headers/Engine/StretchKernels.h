@@ -0,0 +1,370 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __STRETCHKERNELS_H__
+#define __STRETCHKERNELS_H__
+
+#include "FitsLiberator.h"
+#include "FitsMath.h"
+#include "Stretch.h"
+#include "StretchChain.h"
+#include "Parallelism.h"
+#include "Instrumentation.h"
+
+#ifdef USE_TBB
+    #include <tbb/parallel_for.h>
+    #include <tbb/blocked_range.h>
+    #include <tbb/partitioner.h>
+#endif
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+    /** Evaluates the logarithms and powers of the stretch functions with the C
+        library, see precisionExact. */
+    struct ExactMath {
+        static inline double log(double x) { return ::log(x); }
+        static inline double log10(double x) { return ::log10(x); }
+        static inline double pow(double x, double y) { return ::pow(x, y); }
+        static inline double exp(double x) { return ::exp(x); }
+    };
+
+    /** Evaluates the logarithms and powers of the stretch functions with the 
+        approximations of FitsMath, see precisionFast. */
+    struct FastMath {
+        static inline double log(double x) { return FitsMath::fastLog(x); }
+        static inline double log10(double x) { return FitsMath::fastLog10(x); }
+        static inline double pow(double x, double y) { return FitsMath::fastPower(x, y); }
+        static inline double exp(double x) { return FitsMath::fastExp(x); }
+    };
+
+    /** The following structs implement the various stretch functions. Stretch
+        functions are un-ary functions (except for the linear stretch) and can
+        be combined in any order to form effecient inlined function objects. 
+        The logarithms and powers are evaluated with either ExactMath or 
+        FastMath. */
+    struct Linear {
+        double scale, offset, background;
+    public:
+        Linear(double scale, double offset, double background) {
+            this->scale = scale;
+            this->offset = offset;
+            this->background = background;
+        }
+
+        inline double operator()(double value) const {
+            return scale * (value - offset) + background;
+        }
+    };
+
+    template<typename Math, typename Inner>
+    struct Log {
+        const Inner& inner;
+    public:
+        Log(const Inner& i) : inner(i) {}
+        inline double operator()(double value) const {
+            return Math::log10(inner(value) + 1);
+        }
+    };
+
+    template<typename Inner>
+    struct Sqrt {
+        const Inner& inner;
+    public:
+        Sqrt(const Inner& i) : inner(i) {}
+        
+        inline double operator()(double value) const {
+            value = inner(value);
+            return FitsMath::signof(value) * sqrt(::abs(value));
+        }
+    };
+
+    template<typename Math, typename Inner>
+    struct Power {
+        const Inner& inner;
+        const double power;
+    public:
+        Power(double p, const Inner& i) : inner(i), power(p) {}
+
+        inline double operator()(double value) const {
+            value = inner(value);
+            return FitsMath::signof(value) * Math::pow(::abs(value), power);
+        }
+    };
+
+    template<typename Math, typename Inner>
+    struct AsinH {
+        const Inner& inner;
+    public:
+        AsinH(const Inner& i) : inner(i) {}
+
+        inline double operator()(double value) const {
+            value = inner(value);
+            return Math::log(value + sqrt(value * value + 1));
+        }
+    };
+
+    template<typename Math, typename Inner>
+    struct Raise {
+        const Inner& inner;
+        const double power;
+    public:
+        Raise(double p, const Inner& i) : inner(i), power(p) {}
+
+        inline double operator()(double value) const {
+            return Math::pow(inner(value), power);
+        }
+    };
+
+    template<typename Inner>
+    struct Square {
+        const Inner& inner;
+    public:
+        Square(const Inner& i) : inner(i) {}
+
+        inline double operator()(double value) const {
+            value = inner(value);
+            return value * value;
+        }
+    };
+
+    template<typename Math, typename Inner>
+    struct Exp {
+        const Inner& inner;
+    public:
+        Exp(const Inner& i) : inner(i) {}
+
+        inline double operator()(double value) const {
+            return Math::exp(inner(value));
+        }
+    };
+
+    template<typename Inner>
+    struct Clip {
+        const Inner& inner;
+        const double low, high;
+    public:
+        Clip(double l, double h, const Inner& i) : inner(i), low(l), high(h) {}
+
+        inline double operator()(double value) const {
+            value = inner(value);
+            return (value < low) ? low : ((value > high) ? high : value);
+        }
+    };
+
+    /** Innermost function of the steps of a StretchChain, which are applied
+        to pixels that have been through the previous steps already. */
+    struct Identity {
+        inline double operator()(double value) const {
+            return value;
+        }
+    };
+
+#ifdef USE_TBB
+    /** The following function object performs the stretching and is called
+        by the TBB runtime. Null pixels are masked out afterwards by
+        FitsEngine::applyNullMap, so the inner loop is branch free. */
+    template<typename Pixels, typename Function, typename Size = size_t>
+    struct Stretcher {
+        double*         out;
+        const Pixels    in;
+
+        const Function& stretch;
+    public:
+        Stretcher(Pixels data, double* buffer, const Function& f) 
+          : out(buffer), in(data), stretch(f) {}
+
+        void operator()(const tbb::blocked_range<Size>& range) const {
+            BusyTimer busy;
+            for(Size i = range.begin(); i != range.end(); ++i) {
+                out[i] = stretch(in[i]);
+            }
+        }
+    };
+
+    /** Applies a stretch function object to count pixels. Loops too small to
+        be worth the TBB runtime run on the calling thread, see Parallelism. */
+    template<typename Pixels, typename Function>
+    void stretchPixels(const Pixels in, Double* out, Int count, Int /*nCpus*/, UInt cost, const Function& stretch) {
+        Stretcher<Pixels, Function> body(in, out, stretch);
+
+        if( !Parallelism::Worth(count, cost) ) {
+            body(tbb::blocked_range<size_t>(0, count));
+            return;
+        }
+        Parallelism::Initialize();
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, count, Parallelism::Grain(cost)), 
+            body, tbb::auto_partitioner());
+    }
+#elif defined(USE_OPENMP)
+    /** Applies a stretch function object to count pixels. Each stretch 
+        function gets its own instance of this loop, which keeps it small 
+        enough for the compiler to inline and vectorise the function object.
+        Loops too small to be worth the threads run serially, see Parallelism. */
+    template<typename Pixels, typename Function>
+    void stretchPixels(const Pixels in, Double* out, Int count, Int nCpus, UInt cost, const Function& stretch) {
+        #pragma omp parallel num_threads( nCpus ) if( Parallelism::Worth(count, cost) )
+        {
+            BusyTimer busy;
+            #pragma omp for
+            for(Int i = 0; i < count; i++) {
+                out[i] = stretch(in[i]);
+            }
+        }
+    }
+#else
+    /** Applies a stretch function object to count pixels. Each stretch 
+        function gets its own instance of this loop, which keeps it small 
+        enough for the compiler to inline and vectorise the function object. */
+    template<typename Pixels, typename Function>
+    void stretchPixels(const Pixels in, Double* out, Int count, Int /*nCpus*/, UInt /*cost*/, const Function& stretch) {
+        for(Int i = 0; i < count; i++) {
+            out[i] = stretch(in[i]);
+        }
+    }
+#endif // USE_TBB
+
+    /** Applies a stretch function to count pixels using the math functions
+        of Math. */
+    template<typename Math, typename Pixels>
+    void stretchWith(const Stretch& stretch, const Pixels in, Double* out, Int count, Int nCpus ) {
+        const Linear linear(stretch.scale, stretch.offset, stretch.scaleBackground);
+        const UInt cost = Parallelism::StretchCost(stretch.function);
+
+        switch(stretch.function) {
+		    case stretchLinear:
+                stretchPixels(in, out, count, nCpus, cost, linear);
+                break;
+		    case stretchLog:
+                stretchPixels(in, out, count, nCpus, cost, Log<Math, Linear>(linear));
+			    break;
+		    case stretchSqrt:
+                stretchPixels(in, out, count, nCpus, cost, Sqrt<Linear>(linear));
+			    break;
+		    case stretchLogSqrt:
+                stretchPixels(in, out, count, nCpus, cost, 
+                    Log<Math, Sqrt<Linear> >(Sqrt<Linear>(linear)));
+                break;
+		    case stretchLogLog:
+                stretchPixels(in, out, count, nCpus, cost, 
+                    Log<Math, Log<Math, Linear> >(Log<Math, Linear>(linear)));
+                break;
+            case stretchCubeR:
+                stretchPixels(in, out, count, nCpus, cost, Power<Math, Linear>(1.0/3.0, linear));
+			    break;
+		    case stretchAsinh:
+                stretchPixels(in, out, count, nCpus, cost, AsinH<Math, Linear>(linear));
+			    break;
+		    case stretchAsinhAsinh:
+                stretchPixels(in, out, count, nCpus, cost, 
+                    AsinH<Math, AsinH<Math, Linear> >(AsinH<Math, Linear>(linear)));
+                break;
+		    case stretchAsinhSqrt:
+                stretchPixels(in, out, count, nCpus, cost, 
+                    AsinH<Math, Sqrt<Linear> >(Sqrt<Linear>(linear)));
+                break;
+		    case stretchRoot4:
+                stretchPixels(in, out, count, nCpus, cost, Power<Math, Linear>(0.25, linear));
+			    break;
+		    case stretchRoot5:
+                stretchPixels(in, out, count, nCpus, cost, Power<Math, Linear>(0.20, linear));
+			    break;
+			case stretchPow15:
+                stretchPixels(in, out, count, nCpus, cost, Raise<Math, Linear>(1.5, linear));
+			    break;
+			case stretchPow2:
+                stretchPixels(in, out, count, nCpus, cost, Square<Linear>(linear));
+			    break;
+            // The approximate power is undefined for negative numbers
+			case stretchPow3:
+                stretchPixels(in, out, count, nCpus, cost, Raise<ExactMath, Linear>(3.0, linear));
+			    break;
+			case stretchPow4:
+                stretchPixels(in, out, count, nCpus, cost, Raise<ExactMath, Linear>(4.0, linear));
+			    break;
+			case stretchPow5:
+                stretchPixels(in, out, count, nCpus, cost, Raise<ExactMath, Linear>(5.0, linear));
+			    break;
+			case stretchExp:
+                stretchPixels(in, out, count, nCpus, cost, Exp<Math, Linear>(linear));
+			    break;
+        }
+    }
+
+    /** Applies the function of a stretch with the approximations of FitsMath
+        to pixels in place. The kernels are compiled in a translation unit 
+        of their own, where the compiler has the room to inline and 
+        vectorise the approximations.
+        @param stretch Stretch whose function to apply; pixels must have been
+            scaled by its scale, offset and scaleBackground already.
+        @param pixels Pixels to stretch.
+        @param count Number of pixels.
+        @param nCpus the number of cpus to use when processing in parallel */
+    Void stretchFast(const Stretch& stretch, Double* pixels, Int count, Int nCpus);
+
+    /** Applies the steps of a chain to pixels in place. The pixels are 
+        processed in blocks that stay in the cache while they pass through
+        all the steps, each step applied by a kernel instantiated from the
+        function objects above.
+        @param chain The chain.
+        @param first Index of the first step to apply; the pixels must have
+            been through the steps before it already.
+        @param pixels Pixels to stretch.
+        @param count Number of pixels.
+        @param nCpus the number of cpus to use when processing in parallel */
+    Void stretchSteps(const StretchChain& chain, UInt first, Double* pixels, Int count, Int nCpus);
+	}
+}
+
+#endif
@@ -0,0 +1,130 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+#ifndef __STRETCHTABLE_H__
+#define __STRETCHTABLE_H__
+
+#include <boost/shared_ptr.hpp>
+
+#include "FitsLiberator.h"
+#include "Stretch.h"
+#include "ImageCube.hpp"
+
+namespace FitsLiberator
+{
+	namespace Engine
+	{
+		/**
+		Stretched value of every possible sample of an image with 8- or 16-bit
+		samples. Such images are stretched by looking their samples up, which
+		evaluates the stretch function once per distinct sample instead of once
+		per pixel. A table is indexed by the bit pattern of a sample as it lies
+		in memory, so stored samples are looked up without swapping their bytes
+		and blank samples map to NaN.
+		*/
+		class StretchTable
+		{
+		public:
+			typedef boost::shared_ptr<StretchTable> Pointer;
+
+			/**
+			Creates a table with undefined values.
+			@param stretch the stretch the values are computed with
+			@param format the format of the samples
+			@param encoding the encoding of stored samples or NULL for pixels read with ImageCube::Read
+			*/
+			StretchTable( const Stretch& stretch, ImageCube::PixelFormat format, const ImageCube::Encoding* encoding );
+
+			/**
+			Returns the number of entries in the table of a sample format:
+			256 for 8-bit samples, 65536 for 16-bit samples and 0 for wider samples.
+			*/
+			static UInt Entries( ImageCube::PixelFormat format );
+			/**
+			Returns the index of a sample in its table.
+			@param samples the samples
+			@param sampleBytes the size of a sample, 1 or 2
+			@param i the index of the sample
+			*/
+			static inline UInt Index( const Void* samples, UInt sampleBytes, UInt i )
+			{
+				return sampleBytes == 1 ? ((const Byte*)samples)[i] : ((const UShort*)samples)[i];
+			}
+			/**
+			Returns a table built earlier for the same stretch and samples.
+			@return the table or an empty pointer
+			*/
+			static Pointer Find( const Stretch& stretch, ImageCube::PixelFormat format, const ImageCube::Encoding* encoding );
+			/**
+			Keeps a table for later calls of Find. Only the most recently
+			inserted tables are kept.
+			*/
+			static Void Insert( const Pointer& table );
+
+			UInt Size() const;
+			Double* Values();
+			const Double* Values() const;
+
+		private:
+			Bool Matches( const Stretch& stretch, ImageCube::PixelFormat format, const ImageCube::Encoding* encoding ) const;
+
+			Stretch					stretch;
+			ImageCube::PixelFormat	format;
+			Bool					encoded;
+			ImageCube::Encoding		encoding;
+			Vector<Double>			values;
+		};
+	}
+}
+
+#endif
@@ -67,6 +67,7 @@
 #include "Environment.h"
 #include "PreviewController.h"
 #include "ProgressModel.h"
+#include "RegionStatistics.h"
 
 namespace FitsLiberator
 {
@@ -88,6 +89,9 @@ namespace FitsLiberator
 
 			ImageTile* getLightTile( const Int tile );
 
+			//loads the pixels and null map of an allocated tile
+			Void readTile( ImageTile& tile, const ImageCube* cube, const Plane& plane );
+
 			Void reTile( const ImageCube* cube, const Int, const Plane& plane );
 
 			//stretches the pixel of a specific tile on a single thread
@@ -121,6 +125,16 @@ namespace FitsLiberator
 
 			ImageTile* getTiles();
 
+			/**Statistics of regions of the plane the statistics were last done for*/
+			const RegionStatistics& getRegionStatistics() const;
+
+			/**Drops the region statistics, e.g. when another file is opened*/
+			Void clearRegionStatistics();
+
+			/**Sets whether doStatistics3 collects the region statistics. Off by
+			default, as it costs a stretch of every tile and the tables*/
+			Void setCollectRegionStatistics( Bool collect );
+
 			static const Int tileSizeLarge = 0;
 			static const Int tileSizeSmall = 1;
 			static const Int tileSizeImport = 2;
@@ -160,6 +174,12 @@ namespace FitsLiberator
 								  Int64 totalBytes, Int* nTiles, Int* nAllocTiles, 
 								  const ImageCube* cube, const Plane& plane ); 
 			
+			//chooses the size of the small tiles from the storage layout
+			Void planTile( const ImageCube* cube, UInt* width, UInt* height );
+
+			//rounds the tile size to whole storage blocks
+			Void alignTile( const ImageCube* cube, UInt* width, UInt* height );
+
 			/**Returns the number of tiles totally allocated  currently*/
 			Int getNCurrentlyAllocated( );
 
@@ -168,10 +188,19 @@ namespace FitsLiberator
 			//maximum amount of lines in the image imported
 			//at a time when exporting to TIFF
 			static const Int maxHeightImport = 1000;
+			//approximate number of pixels in a small tile
+			static const Int tileTargetPixels = ImageTile::tile_small_min_width * ImageTile::tile_small_min_height;
+			//fewest rows in a strip of a row-major image, wider images are
+			//cut into narrower strips
+			static const Int minStripHeight = 8;
 
 			UInt maxMemUsage;
 			UInt oldMaxMemUsage;
 
+			//collected by doStatistics3 from the linear pixel values
+			RegionStatistics regionStatistics;
+			Bool collectRegionStatistics;
+
 
 		};
 	}
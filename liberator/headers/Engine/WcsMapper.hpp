@@ -55,6 +55,9 @@
     Contains definitions for the WCS coordinate mapper.
 */
 
+#ifndef __WCSMAPPER_H__
+#define __WCSMAPPER_H__
+
 #include "ImageCube.hpp"
 
 namespace FitsLiberator {
@@ -64,12 +67,54 @@ namespace FitsLiberator {
 			char  coordtype[5];
 
             bool valid;
+
+            /** Projections the batch methods evaluate themselves, all
+                others are passed to CFITSIO one coordinate at a time. */
+            enum Projection {
+                projectionLinear,   ///< -CAR
+                projectionTangent,  ///< -TAN
+                projectionOther
+            };
+            Projection projection;
+            double cosr, sinr;              //< Rotation.
+            double ra0, dec0;               //< Reference coordinates in radians.
+            double cos0, sin0;              //< Of dec0.
+            double cosRa0, sinRa0;          //< Of ra0.
+
+            void Prepare();
         public:
             /** Create a WCS mapper from an image. Returns null_ptr if the image does not support WCS coordinates.
                 @param image Image to use for creating the mapper. */
             WcsMapper(const ImageCube* image);
+            /** Returns true if the image has WCS coordinates. */
+            bool Valid() const;
             /** Maps image coordinates to WCS coordinates. */
             bool Map(double x, double y, double* ra, double* dec) const;
+            /** Maps a batch of image coordinates to WCS coordinates. The
+                offsets and rotation are applied to the whole batch before 
+                the projection, and the common projections are evaluated
+                without calling CFITSIO, so the loops vectorize.
+                @param x,y Image coordinates as passed to Map.
+                @param count Number of coordinates.
+                @param ra,dec Receive the WCS coordinates, NaN for
+                    coordinates that cannot be mapped.
+                @return True if all coordinates were mapped. */
+            bool Map(const double* x, const double* y, ImageCube::size_type count, double* ra, double* dec) const;
+            /** Maps count consecutive pixels of a row, starting at (x, y), 
+                see the batch Map. */
+            bool MapRow(double x, double y, ImageCube::size_type count, double* ra, double* dec) const;
+            /** Maps WCS coordinates to image coordinates, the inverse of Map. */
+            bool Unmap(double ra, double dec, double* x, double* y) const;
+            /** Maps a batch of WCS coordinates to image coordinates, see the
+                batch Map.
+                @param ra,dec WCS coordinates; NaN coordinates map to NaN.
+                @param count Number of coordinates.
+                @param x,y Receive the image coordinates, NaN for coordinates
+                    that cannot be mapped.
+                @return True if all coordinates were mapped. */
+            bool Unmap(const double* ra, const double* dec, ImageCube::size_type count, double* x, double* y) const;
         };
     }
 }
+
+#endif // __WCSMAPPER_H__
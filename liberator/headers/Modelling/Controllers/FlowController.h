@@ -79,6 +79,7 @@
 #include "OptionsModel.h"
 #include "ProgressModel.h"
 #include "WcsMapper.hpp"
+#include "PixelProbe.h"
 #include "FitsSession.h"
 #include "FileLoader.h"
 #include "RepositoryModel.h"
@@ -210,6 +211,15 @@ namespace FitsLiberator
 			*/
 			Void peakGuess( const FitsLiberator::Point& p );
 
+			/**
+			Computes the statistics of a region of the current plane from
+			the tables collected with its statistics. Returns false if they
+			are not available, e.g. because the plane is too large for them.
+			@param region The pixels of the region, right and bottom exclusive.
+			*/
+			Bool getRegionStatistics( const FitsLiberator::Rectangle& region, 
+				FitsLiberator::Engine::RegionSummary* summary );
+
 			/**
 			Called when the user hits the auto-background button
 			*/
@@ -349,8 +359,9 @@ namespace FitsLiberator
 		protected:
 
 		private:	
-            /** Called in the beginning of a long running operation. */
-            Bool Begin();
+            /** Called in the beginning of a long running operation. 
+                @param name Name of the operation, used for instrumentation. */
+            Bool Begin( const String& name );
             /** Called at the end of a long running operation. */
             void End();
 			//Method for doing the statistics
@@ -370,6 +381,8 @@ namespace FitsLiberator
 			Void makePreview2( const FitsLiberator::Engine::ImageCube* cube );
 			//make the guess for the background or peak level
 			Double makeGuess( const FitsLiberator::Point& p );
+			//reads the pixel under a point of the preview at full resolution
+			Bool probePixel( const FitsLiberator::Point& p, Double* real, Double* stretched );
 		
 			//internal defaultValues function
 			Void defaultValues_();
@@ -440,6 +453,14 @@ namespace FitsLiberator
 			
             boost::shared_ptr<WcsMapper> wcs;
 
+			//reads the pixels under the mouse from the image
+			FitsLiberator::Engine::PixelProbe pixelProbe;
+
+			//name of the operation currently running
+			String operation;
+			//time the current operation was started
+			Double operationStart;
+
 			//the saved state
 			FlowControllerState* currentState;
 			
@@ -90,6 +90,8 @@ namespace FitsLiberator
 			Void scaleDynamicRange( Double bl, Double wl);///> rescales the image in the current dynamic range [blacklevel:whitelevel]
 			Double getPixelGuess( const FitsLiberator::Point&, FitsLiberator::Size& rawSize, 
 				const FitsLiberator::Engine::Stretch& stretch, const Bool flip );
+			FitsLiberator::Rectangle getImageRegion( const FitsLiberator::Point&, Int width, 
+				Int height, const Bool flip );///> the pixels of the image under a window of the preview
 
 			Void setZoomIndex( Int f, const FitsLiberator::Size& rawSize, Bool flip );
 			Void setUnityZoom( const FitsLiberator::Size&, Bool flip );
@@ -71,6 +71,8 @@ namespace FitsLiberator
 			
 			
 			Vector<Double>& getRawBins();			///> returns the bins
+			Void rawBinsChanged();					///> to be called whenever the raw bins have been altered
+			Double getRawBinMax(UInt, UInt);		///> returns the largest raw bin in [from;to[
 			Vector<Int>&	getEndBins();			///> returns the bins to be rendered in the window.
 
 			Void setMaxBin(Double);					///> sets the maximum value a bin takes		
@@ -135,6 +137,11 @@ namespace FitsLiberator
 
 			Vector<Double> rawBins;					///> the raw bins, from which the histogram is generated
 			Vector<Int> endBins;					///> the length of the bins to be drawn
+			/** Max mipmap of the raw bins: entry i of level k holds the largest of
+				the raw bins [i*2^(k+1);(i+1)*2^(k+1)[, so the largest bin of any range
+				is found in O(log bins) steps. Rebuilt on demand after rawBinsChanged. */
+			Vector< Vector<Double> > binMaxima;
+			Bool binMaximaValid;					///> false if the raw bins changed since the maxima were built
 		
 			Int offset;								///> defines the offset of the end bins according to the raw bins. Should be inited to zero
 			Double currentZoomValue;				///> The actual current zoom factor
@@ -219,7 +219,7 @@ namespace FitsLiberator {
 
             KeywordList     keywords;               ///< Defined keywords
             CategoryList    categories;             ///< Defined categories
-            RuleList        rules[3];               ///< Array<List<Rule>>; one list for each format
+            RuleList        rules[4];               ///< Array<List<Rule>>; one list for each format
             String          vrSchema;               ///< Schema to use for serialization
             String          vrNamespace;            ///< XML namespace prefix to use for serialization
 		};
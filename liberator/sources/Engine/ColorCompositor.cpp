@@ -0,0 +1,548 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "ColorCompositor.h"
+#include "FitsEngine.h"
+#include "FitsMath.h"
+#include "ImageTile.h"
+#include "Instrumentation.h"
+#include "Parallelism.h"
+#include "Exception.h"
+
+#include <algorithm>
+
+#ifdef USE_TBB
+	#include <tbb/pipeline.h>
+	#include <tbb/task_scheduler_init.h>
+#endif
+
+#ifdef USE_OPENMP
+	#include <omp.h>
+#endif
+
+using namespace FitsLiberator::Engine;
+using FitsLiberator::Modelling::ProgressModel;
+
+/**
+Allocates the buffers of a strip for every layer of the compositor.
+@throws std::bad_alloc if the strip does not fit in memory.
+*/
+ColorCompositor::StripBuffer::StripBuffer( UInt s, UInt r, UInt n, const ColorCompositor& compositor )
+	: strip( s ), row( r ), rows( n ), pixels( NULL ), colors( NULL ), output( NULL )
+{
+	UInt nPixels = compositor.width * rows;
+	try
+	{
+		for ( UInt i = 0; i < compositor.layers.size(); i++ )
+		{
+			const Layer& layer = compositor.layers[i];
+			ImageCube::PixelFormat format = layer.encoded ? layer.encoding.format : layer.cube->Format();
+
+			rawPixels.push_back( NULL );
+			nullPixels.push_back( NULL );
+			rawPixels[i] = new Byte[ImageCube::SizeOf( format, compositor.width, rows )];
+			if ( !layer.encoded && layer.cube->NeedsNullMap() )
+				nullPixels[i] = new Byte[ImageCube::NullMapSize( nPixels )];
+		}
+		pixels = new Double[nPixels];
+		colors = new Double[3 * nPixels];
+		output = new Byte[3 * nPixels * ( compositor.bitDepth / 8 )];
+	}
+	catch ( std::bad_alloc& )
+	{
+		release();
+		throw;
+	}
+}
+
+ColorCompositor::StripBuffer::~StripBuffer()
+{
+	release();
+}
+
+Void ColorCompositor::StripBuffer::release()
+{
+	for ( UInt i = 0; i < rawPixels.size(); i++ )
+	{
+		delete[] rawPixels[i];
+		delete[] nullPixels[i];
+	}
+	rawPixels.clear();
+	nullPixels.clear();
+	delete[] pixels;
+	delete[] colors;
+	delete[] output;
+	pixels = NULL;
+	colors = NULL;
+	output = NULL;
+}
+
+#ifdef USE_TBB
+namespace
+{
+	/**
+	First stage of the pipeline. Reads the strips one after another so
+	every input is traversed once from top to bottom.
+	*/
+	class StripReader : public tbb::filter
+	{
+		const ColorCompositor&	compositor;
+		ProgressModel*			progressModel;
+		UInt					next;
+		UInt					rowsPerStrip;
+		UInt					height;
+	public:
+		Int						status;
+		String					error;
+
+		StripReader( const ColorCompositor& c, ProgressModel* pm, UInt r, UInt h )
+			: tbb::filter( true ), compositor( c ), progressModel( pm ), next( 0 ),
+			  rowsPerStrip( r ), height( h ), status( ImageTile::AllocOk ) {}
+
+		void* operator()( void* )
+		{
+			UInt row = next * rowsPerStrip;
+			if ( row >= height || status != ImageTile::AllocOk || !error.empty() )
+				return NULL;
+			if ( progressModel != NULL && progressModel->QueryCancel() )
+			{
+				status = ImageTile::OperationCanceled;
+				return NULL;
+			}
+
+			UInt rows = ( row + rowsPerStrip > height ) ? height - row : rowsPerStrip;
+			ColorCompositor::StripBuffer* buffer = NULL;
+			try
+			{
+				buffer = new ColorCompositor::StripBuffer( next, row, rows, compositor );
+			}
+			catch ( std::bad_alloc& )
+			{
+				status = ImageTile::AllocErr;
+				return NULL;
+			}
+			try
+			{
+				compositor.readStrip( *buffer );
+			}
+			catch ( FitsLiberator::Exception& e )
+			{
+				delete buffer;
+				error = e.getMessage();
+				return NULL;
+			}
+			next++;
+			return buffer;
+		}
+	};
+
+	/**
+	Middle stage of the pipeline. Strips are independent so any number of
+	them may be stretched and composited at the same time.
+	*/
+	class StripWorker : public tbb::filter
+	{
+		const ColorCompositor& compositor;
+	public:
+		StripWorker( const ColorCompositor& c ) : tbb::filter( false ), compositor( c ) {}
+
+		void* operator()( void* item )
+		{
+			ColorCompositor::StripBuffer* buffer = static_cast<ColorCompositor::StripBuffer*>( item );
+			compositor.compositeStrip( *buffer, 1 );
+			return buffer;
+		}
+	};
+
+	/**
+	Last stage of the pipeline. Writes the strips to the file; being serial
+	it is also the only stage that touches the file and the progress model.
+	*/
+	class StripWriter : public tbb::filter
+	{
+		ColorCompositor&	compositor;
+		ProgressModel*		progressModel;
+	public:
+		String				error;
+
+		StripWriter( ColorCompositor& c, ProgressModel* pm )
+			: tbb::filter( true ), compositor( c ), progressModel( pm ) {}
+
+		void* operator()( void* item )
+		{
+			ColorCompositor::StripBuffer* buffer = static_cast<ColorCompositor::StripBuffer*>( item );
+			if ( error.empty() )
+			{
+				try
+				{
+					compositor.writeStrip( *buffer );
+				}
+				catch ( FitsLiberator::Exception& e )
+				{
+					error = e.getMessage();
+				}
+			}
+			delete buffer;
+			if ( progressModel != NULL )
+				progressModel->Increment();
+			return NULL;
+		}
+	};
+}
+#endif
+
+ColorCompositor::ColorCompositor()
+	: width( 0 ), height( 0 ), rowsPerStrip( 0 ), bitDepth( 8 ), flipped( false ), file( NULL )
+{
+
+}
+
+Void ColorCompositor::addLayer( const ImageCube* cube, UInt plane, const Stretch& stretch,
+	Double red, Double green, Double blue )
+{
+	if ( layers.empty() )
+	{
+		width = cube->Width();
+		height = cube->Height();
+	}
+	else if ( cube->Width() != width || cube->Height() != height )
+		throw Exception( "The images to combine must have the same size" );
+
+	Layer layer;
+	layer.cube = cube;
+	layer.plane = plane;
+	layer.stretch = stretch;
+	//scaled values between 0 and 1 are the fraction of the layer's colour
+	layer.stretch.outputMax = 1.0;
+	layer.encoded = cube->Encoded( &layer.encoding );
+	layer.red = red;
+	layer.green = green;
+	layer.blue = blue;
+	layers.push_back( layer );
+}
+
+Void ColorCompositor::setExport( const String& name, Short depth, Bool flip, const String& meta )
+{
+	fileName = name;
+	bitDepth = ( depth == 16 ) ? 16 : 8;
+	flipped = flip;
+	metaData = meta;
+}
+
+UInt ColorCompositor::getNumberOfStrips() const
+{
+	UInt rows = getRowsPerStrip();
+	if ( rows == 0 )
+		return 0;
+	return ( height + rows - 1 ) / rows;
+}
+
+/**
+Returns the number of rows in the strips of the file, strips of roughly 64 KB.
+*/
+UInt ColorCompositor::getRowsPerStrip() const
+{
+	if ( width == 0 )
+		return 0;
+	UInt bytesPerPixel = 3 * ( bitDepth / 8 );
+	UInt rows = ( 0x10000 / bytesPerPixel + width - 1 ) / width;
+	return ( rows > height ) ? height : rows;
+}
+
+/**
+Reads the rows of a strip from every layer.
+*/
+Void ColorCompositor::readStrip( StripBuffer& buffer ) const
+{
+	ScopedTimer timer( stageRead );
+	const Rectangle bounds( 0, buffer.row, width, buffer.row + buffer.rows );
+
+	for ( UInt i = 0; i < layers.size(); i++ )
+	{
+		const Layer& layer = layers[i];
+		if ( layer.encoded )
+		{
+			Instrumentation::add( counterBytesRead, ImageCube::SizeOf( layer.encoding.format, width, buffer.rows ) );
+			layer.cube->ReadEncoded( layer.plane, bounds, buffer.rawPixels[i] );
+		}
+		else if ( buffer.nullPixels[i] != NULL )
+		{
+			Instrumentation::add( counterBytesRead, layer.cube->SizeOf( width, buffer.rows ) );
+			//the null map is only applied if the strip has nulls
+			if ( !layer.cube->Read( layer.plane, bounds, buffer.rawPixels[i], buffer.nullPixels[i] ) )
+			{
+				delete[] buffer.nullPixels[i];
+				buffer.nullPixels[i] = NULL;
+			}
+		}
+		else
+		{
+			Instrumentation::add( counterBytesRead, layer.cube->SizeOf( width, buffer.rows ) );
+			layer.cube->Read( layer.plane, bounds, buffer.rawPixels[i] );
+		}
+	}
+}
+
+/**
+Stretches the strip of each layer, scales it to [0;1] and adds it to the
+colour sums, which are finally converted to the samples of the file.
+*/
+Void ColorCompositor::compositeStrip( StripBuffer& buffer, Int nCpus ) const
+{
+	const Int nPixels = (Int)( width * buffer.rows );
+	Double* colors = buffer.colors;
+	std::fill( colors, colors + 3 * nPixels, 0.0 );
+
+	for ( UInt i = 0; i < layers.size(); i++ )
+	{
+		const Layer& layer = layers[i];
+		Double* pixels = buffer.pixels;
+
+		if ( layer.encoded )
+			FitsEngine::stretchEncoded( layer.stretch, layer.encoding, buffer.rawPixels[i],
+				pixels, nPixels, nCpus );
+		else
+			FitsEngine::stretch( layer.stretch, layer.cube->Format(), buffer.rawPixels[i],
+				buffer.nullPixels[i], pixels, nPixels, nCpus );
+		FitsEngine::scale_par( layer.stretch, pixels, nPixels, nCpus );
+
+		const Double red = layer.red;
+		const Double green = layer.green;
+		const Double blue = layer.blue;
+
+		#ifdef USE_OPENMP
+			#pragma omp parallel num_threads( nCpus ) if( Parallelism::Worth(nPixels, Parallelism::costCompare) )
+			{
+			BusyTimer busy;
+			#pragma omp for
+		#endif // USE_OPENMP
+		for ( Int j = 0; j < nPixels; j++ )
+		{
+			//undefined values add no colour
+			Double pixel = pixels[j];
+			if ( pixel != FitsMath::NaN && FitsMath::isFinite( pixel ) )
+			{
+				if ( pixel > 1.0 )
+					pixel = 1.0;
+				if ( pixel < 0 )
+					pixel = 0;
+				colors[3*j]		+= red * pixel;
+				colors[3*j + 1]	+= green * pixel;
+				colors[3*j + 2]	+= blue * pixel;
+			}
+		}
+		#ifdef USE_OPENMP
+			}
+		#endif // USE_OPENMP
+	}
+
+	if ( bitDepth == 16 )
+		convertStrip<UShort>( buffer, 0xFFFF );
+	else
+		convertStrip<Byte>( buffer, 0xFF );
+}
+
+/**
+Saturates the colour sums of a strip and scales them to the samples of the
+file.
+*/
+template<typename O>
+Void ColorCompositor::convertStrip( StripBuffer& buffer, O maxValue ) const
+{
+	const UInt nSamples = 3 * width * buffer.rows;
+	const Double* colors = buffer.colors;
+	O* output = (O*)buffer.output;
+
+	for ( UInt i = 0; i < nSamples; i++ )
+	{
+		Double sample = colors[i];
+		if ( sample > 1.0 )
+			sample = 1.0;
+		output[i] = (O)( sample * maxValue + 0.5 );
+	}
+}
+
+/**
+Creates the TIFF file with the same tags as FileLoader::readBlack, but
+three samples per pixel.
+*/
+Void ColorCompositor::open()
+{
+	TIFFSetErrorHandler( NULL );
+	file = TIFFOpen( fileName.c_str(), "w" );
+	if ( file == NULL )
+		throw Exception( "Could not open the file" );
+
+	Bool ok = TIFFSetField( file, TIFFTAG_SAMPLESPERPIXEL, 3 )
+		&& TIFFSetField( file, TIFFTAG_BITSPERSAMPLE, bitDepth )
+		&& TIFFSetField( file, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB )
+		&& TIFFSetField( file, TIFFTAG_IMAGEWIDTH, width )
+		&& TIFFSetField( file, TIFFTAG_IMAGELENGTH, height )
+		&& TIFFSetField( file, TIFFTAG_ROWSPERSTRIP, rowsPerStrip )
+		&& TIFFSetField( file, TIFFTAG_RESOLUTIONUNIT, RESUNIT_NONE )
+		&& TIFFSetField( file, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG )
+		&& TIFFSetField( file, TIFFTAG_SOFTWARE, "The ESA/ESO/NASA FITS Liberator" )
+		&& TIFFSetField( file, TIFFTAG_SUBFILETYPE, 0 )
+		&& TIFFSetField( file, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT )
+		&& ( !flipped || TIFFSetField( file, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT ) )
+		&& ( metaData.empty() || TIFFSetField( file, TIFFTAG_XMLPACKET, metaData.length(), metaData.c_str() ) );
+	if ( !ok )
+	{
+		close();
+		throw Exception( "Could not set the TIFF fields" );
+	}
+}
+
+Void ColorCompositor::close()
+{
+	if ( file != NULL )
+		TIFFClose( file );
+	file = NULL;
+}
+
+Void ColorCompositor::writeStrip( const StripBuffer& buffer )
+{
+	ScopedTimer timer( stageExport );
+
+	tsize_t size = 3 * width * buffer.rows * ( bitDepth / 8 );
+	if ( TIFFWriteEncodedStrip( file, buffer.strip, buffer.output, size ) == -1 )
+		throw Exception( "Could not write encoded strip" );
+	Instrumentation::add( counterBytesWritten, size );
+}
+
+Int ColorCompositor::run( ProgressModel* progressModel )
+{
+	if ( layers.empty() )
+		throw Exception( "No images to combine" );
+
+	TraceSpan span( "color compositing" );
+
+	rowsPerStrip = getRowsPerStrip();
+
+	open();
+	Int status = ImageTile::AllocOk;
+
+#ifdef USE_TBB
+	Parallelism::Initialize();
+
+	StripReader reader( *this, progressModel, rowsPerStrip, height );
+	StripWorker worker( *this );
+	StripWriter writer( *this, progressModel );
+
+	tbb::pipeline pipeline;
+	pipeline.add_filter( reader );
+	pipeline.add_filter( worker );
+	pipeline.add_filter( writer );
+	//one strip per thread in flight plus one being read and one being written
+	pipeline.run( tbb::task_scheduler_init::default_num_threads() + 2 );
+	pipeline.clear();
+	close();
+
+	if ( !reader.error.empty() )
+		throw Exception( reader.error );
+	if ( !writer.error.empty() )
+		throw Exception( writer.error );
+	status = reader.status;
+#else
+	#ifdef USE_OPENMP
+		Int nCpus = omp_get_num_procs();
+	#else
+		Int nCpus = 1;
+	#endif
+
+	try
+	{
+		for ( UInt row = 0, strip = 0; row < height; row += rowsPerStrip, strip++ )
+		{
+			if ( progressModel != NULL && progressModel->QueryCancel() )
+			{
+				status = ImageTile::OperationCanceled;
+				break;
+			}
+
+			UInt rows = ( row + rowsPerStrip > height ) ? height - row : rowsPerStrip;
+			StripBuffer* buffer = NULL;
+			try
+			{
+				buffer = new StripBuffer( strip, row, rows, *this );
+			}
+			catch ( std::bad_alloc& )
+			{
+				status = ImageTile::AllocErr;
+				break;
+			}
+			try
+			{
+				readStrip( *buffer );
+				compositeStrip( *buffer, nCpus );
+				writeStrip( *buffer );
+			}
+			catch ( ... )
+			{
+				delete buffer;
+				throw;
+			}
+			delete buffer;
+
+			if ( progressModel != NULL )
+				progressModel->Increment();
+		}
+	}
+	catch ( ... )
+	{
+		close();
+		throw;
+	}
+	close();
+#endif
+	return status;
+}
@@ -0,0 +1,526 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "CubeProcessor.h"
+#include "FitsEngine.h"
+#include "FitsStatisticsTools.h"
+#include "FitsMath.h"
+#include "ImageTile.h"
+#include "Instrumentation.h"
+#include "Parallelism.h"
+#include "Exception.h"
+#include "tiffio.h"
+
+#include <sstream>
+#include <iomanip>
+
+#ifdef USE_TBB
+	#include <tbb/pipeline.h>
+	#include <tbb/task_scheduler_init.h>
+#endif
+
+#ifdef USE_OPENMP
+	#include <omp.h>
+#endif
+
+using namespace FitsLiberator::Engine;
+using FitsLiberator::Modelling::ProgressModel;
+
+/**
+Allocates the buffers needed for a single plane of the cube.
+@throws std::bad_alloc if the plane does not fit in memory.
+*/
+CubeProcessor::PlaneBuffer::PlaneBuffer( UInt p, const ImageCube* cube )
+	: plane( p ), rawPixels( NULL ), nullPixels( NULL ), stretchedPixels( NULL ), hasNulls( false )
+{
+	UInt nPixels = cube->Width() * cube->Height();
+	try
+	{
+		rawPixels = new Byte[cube->SizeOf( plane )];
+		stretchedPixels = new Double[nPixels];
+		if ( cube->NeedsNullMap() )
+			nullPixels = new Byte[ImageCube::NullMapSize( nPixels )];
+	}
+	catch ( std::bad_alloc& )
+	{
+		delete[] rawPixels;
+		delete[] stretchedPixels;
+		delete[] nullPixels;
+		throw;
+	}
+}
+
+CubeProcessor::PlaneBuffer::~PlaneBuffer()
+{
+	delete[] rawPixels;
+	delete[] stretchedPixels;
+	delete[] nullPixels;
+}
+
+UInt64 CubeProcessor::PlaneBuffer::SizeOf( const ImageCube* cube )
+{
+	UInt nPixels = cube->Width() * cube->Height();
+	UInt64 bytes = (UInt64)cube->SizeOf( 0 ) + (UInt64)nPixels * sizeof(Double);
+	if ( cube->NeedsNullMap() )
+		bytes += ImageCube::NullMapSize( nPixels );
+	return bytes;
+}
+
+#ifdef USE_TBB
+namespace
+{
+	/**
+	First stage of the pipeline. Reads the planes one after another so the
+	file is traversed once from beginning to end.
+	*/
+	class PlaneReader : public tbb::filter
+	{
+		const CubeProcessor&	processor;
+		const ImageCube*		cube;
+		ProgressModel*			progressModel;
+		UInt					next;
+	public:
+		Int						status;
+		String					error;
+
+		PlaneReader( const CubeProcessor& p, const ImageCube* c, ProgressModel* pm )
+			: tbb::filter( true ), processor( p ), cube( c ), progressModel( pm ),
+			  next( 0 ), status( ImageTile::AllocOk ) {}
+
+		void* operator()( void* )
+		{
+			if ( next >= cube->Planes() || status != ImageTile::AllocOk )
+				return NULL;
+			if ( progressModel != NULL && progressModel->QueryCancel() )
+			{
+				status = ImageTile::OperationCanceled;
+				return NULL;
+			}
+
+			CubeProcessor::PlaneBuffer* buffer = NULL;
+			try
+			{
+				buffer = new CubeProcessor::PlaneBuffer( next, cube );
+			}
+			catch ( std::bad_alloc& )
+			{
+				status = ImageTile::AllocErr;
+				return NULL;
+			}
+			try
+			{
+				processor.readPlane( *buffer );
+			}
+			catch ( FitsLiberator::Exception& e )
+			{
+				delete buffer;
+				error = e.getMessage();
+				return NULL;
+			}
+			next++;
+			return buffer;
+		}
+	};
+
+	/**
+	Middle stage of the pipeline. Planes are independent so any number of
+	them may be stretched, analyzed and exported at the same time.
+	*/
+	class PlaneWorker : public tbb::filter
+	{
+		CubeProcessor& processor;
+	public:
+		PlaneWorker( CubeProcessor& p ) : tbb::filter( false ), processor( p ) {}
+
+		void* operator()( void* item )
+		{
+			CubeProcessor::PlaneBuffer* buffer = static_cast<CubeProcessor::PlaneBuffer*>( item );
+			try
+			{
+				processor.processPlane( *buffer, 1 );
+			}
+			catch ( FitsLiberator::Exception& e )
+			{
+				buffer->error = e.getMessage();
+			}
+			catch ( std::bad_alloc& )
+			{
+				buffer->error = "Out of memory";
+			}
+			return buffer;
+		}
+	};
+
+	/**
+	Last stage of the pipeline. Being serial it is the only stage that
+	touches the progress model, which expects a single updating thread.
+	*/
+	class PlaneRetirer : public tbb::filter
+	{
+		ProgressModel* progressModel;
+	public:
+		String error;
+
+		PlaneRetirer( ProgressModel* pm ) : tbb::filter( true ), progressModel( pm ) {}
+
+		void* operator()( void* item )
+		{
+			CubeProcessor::PlaneBuffer* buffer = static_cast<CubeProcessor::PlaneBuffer*>( item );
+			if ( error.empty() )
+				error = buffer->error;
+			delete buffer;
+			if ( progressModel != NULL )
+				progressModel->Increment();
+			return NULL;
+		}
+	};
+}
+#endif
+
+CubeProcessor::CubeProcessor( const ImageCube* c, const Stretch& s, UInt bins, UInt maxMem )
+	: cube( c ), stretch( s ), exportStretch( s ), binCount( bins ), maxMemUsage( maxMem ),
+	  statistics( c->Planes() ), bitDepth( 8 ), flipped( false ), doExport( false )
+{
+	encoded = cube->Encoded( &encoding );
+}
+
+Void CubeProcessor::setExport( const String& name, Short depth, Bool flip, const String& meta )
+{
+	fileName = name;
+	bitDepth = depth;
+	flipped = flip;
+	metaData = meta;
+	doExport = true;
+
+	//same output ranges as FileLoader::ReadStart
+	switch ( bitDepth )
+	{
+		case 32:
+			exportStretch.outputMax = 1.0;
+			break;
+		case 16:
+			exportStretch.outputMax = 0xFFFF;
+			break;
+		default:
+			exportStretch.outputMax = 0xFF;
+			break;
+	}
+}
+
+const PlaneStatistics& CubeProcessor::getStatistics( UInt plane ) const
+{
+	return statistics[plane];
+}
+
+String CubeProcessor::getFileName( UInt plane ) const
+{
+	std::ostringstream number;
+	number << "_" << std::setw( 3 ) << std::setfill( '0' ) << (plane + 1);
+
+	String::size_type dot = fileName.find_last_of( '.' );
+	String::size_type separator = fileName.find_last_of( "/\\:" );
+	if ( dot == String::npos || ( separator != String::npos && dot < separator ) )
+		return fileName + number.str();
+	return fileName.substr( 0, dot ) + number.str() + fileName.substr( dot );
+}
+
+Int CubeProcessor::getNumberOfThreads() const
+{
+#if defined(USE_TBB)
+	return tbb::task_scheduler_init::default_num_threads();
+#elif defined(USE_OPENMP)
+	return omp_get_num_procs();
+#else
+	return 1;
+#endif
+}
+
+/**
+Loads all pixels and the null map of a plane, or the stored samples of the
+plane if the image can be read in its stored encoding.
+*/
+Void CubeProcessor::readPlane( PlaneBuffer& buffer ) const
+{
+	ScopedTimer timer( stageRead );
+
+	if ( encoded )
+	{
+		Instrumentation::add( counterBytesRead, ImageCube::SizeOf( encoding.format, cube->Width(), cube->Height() ) );
+		cube->ReadEncoded( buffer.plane, Rectangle( 0, 0, cube->Width(), cube->Height() ), buffer.rawPixels );
+		buffer.hasNulls = false;
+		return;
+	}
+
+	Instrumentation::add( counterBytesRead, cube->SizeOf( buffer.plane ) );
+	if ( buffer.nullPixels != NULL )
+	{
+		buffer.hasNulls = cube->Read( buffer.plane, buffer.rawPixels, buffer.nullPixels );
+		Instrumentation::add( counterBytesRead, ImageCube::NullMapSize( cube->Width() * cube->Height() ) );
+	}
+	else
+	{
+		cube->Read( buffer.plane, buffer.rawPixels );
+		buffer.hasNulls = false;
+	}
+}
+
+/**
+Stretches a loaded plane and computes its statistics. The computation
+mirrors TileControl::doStatistics3 so the results do not depend on whether
+a plane was processed here or interactively.
+*/
+Void CubeProcessor::processPlane( PlaneBuffer& buffer, Int nCpus )
+{
+	UInt nPixels = cube->Width() * cube->Height();
+	PlaneStatistics& s = statistics[buffer.plane];
+
+	s.min = DoubleMax;
+	s.max = DoubleMin;
+	s.mean = 0;
+	s.median = 0;
+	s.stdev = 0;
+	s.maxBinCount = 0;
+	s.pixelCount = 0;
+	s.histogram.assign( binCount, 0. );
+
+	//8- and 16-bit planes are stretched through a lookup table and their
+	//statistics come from the counts of each sample, see StretchTable
+	ImageCube::PixelFormat format = encoded ? encoding.format : cube->Format();
+	StretchTable::Pointer table = FitsEngine::getTable( stretch, format, encoded ? &encoding : NULL );
+	if ( table )
+	{
+		Vector<UInt> counts( table->Size(), 0 );
+		FitsStatisticsTools::countSamples( buffer.rawPixels, ImageCube::SizeOf( format, 1, 1 ), nPixels,
+			buffer.hasNulls ? buffer.nullPixels : NULL, counts );
+
+		FitsStatisticsTools::getRange( counts, table->Values(), &s.pixelCount, &s.min, &s.max, &s.mean );
+		s.mean = s.mean / s.pixelCount;
+
+		Double invBinSize = (binCount - 1.) / (s.max - s.min);
+		FitsStatisticsTools::getHistogram( counts, table->Values(), &s.stdev,
+			s.mean, s.min, invBinSize, s.histogram );
+	}
+
+	if ( table == NULL || doExport )
+	{
+		if ( encoded )
+			FitsEngine::stretchEncoded( stretch, encoding, buffer.rawPixels,
+				buffer.stretchedPixels, nPixels, nCpus );
+		else
+			FitsEngine::stretch( stretch, cube->Format(), buffer.rawPixels,
+				buffer.hasNulls ? buffer.nullPixels : NULL, buffer.stretchedPixels, nPixels, nCpus );
+	}
+
+	if ( table == NULL )
+	{
+		FitsStatisticsTools::getRange_par( buffer.stretchedPixels, nPixels, &s.pixelCount,
+			&s.min, &s.max, &s.mean, nCpus );
+		s.mean = s.mean / s.pixelCount;
+
+		Double invBinSize = (binCount - 1.) / (s.max - s.min);
+		FitsStatisticsTools::getHistogram_par( buffer.stretchedPixels, nPixels, &s.stdev,
+			s.mean, s.min, invBinSize, s.histogram, nCpus );
+	}
+	s.stdev = FitsMath::squareroot( 1. / ((Double)s.pixelCount) * s.stdev );
+
+	FitsStatisticsTools::scaleHistogram( s.histogram, &s.median, s.min, s.max,
+		&s.maxBinCount, s.pixelCount );
+
+	if ( doExport )
+	{
+		//the stretched pixels are no longer needed for the statistics
+		//so they are scaled in place
+		FitsEngine::scale_par( exportStretch, buffer.stretchedPixels, nPixels, nCpus );
+		if ( bitDepth == 32 )
+			writePlane<float>( buffer, (float)exportStretch.outputMax );
+		else if ( bitDepth == 16 )
+			writePlane<UShort>( buffer, (UShort)exportStretch.outputMax );
+		else
+			writePlane<Byte>( buffer, (Byte)exportStretch.outputMax );
+	}
+}
+
+/**
+Writes a scaled plane to its own TIFF file with the same tags as
+FileLoader::readBlack; undefined values are written as black.
+*/
+template<typename O>
+Void CubeProcessor::writePlane( const PlaneBuffer& buffer, O maxValue )
+{
+	ScopedTimer timer( stageExport );
+
+	const UInt width = cube->Width();
+	const UInt height = cube->Height();
+	//strips of roughly 64 KB
+	UInt rowsPerStrip = ( 0x10000 / sizeof(O) + width - 1 ) / width;
+	if ( rowsPerStrip > height )
+		rowsPerStrip = height;
+
+	TIFFSetErrorHandler( NULL );
+	TIFF* outImage = TIFFOpen( getFileName( buffer.plane ).c_str(), "w" );
+	if ( outImage == NULL )
+		throw Exception( "Could not open the file" );
+
+	Bool ok = TIFFSetField( outImage, TIFFTAG_SAMPLESPERPIXEL, 1 )
+		&& TIFFSetField( outImage, TIFFTAG_BITSPERSAMPLE, bitDepth )
+		&& TIFFSetField( outImage, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK )
+		&& TIFFSetField( outImage, TIFFTAG_IMAGEWIDTH, width )
+		&& TIFFSetField( outImage, TIFFTAG_IMAGELENGTH, height )
+		&& TIFFSetField( outImage, TIFFTAG_ROWSPERSTRIP, rowsPerStrip )
+		&& TIFFSetField( outImage, TIFFTAG_RESOLUTIONUNIT, RESUNIT_NONE )
+		&& TIFFSetField( outImage, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG )
+		&& TIFFSetField( outImage, TIFFTAG_SOFTWARE, "The ESA/ESO/NASA FITS Liberator" )
+		&& TIFFSetField( outImage, TIFFTAG_SUBFILETYPE, 0 )
+		&& TIFFSetField( outImage, TIFFTAG_SAMPLEFORMAT, bitDepth == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT )
+		&& ( !flipped || TIFFSetField( outImage, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT ) )
+		&& ( metaData.empty() || TIFFSetField( outImage, TIFFTAG_XMLPACKET, metaData.length(), metaData.c_str() ) );
+	if ( !ok )
+	{
+		TIFFClose( outImage );
+		throw Exception( "Could not set the TIFF fields" );
+	}
+
+	O* stripBuffer = new O[width * rowsPerStrip];
+	for ( UInt row = 0, strip = 0; row < height; row += rowsPerStrip, strip++ )
+	{
+		UInt nRows = ( row + rowsPerStrip > height ) ? height - row : rowsPerStrip;
+		UInt nPixels = width * nRows;
+		const Double* pixels = buffer.stretchedPixels + (size_t)width * row;
+
+		for ( UInt i = 0; i < nPixels; i++ )
+		{
+			Double pixel = pixels[i];
+			if ( pixel != FitsMath::NaN && FitsMath::isFinite( pixel ) )
+			{
+				if ( pixel > maxValue )
+					pixel = maxValue;
+				if ( pixel < 0 )
+					pixel = 0;
+			}
+			else
+				pixel = 0;
+			stripBuffer[i] = (O)pixel;
+		}
+
+		if ( TIFFWriteEncodedStrip( outImage, strip, stripBuffer, sizeof(O) * nPixels ) == -1 )
+		{
+			delete[] stripBuffer;
+			TIFFClose( outImage );
+			throw Exception( "Could not write encoded strip" );
+		}
+		Instrumentation::add( counterBytesWritten, sizeof(O) * nPixels );
+	}
+	delete[] stripBuffer;
+	TIFFClose( outImage );
+}
+
+Int CubeProcessor::run( ProgressModel* progressModel )
+{
+	TraceSpan span( "cube processing" );
+	SequentialPass pass( cube );
+
+#ifdef USE_TBB
+	Parallelism::Initialize();
+
+	PlaneReader reader( *this, cube, progressModel );
+	PlaneWorker worker( *this );
+	PlaneRetirer retirer( progressModel );
+
+	tbb::pipeline pipeline;
+	pipeline.add_filter( reader );
+	pipeline.add_filter( worker );
+	pipeline.add_filter( retirer );
+	//one plane per thread in flight plus one being read, as far as they fit
+	//into the memory budget
+	UInt64 planes = maxMemUsage / FitsMath::maximum( (UInt64)1, PlaneBuffer::SizeOf( cube ) );
+	planes = FitsMath::maximum( (UInt64)1, FitsMath::minimum( planes, (UInt64)getNumberOfThreads() + 1 ) );
+	pipeline.run( (size_t)planes );
+	pipeline.clear();
+
+	if ( !reader.error.empty() )
+		throw Exception( reader.error );
+	if ( !retirer.error.empty() )
+		throw Exception( retirer.error );
+	return reader.status;
+#else
+	for ( UInt plane = 0; plane < cube->Planes(); plane++ )
+	{
+		if ( progressModel != NULL && progressModel->QueryCancel() )
+			return ImageTile::OperationCanceled;
+
+		PlaneBuffer* buffer = NULL;
+		try
+		{
+			buffer = new PlaneBuffer( plane, cube );
+		}
+		catch ( std::bad_alloc& )
+		{
+			return ImageTile::AllocErr;
+		}
+		try
+		{
+			readPlane( *buffer );
+			processPlane( *buffer, getNumberOfThreads() );
+		}
+		catch ( ... )
+		{
+			delete buffer;
+			throw;
+		}
+		delete buffer;
+
+		if ( progressModel != NULL )
+			progressModel->Increment();
+	}
+	return ImageTile::AllocOk;
+#endif
+}
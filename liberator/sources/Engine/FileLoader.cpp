@@ -55,6 +55,7 @@
 #include "FitsMath.h"
 #include "FitsEngine.h"
 #include "TilePusher.h"
+#include "Instrumentation.h"
 
 
 using namespace FitsLiberator;
@@ -112,6 +113,9 @@ Void FileLoader::ReadStart( ) {
  * saving a large file thus making it necessary to show the progress thingy in the GUI
  */
 Void FileLoader::ReadContinue( FitsLiberator::Modelling::ProgressModel& progModel ) {
+	ScopedTimer timer( stageExport );
+	//the export reads the image once from top to bottom
+	SequentialPass pass( reader[session->plane.imageIndex] );
 	//do this to make sure we use the most efficient way of loading into PS
 	
     
@@ -235,8 +239,8 @@ Void FileLoader::readTransparent( O maxValue, Short bitDepth,
 	if ( !(TIFFSetField( outImage, TIFFTAG_EXTRASAMPLES, 1, &out ))) 
 		throw FileLoaderException("Could not set field EXTRASAMPLES");
 	
-	//write the metadata to the file
-	if ( !(TIFFSetField( outImage, TIFFTAG_XMLPACKET, session->metaData.length(), session->metaData.c_str() )))
+	//write the metadata to the file (libtiff rejects an empty packet)
+	if ( !session->metaData.empty() && !(TIFFSetField( outImage, TIFFTAG_XMLPACKET, session->metaData.length(), session->metaData.c_str() )))
 		throw FileLoaderException("Could not set field XMLPACKET");
 
 //	TIFFSetField( outImage, TIFFTAG_COMPRESSION, COMPRESSION_LZW );
@@ -311,6 +315,7 @@ Void FileLoader::readTransparent( O maxValue, Short bitDepth,
 		
 		if ( !(TIFFWriteEncodedStrip( outImage, i, rowBuffer, 2*bytesPerStrip )) )
 			throw FileLoaderException("Could not write encoded strip");
+		Instrumentation::add( counterBytesWritten, 2*bytesPerStrip );
 		
 		//call the progress thingy
 		progModel.Increment();
@@ -351,6 +356,7 @@ Void FileLoader::readTransparent( O maxValue, Short bitDepth,
 			
 			if ( !(TIFFWriteEncodedStrip( outImage, stripsPerImage-1, rowBuffer,sizeof(O)*pixelsRemaining*2)))
 				throw FileLoaderException("Could not write encoded strip");
+			Instrumentation::add( counterBytesWritten, sizeof(O)*pixelsRemaining*2 );
 			progModel.Increment();
 		}
 
@@ -462,8 +468,8 @@ Void FileLoader::readBlack( O maxValue, Short bitDepth,FitsLiberator::Modelling:
 		if ( !(TIFFSetField( outImage, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT )))
 			throw FileLoaderException("Could not set field ORIENTATION");
 	}
-	//write the metadata to the file
-	if ( !(TIFFSetField( outImage, TIFFTAG_XMLPACKET, session->metaData.length(), session->metaData.c_str() )))
+	//write the metadata to the file (libtiff rejects an empty packet)
+	if ( !session->metaData.empty() && !(TIFFSetField( outImage, TIFFTAG_XMLPACKET, session->metaData.length(), session->metaData.c_str() )))
 		throw FileLoaderException("Could not set field XMLPACKET");
 
 	//the output buffer written to the tiff file
@@ -518,6 +524,7 @@ Void FileLoader::readBlack( O maxValue, Short bitDepth,FitsLiberator::Modelling:
 		
 		if ( TIFFWriteEncodedStrip( outImage, i, rowBuffer, bytesPerStrip ) == -1 )
 			throw FileLoaderException("Could not write encoded strip");
+		Instrumentation::add( counterBytesWritten, bytesPerStrip );
 		progModel.Increment();
 		//if the current tile is the last one it may extend two strips of the output image
 		if ( i == nTiles - 1 && stripsPerImage > nTiles )
@@ -552,6 +559,7 @@ Void FileLoader::readBlack( O maxValue, Short bitDepth,FitsLiberator::Modelling:
 				//write to the file
 				if ( TIFFWriteEncodedStrip( outImage, stripsPerImage-1, rowBuffer,sizeof(O)*pixelsRemaining) == -1 )
 					throw FileLoaderException("Could not write encoded strip");
+				Instrumentation::add( counterBytesWritten, sizeof(O)*pixelsRemaining );
 			}
 			progModel.Increment();
 		}
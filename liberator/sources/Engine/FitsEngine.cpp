@@ -54,13 +54,18 @@
 
 #include "FitsEngine.h"
 #include "FitsMath.h"
+#include "Instrumentation.h"
+#include "StretchKernels.h"
+#include "Parallelism.h"
+
+#include <algorithm>
 
 #ifdef USE_TBB
     #include <limits>
 
     #include <tbb/parallel_for.h>
     #include <tbb/blocked_range.h>
-    #include <tbb/task_scheduler_init.h>
+    #include <tbb/partitioner.h>
 
     using namespace std;
     using namespace tbb;
@@ -69,614 +74,367 @@
 using FitsLiberator::Engine::FitsEngine;
 using FitsLiberator::Engine::Stretch;
 using FitsLiberator::Engine::ImageCube;
+using FitsLiberator::Engine::FitsMath;
+using FitsLiberator::Engine::StretchTable;
+using namespace FitsLiberator::Engine;
 
 //-----------------------------------------------------------------------------
 // Helper functions
 //-----------------------------------------------------------------------------
 
-inline double signof(double value) {
-    return (value < 0.0) ? -1.0 : 1.0;
+/** Reverses the byte order of a value. */
+template<typename T>
+inline T swapBytes(T value) {
+    union { T value; unsigned char bytes[sizeof(T)]; } in, out;
+    in.value = value;
+    for(size_t b = 0; b < sizeof(T); b++)
+        out.bytes[b] = in.bytes[sizeof(T) - 1 - b];
+    return out.value;
 }
 
-//-----------------------------------------------------------------------------
-// Implementation of regular stretch
-//-----------------------------------------------------------------------------
-
-#ifdef USE_TBB
-    /** The following structs implement the various stretch functions. Stretch
-        functions are un-ary functions (except for the linear stretch) and can
-        be combined in any order to form effecient inlined function objects. */
-    struct Linear {
-        double scale, offset, background;
-    public:
-        Linear(double scale, double offset, double background) {
-            this->scale = scale;
-            this->offset = offset;
-            this->background = background;
-        }
-
-        inline double operator()(double value) const {
-            return scale * (value - offset) + background;
-        }
-    };
-
-    template<typename Inner>
-    struct Log {
-        const Inner& inner;
-    public:
-        Log(const Inner& i) : inner(i) {}
-        inline double operator()(double value) const {
-            return log10(inner(value) + 1);
-        }
-    };
-
-    template<typename Inner>
-    struct Sqrt {
-        const Inner& inner;
-    public:
-        Sqrt(const Inner& i) : inner(i) {}
-        
-        inline double operator()(double value) const {
-            value = inner(value);
-            return signof(value) * sqrt(::abs(value));
-        }
-    };
-
-    template<typename Inner>
-    struct Power {
-        const Inner& inner;
-        const double power;
-    public:
-        Power(double p, const Inner& i) : inner(i), power(p) {}
-
-        inline double operator()(double value) const {
-            value = inner(value);
-            return signof(value) * pow(::abs(value), power);
-        }
-    };
-
-    template<typename Inner>
-    struct AsinH {
-        const Inner& inner;
-    public:
-        AsinH(const Inner& i) : inner(i) {}
+/** Indexes stored samples of type T like an array of doubles, reversing 
+    their byte order first if Swap is set. Blank samples read as NaN, which
+    passes through every stretch function like the pixels masked by a null 
+    map. Swapping, blank detection, BSCALE and BZERO thus happen in the 
+    kernel's single pass over the samples. */
+template<typename T, bool Swap>
+struct StoredPixels {
+    const T*    samples;
+    bool        hasBlank;
+    T           blank;
+public:
+    StoredPixels(const T* s, bool b, T v) : samples(s), hasBlank(b), blank(v) {}
+
+    inline double operator[](size_t i) const {
+        T value = Swap ? swapBytes(samples[i]) : samples[i];
+        return (hasBlank && value == blank) ? FitsMath::NaN : (double)value;
+    }
+};
+
+/** Returns the linear part of a stretch, i.e. the stretch without its 
+    function. */
+inline Stretch scalingOf(const Stretch& stretch) {
+    Stretch scaling = stretch;
+    scaling.function = stretchLinear;
+    return scaling;
+}
 
-        inline double operator()(double value) const {
-            value = inner(value);
-            return log(value + sqrt(value * value + 1));
-        }
-    };
+/** Returns the function of a stretch applied to pixels that have been 
+    scaled already, see scalingOf. */
+inline Stretch functionOf(const Stretch& stretch) {
+    Stretch function = stretch;
+    function.scale = 1.0;
+    function.offset = 0.0;
+    function.scaleBackground = 0.0;
+    return function;
+}
 
-    /** The following two function objects performs the strecthing and is 
-        called by the TBB runtime. One version supports a null map and the 
-        other does not. */
-    template<typename Type, typename Function, typename Size = size_t>
-    struct MaskStretcher {
-        double*               out;
-        const Type*           in;
-        const unsigned char*  valid;
-
-        const Function&       stretch;
-
-        static inline double invalid() {
-            if(numeric_limits<double>::has_signaling_NaN) {
-                return numeric_limits<double>::signaling_NaN();
-            } else {
-                return numeric_limits<double>::quiet_NaN();
-            }
-        }
+#ifdef USE_TBB
+    /** Looks up the stretched values of 8- or 16-bit samples. */
+    template<typename Index, typename Size = size_t>
+    struct TableLookup {
+        const Index*    in;
+        const double*   table;
+        double*         out;
     public:
-        MaskStretcher(const Type* data, double* buffer, 
-            const unsigned char* nullmap, const Function& f) 
-          : in(data), out(buffer), valid(nullmap), stretch(f) {}
+        TableLookup(const Index* data, const double* values, double* buffer)
+          : in(data), table(values), out(buffer) {}
 
         void operator()(const tbb::blocked_range<Size>& range) const {
-            double nan = invalid();
+            BusyTimer busy;
             for(Size i = range.begin(); i != range.end(); ++i) {
-                out[i] = (valid[i] == 0) ? stretch(in[i]) : nan;
+                out[i] = table[in[i]];
             }
         }
     };
 
-    template<typename Type, typename Function, typename Size = size_t>
-    struct Stretcher {
-        double*         out;
-        const Type*     in;
-
-        const Function& stretch;
-    public:
-        Stretcher(const Type* data, double* buffer, const Function& f) 
-          : in(data), out(buffer), stretch(f) {}
+    template<typename Index>
+    inline void lookupTable(const Index* in, const double* table, double* out, 
+                            size_t count, int /*nCpus*/) {
+        TableLookup<Index> body(in, table, out);
 
-        void operator()(const tbb::blocked_range<Size>& range) const {
-            for(Size i = range.begin(); i != range.end(); ++i) {
-                out[i] = stretch(in[i]);
+        if( !Parallelism::Worth(count, Parallelism::costCopy) ) {
+            body(tbb::blocked_range<size_t>(0, count));
+            return;
+        }
+        Parallelism::Initialize();
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, count, Parallelism::Grain(Parallelism::costCopy)),
+            body, tbb::auto_partitioner());
+    }
+#elif defined(USE_OPENMP)
+    template<typename Index>
+    inline void lookupTable(const Index* in, const double* table, double* out, 
+                            Int count, Int nCpus) {
+        #pragma omp parallel num_threads( nCpus ) if( Parallelism::Worth(count, Parallelism::costCopy) )
+        {
+            BusyTimer busy;
+            #pragma omp for
+            for(Int i = 0; i < count; i++) {
+                out[i] = table[in[i]];
             }
         }
-    };
+    }
+#else
+    template<typename Index>
+    inline void lookupTable(const Index* in, const double* table, double* out, 
+                            Int count, Int /*nCpus*/) {
+        for(Int i = 0; i < count; i++) {
+            out[i] = table[in[i]];
+        }
+    }
+#endif // USE_TBB
 
-    // TODO: Figure out how to merge to the following two functions.
+//-----------------------------------------------------------------------------
+// Implementation of regular stretch
+//-----------------------------------------------------------------------------
 
+#ifdef USE_TBB
     void FitsEngine::stretchRealValues(
         const Stretch& stretch, Double* rawPixels, Double* buffer, Int count) {
-
-        tbb::task_scheduler_init init;
-
-        const double* in  = rawPixels;
-              double* out = buffer;
-
-        switch(stretch.function) {
-		    case stretchLinear:
-                parallel_for(blocked_range<size_t>(0, count),
-                    Stretcher<double, Linear>(in, out, 
-                        Linear(stretch.scale, stretch.offset, stretch.scaleBackground)));
-                break;
-		    case stretchLog:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Log<Linear> >(in, out,
-                        Log<Linear>(
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchSqrt:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Sqrt<Linear> >(in, out,
-                        Sqrt<Linear>(
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchLogSqrt:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Log<Sqrt<Linear> > >(in, out,
-                        Log<Sqrt<Linear> >(
-                            Sqrt<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-		    case stretchLogLog:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Log<Log<Linear> > >(in, out,
-                        Log<Log<Linear> >(
-                            Log<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-            case stretchCubeR:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Power<Linear> >(in, out,
-                        Power<Linear>(1.0/3.0,
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchAsinh:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, AsinH<Linear> >(in, out,
-                        AsinH<Linear>(
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchAsinhAsinh:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, AsinH<AsinH<Linear> > >(in, out,
-                        AsinH<AsinH<Linear> >(
-                            AsinH<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-		    case stretchAsinhSqrt:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, AsinH<Sqrt<Linear> > >(in, out,
-                        AsinH<Sqrt<Linear> >(
-                            Sqrt<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-		    case stretchRoot4:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Power<Linear> >(in, out,
-                        Power<Linear>(1.0/4.0,
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchRoot5:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    Stretcher<double, Power<Linear> >(in, out,
-                        Power<Linear>(1.0/5.0,
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-        }
+        FitsEngine::_stretch(stretch, (const Double*)rawPixels, (Byte*)NULL, buffer, count, 1);
     }
 
-    template<typename I>
-    Void FitsEngine::_stretch(const Stretch& stretch, I* rawPixels, Byte* nullPixels, Double* buffer, 
+    template<typename Pixels>
+    Void FitsEngine::_stretch(const Stretch& stretch, Pixels rawPixels, Byte* nullPixels, Double* buffer, 
                               Int count, Int /*nCpus*/ ) {
-
-        tbb::task_scheduler_init init;//(nCpus);
-
-        const I*             in   = rawPixels;
-        double*              out  = buffer;
-        const unsigned char* mask = nullPixels;
-
-        switch(stretch.function) {
-		    case stretchLinear:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Linear>(in, out, mask, 
-                        Linear(stretch.scale, stretch.offset, stretch.scaleBackground)));
-                break;
-		    case stretchLog:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Log<Linear> >(in, out, mask,
-                        Log<Linear>(
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchSqrt:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Sqrt<Linear> >(in, out, mask,
-                        Sqrt<Linear>(
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchLogSqrt:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Log<Sqrt<Linear> > >(in, out, mask,
-                        Log<Sqrt<Linear> >(
-                            Sqrt<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-		    case stretchLogLog:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Log<Log<Linear> > >(in, out, mask,
-                        Log<Log<Linear> >(
-                            Log<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-            case stretchCubeR:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Power<Linear> >(in, out, mask,
-                        Power<Linear>(1.0/3.0,
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchAsinh:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, AsinH<Linear> >(in, out, mask,
-                        AsinH<Linear>(
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchAsinhAsinh:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, AsinH<AsinH<Linear> > >(in, out, mask,
-                        AsinH<AsinH<Linear> >(
-                            AsinH<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-		    case stretchAsinhSqrt:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, AsinH<Sqrt<Linear> > >(in, out, mask,
-                        AsinH<Sqrt<Linear> >(
-                            Sqrt<Linear>(
-                                Linear(stretch.scale, stretch.offset, stretch.scaleBackground)))));
-                break;
-		    case stretchRoot4:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Power<Linear> >(in, out, mask,
-                        Power<Linear>(1.0/4.0,
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
-		    case stretchRoot5:
-                tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
-                    MaskStretcher<I, Power<Linear> >(in, out, mask,
-                        Power<Linear>(1.0/5.0,
-                            Linear(stretch.scale, stretch.offset, stretch.scaleBackground))));
-			    break;
+        // The approximations are compiled for doubles only, the pixels are
+        // scaled into the buffer first and the function applied in place
+        if( stretch.precision == precisionFast ) {
+            stretchWith<ExactMath>(scalingOf(stretch), rawPixels, buffer, count, 1);
+            stretchFast(functionOf(stretch), buffer, count, 1);
         }
+        else
+            stretchWith<ExactMath>(stretch, rawPixels, buffer, count, 1);
+
+        if( nullPixels != NULL )
+            applyNullMap( nullPixels, buffer, count );
     }
 #else
     Void FitsEngine::stretchRealValues(const Stretch& stretch, Double* rawPixels, Double* out, Int count)
     {
-	    //setting up the null map array
-	    Byte* nullPixels = new Byte[count];
-        std::fill(nullPixels, nullPixels + count, 0);
-	    FitsEngine::_stretch(stretch, rawPixels, nullPixels, out, count, 1);
-	    delete[] nullPixels;
+	    FitsEngine::_stretch(stretch, rawPixels, (Byte*)NULL, out, count, 1);
     }
 
-    template<typename I>
-    Void FitsEngine::_stretch(const Stretch& stretch, I* rawPixels, Byte* nullPixels, Double* out, Int count, Int nCpus ) {
-        static const double c = 1.0; ///< The loglog stretch constant "to be determined during development"
-
-        #ifdef USE_OPENMP	
-            #pragma omp parallel num_threads( nCpus )
-	        {
-        #endif // USE_OPENMP  
-    	
-	    register double value;
-        switch(stretch.function) {
-		    case stretchLinear:
-			    #ifdef USE_OPENMP	
-	    		    #pragma omp for
-			    #endif // USE_OPENMP
-                for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-                break;
-
-		    case stretchLog:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for ( Int i = 0; i < count; i++ ) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = log10( value + 1);
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }			
-			    break;
-		    case stretchSqrt:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-                for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-                        value = FitsMath::signof( value ) * sqrt( abs(value) );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }    
-                break;
-		    case stretchLogSqrt:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = log10( FitsMath::signof( value ) * sqrt( abs( value ) ) + 1 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }    
-			    break;
-		    case stretchLogLog:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-                for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-                        value = log10( c * log10( value + 1 ) + 1 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }    
-                break;
-            case stretchCubeR:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-                for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = FitsMath::signof( value ) * pow( abs( value ), 1.0/3.0 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-                break;
-
-		    case stretchAsinh:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-                for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = log( value + sqrt( value * value + 1) );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-                break;
-		    case stretchAsinhAsinh:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    //start by calculating asinh(x)
-					    value = log( value + sqrt( value * value + 1) );
-					    //then asinh( asinh ( x ) )
-					    value = log( value + sqrt( value * value + 1) );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-		    case stretchAsinhSqrt:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    //start by calculating sqrt(x)
-					    value = FitsMath::signof( value ) * sqrt( abs( value ) );
-					    //then asinh( sqrt ( x ) )
-					    value = log( value + sqrt( value * value + 1) );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-		    case stretchRoot4:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = FitsMath::signof( value ) * pow( abs( value ), 0.25 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-		    case stretchRoot5:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = FitsMath::signof( value ) * pow( abs( value ), 0.20 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-			case stretchPow15:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = pow( value, 1.5 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-			case stretchPow2:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = value * value;
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-			case stretchPow3:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = pow( value, 3. );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-			case stretchPow4:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = pow( value, 4.0 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-			case stretchPow5:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = pow( value, 5.0 );
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
-			case stretchExp:
-			    #ifdef USE_OPENMP	
-			        #pragma omp for
-			    #endif // USE_OPENMP
-			    for(Int i = 0; i < count; i++) {
-                    if( nullPixels[i] == 0 ) {
-                        value = applyPreStretch( rawPixels[i], stretch.scale, stretch.offset, stretch.scaleBackground );
-					    value = exp(value);
-                        out[i] = value;
-                    } else {
-                        out[i] = FitsMath::NaN;
-                    }
-                }
-			    break;
+    template<typename Pixels>
+    Void FitsEngine::_stretch(const Stretch& stretch, Pixels rawPixels, Byte* nullPixels, Double* out, Int count, Int nCpus ) {
+        // The approximations are compiled for doubles only, the pixels are
+        // scaled into out first and the function applied in place
+        if( stretch.precision == precisionFast ) {
+            stretchWith<ExactMath>(scalingOf(stretch), rawPixels, out, count, nCpus);
+            stretchFast(functionOf(stretch), out, count, nCpus);
         }
+        else
+            stretchWith<ExactMath>(stretch, rawPixels, out, count, nCpus);
 
-        #ifdef USE_OPENMP
-            }   // omp parallel
-        #endif // USE_OPENMP
+        if( nullPixels != NULL )
+            applyNullMap( nullPixels, out, count );
     }
 #endif // USE_TBB
 
 Void FitsEngine::stretch(const Stretch& stretch, ImageCube::PixelFormat bitDepth, Void* rawPixels, 
 						 Byte* nullPixels, Double* out, UInt count, Int nCpus ) {
+    ScopedTimer timer(stageStretch);
+    Instrumentation::add(counterPixelsStretched, count);
+
+    // Building a table costs as much as stretching one pixel per entry.
+    UInt entries = StretchTable::Entries(bitDepth);
+    if( entries != 0 && count >= entries ) {
+        lookup(*getTable(stretch, bitDepth, NULL), rawPixels, out, count, nCpus);
+        if( nullPixels != NULL )
+            applyNullMap( nullPixels, out, count );
+        return;
+    }
+    FitsEngine::_stretchFormat(stretch, bitDepth, rawPixels, nullPixels, out, count, nCpus );
+}
+
+Void FitsEngine::_stretchFormat(const Stretch& stretch, ImageCube::PixelFormat bitDepth, const Void* rawPixels, 
+						 Byte* nullPixels, Double* out, UInt count, Int nCpus ) {
     // Select between the different datatypes, datatypes marked with (1) are not part of the 
     // FITS standard but are used by CFITSIO in case the BSCALE and BZERO keywords are used to
     // change an integer range from signed to unsigned.
     switch(bitDepth) {
         case ImageCube::Unsigned8:        // Unsigned 8-bit integer
-            FitsEngine::_stretch(stretch, (Byte*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Byte*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Signed16:        // Signed 16-bit integer
-            FitsEngine::_stretch(stretch, (Short*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Short*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Signed32:        // Signed 32-bit integer
-            FitsEngine::_stretch(stretch, (Int*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Int*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Signed64:    // Signed 64-bit integer
-            FitsEngine::_stretch(stretch, (Int*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Int*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Float32:        // 32-bit float
-            FitsEngine::_stretch(stretch, (Float*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Float*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Float64:    // 64-bit float
-            FitsEngine::_stretch(stretch, (Double*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Double*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Signed8:        // Signed 8-bit (1)
-            FitsEngine::_stretch(stretch, (Char*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const Char*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Unsigned16:    // Unsigned 16-bit integer (1)
-            FitsEngine::_stretch(stretch, (UShort*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const UShort*)rawPixels, nullPixels, out, count, nCpus );
             break;
         case ImageCube::Unsigned32:        // Unsigned 32-bit integer (1)
-            FitsEngine::_stretch(stretch, (UInt*)rawPixels, nullPixels, out, count, nCpus );
+            FitsEngine::_stretch(stretch, (const UInt*)rawPixels, nullPixels, out, count, nCpus );
+            break;
+        default:
+            throw Exception("Invalid bitdepth");
+    }
+}
+
+template<typename T>
+Void FitsEngine::_stretchStored(const Stretch& stretch, const ImageCube::Encoding& encoding,
+                                const Void* rawPixels, Double* out, Int count, Int nCpus ) {
+    const T* samples = (const T*)rawPixels;
+    const T  blank   = (T)encoding.blank;
+    if( encoding.swap )
+        FitsEngine::_stretch(stretch, StoredPixels<T, true>(samples, encoding.hasBlank, blank),
+            (Byte*)NULL, out, count, nCpus );
+    else
+        FitsEngine::_stretch(stretch, StoredPixels<T, false>(samples, encoding.hasBlank, blank),
+            (Byte*)NULL, out, count, nCpus );
+}
+
+Void FitsEngine::stretchEncoded(const Stretch& stretch, const ImageCube::Encoding& encoding, 
+                                const Void* rawPixels, Double* out, UInt count, Int nCpus ) {
+    ScopedTimer timer(stageStretch);
+    Instrumentation::add(counterPixelsStretched, count);
+
+    UInt entries = StretchTable::Entries(encoding.format);
+    if( entries != 0 && count >= entries ) {
+        lookup(*getTable(stretch, encoding.format, &encoding), rawPixels, out, count, nCpus);
+        return;
+    }
+    FitsEngine::_stretchEncoded(stretch, encoding, rawPixels, out, count, nCpus );
+}
+
+Void FitsEngine::stretchChain(const StretchChain& chain, ImageCube::PixelFormat bitDepth, Void* rawPixels, 
+                              Byte* nullPixels, Double* out, UInt count, Int nCpus ) {
+    ScopedTimer timer(stageStretch);
+    Instrumentation::add(counterPixelsStretched, count);
+
+    // A leading affine step is applied while the pixels are converted
+    Stretch scaling;
+    scaling.function        = stretchLinear;
+    scaling.scale           = 1.0;
+    scaling.offset          = 0.0;
+    scaling.scaleBackground = 0.0;
+
+    UInt first = 0;
+    if( chain.Size() > 0 && chain[0].operation == StretchChain::operationAffine ) {
+        scaling.scale           = chain[0].a;
+        scaling.scaleBackground = chain[0].b;
+        first = 1;
+    }
+    FitsEngine::_stretchFormat(scaling, bitDepth, rawPixels, NULL, out, count, nCpus );
+
+    if( first < chain.Size() )
+        stretchSteps(chain, first, out, count, nCpus);
+
+    if( nullPixels != NULL )
+        applyNullMap( nullPixels, out, count );
+}
+
+Void FitsEngine::_stretchEncoded(const Stretch& stretch, const ImageCube::Encoding& encoding, 
+                                 const Void* rawPixels, Double* out, UInt count, Int nCpus ) {
+    // BSCALE and BZERO are folded into the pre-stretch, so the stored samples
+    // go through the regular kernels:
+    //   scale * (bscale * s + bzero - offset) + background 
+    //     = (scale * bscale) * (s - (offset - bzero) / bscale) + background
+    Stretch folded = stretch;
+    folded.scale   = stretch.scale * encoding.scale;
+    folded.offset  = (stretch.offset - encoding.zero) / encoding.scale;
+
+    // FITS stores only the BITPIX types; the unsigned and signed 8-bit 
+    // formats are derived from them through BZERO.
+    switch(encoding.format) {
+        case ImageCube::Unsigned8:
+            FitsEngine::_stretchStored<Byte>(folded, encoding, rawPixels, out, count, nCpus );
+            break;
+        case ImageCube::Signed16:
+            FitsEngine::_stretchStored<Short>(folded, encoding, rawPixels, out, count, nCpus );
+            break;
+        case ImageCube::Signed32:
+            FitsEngine::_stretchStored<Int>(folded, encoding, rawPixels, out, count, nCpus );
+            break;
+        case ImageCube::Signed64:
+            FitsEngine::_stretchStored<Int64>(folded, encoding, rawPixels, out, count, nCpus );
+            break;
+        case ImageCube::Float32:
+            FitsEngine::_stretchStored<Float>(folded, encoding, rawPixels, out, count, nCpus );
+            break;
+        case ImageCube::Float64:
+            FitsEngine::_stretchStored<Double>(folded, encoding, rawPixels, out, count, nCpus );
             break;
         default:
             throw Exception("Invalid bitdepth");
     }
 }
 
+StretchTable::Pointer FitsEngine::getTable(const Stretch& stretch, ImageCube::PixelFormat format,
+                                           const ImageCube::Encoding* encoding) {
+    UInt entries = StretchTable::Entries(format);
+    if( entries == 0 )
+        return StretchTable::Pointer();
+
+    StretchTable::Pointer table = StretchTable::Find(stretch, format, encoding);
+    if( table )
+        return table;
+
+    // Stretch every bit pattern of a sample with the regular kernels, so 
+    // looked up pixels get exactly the values they would otherwise get.
+    Vector<UShort> patterns(entries);
+    if( entries == (1 << 8) ) {
+        Byte* bytes = reinterpret_cast<Byte*>(&patterns[0]);
+        for( UInt i = 0; i < entries; i++ )
+            bytes[i] = (Byte)i;
+    } else {
+        for( UInt i = 0; i < entries; i++ )
+            patterns[i] = (UShort)i;
+    }
+
+    table.reset(new StretchTable(stretch, format, encoding));
+    if( encoding != NULL )
+        FitsEngine::_stretchEncoded(stretch, *encoding, &patterns[0], table->Values(), entries, 1 );
+    else
+        FitsEngine::_stretchFormat(stretch, format, &patterns[0], NULL, table->Values(), entries, 1 );
+    StretchTable::Insert(table);
+    return table;
+}
+
+Void FitsEngine::lookup(const StretchTable& table, const Void* rawPixels, Double* out, 
+                        UInt count, Int nCpus ) {
+    if( table.Size() == (1 << 8) )
+        lookupTable((const Byte*)rawPixels, table.Values(), out, count, nCpus);
+    else
+        lookupTable((const UShort*)rawPixels, table.Values(), out, count, nCpus);
+}
+
 //-----------------------------------------------------------------------------
 // FitEngine misc. functions
 //-----------------------------------------------------------------------------
 
+Void FitsEngine::applyNullMap(const Byte* nullMap, Double* out, UInt count) {
+    UInt bytes = ImageCube::NullMapSize(count);
+    for(UInt b = 0; b < bytes; b++) {
+        // Most bytes of a sparse null map are zero, skip them 8 pixels at a time.
+        if( nullMap[b] == 0 )
+            continue;
+        UInt end = std::min(count, (b + 1) << 3);
+        for(UInt i = b << 3; i < end; i++) {
+            if( ImageCube::IsNull(nullMap, i) )
+                out[i] = FitsMath::NaN;
+        }
+    }
+}
+
 Void FitsEngine::scale(const Stretch& stretch, Double* pixels, UInt count ) {
+    ScopedTimer timer(stageScale);
+    Instrumentation::add(counterPixelsScaled, count);
+
     //
     // The Preview and FitsLoader needs values that will fit inside an 8-bit
     // or 16-bit integer so we need to scale the pixels to fit; the following
@@ -706,6 +464,7 @@ Void FitsEngine::scale(const Stretch& stretch, Double* pixels, UInt count ) {
 			: pixels(data), scale(s), offset(o) {}
 
 		void operator()(const tbb::blocked_range<Size>& range) const {
+			BusyTimer busy;
 			for(Size i = range.begin(); i != range.end(); ++i) {
 				pixels[i] = scale * pixels[i] + offset;
 			}
@@ -713,15 +472,26 @@ Void FitsEngine::scale(const Stretch& stretch, Double* pixels, UInt count ) {
 	};
 
 	Void FitsEngine::scale_par(const Stretch& stretch, Double* pixels, UInt count, UInt) {
+        ScopedTimer timer(stageScale);
+        Instrumentation::add(counterPixelsScaled, count);
+
         double scale = stretch.outputMax / (stretch.whiteLevel - stretch.blackLevel);
         double offset = -stretch.blackLevel * scale;
         
-        tbb::task_scheduler_init init;
-		tbb::parallel_for(tbb::blocked_range<size_t>(0, count), 
-			Scaler<size_t>(pixels, scale, offset));
+        Scaler<size_t> body(pixels, scale, offset);
+        if( !Parallelism::Worth(count, Parallelism::costCopy) ) {
+            body(tbb::blocked_range<size_t>(0, count));
+            return;
+        }
+        Parallelism::Initialize();
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, count, Parallelism::Grain(Parallelism::costCopy)), 
+			body, tbb::auto_partitioner());
 	}
 #else
 	Void FitsEngine::scale_par(const Stretch& stretch, Double* pixels, UInt count, UInt nCpus ) {
+		ScopedTimer timer(stageScale);
+		Instrumentation::add(counterPixelsScaled, count);
+
 		//
 		// The Preview and FitsLoader needs values that will fit inside an 8-bit
 		// or 16-bit integer so we need to scale the pixels to fit; the following
@@ -735,8 +505,9 @@ Void FitsEngine::scale(const Stretch& stretch, Double* pixels, UInt count ) {
 		Double offset = -stretch.blackLevel * scale;
 
 		#ifdef USE_OPENMP	
-		#pragma omp parallel num_threads( nCpus )
+		#pragma omp parallel num_threads( nCpus ) if( Parallelism::Worth(count, Parallelism::costCopy) )
 		{		
+			BusyTimer busy;
 			#pragma omp for		
 		#endif // USE_OPENMP  
 			for ( Int i = 0; i < count; i++ )
@@ -759,204 +530,22 @@ Double FitsEngine::getLinearValWithoutStretch(const Stretch& stretch, Double val
 
 Double FitsEngine::linearValStretch( const Stretch& stretch, Double val, Bool doStretch )
 {
-	Double scale = stretch.scale;
-	Double offset = stretch.offset;
-	Double scaleBackground =  stretch.scaleBackground;
-    switch(stretch.function) {
-		case stretchLinear:
-			if ( doStretch )
-			{
-				return unapplyPreStretch( val, scale, offset, scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchLog:
-			val = FitsMath::power( 10.0, val) - 1;
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset, scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchSqrt:
-			val = FitsMath::signof( val ) * FitsMath::power( val, 2.0 );
-			//val = FitsMath::power( val, 2.0 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset, scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchLogSqrt:
-			val = FitsMath::power( 10.0, val ) - 1;
-			val = FitsMath::signof( val ) * FitsMath::power( ::abs( val ), 2.0 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset, scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchLogLog:
-			val = FitsMath::power( 10.0, val) - 1;
-			val = FitsMath::power( 10.0, val) - 1;
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset, scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchCubeR:
-			val = FitsMath::signof( val ) * FitsMath::power( ::abs( val ), 3.0 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchAsinh:
-			val = sinh( val );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-		case stretchAsinhAsinh:
-			val = sinh( val );
-			val = sinh( val );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchAsinhSqrt:
-			val = sinh( val );
-			val = FitsMath::signof( val ) * pow( ::abs( val ), 2.0 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchRoot4:
-			val = FitsMath::signof( val ) * pow( ::abs( val ), 4.0 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchRoot5:
-			val = FitsMath::signof( val ) * pow( ::abs( val ), 5.0 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		
-		case stretchPow15:
-			val = pow( val, 1./1.5 );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchPow2:
-			val = pow( val, 1./2. );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchPow3:
-			val = pow( val, 1./3. );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchPow4:
-			val = pow( val, 1./4. );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchPow5:
-			val = pow( val, 1./5. );
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-		case stretchExp:
-			val = exp(-val);
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-			break;
-        default:
-			if (doStretch)
-			{
-				return unapplyPreStretch( val, scale, offset,scaleBackground );
-			}
-			else
-			{
-				return val;
-			}
-	}
+	if ( doStretch )
+		getLinearValues( stretch, &val, &val, 1 );
+	else
+		getLinearValuesWithoutStretch( stretch, &val, &val, 1 );
+	return val;
+}
+
+Void FitsEngine::getLinearValues(const Stretch& stretch, const Double* in, Double* out, UInt count) {
+	StretchChain( stretch ).Inverse( in, out, count );
+}
+
+Void FitsEngine::getLinearValuesWithoutStretch(const Stretch& stretch, const Double* in, Double* out, UInt count) {
+	StretchChain( functionOf( stretch ) ).Inverse( in, out, count );
+}
+
+Void FitsEngine::getStretchDerivatives(const Stretch& stretch, const Double* in, Double* out, UInt count) {
+	StretchChain( stretch ).Derivative( in, out, count );
 }
 
@@ -0,0 +1,335 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file implements the class Engine::FitsHduIndex. */
+
+#include <map>
+#include <string>
+#include <stdlib.h>
+
+#include "FitsHduIndex.hpp"
+#include "FitsHeader.hpp"
+
+using std::string;
+
+using FitsLiberator::Engine::FitsHduIndex;
+using FitsLiberator::Engine::FitsHeader;
+
+// fitsio2.h cannot be included from C++, so the raw read function is 
+// declared here. ffmbyt is declared in fitsio.h.
+extern "C" int ffgbyt(fitsfile* fptr, LONGLONG nbytes, void* buffer, int* status);
+
+namespace {
+	/** Size of a FITS block. */
+	const size_t blockSize = 2880;
+	/** Size of a header card. */
+	const size_t cardSize = 80;
+
+	/** The keywords of a header that describe its data unit. */
+	struct Keywords {
+		string	xtension;
+		bool	groups;
+		bool	zimage;
+		long	bitPix;
+		long	zBitPix;
+		long	nAxis;
+		long	zNAxis;
+		std::map<long, UInt64> nAxes;
+		std::map<long, UInt64> zNAxes;
+		UInt64	pCount;
+		UInt64	gCount;
+		double	bScale;
+		double	bZero;
+
+		Keywords() : groups(false), zimage(false), bitPix(0), zBitPix(0),
+			nAxis(0), zNAxis(0), pCount(0), gCount(1), bScale(1.0), bZero(0.0) {
+		}
+
+		/** Records a keyword if it is one of the interesting ones. Most 
+			cards are not, so the names are compared in place.
+			@param card Header card with a value. */
+		void Set(const char* card) {
+			switch( card[0] ) {
+				case 'X':
+					if( Is(card, "XTENSION") )
+						xtension = FitsHeader::CardValue(card);
+					break;
+				case 'G':
+					if( Is(card, "GROUPS") )
+						groups = (FitsHeader::CardValue(card) == "T");
+					else if( Is(card, "GCOUNT") )
+						gCount = (UInt64)Number(card);
+					break;
+				case 'Z':
+					if( Is(card, "ZIMAGE") )
+						zimage = (FitsHeader::CardValue(card) == "T");
+					else if( Is(card, "ZBITPIX") )
+						zBitPix = (long)Number(card);
+					else if( Is(card, "ZNAXIS") )
+						zNAxis = (long)Number(card);
+					else if( Axis(card, "ZNAXIS") > 0 )
+						zNAxes[Axis(card, "ZNAXIS")] = (UInt64)Number(card);
+					break;
+				case 'B':
+					if( Is(card, "BITPIX") )
+						bitPix = (long)Number(card);
+					else if( Is(card, "BSCALE") )
+						bScale = Number(card);
+					else if( Is(card, "BZERO") )
+						bZero = Number(card);
+					break;
+				case 'N':
+					if( Is(card, "NAXIS") )
+						nAxis = (long)Number(card);
+					else if( Axis(card, "NAXIS") > 0 )
+						nAxes[Axis(card, "NAXIS")] = (UInt64)Number(card);
+					break;
+				case 'P':
+					if( Is(card, "PCOUNT") )
+						pCount = (UInt64)Number(card);
+					break;
+			}
+		}
+
+		/** Checks whether a card holds the given keyword. */
+		static bool Is(const char* card, const char* name) {
+			size_t i = 0;
+			for( ; name[i] != 0; i++ ) {
+				if( card[i] != name[i] )
+					return false;
+			}
+			for( ; i < 8; i++ ) {
+				if( card[i] != ' ' )
+					return false;
+			}
+			return true;
+		}
+
+		/** Returns the axis number of an indexed keyword such as NAXIS2, or 0
+			if the card holds another keyword. */
+		static long Axis(const char* card, const char* root) {
+			size_t i = 0;
+			for( ; root[i] != 0; i++ ) {
+				if( card[i] != root[i] )
+					return 0;
+			}
+			long axis = 0;
+			for( ; i < 8 && card[i] >= '0' && card[i] <= '9'; i++ )
+				axis = axis * 10 + (card[i] - '0');
+			for( ; i < 8; i++ ) {
+				if( card[i] != ' ' )
+					return 0;
+			}
+			return axis;
+		}
+
+		/** Parses the numeric value of a card, which may use a FORTRAN style
+			exponent. */
+		static double Number(const char* card) {
+			string value = FitsHeader::CardValue(card);
+			string::size_type exponent = value.find_first_of("Dd");
+			if( exponent != string::npos )
+				value[exponent] = 'E';
+			return ::strtod(value.c_str(), NULL);
+		}
+
+		/** Size of the data unit in bytes, without padding. */
+		UInt64 DataSize() const {
+			if( nAxis == 0 )
+				return 0;
+			UInt64 size = 1;
+			// Random groups have NAXIS1 = 0, which does not count.
+			for( long i = (groups && At(nAxes, 1) == 0) ? 2 : 1; i <= nAxis; i++ )
+				size *= At(nAxes, i);
+			return (UInt64)(bitPix < 0 ? -bitPix : bitPix) / 8 * gCount * (pCount + size);
+		}
+
+		static UInt64 At(const std::map<long, UInt64>& axes, long i) {
+			std::map<long, UInt64>::const_iterator value = axes.find(i);
+			return value != axes.end() ? value->second : 0;
+		}
+	};
+
+	/** Replicates fits_get_img_equivtype: integer images with integral 
+		BSCALE and BZERO map to the smallest integer type holding the 
+		scaled range, other scaled integer images to floating point. */
+	int EquivalentType(int bitPix, double bScale, double bZero) {
+		if( bScale == 1.0 && bZero == 0.0 )
+			return bitPix;
+
+		double minValue, maxValue;
+		switch( bitPix ) {
+			case BYTE_IMG:
+				minValue = 0.0;
+				maxValue = 255.0;
+				break;
+			case SHORT_IMG:
+				minValue = -32768.0;
+				maxValue =  32767.0;
+				break;
+			case LONG_IMG:
+				minValue = -2147483648.0;
+				maxValue =  2147483647.0;
+				break;
+			default:
+				return bitPix;
+		}
+
+		if( bScale >= 0.0 ) {
+			minValue = bZero + bScale * minValue;
+			maxValue = bZero + bScale * maxValue;
+		} else {
+			double low = bZero + bScale * maxValue;
+			maxValue   = bZero + bScale * minValue;
+			minValue   = low;
+		}
+		long longZero  = (bZero < 2147483648.0) ? (long)bZero : 0;
+		long longScale = (long)bScale;
+
+		if( bZero != 2147483648.0 && (longZero != bZero || longScale != bScale) )
+			return (bitPix == BYTE_IMG || bitPix == SHORT_IMG) ? FLOAT_IMG : DOUBLE_IMG;
+		else if( minValue == -128.0 && maxValue == 127.0 )
+			return SBYTE_IMG;
+		else if( minValue >= -32768.0 && maxValue <= 32767.0 )
+			return SHORT_IMG;
+		else if( minValue >= 0.0 && maxValue <= 65535.0 )
+			return USHORT_IMG;
+		else if( minValue >= -2147483648.0 && maxValue <= 2147483647.0 )
+			return LONG_IMG;
+		else if( minValue >= 0.0 && maxValue < 4294967296.0 )
+			return ULONG_IMG;
+		return DOUBLE_IMG;
+	}
+}
+
+FitsHduIndex::FitsHduIndex(fitsfile* fileHandle) {
+	UInt64 offset = 0;
+	for( unsigned int number = 1; ; number++ ) {
+		Hdu hdu;
+		hdu.number		= number;
+		hdu.headerStart = offset;
+		if( !ReadHeader(fileHandle, hdu) )
+			break;
+		hdus.push_back(hdu);
+		offset = hdu.dataStart + (hdu.dataSize + blockSize - 1) / blockSize * blockSize;
+	}
+}
+
+bool
+FitsHduIndex::ReadHeader(fitsfile* fileHandle, Hdu& hdu) const {
+	int status = 0;
+	if( ffmbyt(fileHandle, hdu.headerStart, 0, &status) )
+		return false;
+
+	Keywords keywords;
+	char block[blockSize];
+	for( UInt64 position = hdu.headerStart; ; position += blockSize ) {
+		if( ffgbyt(fileHandle, blockSize, block, &status) )
+			return false;
+
+		for( size_t i = 0; i < blockSize; i += cardSize ) {
+			const char* card = block + i;
+			for( size_t j = 0; j < cardSize; j++ ) {
+				if( card[j] < ' ' || card[j] > '~' )
+					return false;
+			}
+			// The first card identifies the HDU, anything else is trailing
+			// data after the last HDU.
+			if( position == hdu.headerStart && i == 0 && 
+				!Keywords::Is(card, hdu.number == 1 ? "SIMPLE" : "XTENSION") )
+				return false;
+
+			if( Keywords::Is(card, "END") ) {
+				hdu.header.append(block, i);
+				hdu.dataStart = position + blockSize;
+				hdu.dataSize  = keywords.DataSize();
+				hdu.compressed = keywords.xtension == "BINTABLE" && keywords.zimage;
+				hdu.image = (hdu.number == 1 && !keywords.groups) || 
+					keywords.xtension == "IMAGE" || hdu.compressed;
+
+				long bitPix = hdu.compressed ? keywords.zBitPix : keywords.bitPix;
+				const std::map<long, UInt64>& axes = hdu.compressed ? keywords.zNAxes : keywords.nAxes;
+				hdu.nAxis = hdu.compressed ? keywords.zNAxis : keywords.nAxis;
+				for( int axis = 0; axis < 4; axis++ )
+					hdu.nAxes[axis] = (axis < hdu.nAxis) ? (long)Keywords::At(axes, axis + 1) : 1;
+				hdu.bitDepth = EquivalentType(bitPix, keywords.bScale, keywords.bZero);
+				return true;
+			}
+			if( card[8] == '=' && card[9] == ' ' )
+				keywords.Set(card);
+		}
+		hdu.header.append(block, blockSize);
+	}
+}
+
+FitsHduIndex::size_type
+FitsHduIndex::size() const {
+	return hdus.size();
+}
+
+const FitsHduIndex::Hdu&
+FitsHduIndex::operator[](size_type i) const {
+	return hdus[i];
+}
+
+FitsHduIndex::const_iterator
+FitsHduIndex::begin() const {
+	return hdus.begin();
+}
+
+FitsHduIndex::const_iterator
+FitsHduIndex::end() const {
+	return hdus.end();
+}
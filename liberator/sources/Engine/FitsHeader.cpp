@@ -0,0 +1,182 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file implements the class Engine::FitsHeader. */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "FitsHeader.hpp"
+#include "Text.hpp"
+#include "TextUtils.h"
+
+using std::string;
+using std::ostream;
+
+using FitsLiberator::newline;
+using FitsLiberator::TextUtils;
+using FitsLiberator::Engine::FitsHeader;
+
+namespace {
+	/** Size of a header card. */
+	const size_t cardSize = 80;
+
+	/** Removes leading and trailing blanks. */
+	string Trim(const string& text) {
+		string::size_type first = text.find_first_not_of(' ');
+		if( first == string::npos )
+			return string();
+		return text.substr(first, text.find_last_not_of(' ') - first + 1);
+	}
+}
+
+FitsHeader::FitsHeader() {
+}
+
+FitsHeader::FitsHeader(const string& header) 
+  : cards(header) {
+
+	// Blank cards in front of END are free space, as in CFITSIO.
+	while( cards.size() >= cardSize && 
+		cards.find_first_not_of(' ', cards.size() - cardSize) == string::npos )
+		cards.erase(cards.size() - cardSize);
+
+	for( size_t i = 0; i + cardSize <= cards.size(); i += cardSize ) {
+		const char* card = cards.data() + i;
+		string name;
+		size_t start;
+		if( memcmp(card, "HIERARCH ", 9) == 0 ) {
+			const char* equals = (const char*)memchr(card + 9, '=', cardSize - 9);
+			if( equals == NULL )
+				continue;
+			name  = Key(string(card + 9, equals));
+			start = equals - card + 1;
+		} else if( card[8] == '=' && card[9] == ' ' ) {
+			name  = Key(string(card, 8));
+			start = 10;
+		} else {
+			continue;
+		}
+
+		// The first occurrence of a keyword wins.
+		if( keywords.find(name) != keywords.end() )
+			continue;
+		Keyword& keyword = keywords[name];
+		keyword.value  = CardValue(card, start);
+		keyword.number = TextUtils::stringToDouble(keyword.value);
+	}
+}
+
+string
+FitsHeader::Key(const string& name) {
+	string key = Trim(name);
+	if( key.size() > 9 && key.compare(0, 9, "HIERARCH ") == 0 )
+		key = Trim(key.substr(9));
+	for( string::iterator i = key.begin(); i != key.end(); ++i )
+		*i = (char)::toupper((unsigned char)*i);
+	return key;
+}
+
+const FitsHeader::Keyword*
+FitsHeader::Find(const string& name) const {
+	KeywordTable::const_iterator i = keywords.find(Key(name));
+	return (i != keywords.end()) ? &i->second : NULL;
+}
+
+string
+FitsHeader::Value(const string& name) const {
+	const Keyword* keyword = Find(name);
+	return (keyword != NULL) ? keyword->value : string();
+}
+
+bool
+FitsHeader::Number(const string& name, double* out) const {
+	const Keyword* keyword = Find(name);
+	if( out == NULL || keyword == NULL || keyword->value.size() == 0 )
+		return false;
+	*out = keyword->number;
+	return true;
+}
+
+void
+FitsHeader::Print(ostream& stream, const string& prefix) const {
+	for( size_t i = 0; i + cardSize <= cards.size(); i += cardSize ) {
+		string card = cards.substr(i, cardSize);
+		stream << prefix << card.erase(card.find_last_not_of(' ') + 1) << newline;
+	}
+}
+
+string
+FitsHeader::CardValue(const char* card, size_t start) {
+	size_t i = start;
+	while( i < cardSize && card[i] == ' ' )
+		i++;
+	string value;
+	if( i < cardSize && card[i] == '\'' ) {
+		for( i++; i < cardSize; i++ ) {
+			if( card[i] == '\'' ) {
+				if( i + 1 < cardSize && card[i + 1] == '\'' )
+					i++;
+				else
+					break;
+			}
+			value += card[i];
+		}
+		return value.erase(value.find_last_not_of(' ') + 1);
+	}
+	while( i < cardSize && card[i] != '/' )
+		value += card[i++];
+	return value.erase(value.find_last_not_of(' ') + 1);
+}
@@ -62,8 +62,11 @@
 	@author        Kaspar Kirstein Nielsen <kaspar@barmave.dk>
 	@author        Lars Holm Nielsen <lars@hankat.dk> */
 
+#include <algorithm>
+#include <stdlib.h>
 #include "FitsImageCube.hpp"
 #include "FitsImageReader.hpp"
+#include "MappedFile.hpp"
 #include "Exception.h"
 
 using std::string;
@@ -73,6 +76,7 @@ using FitsLiberator::Rectangle;
 using FitsLiberator::Engine::ImageCube;
 using FitsLiberator::Engine::FitsImageCube;
 using FitsLiberator::Engine::ImageReader;
+using FitsLiberator::Engine::MappedFile;
 
 template<typename Value>
 static inline int sign(Value number) {
@@ -80,9 +84,10 @@ static inline int sign(Value number) {
 }
 
 FitsImageCube::FitsImageCube(unsigned int index, unsigned int nAxis, 
-							 long* nAxes, int bitDepth, ImageReader* owner
+							 long* nAxes, int bitDepth, const FitsHeader& header,
+							 ImageReader* owner
 	) : super(nAxes[0], nAxes[1], (nAxis >= 3) ? nAxes[2] : 1, 
-			  Map(bitDepth), owner ) {
+			  Map(bitDepth), owner ), header(header) {
 
 	this->dimensions = nAxis;
 	this->index      = index;
@@ -121,6 +126,19 @@ FitsImageCube::NeedsNullMap() const {
 	return !(format == Float64 || format == Float32);
 }
 
+void
+FitsImageCube::StorageBlock(size_type* width, size_type* height) const {
+	super::StorageBlock(width, height);
+
+	// Compressed images default to one tile per row when ZTILEn is missing.
+	double tileWidth, tileHeight;
+	if( NumericProperty("ZTILE1", &tileWidth) && tileWidth >= 1.0 ) {
+		*width = std::min((size_type)tileWidth, Width());
+		if( NumericProperty("ZTILE2", &tileHeight) && tileHeight >= 1.0 )
+			*height = std::min((size_type)tileHeight, Height());
+	}
+}
+
 unsigned int
 FitsImageCube::Index() const {
 	return index;
@@ -128,18 +146,17 @@ FitsImageCube::Index() const {
 
 std::string
 FitsImageCube::Property(const std::string& name) const {
-	FitsImageReader* reader = dynamic_cast<FitsImageReader*>(Owner());
-	assert(reader != 0);
-
-	return reader->Property(this, name);
+	return header.Value(name);
 }
 
 void
 FitsImageCube::Properties(ostream& stream, const string& prefix) const {
-	FitsImageReader* reader = dynamic_cast<FitsImageReader*>(Owner());
-	assert(reader != 0);
+	header.Print(stream, prefix);
+}
 
-	reader->Properties(this, stream, prefix);
+bool
+FitsImageCube::NumericProperty(const string& name, double* out) const {
+	return header.Number(name, out);
 }
 
 ImageCube::RowOrdering
@@ -176,6 +193,12 @@ FitsImageCube::RowOrder() const {
 	return order;
 }
 
+void
+FitsImageCube::Access(ImageCube::AccessPattern pattern) const {
+    FitsImageReader* reader = dynamic_cast<FitsImageReader*>(Owner());
+	reader->Access(pattern);
+}
+
 void
 FitsImageCube::Read(ImageCube::size_type plane, const Rectangle& bounds, 
 					void *buffer) const {
@@ -183,12 +206,12 @@ FitsImageCube::Read(ImageCube::size_type plane, const Rectangle& bounds,
 	reader->Read(this, plane, bounds, buffer);
 }
 
-void 
+bool 
 FitsImageCube::Read(ImageCube::size_type plane, const Rectangle& bounds, 
-					void* buffer, char* valid) const {
+					void* buffer, unsigned char* nullMap) const {
 
     FitsImageReader* reader = dynamic_cast<FitsImageReader*>(Owner());
-	reader->Read(this, plane, bounds, buffer, valid);
+	return reader->Read(this, plane, bounds, buffer, nullMap);
 }
 
 void 
@@ -197,9 +220,42 @@ FitsImageCube::Read(ImageCube::size_type plane, void* buffer) const {
 	reader->Read(this, plane, buffer);
 }
 
-void
+bool
 FitsImageCube::Read(ImageCube::size_type plane, 
-                    void* buffer, char* valid) const {
+                    void* buffer, unsigned char* nullMap) const {
+    FitsImageReader* reader = dynamic_cast<FitsImageReader*>(Owner());
+	return reader->Read(this, plane, buffer, nullMap);
+}
+
+bool
+FitsImageCube::Encoded(Encoding* encoding) const {
+	// Tile-compressed images have no stored form of their pixels.
+	double bitPix;
+	if( Property("ZIMAGE").size() != 0 || !NumericProperty("BITPIX", &bitPix) )
+		return false;
+
+	double scale = 1.0;
+	double zero  = 0.0;
+	NumericProperty("BSCALE", &scale);
+	NumericProperty("BZERO", &zero);
+	if( scale == 0.0 )
+		return false;
+
+	encoding->format = Map((int)bitPix);
+	encoding->swap   = MappedFile::IsLittleEndian() && encoding->format != Unsigned8;
+	encoding->scale  = scale;
+	encoding->zero   = zero;
+
+	// BLANK is parsed as an integer, a double cannot hold every 64-bit value.
+	string blank = Property("BLANK");
+	encoding->hasBlank = bitPix > 0 && blank.size() != 0;
+	encoding->blank    = encoding->hasBlank ? strtoll(blank.c_str(), NULL, 10) : 0;
+	return true;
+}
+
+void
+FitsImageCube::ReadEncoded(ImageCube::size_type plane, const Rectangle& bounds, 
+						   void* buffer) const {
     FitsImageReader* reader = dynamic_cast<FitsImageReader*>(Owner());
-	reader->Read(this, plane, buffer, valid);
+	reader->ReadEncoded(this, plane, bounds, buffer);
 }
@@ -64,7 +64,18 @@
 	@author        Lars Holm Nielsen <lars@hankat.dk> */
 
 #include <iostream>
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#ifndef WINDOWS
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
 #include "FitsImageReader.hpp"
+#include "FitsHduIndex.hpp"
+#include "FitsTileDecoder.hpp"
+#include "GzipIndex.hpp"
+#include "StagingCache.hpp"
 #include "Text.hpp"
 
 using std::string;
@@ -80,6 +91,35 @@ using FitsLiberator::Engine::ImageReader;
 using FitsLiberator::Engine::ImageCube;
 using FitsLiberator::Engine::FitsImageReader;
 using FitsLiberator::Engine::FitsImageCube;
+using FitsLiberator::Engine::FitsHduIndex;
+using FitsLiberator::Engine::FitsHeader;
+using FitsLiberator::Engine::FitsTileDecoder;
+using FitsLiberator::Engine::GzipIndex;
+using FitsLiberator::Engine::StagingCache;
+
+// fitsio2.h cannot be included from C++, so the raw read function is 
+// declared here. ffmbyt is declared in fitsio.h.
+extern "C" int ffgbyt(fitsfile* fptr, LONGLONG nbytes, void* buffer, int* status);
+
+/** Maximum number of pixels read per call when a null map is requested. Bounds
+    the size of the temporary byte-per-pixel null array CFITSIO writes into. */
+static const ImageCube::size_type maxNullChunk = 1 << 20;
+
+/** Returns whether CFITSIO takes a file name appended to a driver prefix 
+    literally. Its extended file name syntax has no escapes, so names with 
+    a ( or [, a trailing +n or blank, or an .imh extension are opened 
+    directly instead of through a driver. */
+static bool IsPlainFileName(const string& filename) {
+    if( filename.empty() || filename.find_first_of("([") != string::npos || 
+        filename.find(".imh") != string::npos || filename[filename.size() - 1] == ' ' )
+        return false;
+
+    string::size_type plus = filename.rfind('+');
+    if( plus != string::npos && plus > 0 && filename.size() - plus < 7 &&
+        filename.find_first_not_of("0123456789", plus + 1) == string::npos )
+        return false;
+    return true;
+}
 
 FitsImageReaderException::FitsImageReaderException(fitsfile *fileHandle, 
 												   int status)
@@ -89,54 +129,66 @@ FitsImageReaderException::FitsImageReaderException(fitsfile *fileHandle,
 }
 
 FitsImageReader::FitsImageReader(const string& filename)
-  : super(filename) {
+  : super(filename), scanFile(-1) {
 	
     int status = 0;
 
-    int nAxis;
-    long nAxes[4];
-    int bitDepth;
-
-    int hduCount;
-    int hduType;
-
-    if( fits_open_diskfile(&fileHandle, filename.c_str(), READONLY, &status) )
-        throw ImageReaderException(filename);
+    // Files on slow file systems are read from their local copy once it has
+    // been staged, and through the staging driver while it is being made.
+    string path = StagingCache::Lookup(filename);
+
+    // Gzip-compressed files are read through an index instead of being 
+    // inflated into memory by CFITSIO.
+    fileHandle = NULL;
+    if( IsPlainFileName(path) && GzipIndex::IsGzip(path) && GzipIndex::RegisterDriver() ) {
+        string url = string(GzipIndex::Prefix) + path;
+        if( fits_open_file(&fileHandle, url.c_str(), READONLY, &status) ) {
+            fileHandle = NULL;
+            status = 0;
+        }
+    }
 
-    // Get the number of HDUs in the file
-    if( fits_get_num_hdus(fileHandle, &hduCount, &status) )
-        throw FitsImageReaderException(fileHandle, status);
+    if( NULL == fileHandle && IsPlainFileName(filename) && StagingCache::IsStaging(filename) && 
+        StagingCache::RegisterDriver() ) {
+        string url = string(StagingCache::Prefix) + filename;
+        if( fits_open_file(&fileHandle, url.c_str(), READONLY, &status) ) {
+            fileHandle = NULL;
+            status = 0;
+        }
+    }
 
-    for( unsigned int i = 1; i <= hduCount; i++ ) {
-        hduType = ANY_HDU;
-        if( fits_movabs_hdu(fileHandle, i, &hduType, &status) )
-			throw FitsImageReaderException(fileHandle, status);
+    if( NULL == fileHandle ) {
+        if( fits_open_diskfile(&fileHandle, path.c_str(), READONLY, &status) )
+            throw ImageReaderException(filename);
+        diskFile = path;
+    }
 
-        if( IMAGE_HDU == hduType && !fits_get_img_dim(fileHandle, &nAxis, &status) ) {
-            // Make sure we don't do an address violation.
-            if( nAxis <= 4 ) {
-                // Get the size of the image
-                if( fits_get_img_size(fileHandle, 4, nAxes, &status) )
-                    throw FitsImageReaderException(fileHandle, status);
-
-                // Only accept images with NAXIS < 4 or the special case NAXIS = 4 and NAXIS4 = 1
-                if( nAxis > 1 && ((nAxis == 4 && nAxes[3] == 1) || nAxis < 4) ) {
-                    // Get the bit depth, using this method we don't have to check the 
-                    // values of BSCALE & BZERO
-                    if( fits_get_img_equivtype(fileHandle, &bitDepth, &status) )
-                        throw FitsImageReaderException(fileHandle, status);
-                    
-                    insert(new FitsImageCube(i, nAxis, nAxes, bitDepth, this));
-                }
-            }
+    // The HDUs are enumerated from the raw header blocks. CFITSIO only 
+    // parses the header of an HDU once an image in it is read; keywords are
+    // looked up in the keyword table each image keeps.
+    FitsHduIndex index(fileHandle);
+    for( FitsHduIndex::const_iterator i = index.begin(); i != index.end(); ++i ) {
+        // Only accept images with NAXIS < 4 or the special case NAXIS = 4 and NAXIS4 = 1
+        if( i->image && i->nAxis > 1 && ((i->nAxis == 4 && i->nAxes[3] == 1) || i->nAxis < 4) ) {
+            long nAxes[4] = {i->nAxes[0], i->nAxes[1], i->nAxes[2], i->nAxes[3]};
+            insert(new FitsImageCube(i->number, i->nAxis, nAxes, i->bitDepth, 
+                FitsHeader(i->header), this));
         }
     }
 }
 
 FitsImageReader::~FitsImageReader() {
+	std::map<unsigned int, FitsTileDecoder*>::iterator i;
+	for( i = decoders.begin(); i != decoders.end(); ++i )
+		delete i->second;
+
 	int status = 0;
 	if( NULL != fileHandle )
 		fits_close_file(fileHandle, &status);
+#ifndef WINDOWS
+	if( scanFile >= 0 )
+		close(scanFile);
+#endif
 }
 
 void
@@ -182,75 +234,91 @@ FitsImageReader::Map(ImageCube::PixelFormat format) {
 void
 FitsImageReader::Read(const FitsImageCube* image, ImageCube::size_type plane, 
 					  const Rectangle& bounds, void* buffer) {
-    if(bounds.getArea() == image->PixelsPerPlane()) {
+    bool anyNulls = false;
+    if(Decode(image, plane, bounds, buffer, NULL, &anyNulls)) {
+        return;
+    } else if(bounds.getArea() == image->PixelsPerPlane()) {
         Read(image, plane, buffer);
     } else {
         assert(buffer != 0);
         assert(plane < image->Planes());
         assert(bounds.left >= 0 && bounds.top >= 0 
-            && bounds.right <= image->Width() && bounds.bottom <= image->Height());
+            && bounds.right <= (Int)image->Width() && bounds.bottom <= (Int)image->Height());
 
         long first[4] = {bounds.left + 1, bounds.top + 1, plane + 1, 1};
         long last[4]  = {bounds.right, bounds.bottom, plane + 1, 1};
 	    int dataType  = Map(image->Format());
-        long inc      = 0;
+        long inc[4]   = {1, 1, 1, 1};
         int status    = 0;
 
 	    SelectHDU(image);
-        if( fits_read_subset(fileHandle, dataType, first, last, &inc, 
+        if( fits_read_subset(fileHandle, dataType, first, last, inc, 
             NULL, buffer, NULL, &status) )
 		    throw FitsImageReaderException(fileHandle, status);
+        Advise(image, plane, bounds);
     }
 }
 
-void 
+bool 
 FitsImageReader::Read(const FitsImageCube* image, ImageCube::size_type plane, 
-					  const Rectangle& bounds, void* buffer, char* valid) {
-    if( bounds.getArea() == image->PixelsPerPlane() ) {
-        Read(image, plane, buffer, valid);
-    } else {
-        assert(buffer != 0);
-        assert(valid != 0);
-        assert(plane < image->Planes());
-        assert(bounds.left >= 0 && bounds.top >= 0 
-            && bounds.right <= image->Width() && bounds.bottom <= image->Height());
+					  const Rectangle& bounds, void* buffer, unsigned char* nullMap) {
+    assert(buffer != 0);
+    assert(nullMap != 0);
+    assert(plane < image->Planes());
+    assert(bounds.left >= 0 && bounds.top >= 0 
+        && bounds.right <= (Int)image->Width() && bounds.bottom <= (Int)image->Height());
+
+    // Integer images without a BLANK keyword cannot contain null pixels, so
+    // there is no need to have CFITSIO produce a null array.
+    if( !MayContainNulls(image) ) {
+        Read(image, plane, bounds, buffer);
+        return false;
+    }
 
+	bool anyNulls  = false;
+	if( Decode(image, plane, bounds, buffer, nullMap, &anyNulls) )
+		return anyNulls;
 
-	    int dataType   = Map(image->Format());
-	    int anyNull    = 0;
+	int dataType   = Map(image->Format());
+	int anyNull    = 0;
+	int status     = 0;
 
-	    int status     = 0;
+	// If the bounds span the entire width of the image several rows can be 
+	// read in one go, otherwise we have to read one row at a time.
+	ImageCube::size_type width = bounds.getWidth();
+	ImageCube::size_type rowsPerRead = 1;
+	if( image->Width() == width ) {
+		rowsPerRead = std::max<ImageCube::size_type>(1, maxNullChunk / width);
+	}
 
-	    int increment  = 0;
-		long long n = 0;
-		//if the asked for width is equal to the image's width then
-		//we use the height of the bounds as increment
-		if ( image->Width() == bounds.getWidth() )
-		{
-			increment = image->SizeOf( bounds.getWidth(), bounds.getHeight() );
-			n = bounds.getArea();
-		}
-		else
-		{
-			increment = image->SizeOf(bounds.getWidth(), 1);
-			n = bounds.getWidth();
-		}
-	    char* begin    = reinterpret_cast<char*>(buffer);
-	    char* end      = begin + image->SizeOf(bounds.getWidth(), bounds.getHeight());
+	// CFITSIO produces one byte per pixel, which is packed into the null map.
+	std::vector<char> nulls(width * std::min<ImageCube::size_type>(rowsPerRead, bounds.getHeight()));
 
-            
+	char* begin = reinterpret_cast<char*>(buffer);
+	ImageCube::size_type offset = 0;
 
-	    SelectHDU(image);
+	SelectHDU(image);
 
-	    long topLeft[4] = {bounds.left + 1, bounds.top + 1, plane + 1, 1};
-        while(begin != end) {
-            if( fits_read_pixnull(fileHandle, dataType, topLeft, n, begin, valid, &anyNull, &status) )
-                throw FitsImageReaderException(fileHandle, status);
-            begin      += increment;
-            valid      += n;
-            topLeft[1] += 1;
-        }
-    }
+	long topLeft[4] = {bounds.left + 1, bounds.top + 1, plane + 1, 1};
+	while( topLeft[1] <= bounds.bottom ) {
+		ImageCube::size_type rows = std::min<ImageCube::size_type>(rowsPerRead, bounds.bottom - topLeft[1] + 1);
+		ImageCube::size_type n    = width * rows;
+
+		if( fits_read_pixnull(fileHandle, dataType, topLeft, n, begin, &nulls[0], &anyNull, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+		if( anyNull ) {
+			if( !anyNulls ) {
+				std::fill(nullMap, nullMap + ImageCube::NullMapSize(bounds.getArea()), 0);
+				anyNulls = true;
+			}
+			ImageCube::PackNullMap(&nulls[0], n, nullMap, offset);
+		}
+		begin      += image->SizeOf(width, rows);
+		offset     += n;
+		topLeft[1] += rows;
+	}
+	Advise(image, plane, bounds);
+	return anyNulls;
 }
 
 void 
@@ -259,6 +327,11 @@ FitsImageReader::Read(const FitsImageCube* image, ImageCube::size_type plane,
 	assert(buffer != 0);
     assert(plane < image->Planes());
 
+	bool anyNulls = false;
+	if( Decode(image, plane, Rectangle(0, 0, image->Width(), image->Height()), 
+		buffer, NULL, &anyNulls) )
+		return;
+
 	long topLeft[4] = {1, 1, plane+1, 1};
 	long long maxPixels  = image->Width() * image->Height();
 	
@@ -270,26 +343,138 @@ FitsImageReader::Read(const FitsImageCube* image, ImageCube::size_type plane,
 	SelectHDU(image);
 	if( fits_read_pix(fileHandle, dataType, topLeft, maxPixels, 0, buffer, &anyNull, &status) )
 		throw FitsImageReaderException(fileHandle, status);	
+	Advise(image, plane, Rectangle(0, 0, image->Width(), image->Height()));
 }
 
-void 
+bool 
 FitsImageReader::Read(const FitsImageCube* image, ImageCube::size_type plane, 
-					  void* buffer, char* valid) {
+					  void* buffer, unsigned char* nullMap) {
+	return Read(image, plane, Rectangle(0, 0, image->Width(), image->Height()), 
+		buffer, nullMap);
+}
+
+void
+FitsImageReader::ReadEncoded(const FitsImageCube* image, ImageCube::size_type plane, 
+							 const Rectangle& bounds, void* buffer) {
 	assert(buffer != 0);
-    assert(valid != 0);
-    assert(plane < image->Planes());
+	assert(plane < image->Planes());
+	assert(bounds.left >= 0 && bounds.top >= 0 
+		&& bounds.right <= (Int)image->Width() && bounds.bottom <= (Int)image->Height());
 
-	long topLeft[4] = {1, 1, plane+1, 1};
-	long long maxPixels  = image->Width() * image->Height();
-	
-	int dataType   = Map(image->Format());
-	int anyNull;
-	
-	int status     = 0;
+	ImageCube::Encoding encoding;
+	if( !image->Encoded(&encoding) )
+		throw ImageReaderException(fileHandle->Fptr->filename);
 
+	LONGLONG headStart, dataStart, dataEnd;
+	int status = 0;
 	SelectHDU(image);
-	if( fits_read_pixnull(fileHandle, dataType, topLeft, maxPixels, buffer, valid, &anyNull, &status) )
+	if( fits_get_hduaddrll(fileHandle, &headStart, &dataStart, &dataEnd, &status) )
 		throw FitsImageReaderException(fileHandle, status);
+
+	LONGLONG sampleBytes = ImageCube::SizeOf(encoding.format, 1, 1);
+	LONGLONG rowBytes    = sampleBytes * image->Width();
+	LONGLONG first       = dataStart + rowBytes * ((LONGLONG)plane * image->Height() + bounds.top)
+		+ sampleBytes * bounds.left;
+
+	// Rows spanning the full width are one range of the file, which CFITSIO
+	// reads directly into the buffer when it is large.
+	char* begin = reinterpret_cast<char*>(buffer);
+	if( bounds.getWidth() == image->Width() ) {
+		if( ffmbyt(fileHandle, first, 0, &status)
+			|| ffgbyt(fileHandle, rowBytes * bounds.getHeight(), begin, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+	} else {
+		LONGLONG width = sampleBytes * bounds.getWidth();
+		for( Int y = bounds.top; y < bounds.bottom; y++, first += rowBytes, begin += width ) {
+			if( ffmbyt(fileHandle, first, 0, &status)
+				|| ffgbyt(fileHandle, width, begin, &status) )
+				throw FitsImageReaderException(fileHandle, status);
+		}
+	}
+	Advise(image, plane, bounds);
+}
+
+void
+FitsImageReader::Access(ImageCube::AccessPattern pattern) {
+#ifndef WINDOWS
+	// CFITSIO reads through its own stream, so the hints are given for the
+	// file's pages through a descriptor of our own. Files read through the
+	// gzip and staging drivers are not advised.
+	if( pattern == ImageCube::SequentialAccess ) {
+		if( scanFile < 0 && !diskFile.empty() )
+			scanFile = open(diskFile.c_str(), O_RDONLY);
+	} else if( scanFile >= 0 ) {
+		close(scanFile);
+		scanFile = -1;
+	}
+#endif
+}
+
+void
+FitsImageReader::Advise(const FitsImageCube* image, ImageCube::size_type plane, 
+						const Rectangle& bounds) {
+#if !defined(WINDOWS) && defined(POSIX_FADV_DONTNEED)
+	// Only whole rows of uncompressed images are one range of the file.
+	if( scanFile < 0 || bounds.getWidth() != image->Width() || Decoder(image) != NULL )
+		return;
+
+	LONGLONG headStart, dataStart, dataEnd;
+	int bitPix;
+	int status = 0;
+	SelectHDU(image);
+	if( fits_get_hduaddrll(fileHandle, &headStart, &dataStart, &dataEnd, &status)
+		|| fits_get_img_type(fileHandle, &bitPix, &status) )
+		return;
+
+	const off_t page = (off_t)sysconf(_SC_PAGESIZE);
+	off_t rowBytes = (off_t)image->Width() * (bitPix < 0 ? -bitPix : bitPix) / 8;
+	off_t begin    = (off_t)dataStart + ((off_t)plane * image->Height() + bounds.top) * rowBytes;
+	off_t end      = begin + (off_t)bounds.getHeight() * rowBytes;
+
+	// Drop the rows that have been read and read ahead as many rows.
+	off_t first = begin & ~(page - 1);
+	off_t last  = end & ~(page - 1);
+	if( last > first )
+		posix_fadvise(scanFile, first, last - first, POSIX_FADV_DONTNEED);
+	off_t ahead = std::min<off_t>((off_t)dataEnd, end + (end - begin));
+	if( ahead > last )
+		posix_fadvise(scanFile, last, ahead - last, POSIX_FADV_WILLNEED);
+#endif
+}
+
+bool
+FitsImageReader::MayContainNulls(const FitsImageCube* image) const {
+	if( !image->NeedsNullMap() )
+		return false;
+	// Compressed images may define the null value as ZBLANK.
+	const FitsTileDecoder* decoder = Decoder(image);
+	if( decoder != NULL )
+		return decoder->HasBlank();
+	return image->Property("BLANK").size() != 0;
+}
+
+const FitsTileDecoder*
+FitsImageReader::Decoder(const FitsImageCube* image) const {
+	// Decoders are set up on first use, since that requires CFITSIO to parse
+	// the header and locate the columns of the compressed image.
+	std::map<unsigned int, FitsTileDecoder*>::const_iterator i = decoders.find(image->Index());
+	if( i != decoders.end() )
+		return i->second;
+	SelectHDU(image);
+	FitsTileDecoder* decoder = FitsTileDecoder::FromHDU(fileHandle, image);
+	decoders[image->Index()] = decoder;
+	return decoder;
+}
+
+bool
+FitsImageReader::Decode(const FitsImageCube* image, ImageCube::size_type plane, 
+						const Rectangle& bounds, void* buffer, unsigned char* nullMap, bool* anyNulls) {
+	const FitsTileDecoder* decoder = Decoder(image);
+	if( decoder == NULL )
+		return false;
+
+	SelectHDU(image);
+	return decoder->Read(fileHandle, plane, bounds, buffer, nullMap, anyNulls);
 }
 
 bool
@@ -321,43 +506,18 @@ FitsImageReader::CanRead(const string& filename) {
     int status = 0;
     fitsfile* handle = 0;
 
+    // Only look at the first header card of gzip-compressed files, opening 
+    // them with CFITSIO would inflate the whole file.
+    char card[6];
+    if( GzipIndex::Peek(filename, card, sizeof(card)) )
+        return 0 == memcmp(card, "SIMPLE", sizeof(card));
+
     if(fits_open_diskfile(&handle, filename.c_str(), READONLY, &status))
         return false;   // cfitsio returns 1 on failure
+    fits_close_file(handle, &status);
     return true;
 }
 
-string
-FitsImageReader::Property(const FitsImageCube* image, const string& name) const {
-	string header;
-
-	int status = 0;
-	char value[81] = {0};
-
-	SelectHDU(image);
-	if(VALUE_UNDEFINED != fits_read_key(fileHandle, TSTRING, const_cast<char*>(name.c_str()), value, NULL, &status)) {
-		header = value;
-	}
-
-	return header;
-}
-
-void
-FitsImageReader::Properties(const FitsImageCube* image, ostream& stream, const string& prefix) const {
-	int          status		 = 0;
-	int          recordCount = 0;
-	char         record[81]	 = {0};
-
-	SelectHDU(image);
-	if(fits_get_hdrspace(fileHandle, &recordCount, NULL, &status))
-		throw FitsImageReaderException(fileHandle, status);
-
-	for(int i = 1; i <= recordCount; ++i) {
-		if(fits_read_record(fileHandle, i, record, &status))
-			throw FitsImageReaderException(fileHandle, status);
-		stream << prefix << record << newline;
-	}
-}
-
 void
 FitsImageReader::header(std::ostream& stream) const {
     int image = 1;
@@ -60,16 +60,20 @@
 //-----------------------------------------------------------------------------
 
 #include "FitsStatisticsTools.h"
+#include "Instrumentation.h"
 #include "Environment.h"
 #include "Stretch.h"
 #include "FitsMath.h"
+#include "StretchTable.h"
+#include "Parallelism.h"
 
 #ifdef USE_TBB
     #include <limits>
+    #include <algorithm>
 
     #include <tbb/parallel_reduce.h>
     #include <tbb/blocked_range.h>
-    #include <tbb/task_scheduler_init.h>
+    #include <tbb/partitioner.h>
 
     using namespace std;
     using namespace tbb;
@@ -97,6 +101,8 @@ inline bool valid(double value) {
 Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
 								    Double* min, Double* max, Double* mean_acc )
 {
+	ScopedTimer timer( stageRange );
+	Instrumentation::add( counterPixelsAnalyzed, nPixels );
 	
     
 	for ( Int i = 0; i < nPixels; i++ )
@@ -139,6 +145,7 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
         }
 
         void operator()(const tbb::blocked_range<size_t>& r) {
+            BusyTimer busy;
             double _min = minimum, _max = maximum, _sum = sum;
             size_t _count = count;
 
@@ -170,11 +177,18 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
         Double* pixels, Int nPixels, UInt* pixelCnt,
         Double* min, Double* max, Double* mean_acc, Int /*nCpus*/ )
     {
+        ScopedTimer timer(stageRange);
+        Instrumentation::add(counterPixelsAnalyzed, nPixels);
 
         ImageRange range(pixels, *min, *max);
 
-        tbb::task_scheduler_init init;//(nCpus);
-        tbb::parallel_reduce(tbb::blocked_range<size_t>(0, nPixels), range);
+        if( Parallelism::Worth(nPixels, Parallelism::costCompare) ) {
+            Parallelism::Initialize();
+            tbb::parallel_reduce(tbb::blocked_range<size_t>(0, nPixels, Parallelism::Grain(Parallelism::costCompare)), 
+                range, tbb::auto_partitioner());
+        }
+        else
+            range(tbb::blocked_range<size_t>(0, nPixels));
 
         *min      = range.minimum;
         *max      = range.maximum;
@@ -187,14 +201,19 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
         Double* pixels, Int nPixels, UInt* pixelCnt,
         Double* min, Double* max, Double* mean_acc, Int nCpus )
     {
+        ScopedTimer timer(stageRange);
+        Instrumentation::add(counterPixelsAnalyzed, nPixels);
+
 	    Double min_int = *min;
 	    Double max_int = *max;
 	    Double mean_acc_int = 0;
 	    UInt pixelCnt_int = 0;
 
         #ifdef USE_OPENMP	
-            #pragma omp parallel num_threads( nCpus ) firstprivate(min_int,max_int,mean_acc_int,pixelCnt_int)
+            #pragma omp parallel num_threads( nCpus ) firstprivate(min_int,max_int,mean_acc_int,pixelCnt_int) \
+                if( Parallelism::Worth(nPixels, Parallelism::costCompare) )
 	            {
+                BusyTimer busy;
             #pragma omp for
         #endif // USE_OPENMP
 	    for ( Int i = 0; i < nPixels; i++ )
@@ -260,6 +279,7 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
         }
         
         void operator()(const tbb::blocked_range<size_t>& r) {
+            BusyTimer busy;
             for(size_t i = r.begin(); i != r.end(); ++i) {
                 double value = pixels[i];
                 if(valid(value)) {
@@ -287,10 +307,20 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
         Double* pixels, Int length, Double* stdev, Double mean, 
         Double min, Double invBinSize, Vector<Double>& histogram, Int /*nCpus*/)
     {	
+        ScopedTimer timer(stageHistogram);
+        Instrumentation::add(counterPixelsAnalyzed, length);
+
         Histogram f(pixels, min, mean, invBinSize, histogram.size());
         
-        tbb::task_scheduler_init init;//(nCpus);
-        tbb::parallel_reduce(tbb::blocked_range<size_t>(0, length), f);
+        if( Parallelism::Worth(length, Parallelism::costRoot) ) {
+            // Every task has a histogram of its own to fill and join
+            size_t grain = std::max(Parallelism::Grain(Parallelism::costRoot), 4 * histogram.size());
+
+            Parallelism::Initialize();
+            tbb::parallel_reduce(tbb::blocked_range<size_t>(0, length, grain), f, tbb::auto_partitioner());
+        }
+        else
+            f(tbb::blocked_range<size_t>(0, length));
         
         for(vector<double>::size_type i = 0; i < histogram.size(); ++i) {
             histogram[i] = f.histogram[i];
@@ -303,13 +333,18 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
         Double* pixels, Int length, Double* stdev, Double mean, 
 		Double min, Double invBinSize, Vector<Double>& histogram, Int nCpus)
     {	
+        ScopedTimer timer(stageHistogram);
+        Instrumentation::add(counterPixelsAnalyzed, length);
+
 	    const Vector<Double>::size_type size = histogram.size();
 	    Double stdev_int = 0;
 		
 
         #ifdef USE_OPENMP
-            #pragma omp parallel num_threads( nCpus ) firstprivate( stdev_int )
+            #pragma omp parallel num_threads( nCpus ) firstprivate( stdev_int ) \
+                if( Parallelism::Worth(length, Parallelism::costRoot) )
 	        {
+				BusyTimer busy;
 				Double* hist_tmp = new Double[size];
 				for ( Int i = 0; i < size; i++ )
 					hist_tmp[i] = 0.;
@@ -355,6 +390,9 @@ Void FitsStatisticsTools::getRange( Double* pixels, Int nPixels, UInt* pixelCnt,
 Void FitsStatisticsTools::getHistogram( Double* pixels, Int length, Double* stdev, Double mean, 
 									   Double min, Double invBinSize, Vector<Double>& histogram )
 {	
+	ScopedTimer timer( stageHistogram );
+	Instrumentation::add( counterPixelsAnalyzed, length );
+
 	for ( Int i = 0; i < length; i++)
 	{		 			
 		if ( pixels[i] != FitsMath::NaN && FitsMath::isFinite( pixels[i] ) )		
@@ -367,9 +405,81 @@ Void FitsStatisticsTools::getHistogram( Double* pixels, Int length, Double* stde
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Statistics of pixels stretched through a StretchTable
+//-----------------------------------------------------------------------------
+
+Void FitsStatisticsTools::countSamples( const Void* pixels, UInt sampleBytes, UInt nPixels,
+									   const Byte* nullMap, Vector<UInt>& counts )
+{
+	ScopedTimer timer( stageRange );
+	Instrumentation::add( counterPixelsAnalyzed, nPixels );
+
+	if ( nullMap != NULL )
+	{
+		for ( UInt i = 0; i < nPixels; i++ )
+		{
+			if ( !ImageCube::IsNull( nullMap, i ) )
+				counts[StretchTable::Index( pixels, sampleBytes, i )]++;
+		}
+	}
+	else if ( sampleBytes == 1 )
+	{
+		const Byte* samples = (const Byte*)pixels;
+		for ( UInt i = 0; i < nPixels; i++ )
+			counts[samples[i]]++;
+	}
+	else
+	{
+		const UShort* samples = (const UShort*)pixels;
+		for ( UInt i = 0; i < nPixels; i++ )
+			counts[samples[i]]++;
+	}
+}
+
+Void FitsStatisticsTools::getRange( const Vector<UInt>& counts, const Double* table, UInt* pixelCnt,
+								   Double* min, Double* max, Double* mean_acc )
+{
+	ScopedTimer timer( stageRange );
+
+	for ( UInt i = 0; i < counts.size(); i++ )
+	{
+		if ( counts[i] != 0 && valid( table[i] ) )
+		{
+			if ( table[i] > *max )
+				*max = table[i];
+
+			if ( table[i] < *min )
+				*min = table[i];
+
+			*mean_acc += counts[i] * table[i];
+			*pixelCnt += counts[i];
+		}
+	}
+}
+
+Void FitsStatisticsTools::getHistogram( const Vector<UInt>& counts, const Double* table, Double* stdev,
+									   Double mean, Double min, Double invBinSize, Vector<Double>& histogram )
+{
+	ScopedTimer timer( stageHistogram );
+
+	for ( UInt i = 0; i < counts.size(); i++ )
+	{
+		if ( counts[i] != 0 && valid( table[i] ) )
+		{
+			*stdev += counts[i] * (mean - table[i]) * (mean - table[i]);
+
+			Int binIndex = (Int)FitsMath::round( invBinSize * (table[i] - min) );
+			histogram[binIndex] += counts[i];
+		}
+	}
+}
+
 Void FitsStatisticsTools::scaleHistogram( Vector<Double>& histogram, Double* median, Double min,
 				Double max, Double* maxBinCount, UInt pixelCount )
 {
+	ScopedTimer timer( stageHistogram );
+
 // Calculate median while scaling the histogram
     *maxBinCount = 0.;
     Double medianCount = 0.;
@@ -0,0 +1,689 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file implements the class Engine::FitsTileDecoder. */
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <zlib.h>
+
+#include "FitsTileDecoder.hpp"
+#include "FitsImageReader.hpp"
+#include "Instrumentation.h"
+#include "Parallelism.h"
+
+#ifdef USE_TBB
+	#include <tbb/parallel_for.h>
+	#include <tbb/blocked_range.h>
+#endif
+
+#ifdef USE_OPENMP
+	#include <omp.h>
+#endif
+
+using std::string;
+using std::vector;
+
+using FitsLiberator::Rectangle;
+using FitsLiberator::Engine::ImageCube;
+using FitsLiberator::Engine::FitsImageCube;
+using FitsLiberator::Engine::FitsTileDecoder;
+using FitsLiberator::Engine::FitsImageReaderException;
+using FitsLiberator::Engine::BusyTimer;
+
+struct FitsTileDecoder::Tile {
+	long				row;		///< Row of the tile in the binary table.
+	size_type			left;		///< Position and size of the tile.
+	size_type			top;
+	size_type			firstPlane;
+	size_type			width;
+	size_type			height;
+	size_type			depth;
+	double				scale;		///< Scaling of quantized pixels.
+	double				zero;
+	int					blank;		///< Value of null pixels.
+	vector<unsigned char> data;		///< Compressed bytes.
+	vector<size_type>	nulls;		///< Null pixels found, as offsets into the requested block.
+	bool				decoded;
+};
+
+//-----------------------------------------------------------------------------
+// Helper functions
+//-----------------------------------------------------------------------------
+
+namespace {
+	/** Number of significant bits in a byte, i.e. the position of the 
+		highest set bit plus one. */
+	const int bitLength[256] = {
+		0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8
+	};
+
+	/** Quantized pixels with this value are null. */
+	const int nullValue = -2147483647;
+	/** Quantized pixels with this value are exactly zero (SUBTRACTIVE_DITHER_2). */
+	const int zeroValue = -2147483646;
+
+	/** The sequence of random numbers used for subtractive dithering. It 
+		must match the one fpack used exactly. */
+	const int randomCount = 10000;
+	float randomValues[randomCount];
+	bool randomInitialized = false;
+
+	void InitRandoms() {
+		if( randomInitialized )
+			return;
+
+		double a = 16807.0;
+		double m = 2147483647.0;
+		double seed = 1.0;
+		for( int i = 0; i < randomCount; ++i ) {
+			double temp = a * seed;
+			seed = temp - m * (int)(temp / m);
+			randomValues[i] = (float)(seed / m);
+		}
+		randomInitialized = true;
+	}
+
+	/** Reads a keyword without leaving an error status behind if it is missing.
+		@return True if the keyword was found. */
+	bool ReadKey(fitsfile* fileHandle, int dataType, const char* name, void* value) {
+		int status = 0;
+		fits_read_key(fileHandle, dataType, const_cast<char*>(name), value, NULL, &status);
+		return status == 0;
+	}
+
+	/** Looks up a column by name.
+		@return The column number or 0 if the column does not exist. */
+	int FindColumn(fitsfile* fileHandle, const char* name) {
+		int status = 0;
+		int column = 0;
+		if( fits_get_colnum(fileHandle, CASEINSEN, const_cast<char*>(name), &column, &status) ) {
+			fits_clear_errmsg();
+			return 0;
+		}
+		return column;
+	}
+}
+
+#ifdef USE_TBB
+	/** Decodes a range of tiles on a TBB worker thread. */
+	struct FitsTileDecoder::DecodeBody {
+		const FitsTileDecoder*	decoder;
+		vector<Tile>*			tiles;
+		size_type				plane;
+		const Rectangle*		bounds;
+		void*					buffer;
+		bool					reportNulls;
+
+		void operator()(const tbb::blocked_range<size_t>& range) const {
+			for(size_t i = range.begin(); i != range.end(); ++i) {
+				Tile& tile = (*tiles)[i];
+				tile.decoded = decoder->DecodeTile(tile, plane, *bounds, buffer, reportNulls);
+			}
+		}
+	};
+#endif
+
+//-----------------------------------------------------------------------------
+// FitsTileDecoder
+//-----------------------------------------------------------------------------
+
+FitsTileDecoder::FitsTileDecoder()
+  : image(0), compression(Rice), quantization(NotQuantized), blockSize(32), 
+	bytePix(4), ditherSeed(1), dataColumn(0), scaleColumn(0), zeroColumn(0),
+	blankColumn(0), scale(1.0), zero(0.0), hasBlank(false), blank(0) {
+}
+
+FitsTileDecoder*
+FitsTileDecoder::FromHDU(fitsfile* fileHandle, const FitsImageCube* image) {
+	int status = 0;
+	if( !fits_is_compressed_image(fileHandle, &status) )
+		return 0;
+
+	FitsTileDecoder decoder;
+	decoder.image = image;
+
+	char value[FLEN_VALUE] = {0};
+	if( !ReadKey(fileHandle, TSTRING, "ZCMPTYPE", value) )
+		return 0;
+	string type(value);
+	if( type == "RICE_1" || type == "RICE_ONE" )
+		decoder.compression = Rice;
+	else if( type == "GZIP_1" )
+		decoder.compression = Gzip;
+	else
+		return 0;
+
+	int bitPix = 0;
+	if( !ReadKey(fileHandle, TINT, "ZBITPIX", &bitPix) )
+		return 0;
+	if( bitPix != BYTE_IMG && bitPix != SHORT_IMG && bitPix != LONG_IMG &&
+		bitPix != FLOAT_IMG && bitPix != DOUBLE_IMG )
+		return 0;
+
+	// Compression parameters, given as ZNAMEn = ZVALn pairs.
+	for( int i = 1; ; ++i ) {
+		char name[FLEN_KEYWORD];
+		sprintf(name, "ZNAME%d", i);
+		if( !ReadKey(fileHandle, TSTRING, name, value) )
+			break;
+		sprintf(name, "ZVAL%d", i);
+		if( string(value) == "BLOCKSIZE" )
+			ReadKey(fileHandle, TINT, name, &decoder.blockSize);
+		else if( string(value) == "BYTEPIX" )
+			ReadKey(fileHandle, TINT, name, &decoder.bytePix);
+	}
+	if( decoder.compression == Rice && decoder.bytePix != 1 && 
+		decoder.bytePix != 2 && decoder.bytePix != 4 )
+		return 0;
+	if( decoder.blockSize < 1 )
+		return 0;
+
+	// Tile geometry, by default each row is a tile.
+	size_type size[3] = {image->Width(), image->Height(), image->Planes()};
+	for( int i = 0; i < 3; ++i ) {
+		char name[FLEN_KEYWORD];
+		long tile = (i == 0) ? size[0] : 1;
+		sprintf(name, "ZTILE%d", i + 1);
+		ReadKey(fileHandle, TLONG, name, &tile);
+		if( tile < 1 )
+			return 0;
+		decoder.tileSize[i]  = std::min<size_type>(tile, size[i]);
+		decoder.tileCount[i] = (size[i] + decoder.tileSize[i] - 1) / decoder.tileSize[i];
+	}
+
+	decoder.dataColumn = FindColumn(fileHandle, "COMPRESSED_DATA");
+	if( decoder.dataColumn == 0 )
+		return 0;
+
+	if( bitPix < 0 ) {
+		// Floating point images are only supported when quantized, in which
+		// case the tiles contain integers that are scaled back.
+		decoder.scaleColumn = FindColumn(fileHandle, "ZSCALE");
+		decoder.zeroColumn  = FindColumn(fileHandle, "ZZERO");
+		bool scaleKey = ReadKey(fileHandle, TDOUBLE, "ZSCALE", &decoder.scale);
+		bool zeroKey  = ReadKey(fileHandle, TDOUBLE, "ZZERO", &decoder.zero);
+		if( !(decoder.scaleColumn || scaleKey) || !(decoder.zeroColumn || zeroKey) )
+			return 0;
+
+		decoder.quantization = NoDither;
+		if( ReadKey(fileHandle, TSTRING, "ZQUANTIZ", value) ) {
+			if( string(value) == "SUBTRACTIVE_DITHER_1" )
+				decoder.quantization = SubtractiveDither1;
+			else if( string(value) == "SUBTRACTIVE_DITHER_2" )
+				decoder.quantization = SubtractiveDither2;
+			else if( string(value) != "NO_DITHER" )
+				return 0;
+		}
+		if( decoder.quantization != NoDither ) {
+			ReadKey(fileHandle, TINT, "ZDITHER0", &decoder.ditherSeed);
+			InitRandoms();
+		}
+
+		decoder.blank = nullValue;
+		decoder.blankColumn = FindColumn(fileHandle, "ZBLANK");
+		decoder.hasBlank = decoder.blankColumn != 0 || ReadKey(fileHandle, TINT, "ZBLANK", &decoder.blank);
+	} else {
+		ReadKey(fileHandle, TDOUBLE, "BSCALE", &decoder.scale);
+		ReadKey(fileHandle, TDOUBLE, "BZERO", &decoder.zero);
+
+		decoder.blankColumn = FindColumn(fileHandle, "ZBLANK");
+		decoder.hasBlank = decoder.blankColumn != 0 || 
+			ReadKey(fileHandle, TINT, "ZBLANK", &decoder.blank) ||
+			ReadKey(fileHandle, TINT, "BLANK", &decoder.blank);
+	}
+
+	return new FitsTileDecoder(decoder);
+}
+
+bool
+FitsTileDecoder::HasBlank() const {
+	return hasBlank;
+}
+
+bool
+FitsTileDecoder::Read(fitsfile* fileHandle, size_type plane, const Rectangle& bounds,
+					  void* buffer, unsigned char* nullMap, bool* anyNulls) const {
+	assert(buffer != 0 && anyNulls != 0);
+	assert(plane < image->Planes());
+	assert(bounds.left >= 0 && bounds.top >= 0 
+		&& bounds.right <= image->Width() && bounds.bottom <= image->Height());
+
+	*anyNulls = false;
+	if( bounds.getArea() == 0 )
+		return true;
+
+	// Find the tiles overlapping the requested block.
+	size_type firstX = bounds.left / tileSize[0];
+	size_type lastX  = (bounds.right - 1) / tileSize[0];
+	size_type firstY = bounds.top / tileSize[1];
+	size_type lastY  = (bounds.bottom - 1) / tileSize[1];
+	size_type z      = plane / tileSize[2];
+
+	vector<Tile> tiles((lastX - firstX + 1) * (lastY - firstY + 1));
+	vector<Tile>::iterator tile = tiles.begin();
+	for( size_type y = firstY; y <= lastY; ++y ) {
+		for( size_type x = firstX; x <= lastX; ++x, ++tile ) {
+			tile->row        = 1 + x + tileCount[0] * (y + tileCount[1] * z);
+			tile->left       = x * tileSize[0];
+			tile->top        = y * tileSize[1];
+			tile->firstPlane = z * tileSize[2];
+			tile->width      = std::min(tileSize[0], image->Width() - tile->left);
+			tile->height     = std::min(tileSize[1], image->Height() - tile->top);
+			tile->depth      = std::min(tileSize[2], image->Planes() - tile->firstPlane);
+			tile->scale      = scale;
+			tile->zero       = zero;
+			tile->blank      = blank;
+			tile->decoded    = false;
+		}
+	}
+
+	// CFITSIO is not thread safe, so the compressed bytes are fetched 
+	// sequentially.
+	int status = 0;
+	for( tile = tiles.begin(); tile != tiles.end(); ++tile ) {
+		long length = 0;
+		long offset = 0;
+		if( fits_read_descript(fileHandle, dataColumn, tile->row, &length, &offset, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+		// Tiles that could not be compressed are stored elsewhere in the 
+		// table; leave those to CFITSIO.
+		if( length == 0 )
+			return false;
+
+		tile->data.resize(length);
+		if( fits_read_col(fileHandle, TBYTE, dataColumn, tile->row, 1, length, 
+			NULL, &tile->data[0], NULL, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+		if( scaleColumn != 0 && fits_read_col(fileHandle, TDOUBLE, scaleColumn, 
+			tile->row, 1, 1, NULL, &tile->scale, NULL, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+		if( zeroColumn != 0 && fits_read_col(fileHandle, TDOUBLE, zeroColumn, 
+			tile->row, 1, 1, NULL, &tile->zero, NULL, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+		if( blankColumn != 0 && fits_read_col(fileHandle, TINT, blankColumn, 
+			tile->row, 1, 1, NULL, &tile->blank, NULL, &status) )
+			throw FitsImageReaderException(fileHandle, status);
+	}
+
+	// The tiles cover disjoint parts of the output, so they can be decoded
+	// concurrently. Null pixels are collected per tile and merged afterwards
+	// since neighbouring tiles share bytes in the bit-packed null map.
+	bool reportNulls = (nullMap != 0);
+#ifdef USE_TBB
+	DecodeBody body;
+	body.decoder     = this;
+	body.tiles       = &tiles;
+	body.plane       = plane;
+	body.bounds      = &bounds;
+	body.buffer      = buffer;
+	body.reportNulls = reportNulls;
+
+	Parallelism::Initialize();
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.size(), 1), body);
+#else
+	int count = (int)tiles.size();
+	#ifdef USE_OPENMP
+	#pragma omp parallel for num_threads( omp_get_num_procs() ) schedule( dynamic )
+	#endif
+	for( int i = 0; i < count; ++i ) {
+		tiles[i].decoded = DecodeTile(tiles[i], plane, bounds, buffer, reportNulls);
+	}
+#endif
+
+	for( tile = tiles.begin(); tile != tiles.end(); ++tile ) {
+		if( !tile->decoded )
+			return false;
+	}
+
+	if( reportNulls ) {
+		for( tile = tiles.begin(); tile != tiles.end(); ++tile ) {
+			for( vector<size_type>::const_iterator i = tile->nulls.begin(); i != tile->nulls.end(); ++i ) {
+				if( !*anyNulls ) {
+					std::fill(nullMap, nullMap + ImageCube::NullMapSize(bounds.getArea()), 0);
+					*anyNulls = true;
+				}
+				nullMap[*i >> 3] |= (unsigned char)(1 << (*i & 7));
+			}
+		}
+	}
+	return true;
+}
+
+bool
+FitsTileDecoder::DecodeTile(Tile& tile, size_type plane, const Rectangle& bounds,
+							void* buffer, bool reportNulls) const {
+	BusyTimer busy;
+	size_type count = tile.width * tile.height * tile.depth;
+	vector<int> pixels(count);
+
+	bool decoded = false;
+	if( compression == Rice )
+		decoded = RiceDecode(&tile.data[0], tile.data.size(), &pixels[0], count, blockSize, bytePix);
+	else
+		decoded = GzipDecode(&tile.data[0], tile.data.size(), &pixels[0], count);
+	if( !decoded )
+		return false;
+
+	// The compressed bytes are no longer needed.
+	vector<unsigned char>().swap(tile.data);
+
+	switch( image->Format() ) {
+		case ImageCube::Float64:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<double*>(buffer), reportNulls);
+			break;
+		case ImageCube::Float32:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<float*>(buffer), reportNulls);
+			break;
+		case ImageCube::Unsigned8:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<unsigned char*>(buffer), reportNulls);
+			break;
+		case ImageCube::Signed8:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<signed char*>(buffer), reportNulls);
+			break;
+		case ImageCube::Signed16:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<short*>(buffer), reportNulls);
+			break;
+		case ImageCube::Unsigned16:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<unsigned short*>(buffer), reportNulls);
+			break;
+		case ImageCube::Signed32:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<int*>(buffer), reportNulls);
+			break;
+		case ImageCube::Unsigned32:
+			Store(tile, &pixels[0], plane, bounds, reinterpret_cast<unsigned int*>(buffer), reportNulls);
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+template<typename T>
+void
+FitsTileDecoder::Store(Tile& tile, const int* pixels, size_type plane,
+					   const Rectangle& bounds, T* buffer, bool reportNulls) const {
+	const bool isInteger = std::numeric_limits<T>::is_integer;
+	const T    nan       = isInteger ? T(0) : std::numeric_limits<T>::quiet_NaN();
+
+	// Part of the tile overlapping the requested block.
+	size_type left   = std::max<size_type>(tile.left, bounds.left);
+	size_type right  = std::min<size_type>(tile.left + tile.width, bounds.right);
+	size_type top    = std::max<size_type>(tile.top, bounds.top);
+	size_type bottom = std::min<size_type>(tile.top + tile.height, bounds.bottom);
+	size_type stride = bounds.getWidth();
+
+	size_type planeOffset = (plane - tile.firstPlane) * tile.width * tile.height;
+
+	if( quantization == NotQuantized ) {
+		bool scaled = (tile.scale != 1.0 || tile.zero != 0.0);
+		for( size_type y = top; y < bottom; ++y ) {
+			const int* src = pixels + planeOffset + (y - tile.top) * tile.width + (left - tile.left);
+			size_type  out = (y - bounds.top) * stride + (left - bounds.left);
+			for( size_type x = left; x < right; ++x, ++src, ++out ) {
+				int raw = *src;
+				if( hasBlank && raw == tile.blank ) {
+					if( !isInteger ) {
+						buffer[out] = nan;
+						continue;
+					}
+					if( reportNulls )
+						tile.nulls.push_back(out);
+				}
+				buffer[out] = scaled ? (T)(raw * tile.scale + tile.zero) : (T)raw;
+			}
+		}
+	} else {
+		// The dither sequence runs through the entire tile, so it has to be
+		// advanced over the pixels outside the requested block as well.
+		int seed = (int)((tile.row + ditherSeed - 2) % randomCount);
+		int next = (int)(randomValues[seed] * 500.0f);
+
+		const int* src = pixels;
+		for( size_type p = 0; p < tile.depth; ++p ) {
+			for( size_type y = 0; y < tile.height; ++y ) {
+				bool rowInside = (tile.firstPlane + p == plane) && 
+					(tile.top + y >= top) && (tile.top + y < bottom);
+				for( size_type x = 0; x < tile.width; ++x, ++src ) {
+					size_type column = tile.left + x;
+					if( rowInside && column >= left && column < right ) {
+						size_type out = (tile.top + y - bounds.top) * stride + (column - bounds.left);
+						int raw = *src;
+						if( hasBlank && raw == tile.blank )
+							buffer[out] = nan;
+						else if( quantization == SubtractiveDither2 && raw == zeroValue )
+							buffer[out] = T(0);
+						else if( quantization == NoDither )
+							buffer[out] = (T)(raw * tile.scale + tile.zero);
+						else
+							buffer[out] = (T)(((double)raw - randomValues[next] + 0.5) * tile.scale + tile.zero);
+					}
+					if( quantization != NoDither && ++next == randomCount ) {
+						if( ++seed == randomCount )
+							seed = 0;
+						next = (int)(randomValues[seed] * 500.0f);
+					}
+				}
+			}
+		}
+	}
+}
+
+bool
+FitsTileDecoder::RiceDecode(const unsigned char* input, size_type length,
+							int* output, size_type count, int blockSize, int bytePix) {
+	// Number of bits used to store the split position, the split position 
+	// flagging uncompressed blocks and the number of bits per pixel.
+	int fsBits, fsMax;
+	switch( bytePix ) {
+		case 1:  fsBits = 3; fsMax = 6;  break;
+		case 2:  fsBits = 4; fsMax = 14; break;
+		case 4:  fsBits = 5; fsMax = 25; break;
+		default: return false;
+	}
+	int bBits = 1 << fsBits;
+	unsigned int mask = (bytePix == 4) ? 0xffffffffu : ((1u << (8 * bytePix)) - 1);
+
+	const unsigned char* c   = input;
+	const unsigned char* end = input + length;
+	if( length < (size_type)bytePix + 1 )
+		return false;
+
+	// The first pixel is stored verbatim.
+	unsigned int lastPix = 0;
+	for( int i = 0; i < bytePix; ++i )
+		lastPix = (lastPix << 8) | *c++;
+
+	unsigned int b = *c++;
+	int nBits = 8;
+
+	for( size_type i = 0; i < count; ) {
+		// Split position for this block.
+		nBits -= fsBits;
+		while( nBits < 0 ) {
+			if( c >= end ) return false;
+			b = (b << 8) | *c++;
+			nBits += 8;
+		}
+		int fs = (int)(b >> nBits) - 1;
+		b &= (1u << nBits) - 1;
+
+		size_type iMax = std::min<size_type>(i + blockSize, count);
+		if( fs < 0 ) {
+			// Constant block.
+			for( ; i < iMax; ++i )
+				output[i] = lastPix;
+		} else if( fs == fsMax ) {
+			// Uncompressed block, bBits per difference.
+			for( ; i < iMax; ++i ) {
+				int k = bBits - nBits;
+				unsigned int diff = (k < 32) ? (b << k) : 0;
+				for( k -= 8; k >= 0; k -= 8 ) {
+					if( c >= end ) return false;
+					diff |= (unsigned int)(*c++) << k;
+				}
+				if( nBits > 0 ) {
+					if( c >= end ) return false;
+					b = *c++;
+					diff |= b >> (-k);
+					b &= (1u << nBits) - 1;
+				} else {
+					b = 0;
+				}
+				diff = ((diff & 1) == 0) ? (diff >> 1) : ~(diff >> 1);
+				lastPix = (diff + lastPix) & mask;
+				output[i] = lastPix;
+			}
+		} else {
+			// Rice coded differences.
+			for( ; i < iMax; ++i ) {
+				while( b == 0 ) {
+					if( c >= end ) return false;
+					nBits += 8;
+					b = *c++;
+				}
+				int nZero = nBits - bitLength[b];
+				nBits -= nZero + 1;
+				b ^= 1u << nBits;
+				nBits -= fs;
+				while( nBits < 0 ) {
+					if( c >= end ) return false;
+					b = (b << 8) | *c++;
+					nBits += 8;
+				}
+				unsigned int diff = ((unsigned int)nZero << fs) | (b >> nBits);
+				b &= (1u << nBits) - 1;
+				diff = ((diff & 1) == 0) ? (diff >> 1) : ~(diff >> 1);
+				lastPix = (diff + lastPix) & mask;
+				output[i] = lastPix;
+			}
+		}
+	}
+
+	// Sign extend 16-bit pixels; 8-bit FITS pixels are unsigned.
+	if( bytePix == 2 ) {
+		for( size_type i = 0; i < count; ++i )
+			output[i] = (short)output[i];
+	}
+	return true;
+}
+
+bool
+FitsTileDecoder::GzipDecode(const unsigned char* input, size_type length,
+							int* output, size_type count) {
+	// The pixels are stored big-endian, using 1, 2 or 4 bytes per pixel 
+	// depending on the version of CFITSIO that wrote the file. Inflate into
+	// the output buffer and expand in place.
+	unsigned char* bytes = reinterpret_cast<unsigned char*>(output);
+	size_type capacity = count * sizeof(int);
+
+	z_stream stream;
+	stream.zalloc    = Z_NULL;
+	stream.zfree     = Z_NULL;
+	stream.opaque    = Z_NULL;
+	stream.next_in   = const_cast<unsigned char*>(input);
+	stream.avail_in  = length;
+	stream.next_out  = bytes;
+	stream.avail_out = capacity;
+
+	// 15 + 32 accepts both gzip and zlib headers.
+	if( inflateInit2(&stream, 15 + 32) != Z_OK )
+		return false;
+	int result = inflate(&stream, Z_FINISH);
+	size_type produced = stream.total_out;
+	inflateEnd(&stream);
+	if( result != Z_STREAM_END || count == 0 || produced % count != 0 )
+		return false;
+
+	// Going backwards never overwrites bytes that are still to be read.
+	switch( produced / count ) {
+		case 1:
+			for( size_type i = count; i-- > 0; )
+				output[i] = bytes[i];
+			break;
+		case 2:
+			for( size_type i = count; i-- > 0; )
+				output[i] = (short)((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+			break;
+		case 4:
+			for( size_type i = 0; i < count; ++i ) {
+				const unsigned char* p = bytes + 4 * i;
+				output[i] = (int)(((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | 
+					((unsigned int)p[2] << 8) | p[3]);
+			}
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,681 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file implements the class Engine::GzipIndex. */
+
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+#include <fitsio.h>
+
+#include "GzipIndex.hpp"
+
+using std::string;
+using std::list;
+using std::vector;
+
+using FitsLiberator::Engine::GzipIndex;
+
+// fitsio2.h cannot be included from C++, so the driver registration 
+// function is declared here.
+extern "C" int fits_register_driver(char* prefix,
+	int (*init)(void),
+	int (*shutdown)(void),
+	int (*setoptions)(int option),
+	int (*getoptions)(int* options),
+	int (*getversion)(int* version),
+	int (*checkfile)(char* urltype, char* infile, char* outfile),
+	int (*open)(char* filename, int rwmode, int* driverhandle),
+	int (*create)(char* filename, int* driverhandle),
+	int (*truncate)(int driverhandle, LONGLONG filesize),
+	int (*close)(int driverhandle),
+	int (*fremove)(char* filename),
+	int (*size)(int driverhandle, LONGLONG* size),
+	int (*flush)(int driverhandle),
+	int (*seek)(int driverhandle, LONGLONG offset),
+	int (*read)(int driverhandle, void* buffer, long nbytes),
+	int (*write)(int driverhandle, void* buffer, long nbytes));
+
+const char GzipIndex::Prefix[] = "gzindex://";
+
+namespace {
+	/** Distance between access points in the uncompressed data. */
+	const Int64 spacing = 1 << 22;
+	/** Size of a deflate window. */
+	const size_t windowSize = 32768;
+	/** Size of the blocks kept in the block cache. */
+	const size_t blockSize = 1 << 16;
+	/** Number of blocks kept in the block cache. */
+	const size_t cacheBlocks = 32;
+	/** Size of the reads from the compressed file. */
+	const size_t chunkSize = 1 << 16;
+	/** Identifies the cache file format. */
+	const char cacheMagic[8] = { 'F', 'L', 'G', 'Z', 'I', 'D', 'X', '1' };
+	/** Written as a native integer to reject cache files from machines 
+		with a different byte order. */
+	const UInt32 byteOrderMark = 0x01020304;
+
+	string cacheDirectory;
+
+	int SeekFile(FILE* file, Int64 offset, int origin = SEEK_SET) {
+	#ifdef WINDOWS
+		return _fseeki64(file, offset, origin);
+	#else
+		return fseeko(file, (off_t)offset, origin);
+	#endif
+	}
+
+	Int64 TellFile(FILE* file) {
+	#ifdef WINDOWS
+		return _ftelli64(file);
+	#else
+		return ftello(file);
+	#endif
+	}
+
+	bool IsMember(FILE* file, Int64 offset) {
+		unsigned char magic[2];
+		return SeekFile(file, offset) == 0 
+			&& fread(magic, 1, 2, file) == 2 
+			&& magic[0] == 0x1f && magic[1] == 0x8b;
+	}
+
+	/** 64-bit FNV-1a hash, used to give cache files of equally named files
+		in different directories distinct names. */
+	UInt64 Hash(const string& text) {
+		UInt64 hash = 14695981039346656037ULL;
+		for( string::size_type i = 0; i < text.size(); i++ ) {
+			hash ^= (unsigned char)text[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	template<typename T>
+	bool ReadValue(FILE* file, T& value) {
+		return fread(&value, sizeof(T), 1, file) == 1;
+	}
+
+	template<typename T>
+	bool WriteValue(FILE* file, const T& value) {
+		return fwrite(&value, sizeof(T), 1, file) == 1;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CFITSIO driver
+//-----------------------------------------------------------------------------
+
+namespace {
+	/** Open file of the "gzindex://" driver. */
+	struct DriverHandle {
+		GzipIndex*	index;
+		Int64		position;
+	};
+
+	vector<DriverHandle> handles;
+	boost::mutex handleLock;
+	bool driverRegistered = false;
+	bool driverAttempted = false;
+
+	int DriverInit() {
+		return 0;
+	}
+
+	int DriverShutdown() {
+		return 0;
+	}
+
+	int DriverSetOptions(int) {
+		return 0;
+	}
+
+	int DriverGetOptions(int* options) {
+		*options = 0;
+		return 0;
+	}
+
+	int DriverGetVersion(int* version) {
+		*version = 10;
+		return 0;
+	}
+
+	int DriverOpen(char* filename, int rwmode, int* handle) {
+		if( rwmode != READONLY )
+			return READONLY_FILE;
+
+		GzipIndex* index = GzipIndex::Open(filename);
+		if( index == NULL )
+			return FILE_NOT_OPENED;
+
+		boost::mutex::scoped_lock guard(handleLock);
+		DriverHandle entry = { index, 0 };
+		for( size_t i = 0; i < handles.size(); i++ ) {
+			if( handles[i].index == NULL ) {
+				handles[i] = entry;
+				*handle = (int)i;
+				return 0;
+			}
+		}
+		handles.push_back(entry);
+		*handle = (int)handles.size() - 1;
+		return 0;
+	}
+
+	int DriverClose(int handle) {
+		boost::mutex::scoped_lock guard(handleLock);
+		delete handles[handle].index;
+		handles[handle].index = NULL;
+		return 0;
+	}
+
+	int DriverSize(int handle, LONGLONG* size) {
+		boost::mutex::scoped_lock guard(handleLock);
+		*size = handles[handle].index->Size();
+		return 0;
+	}
+
+	int DriverFlush(int) {
+		return 0;
+	}
+
+	int DriverSeek(int handle, LONGLONG offset) {
+		boost::mutex::scoped_lock guard(handleLock);
+		handles[handle].position = offset;
+		return 0;
+	}
+
+	int DriverRead(int handle, void* buffer, long nbytes) {
+		GzipIndex* index;
+		Int64 position;
+		{
+			boost::mutex::scoped_lock guard(handleLock);
+			index = handles[handle].index;
+			position = handles[handle].position;
+		}
+		if( !index->Read(position, buffer, nbytes) )
+			return position >= index->Size() ? END_OF_FILE : READ_ERROR;
+
+		boost::mutex::scoped_lock guard(handleLock);
+		handles[handle].position = position + nbytes;
+		return 0;
+	}
+}
+
+bool
+GzipIndex::RegisterDriver() {
+	boost::mutex::scoped_lock guard(handleLock);
+	if( !driverAttempted ) {
+		driverAttempted = true;
+		driverRegistered = 0 == fits_register_driver(const_cast<char*>(Prefix),
+			DriverInit, DriverShutdown, DriverSetOptions, DriverGetOptions,
+			DriverGetVersion, NULL, DriverOpen, NULL, NULL, DriverClose, 
+			NULL, DriverSize, DriverFlush, DriverSeek, DriverRead, NULL);
+	}
+	return driverRegistered;
+}
+
+//-----------------------------------------------------------------------------
+// GzipIndex
+//-----------------------------------------------------------------------------
+
+bool
+GzipIndex::IsGzip(const string& filename) {
+	FILE* file = fopen(filename.c_str(), "rb");
+	if( file == NULL )
+		return false;
+	bool result = IsMember(file, 0);
+	fclose(file);
+	return result;
+}
+
+bool
+GzipIndex::Peek(const string& filename, void* buffer, size_t length) {
+	if( !IsGzip(filename) )
+		return false;
+
+	gzFile file = gzopen(filename.c_str(), "rb");
+	if( file == NULL )
+		return false;
+	int count = gzread(file, buffer, (unsigned)length);
+	gzclose(file);
+	return count == (int)length;
+}
+
+GzipIndex*
+GzipIndex::Open(const string& filename) {
+	FILE* file = fopen(filename.c_str(), "rb");
+	if( file == NULL )
+		return NULL;
+
+	GzipIndex* index = new GzipIndex(filename, file);
+	string path = index->CachePath();
+	if( path.empty() || !index->Load(path) ) {
+		if( !index->Build() ) {
+			delete index;
+			return NULL;
+		}
+		if( !path.empty() )
+			index->Save(path);
+	}
+	return index;
+}
+
+void
+GzipIndex::SetCacheDirectory(const string& directory) {
+	cacheDirectory = directory;
+}
+
+GzipIndex::GzipIndex(const string& filename, FILE* file)
+  : filename(filename), file(file), compressedSize(0), modified(0), size(0),
+	streamReady(false), rawStream(true), cursor(0), inputPosition(0), 
+	input(chunkSize), scratch(blockSize) {
+
+	if( SeekFile(file, 0, SEEK_END) == 0 )
+		compressedSize = TellFile(file);
+
+	struct stat status;
+	if( stat(filename.c_str(), &status) == 0 )
+		modified = (Int64)status.st_mtime;
+
+	memset(&stream, 0, sizeof(stream));
+	inflateInit2(&stream, -15);
+}
+
+GzipIndex::~GzipIndex() {
+	inflateEnd(&stream);
+	fclose(file);
+}
+
+Int64
+GzipIndex::Size() const {
+	return size;
+}
+
+bool
+GzipIndex::Build() {
+	z_stream build;
+	memset(&build, 0, sizeof(build));
+	// 15 + 32 accepts zlib and gzip headers.
+	if( inflateInit2(&build, 15 + 32) != Z_OK )
+		return false;
+
+	vector<unsigned char> chunk(chunkSize);
+	vector<unsigned char> window(windowSize, 0);
+	Int64 totalIn  = 0;
+	Int64 totalOut = 0;
+	Int64 last     = 0;
+	int   ret      = Z_OK;
+
+	points.clear();
+	windows.clear();
+	SeekFile(file, 0);
+
+	while( true ) {
+		if( build.avail_in == 0 ) {
+			size_t count = fread(&chunk[0], 1, chunk.size(), file);
+			if( count == 0 ) {
+				ret = Z_DATA_ERROR;		// Truncated file.
+				break;
+			}
+			build.next_in  = &chunk[0];
+			build.avail_in = (uInt)count;
+		}
+		if( build.avail_out == 0 ) {
+			build.next_out  = &window[0];
+			build.avail_out = windowSize;
+		}
+
+		// Stop at the end of every deflate block to look for access points.
+		totalIn  += build.avail_in;
+		totalOut += build.avail_out;
+		ret = inflate(&build, Z_BLOCK);
+		totalIn  -= build.avail_in;
+		totalOut -= build.avail_out;
+
+		if( ret == Z_NEED_DICT )
+			ret = Z_DATA_ERROR;
+		if( ret == Z_MEM_ERROR || ret == Z_DATA_ERROR )
+			break;
+
+		if( ret == Z_STREAM_END ) {
+			// Concatenated gzip files decompress to the concatenated data.
+			if( !IsMember(file, totalIn) )
+				break;
+			SeekFile(file, totalIn);
+			build.avail_in = 0;
+			inflateReset(&build);
+			continue;
+		}
+
+		// Bit 7 of data_type marks the end of a block (or header) and bit 6
+		// the end of the last block, after which there is nothing to resume.
+		if( (build.data_type & 128) && !(build.data_type & 64) 
+			&& (totalOut == 0 || totalOut - last > spacing) ) {
+			Point point = { totalOut, totalIn, build.data_type & 7 };
+			points.push_back(point);
+
+			// Unroll the circular output window.
+			size_t left = build.avail_out;
+			size_t base = windows.size();
+			windows.resize(base + windowSize);
+			if( left > 0 )
+				memcpy(&windows[base], &window[windowSize - left], left);
+			if( left < windowSize )
+				memcpy(&windows[base + left], &window[0], windowSize - left);
+
+			last = totalOut;
+		}
+	}
+	inflateEnd(&build);
+
+	size = totalOut;
+	streamReady = false;
+	return ret == Z_STREAM_END && !points.empty();
+}
+
+string
+GzipIndex::CachePath() const {
+	if( cacheDirectory.empty() )
+		return string();
+
+	string::size_type separator = filename.find_last_of("/\\");
+	string name = (separator == string::npos) ? filename : filename.substr(separator + 1);
+
+	char hash[17];
+	sprintf(hash, "%016llx", (unsigned long long)Hash(filename));
+
+	string path = cacheDirectory;
+	char last = path[path.size() - 1];
+	if( last != '/' && last != '\\' ) {
+	#ifdef WINDOWS
+		path += '\\';
+	#else
+		path += '/';
+	#endif
+	}
+	return path + name + "." + hash + ".gzi";
+}
+
+bool
+GzipIndex::Load(const string& path) {
+	FILE* cache = fopen(path.c_str(), "rb");
+	if( cache == NULL )
+		return false;
+
+	char   magic[sizeof(cacheMagic)];
+	UInt32 mark;
+	Int64  cachedSize, cachedModified, dataSize;
+	UInt32 count;
+
+	bool valid = fread(magic, 1, sizeof(magic), cache) == sizeof(magic)
+		&& memcmp(magic, cacheMagic, sizeof(magic)) == 0
+		&& ReadValue(cache, mark) && mark == byteOrderMark
+		&& ReadValue(cache, cachedSize) && cachedSize == compressedSize
+		&& ReadValue(cache, cachedModified) && cachedModified == modified
+		&& ReadValue(cache, dataSize) 
+		&& ReadValue(cache, count) && count > 0;
+
+	if( valid ) {
+		points.resize(count);
+		for( UInt32 i = 0; valid && i < count; i++ ) {
+			Int32 bits;
+			valid = ReadValue(cache, points[i].out) 
+				&& ReadValue(cache, points[i].in) 
+				&& ReadValue(cache, bits);
+			points[i].bits = bits;
+		}
+	}
+	if( valid ) {
+		windows.resize(count * windowSize);
+		valid = fread(&windows[0], 1, windows.size(), cache) == windows.size();
+	}
+	fclose(cache);
+
+	if( valid ) {
+		size = dataSize;
+	} else {
+		points.clear();
+		windows.clear();
+	}
+	return valid;
+}
+
+void
+GzipIndex::Save(const string& path) const {
+	FILE* cache = fopen(path.c_str(), "wb");
+	if( cache == NULL )
+		return;
+
+	UInt32 count = (UInt32)points.size();
+	bool written = fwrite(cacheMagic, 1, sizeof(cacheMagic), cache) == sizeof(cacheMagic)
+		&& WriteValue(cache, byteOrderMark)
+		&& WriteValue(cache, compressedSize)
+		&& WriteValue(cache, modified)
+		&& WriteValue(cache, size)
+		&& WriteValue(cache, count);
+	for( UInt32 i = 0; written && i < count; i++ ) {
+		written = WriteValue(cache, points[i].out) 
+			&& WriteValue(cache, points[i].in) 
+			&& WriteValue(cache, (Int32)points[i].bits);
+	}
+	if( written )
+		written = fwrite(&windows[0], 1, windows.size(), cache) == windows.size();
+	fclose(cache);
+
+	// A partial index would fail to load anyway, but don't leave it around.
+	if( !written )
+		remove(path.c_str());
+}
+
+bool
+GzipIndex::Read(Int64 offset, void* buffer, size_t length) {
+	if( offset < 0 || offset + (Int64)length > size )
+		return false;
+
+	boost::mutex::scoped_lock guard(lock);
+	unsigned char* output = static_cast<unsigned char*>(buffer);
+	while( length > 0 ) {
+		const Block* block = Fetch(offset / blockSize);
+		size_t start = (size_t)(offset % blockSize);
+		if( block == NULL || start >= block->data.size() )
+			return false;
+
+		size_t count = std::min(length, block->data.size() - start);
+		memcpy(output, &block->data[start], count);
+		output += count;
+		offset += count;
+		length -= count;
+	}
+	return true;
+}
+
+const GzipIndex::Block*
+GzipIndex::Fetch(Int64 index) {
+	for( list<Block>::iterator i = blocks.begin(); i != blocks.end(); ++i ) {
+		if( i->index == index ) {
+			blocks.splice(blocks.begin(), blocks, i);
+			return &blocks.front();
+		}
+	}
+
+	// Reuse the least recently used block once the cache is full.
+	if( blocks.size() < cacheBlocks )
+		blocks.push_front(Block());
+	else
+		blocks.splice(blocks.begin(), blocks, --blocks.end());
+
+	Block& block = blocks.front();
+	block.index = -1;
+	block.data.resize(blockSize);
+
+	long count = -1;
+	if( Position(index * blockSize) )
+		count = Inflate(&block.data[0], blockSize);
+	if( count < 0 ) {
+		streamReady = false;
+		blocks.pop_front();
+		return NULL;
+	}
+	block.index = index;
+	block.data.resize(count);
+	return &block;
+}
+
+bool
+GzipIndex::Position(Int64 offset) {
+	if( points.empty() )
+		return false;
+
+	// Find the last access point at or before the offset.
+	size_t low  = 0;
+	size_t high = points.size();
+	while( high - low > 1 ) {
+		size_t middle = (low + high) / 2;
+		if( points[middle].out <= offset )
+			low = middle;
+		else
+			high = middle;
+	}
+
+	if( !streamReady || cursor > offset || points[low].out > cursor ) {
+		if( !Restart(low) )
+			return false;
+	}
+
+	while( cursor < offset ) {
+		size_t count = (size_t)std::min<Int64>(offset - cursor, scratch.size());
+		if( Inflate(&scratch[0], count) != (long)count )
+			return false;
+	}
+	return true;
+}
+
+bool
+GzipIndex::Restart(size_t index) {
+	const Point& point = points[index];
+
+	streamReady = false;
+	if( inflateReset2(&stream, -15) != Z_OK )
+		return false;
+
+	// A point may start in the middle of a byte, in which case the 
+	// remaining bits of that byte are primed into the inflater.
+	Int64 start = point.in - (point.bits ? 1 : 0);
+	if( SeekFile(file, start) != 0 )
+		return false;
+	inputPosition   = start;
+	stream.avail_in = 0;
+
+	if( point.bits ) {
+		int value = getc(file);
+		if( value == EOF )
+			return false;
+		inputPosition += 1;
+		inflatePrime(&stream, point.bits, value >> (8 - point.bits));
+	}
+	inflateSetDictionary(&stream, &windows[index * windowSize], windowSize);
+
+	rawStream   = true;
+	cursor      = point.out;
+	streamReady = true;
+	return true;
+}
+
+long
+GzipIndex::Inflate(unsigned char* output, size_t length) {
+	stream.next_out  = output;
+	stream.avail_out = (uInt)length;
+
+	while( stream.avail_out > 0 ) {
+		if( stream.avail_in == 0 ) {
+			size_t count = fread(&input[0], 1, input.size(), file);
+			if( count == 0 )
+				break;
+			inputPosition   += count;
+			stream.next_in   = &input[0];
+			stream.avail_in  = (uInt)count;
+		}
+
+		int ret = inflate(&stream, Z_NO_FLUSH);
+		if( ret == Z_STREAM_END ) {
+			if( !NextMember() )
+				break;
+		}
+		else if( ret != Z_OK )
+			return -1;
+	}
+
+	long count = (long)(length - stream.avail_out);
+	cursor += count;
+	return count;
+}
+
+bool
+GzipIndex::NextMember() {
+	// Raw inflation stops in front of the 8 byte gzip trailer, whereas 
+	// gzip inflation consumes it.
+	Int64 next = inputPosition - stream.avail_in + (rawStream ? 8 : 0);
+	if( !IsMember(file, next) ) {
+		SeekFile(file, inputPosition);
+		return false;
+	}
+
+	SeekFile(file, next);
+	inputPosition   = next;
+	stream.avail_in = 0;
+	rawStream       = false;
+	return inflateReset2(&stream, 15 + 16) == Z_OK;
+}
@@ -65,6 +65,7 @@
 
 #include "ImageCube.hpp"
 #include "TextUtils.h"
+#include "Exception.h"
 
 using std::string;
 
@@ -157,13 +158,47 @@ ImageCube::SizeOf(ImageCube::PixelFormat format,
 	}
 }
 
+ImageCube::size_type
+ImageCube::NullMapSize(ImageCube::size_type pixels) {
+	return (pixels + 7) >> 3;
+}
 
+void
+ImageCube::PackNullMap(const char* nulls, ImageCube::size_type count,
+					   unsigned char* nullMap, ImageCube::size_type offset) {
+	for(ImageCube::size_type i = 0; i < count; i++) {
+		if(nulls[i] != 0) {
+			ImageCube::size_type bit = offset + i;
+			nullMap[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+		}
+	}
+}
 
 ImageReader*
 ImageCube::Owner() const {
 	return this->owner;
 }
 
+void
+ImageCube::StorageBlock(size_type* width, size_type* height) const {
+	*width  = Width();
+	*height = 1;
+}
+
+void
+ImageCube::Access(AccessPattern) const {
+}
+
+bool
+ImageCube::Encoded(Encoding*) const {
+	return false;
+}
+
+void
+ImageCube::ReadEncoded(ImageCube::size_type, const FitsLiberator::Rectangle&, void*) const {
+	throw FitsLiberator::Exception("Image cannot be read in its stored encoding");
+}
+
 bool
 ImageCube::NumericProperty(const string& name, double *out) const {
 	if(out != 0) {
@@ -54,6 +54,8 @@
 
 #include "ImageReader.hpp"
 #include "FitsImageReader.hpp"
+#include "Pds4ImageReader.hpp"
+// Included after TinyXML since the PDS library defines a Parent macro.
 #include "PdsImageReader.hpp"
 
 using std::string;
@@ -63,6 +65,7 @@ using FitsLiberator::Engine::ImageReaderException;
 using FitsLiberator::Engine::ImageReader;
 using FitsLiberator::Engine::FitsImageReader;
 using FitsLiberator::Engine::PdsImageReader;
+using FitsLiberator::Engine::Pds4ImageReader;
 
 using FitsLiberator::Engine::ImageCube;
 
@@ -94,6 +97,25 @@ ImageReader::FromFile(const string& filename) {
 		catch(Exception) {}
     }
 
+    // PDS4 labels are recognised before handing the file to the PDS label
+    // parser.
+    if(Pds4ImageReader::CanRead(filename)) {
+        try {
+		    reader = new Pds4ImageReader(filename);
+		    if( reader->size() > 0 )
+			    return reader;
+			else
+				return 0;
+    	} catch(ImageReaderException)
+		{
+			return 0;
+		}
+		catch(Exception)
+		{
+			return 0;
+		}
+    }
+
     if(PdsImageReader::CanRead(filename)) {
         try {
 		    reader = new PdsImageReader(filename);
@@ -118,6 +140,8 @@ Bool ImageReader::IsSupported( const string& filename )
 {
 	if ( FitsImageReader::CanRead(filename) )
 		return true;
+	else if ( Pds4ImageReader::CanRead( filename ) )
+		return true;
 	else if ( PdsImageReader::CanRead( filename ) )
 		return true;
 
@@ -51,6 +51,7 @@
 //
 // =============================================================================
 #include "ImageTile.h"
+#include "ImageCube.hpp"
 
 using namespace FitsLiberator::Engine;
 
@@ -65,6 +66,8 @@ ImageTile::ImageTile()
 	rawPixels = NULL;
 	stretchedPixels = NULL;
 	nullPixels = NULL;
+	hasNulls = false;
+	encoded = false;
 
 	locked = false;
 	stretched = false;
@@ -88,7 +91,7 @@ Bool operator==( const ImageTile& lhs, const ImageTile& rhs )
 
 Bool ImageTile::isAllocated()
 {
-	if ( rawPixels != NULL && stretchedPixels != NULL && nullPixels != NULL )
+	if ( rawPixels != NULL && stretchedPixels != NULL )
 		return true;
 
 	return false;
@@ -106,6 +109,8 @@ Void ImageTile::deallocatePixels()
 		rawPixels = NULL;
 		stretchedPixels = NULL;
 		nullPixels = NULL;
+		hasNulls = false;
+		encoded = false;
 		stretched = false;
 		stretch.function = stretchNoStretch;
 
@@ -134,16 +139,21 @@ Bool ImageTile::isCurrent()
 	Tries to allocate the current set up pixels with the specified bit dept
 	If that is not possible it will return ImageTile::AllocErr and make sure that
 	the contained buffers are cleaned appropriately
+	@param bitDepth the number of bytes per raw pixel
+	@param nullMap true if a null map should be allocated as well, i.e. 
+	if ImageCube::NeedsNullMap is true for the image.
 */
-Int ImageTile::allocatePixels( Int bitDepth)
+Int ImageTile::allocatePixels( Int bitDepth, Bool nullMap )
 {
 	if ( isAllocated() == false && width > 0 && height > 0 && bitDepth > 0 )
 	{
 		try
 		{
 			rawPixels = (Void*)new Byte[width*height*bitDepth];
-			nullPixels = new char [width * height];
+			if ( nullMap )
+				nullPixels = new Byte [ImageCube::NullMapSize( width * height )];
 			stretchedPixels = new Double [width * height];
+			hasNulls = false;
 			
 		}
 		catch( std::bad_alloc ba )
@@ -166,6 +176,15 @@ Int ImageTile::allocatePixels( Int bitDepth)
 	return ImageTile::AllocOk;
 }
 
+/**
+	Returns the null map of the currently loaded pixels or NULL if
+	they contain no null pixels.
+*/
+Byte* ImageTile::getNullMap()
+{
+	return hasNulls ? nullPixels : NULL;
+}
+
 const Rectangle ImageTile::getBounds()
 {
 	bounds.left = x;
@@ -0,0 +1,402 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "Instrumentation.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#ifdef WINDOWS
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <mach/mach_time.h>
+#else
+	#include <time.h>
+#endif
+
+using namespace FitsLiberator::Engine;
+
+//-----------------------------------------------------------------------------
+// Global state
+//-----------------------------------------------------------------------------
+
+Bool Instrumentation::enabled = false;
+Bool TraceLog::enabled = false;
+
+namespace {
+	boost::mutex			lock;
+	InstrumentationSnapshot	current;
+	String					dumpFile;
+
+	/** Number of busy scopes entered on each thread. */
+	boost::thread_specific_ptr<UInt>	busyDepth;
+
+	/** A completed span in the trace. */
+	struct TraceEvent {
+		String		name;
+		const Char*	category;
+		Double		start;
+		Double		duration;
+		String		thread;
+	};
+
+	/** Upper bound on the number of spans kept in memory between flushes. */
+	const std::vector<TraceEvent>::size_type maxTraceEvents = 1000000;
+
+	boost::mutex				traceLock;
+	/** Serializes writes to the trace file, held without traceLock. */
+	boost::mutex				traceWriteLock;
+	std::vector<TraceEvent>		traceEvents;
+	String						traceFile;
+	Double						traceStart = 0.0;
+	/** Small integer ids of the threads written to the trace so far. */
+	std::map<String, Int>		traceThreads;
+
+	const Char* stageNames[stageCount] = {
+		"read", "stretch", "scale", "range", "histogram", "preview", "export"
+	};
+
+	const Char* counterNames[counterCount] = {
+		"bytesRead", "tilesLoaded", "tilesEvicted", "pixelsStretched",
+		"pixelsScaled", "pixelsAnalyzed", "tilesResampled", "bytesWritten"
+	};
+
+	/** Writes a string as a JSON string literal. */
+	Void writeString( std::ostream& stream, const String& value ) {
+		stream << '"';
+		for( String::size_type i = 0; i < value.size(); i++ ) {
+			Char c = value[i];
+			if( c == '"' || c == '\\' )
+				stream << '\\';
+			stream << c;
+		}
+		stream << '"';
+	}
+}
+
+//-----------------------------------------------------------------------------
+// InstrumentationSnapshot
+//-----------------------------------------------------------------------------
+
+InstrumentationSnapshot::InstrumentationSnapshot() {
+	std::fill( counters, counters + counterCount, 0 );
+	std::fill( stageTime, stageTime + stageCount, 0.0 );
+	std::fill( stageCalls, stageCalls + stageCount, 0 );
+}
+
+Void InstrumentationSnapshot::toJSON( std::ostream& stream ) const {
+	stream << "{\"counters\": {";
+	for( Int i = 0; i < counterCount; i++ ) {
+		stream << ( i ? ", " : "" ) << '"' 
+			<< Instrumentation::counterName( (InstrumentationCounter)i ) 
+			<< "\": " << counters[i];
+	}
+	stream << "}, \"stages\": {";
+	for( Int i = 0; i < stageCount; i++ ) {
+		stream << ( i ? ", " : "" ) << '"' 
+			<< Instrumentation::stageName( (InstrumentationStage)i ) 
+			<< "\": {\"seconds\": " << stageTime[i] 
+			<< ", \"calls\": " << stageCalls[i] << "}";
+	}
+	stream << "}, \"threads\": {";
+	for( std::map<String, Double>::const_iterator it = threadBusy.begin(); 
+		it != threadBusy.end(); ++it ) {
+		if( it != threadBusy.begin() )
+			stream << ", ";
+		writeString( stream, it->first );
+		stream << ": " << it->second;
+	}
+	stream << "}}";
+}
+
+//-----------------------------------------------------------------------------
+// Instrumentation
+//-----------------------------------------------------------------------------
+
+Void Instrumentation::setEnabled( Bool e ) {
+	enabled = e;
+}
+
+Void Instrumentation::add( InstrumentationCounter counter, Int64 value ) {
+	if( enabled ) {
+		boost::mutex::scoped_lock guard( lock );
+		current.counters[counter] += value;
+	}
+}
+
+Void Instrumentation::addTime( InstrumentationStage stage, Double seconds ) {
+	if( enabled ) {
+		boost::mutex::scoped_lock guard( lock );
+		current.stageTime[stage] += seconds;
+		current.stageCalls[stage]++;
+	}
+}
+
+Bool Instrumentation::enterBusy() {
+	UInt* depth = busyDepth.get();
+	if( depth == NULL ) {
+		depth = new UInt( 0 );
+		busyDepth.reset( depth );
+	}
+	return ( (*depth)++ == 0 );
+}
+
+Void Instrumentation::leaveBusy( Bool outermost, Double seconds ) {
+	UInt* depth = busyDepth.get();
+	if( depth != NULL && *depth != 0 )
+		(*depth)--;
+
+	if( outermost && enabled ) {
+		String thread = threadId();
+		boost::mutex::scoped_lock guard( lock );
+		current.threadBusy[thread] += seconds;
+	}
+}
+
+InstrumentationSnapshot Instrumentation::snapshot() {
+	boost::mutex::scoped_lock guard( lock );
+	return current;
+}
+
+Void Instrumentation::reset() {
+	boost::mutex::scoped_lock guard( lock );
+	current = InstrumentationSnapshot();
+}
+
+Void Instrumentation::setDumpFile( const String& fileName ) {
+	{
+		boost::mutex::scoped_lock guard( lock );
+		dumpFile = fileName;
+	}
+	if( fileName.size() != 0 )
+		setEnabled( true );
+}
+
+Void Instrumentation::operationFinished( const String& operation ) {
+	if( !enabled )
+		return;
+
+	InstrumentationSnapshot copy;
+	String fileName;
+	{
+		boost::mutex::scoped_lock guard( lock );
+		copy = current;
+		fileName = dumpFile;
+		if( fileName.size() != 0 )
+			current = InstrumentationSnapshot();
+	}
+
+	if( fileName.size() != 0 ) {
+		// One JSON object per line, so the file can be appended to.
+		std::ofstream stream( fileName.c_str(), std::ios::app );
+		stream << "{\"operation\": ";
+		writeString( stream, operation );
+		stream << ", \"snapshot\": ";
+		copy.toJSON( stream );
+		stream << "}" << std::endl;
+	}
+}
+
+const Char* Instrumentation::stageName( InstrumentationStage stage ) {
+	return stageNames[stage];
+}
+
+const Char* Instrumentation::counterName( InstrumentationCounter counter ) {
+	return counterNames[counter];
+}
+
+Double Instrumentation::now() {
+#ifdef WINDOWS
+	LARGE_INTEGER count, frequency;
+	::QueryPerformanceCounter( &count );
+	::QueryPerformanceFrequency( &frequency );
+	return (Double)count.QuadPart / (Double)frequency.QuadPart;
+#elif defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	::mach_timebase_info( &timebase );
+	return (Double)::mach_absolute_time() * timebase.numer / timebase.denom * 1e-9;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+String Instrumentation::threadId() {
+	std::ostringstream s;
+	s << boost::this_thread::get_id();
+	return s.str();
+}
+
+//-----------------------------------------------------------------------------
+// BusyTimer
+//-----------------------------------------------------------------------------
+
+BusyTimer::BusyTimer() : counted( Instrumentation::isEnabled() ), outermost( false ), start( 0.0 ) {
+	if( counted ) {
+		outermost = Instrumentation::enterBusy();
+		if( outermost )
+			start = Instrumentation::now();
+	}
+}
+
+BusyTimer::~BusyTimer() {
+	if( counted )
+		Instrumentation::leaveBusy( outermost, outermost ? Instrumentation::now() - start : 0.0 );
+}
+
+//-----------------------------------------------------------------------------
+// ScopedTimer
+//-----------------------------------------------------------------------------
+
+ScopedTimer::ScopedTimer( InstrumentationStage s ) : stage( s ) {
+	start = ( Instrumentation::isEnabled() || TraceLog::isEnabled() ) ? Instrumentation::now() : 0.0;
+}
+
+ScopedTimer::~ScopedTimer() {
+	if( start != 0.0 ) {
+		Double end = Instrumentation::now();
+		Instrumentation::addTime( stage, end - start );
+		if( TraceLog::isEnabled() )
+			TraceLog::addSpan( Instrumentation::stageName( stage ), "kernel", start, end );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// TraceLog
+//-----------------------------------------------------------------------------
+
+Void TraceLog::setFile( const String& fileName ) {
+	boost::mutex::scoped_lock writeGuard( traceWriteLock );
+	boost::mutex::scoped_lock guard( traceLock );
+	traceFile = fileName;
+	traceEvents.clear();
+	traceThreads.clear();
+	traceStart = Instrumentation::now();
+	enabled = ( fileName.size() != 0 );
+	if( enabled ) {
+		std::ofstream stream( traceFile.c_str() );
+		stream << "[\n";
+	}
+}
+
+Void TraceLog::addSpan( const String& name, const Char* category, Double start, Double end ) {
+	if( !enabled )
+		return;
+
+	TraceEvent e;
+	e.name		= name;
+	e.category	= category;
+	e.start		= start;
+	e.duration	= end - start;
+	e.thread	= Instrumentation::threadId();
+
+	boost::mutex::scoped_lock guard( traceLock );
+	if( traceEvents.size() < maxTraceEvents )
+		traceEvents.push_back( e );
+}
+
+Void TraceLog::flush() {
+	if( !enabled )
+		return;
+
+	// Take the pending spans, so other threads can record new ones while
+	// the file is written.
+	std::vector<TraceEvent> events;
+	{
+		boost::mutex::scoped_lock guard( traceLock );
+		events.swap( traceEvents );
+	}
+	if( events.empty() )
+		return;
+
+	boost::mutex::scoped_lock guard( traceWriteLock );
+	std::ofstream stream( traceFile.c_str(), std::ios::app );
+	for( std::vector<TraceEvent>::size_type i = 0; i < events.size(); i++ ) {
+		const TraceEvent& e = events[i];
+		// Chrome wants small integer thread ids, so the thread names are 
+		// mapped to numbers in order of appearance and named when first seen.
+		std::map<String, Int>::iterator it = traceThreads.find( e.thread );
+		if( it == traceThreads.end() ) {
+			it = traceThreads.insert( std::make_pair( e.thread, (Int)traceThreads.size() + 1 ) ).first;
+			stream << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " 
+				<< it->second << ", \"args\": {\"name\": ";
+			writeString( stream, "thread " + it->first );
+			stream << "}},\n";
+		}
+
+		stream << "{\"name\": ";
+		writeString( stream, e.name );
+		stream << ", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"pid\": 1"
+			<< ", \"tid\": " << it->second
+			<< ", \"ts\": " << (Int64)( ( e.start - traceStart ) * 1e6 )
+			<< ", \"dur\": " << (Int64)( e.duration * 1e6 ) << "},\n";
+	}
+}
+
+//-----------------------------------------------------------------------------
+// TraceSpan
+//-----------------------------------------------------------------------------
+
+TraceSpan::TraceSpan( const Char* n, const Char* c ) : name( n ), category( c ) {
+	start = TraceLog::isEnabled() ? Instrumentation::now() : 0.0;
+}
+
+TraceSpan::~TraceSpan() {
+	if( start != 0.0 )
+		TraceLog::addSpan( name, category, start, Instrumentation::now() );
+}
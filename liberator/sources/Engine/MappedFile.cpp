@@ -0,0 +1,314 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+	Contains definitions for the wrapper layer above the 3rd party I/O 
+	libraries. This file implements the class Engine::MappedFile. */
+
+#ifdef WINDOWS
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#include <string.h>
+#include <algorithm>
+
+#include "MappedFile.hpp"
+
+using std::string;
+
+using FitsLiberator::Rectangle;
+using FitsLiberator::Engine::ArrayLayout;
+using FitsLiberator::Engine::MappedFile;
+
+namespace {
+	/** Alignment of the offsets, sizes and buffers of direct reads. */
+	const UInt64 directAlignment = 4096;
+
+	bool directIO = false;
+
+	/** Copies samples of N bytes, optionally reversing their byte order. */
+	template<size_t N>
+	void CopySamples(unsigned char* dst, const unsigned char* src, 
+		size_t count, size_t stride, bool swap) {
+		if( swap ) {
+			for( size_t i = 0; i < count; i++, src += stride, dst += N ) {
+				for( size_t b = 0; b < N; b++ )
+					dst[b] = src[N - 1 - b];
+			}
+		} else {
+			for( size_t i = 0; i < count; i++, src += stride, dst += N ) {
+				for( size_t b = 0; b < N; b++ )
+					dst[b] = src[b];
+			}
+		}
+	}
+}
+
+UInt64
+ArrayLayout::Extent(UInt64 width, UInt64 height, UInt64 planes) const {
+	return offset + (planes - 1) * planeStride + (height - 1) * lineStride
+		+ (width - 1) * sampleStride + sampleBytes;
+}
+
+MappedFile::MappedFile()
+  : data(NULL), size(0), sequential(false) {
+#ifdef WINDOWS
+	file    = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	file    = -1;
+	direct  = -1;
+#endif
+}
+
+void
+MappedFile::SetDirectIO(bool enable) {
+	directIO = enable;
+}
+
+MappedFile*
+MappedFile::Open(const string& filename) {
+	MappedFile* mapped = new MappedFile();
+
+#ifdef WINDOWS
+	mapped->file = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER fileSize;
+	if( mapped->file != INVALID_HANDLE_VALUE && ::GetFileSizeEx(mapped->file, &fileSize) && fileSize.QuadPart > 0 ) {
+		mapped->size    = fileSize.QuadPart;
+		mapped->mapping = ::CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if( mapped->mapping != NULL && (UInt64)(SIZE_T)mapped->size == mapped->size )
+			mapped->data = static_cast<const unsigned char*>(::MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+#else
+	mapped->file = open(filename.c_str(), O_RDONLY);
+	struct stat status;
+	if( mapped->file >= 0 && fstat(mapped->file, &status) == 0 && status.st_size > 0 ) {
+		mapped->size = status.st_size;
+		if( (UInt64)(size_t)mapped->size == mapped->size ) {
+			void* address = mmap(NULL, (size_t)mapped->size, PROT_READ, MAP_SHARED, mapped->file, 0);
+			if( address != MAP_FAILED )
+				mapped->data = static_cast<const unsigned char*>(address);
+		}
+	}
+	if( directIO && mapped->data != NULL ) {
+	#if defined(O_DIRECT)
+		mapped->direct = open(filename.c_str(), O_RDONLY | O_DIRECT);
+	#elif defined(F_NOCACHE)
+		mapped->direct = open(filename.c_str(), O_RDONLY);
+		if( mapped->direct >= 0 )
+			fcntl(mapped->direct, F_NOCACHE, 1);
+	#endif
+	}
+#endif
+
+	if( mapped->data == NULL ) {
+		delete mapped;
+		return NULL;
+	}
+	return mapped;
+}
+
+MappedFile::~MappedFile() {
+#ifdef WINDOWS
+	if( data != NULL )
+		::UnmapViewOfFile(data);
+	if( mapping != NULL )
+		::CloseHandle(mapping);
+	if( file != INVALID_HANDLE_VALUE )
+		::CloseHandle(file);
+#else
+	if( data != NULL )
+		munmap(const_cast<unsigned char*>(data), (size_t)size);
+	if( file >= 0 )
+		close(file);
+	if( direct >= 0 )
+		close(direct);
+#endif
+}
+
+const unsigned char*
+MappedFile::Data() const {
+	return data;
+}
+
+UInt64
+MappedFile::Size() const {
+	return size;
+}
+
+bool
+MappedFile::Read(const ArrayLayout& layout, UInt64 plane, 
+				 const Rectangle& bounds, void* buffer) const {
+	UInt64 begin = layout.offset + plane * layout.planeStride 
+		+ bounds.top * layout.lineStride + bounds.left * layout.sampleStride;
+	const unsigned char* src = data + begin;
+	unsigned char* dst = static_cast<unsigned char*>(buffer);
+	size_t width  = bounds.getWidth();
+	size_t bytes  = width * layout.sampleBytes;
+	size_t stride = (size_t)layout.sampleStride;
+	bool contiguous = !layout.swap && layout.sampleStride == layout.sampleBytes;
+
+	switch( layout.sampleBytes ) {
+		case 1: case 2: case 4: case 8: break;
+		default: return false;
+	}
+
+	// Whole rows of band sequential arrays are one range of the file, 
+	// which is what sequential passes are tuned for.
+	UInt64 end = std::min(size, begin + bounds.getHeight() * layout.lineStride);
+	bool rows = sequential && width * layout.sampleStride == layout.lineStride
+		&& layout.planeStride > layout.lineStride;
+
+	unsigned char* storage = NULL;
+	if( rows ) {
+		const unsigned char* copy = ReadDirect(begin, end, &storage);
+		if( copy != NULL )
+			src = copy;
+	}
+
+	for( Int y = bounds.top; y < bounds.bottom; y++ ) {
+		if( contiguous ) {
+			memcpy(dst, src, bytes);
+		} else {
+			switch( layout.sampleBytes ) {
+				case 1: CopySamples<1>(dst, src, width, stride, false); break;
+				case 2: CopySamples<2>(dst, src, width, stride, layout.swap); break;
+				case 4: CopySamples<4>(dst, src, width, stride, layout.swap); break;
+				case 8: CopySamples<8>(dst, src, width, stride, layout.swap); break;
+			}
+		}
+		src += layout.lineStride;
+		dst += bytes;
+	}
+
+	delete[] storage;
+	if( rows )
+		Advise(begin, end);
+	return true;
+}
+
+void
+MappedFile::Sequential(bool enable) const {
+	sequential = enable;
+#ifndef WINDOWS
+	madvise(const_cast<unsigned char*>(data), (size_t)size, enable ? MADV_SEQUENTIAL : MADV_NORMAL);
+#endif
+}
+
+void
+MappedFile::Advise(UInt64 begin, UInt64 end) const {
+#ifndef WINDOWS
+	const UInt64 page = (UInt64)sysconf(_SC_PAGESIZE);
+
+	// Drop the pages that have been copied. Pages mapped by this process 
+	// must be released before the kernel can drop them from the page cache.
+	UInt64 first = begin & ~(page - 1);
+	UInt64 last  = end & ~(page - 1);
+	if( last > first ) {
+		madvise(const_cast<unsigned char*>(data + first), (size_t)(last - first), MADV_DONTNEED);
+	#ifdef POSIX_FADV_DONTNEED
+		posix_fadvise(file, (off_t)first, (off_t)(last - first), POSIX_FADV_DONTNEED);
+	#endif
+	}
+
+	// Read ahead as many rows as have just been read.
+	UInt64 ahead = std::min(size, end + (end - begin));
+	if( ahead > last && direct < 0 )
+		madvise(const_cast<unsigned char*>(data + last), (size_t)(ahead - last), MADV_WILLNEED);
+#endif
+}
+
+const unsigned char*
+MappedFile::ReadDirect(UInt64 begin, UInt64 end, unsigned char** storage) const {
+#ifdef WINDOWS
+	return NULL;
+#else
+	if( direct < 0 || end <= begin )
+		return NULL;
+
+	UInt64 first  = begin & ~(directAlignment - 1);
+	UInt64 last   = (end + directAlignment - 1) & ~(directAlignment - 1);
+	size_t length = (size_t)(last - first);
+
+	*storage = new unsigned char[length + directAlignment];
+	unsigned char* aligned = *storage + (directAlignment 
+		- ((size_t)*storage & (directAlignment - 1))) % directAlignment;
+
+	// The final block of the file may be read short.
+	size_t done = 0;
+	while( done < length ) {
+		ssize_t count = pread(direct, aligned + done, length - done, (off_t)(first + done));
+		if( count <= 0 )
+			break;
+		done += (size_t)count;
+	}
+	if( done < end - first ) {
+		delete[] *storage;
+		*storage = NULL;
+		return NULL;
+	}
+	return aligned + (begin - first);
+#endif
+}
+
+bool
+MappedFile::IsLittleEndian() {
+	const short one = 1;
+	return *reinterpret_cast<const char*>(&one) == 1;
+}
@@ -0,0 +1,173 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "Parallelism.h"
+#include "FitsMath.h"
+#include "Instrumentation.h"
+
+#include <boost/thread/once.hpp>
+
+#ifdef USE_TBB
+	#include <tbb/task_scheduler_init.h>
+	#include <tbb/parallel_for.h>
+	#include <tbb/blocked_range.h>
+	#include <boost/thread/tss.hpp>
+#endif
+
+using namespace FitsLiberator::Engine;
+
+size_t Parallelism::serialWork	= 32768;
+size_t Parallelism::taskWork	= 8192;
+
+namespace
+{
+	/** Bounds of the measured serialWork. */
+	const size_t minSerialWork		= 4096;
+	const size_t maxSerialWork		= 1048576;
+	/** Multiply-adds in a timed serial loop. */
+	const size_t calibrationWork	= 65536;
+	/** Timings of each loop; the fastest one is used. */
+	const Int calibrationRuns		= 8;
+
+	boost::once_flag calibrated = BOOST_ONCE_INIT;
+
+	#ifdef USE_TBB
+		class EmptyBody
+		{
+		public:
+			Void operator()( const tbb::blocked_range<Int>& ) const {}
+		};
+	#endif
+}
+
+Void Parallelism::Measure()
+{
+#if defined(USE_TBB) || defined(USE_OPENMP)
+	// Seconds per multiply-add.
+	volatile Double sink = 0.0;
+	Double unit = DoubleMax;
+	for( Int run = 0; run < calibrationRuns; run++ )
+	{
+		Double start = Instrumentation::now();
+		Double x = sink + 1.0;
+		for( size_t i = 0; i < calibrationWork; i++ )
+			x = x * 0.999999 + 1e-6;
+		sink = x;
+		unit = FitsMath::minimum( unit, ( Instrumentation::now() - start ) / calibrationWork );
+	}
+
+	// Seconds to start and finish a parallel loop that does nothing.
+	Double overhead = DoubleMax;
+	#ifdef USE_TBB
+		Int tasks = 4 * tbb::task_scheduler_init::default_num_threads();
+	#endif
+	for( Int run = 0; run < calibrationRuns; run++ )
+	{
+		Double start = Instrumentation::now();
+		#ifdef USE_TBB
+			tbb::parallel_for( tbb::blocked_range<Int>( 0, tasks, 1 ), EmptyBody() );
+		#else
+			#pragma omp parallel
+			{
+			}
+		#endif
+		overhead = FitsMath::minimum( overhead, Instrumentation::now() - start );
+	}
+
+	if( unit > 0.0 )
+	{
+		Double work = FitsMath::maximum( (Double)minSerialWork, 
+			FitsMath::minimum( (Double)maxSerialWork, overhead / unit ) );
+		serialWork	= (size_t)work;
+		taskWork	= serialWork / 4;
+	}
+#endif
+}
+
+UInt Parallelism::StretchCost( StretchFunction function )
+{
+	switch ( function )
+	{
+		case stretchLinear:
+		case stretchPow2:
+		case stretchNoStretch:
+			return costCopy;
+		case stretchSqrt:
+			return costRoot;
+		case stretchLogSqrt:
+		case stretchLogLog:
+		case stretchAsinhAsinh:
+		case stretchAsinhSqrt:
+			return 2 * costTranscendental;
+		default:
+			return costTranscendental;
+	}
+}
+
+#ifdef USE_TBB
+	namespace
+	{
+		boost::thread_specific_ptr<tbb::task_scheduler_init> scheduler;
+	}
+
+	Void Parallelism::Initialize()
+	{
+		if ( scheduler.get() == NULL )
+			scheduler.reset( new tbb::task_scheduler_init() );
+		boost::call_once( calibrated, &Parallelism::Measure );
+	}
+#else
+	Void Parallelism::Initialize()
+	{
+		boost::call_once( calibrated, &Parallelism::Measure );
+	}
+#endif // USE_TBB
@@ -0,0 +1,363 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party library
+    TinyXML. This file implements the class Engine::Pds4ImageCube. */
+
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+#include <vector>
+#include "Pds4ImageCube.hpp"
+#include "ImageReader.hpp"
+#include "Text.hpp"
+
+using std::string;
+using std::ostream;
+using std::vector;
+
+using FitsLiberator::Rectangle;
+using FitsLiberator::newline;
+using FitsLiberator::Engine::ImageReader;
+using FitsLiberator::Engine::ImageCube;
+using FitsLiberator::Engine::Pds4ImageCube;
+using FitsLiberator::Engine::MappedFile;
+using FitsLiberator::Engine::ArrayLayout;
+
+namespace {
+	/** Axis of an array as described by an Axis_Array element. */
+	struct Axis {
+		string	name;
+		UInt64	elements;
+		long	sequence;
+		UInt64	stride;
+
+		/** Orders axes by their position in the storage order. */
+		static bool BySequence(const Axis& a, const Axis& b) {
+			return a.sequence < b.sequence;
+		}
+	};
+
+	/** Case insensitive comparison of axis names. */
+	bool SameName(const string& a, const char* b) {
+		string::size_type i = 0;
+		for( ; i < a.size() && b[i] != 0; i++ ) {
+			if( ::tolower(a[i]) != ::tolower(b[i]) )
+				return false;
+		}
+		return i == a.size() && b[i] == 0;
+	}
+
+	/** Removes the axis with the given name from the list.
+		@return True if the axis was found. */
+	bool TakeAxis(vector<Axis>& axes, const char* name, Axis& axis) {
+		for( vector<Axis>::iterator i = axes.begin(); i != axes.end(); ++i ) {
+			if( SameName(i->name, name) ) {
+				axis = *i;
+				axes.erase(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/** Parses a non-negative integer. Malformed values yield 0. */
+	UInt64 ToUInt64(const string& text) {
+		UInt64 value = 0;
+		std::istringstream stream(text);
+		stream >> value;
+		return stream.fail() ? 0 : value;
+	}
+
+	/** Finds the first element with the given local name in a subtree. */
+	const TiXmlElement* Find(const TiXmlNode* node, const string& name) {
+		for( const TiXmlElement* child = node->FirstChildElement(); 
+			child != NULL; child = child->NextSiblingElement() ) {
+			if( Pds4ImageCube::LocalName(child) == name )
+				return child;
+			const TiXmlElement* found = Find(child, name);
+			if( found != NULL )
+				return found;
+		}
+		return NULL;
+	}
+}
+
+Pds4ImageCube::Pds4ImageCube(const TiXmlElement* element, const MappedFile* file,
+	const ArrayLayout& layout, unsigned int width, unsigned int height, 
+	unsigned int planes, ImageCube::PixelFormat format, ImageReader* owner
+	) : super(width, height, planes, format, owner), element(element), 
+		file(file), layout(layout) {
+}
+
+string
+Pds4ImageCube::LocalName(const TiXmlNode* node) {
+	string name = node->Value();
+	string::size_type colon = name.find(':');
+	if( colon != string::npos )
+		name.erase(0, colon + 1);
+	return name;
+}
+
+string
+Pds4ImageCube::Text(const TiXmlElement* element) {
+	string text;
+	for( const TiXmlNode* node = element->FirstChild(); node != NULL; 
+		node = node->NextSibling() ) {
+		if( node->ToText() != NULL )
+			text += node->Value();
+	}
+	const char* whitespace = " \t\r\n";
+	string::size_type first = text.find_first_not_of(whitespace);
+	if( first == string::npos )
+		return string();
+	return text.substr(first, text.find_last_not_of(whitespace) - first + 1);
+}
+
+const TiXmlElement*
+Pds4ImageCube::Child(const TiXmlNode* node, const string& name) {
+	for( const TiXmlElement* child = node->FirstChildElement(); 
+		child != NULL; child = child->NextSiblingElement() ) {
+		if( LocalName(child) == name )
+			return child;
+	}
+	return NULL;
+}
+
+Pds4ImageCube*
+Pds4ImageCube::FromElement(ImageReader* owner, const TiXmlElement* element,
+	const MappedFile* file) {
+
+	const TiXmlElement* offset		= Child(element, "offset");
+	const TiXmlElement* elementArray = Child(element, "Element_Array");
+	const TiXmlElement* dataType	= elementArray != NULL ? Child(elementArray, "data_type") : NULL;
+	if( file == NULL || offset == NULL || dataType == NULL )
+		return NULL;
+
+	ArrayLayout layout;
+	ImageCube::PixelFormat format = MapDataType(Text(dataType), layout);
+	if( format == ImageCube::Invalid )
+		return NULL;
+	layout.offset = ToUInt64(Text(offset));
+
+	vector<Axis> axes;
+	for( const TiXmlElement* child = element->FirstChildElement(); 
+		child != NULL; child = child->NextSiblingElement() ) {
+		if( LocalName(child) != "Axis_Array" )
+			continue;
+		const TiXmlElement* name	 = Child(child, "axis_name");
+		const TiXmlElement* elements = Child(child, "elements");
+		const TiXmlElement* sequence = Child(child, "sequence_number");
+		if( elements == NULL || sequence == NULL )
+			return NULL;
+		Axis axis;
+		axis.name	  = name != NULL ? Text(name) : string();
+		axis.elements = ToUInt64(Text(elements));
+		axis.sequence = ::atol(Text(sequence).c_str());
+		if( axis.elements == 0 )
+			return NULL;
+		axes.push_back(axis);
+	}
+	if( axes.size() < 2 || axes.size() > 3 )
+		return NULL;
+
+	// Order the axes from the fastest varying to the slowest varying and 
+	// assign the strides in that order.
+	std::sort(axes.begin(), axes.end(), Axis::BySequence);
+	const TiXmlElement* order = Child(element, "axis_index_order");
+	if( order == NULL || Text(order) != "First Index Fastest" )
+		std::reverse(axes.begin(), axes.end());
+	UInt64 stride = layout.sampleBytes;
+	for( vector<Axis>::iterator i = axes.begin(); i != axes.end(); ++i ) {
+		i->stride = stride;
+		stride *= i->elements;
+	}
+
+	// Named axes are honoured; otherwise the fastest varying axis runs along 
+	// a line and the slowest varying axis selects the plane.
+	Axis sample, line, band;
+	band.elements = 1;
+	band.stride   = 0;
+	if( !TakeAxis(axes, "Sample", sample) ) {
+		sample = axes.front();
+		axes.erase(axes.begin());
+	}
+	if( !TakeAxis(axes, "Line", line) ) {
+		line = axes.front();
+		axes.erase(axes.begin());
+	}
+	if( !axes.empty() )
+		band = axes.front();
+
+	layout.sampleStride = sample.stride;
+	layout.lineStride	= line.stride;
+	layout.planeStride	= band.stride;
+	if( layout.Extent(sample.elements, line.elements, band.elements) > file->Size() )
+		return NULL;
+
+	return new Pds4ImageCube(element, file, layout, (unsigned int)sample.elements, 
+		(unsigned int)line.elements, (unsigned int)band.elements, format, owner);
+}
+
+ImageCube::PixelFormat
+Pds4ImageCube::MapDataType(const string& dataType, ArrayLayout& layout) {
+	static const struct {
+		const char*				name;
+		ImageCube::PixelFormat	format;
+		size_t					bytes;
+	} types[] = {
+		{ "UnsignedByte",		ImageCube::Unsigned8,  1 },
+		{ "SignedByte",			ImageCube::Signed8,	   1 },
+		{ "UnsignedLSB2",		ImageCube::Unsigned16, 2 },
+		{ "UnsignedMSB2",		ImageCube::Unsigned16, 2 },
+		{ "SignedLSB2",			ImageCube::Signed16,   2 },
+		{ "SignedMSB2",			ImageCube::Signed16,   2 },
+		{ "UnsignedLSB4",		ImageCube::Unsigned32, 4 },
+		{ "UnsignedMSB4",		ImageCube::Unsigned32, 4 },
+		{ "SignedLSB4",			ImageCube::Signed32,   4 },
+		{ "SignedMSB4",			ImageCube::Signed32,   4 },
+		{ "SignedLSB8",			ImageCube::Signed64,   8 },
+		{ "SignedMSB8",			ImageCube::Signed64,   8 },
+		{ "IEEE754LSBSingle",	ImageCube::Float32,	   4 },
+		{ "IEEE754MSBSingle",	ImageCube::Float32,	   4 },
+		{ "IEEE754LSBDouble",	ImageCube::Float64,	   8 },
+		{ "IEEE754MSBDouble",	ImageCube::Float64,	   8 }
+	};
+
+	for( size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++ ) {
+		if( dataType == types[i].name ) {
+			bool lsb = dataType.find("LSB") != string::npos;
+			bool msb = dataType.find("MSB") != string::npos;
+			layout.sampleBytes = types[i].bytes;
+			layout.swap = MappedFile::IsLittleEndian() ? msb : lsb;
+			return types[i].format;
+		}
+	}
+	return ImageCube::Invalid;
+}
+
+bool
+Pds4ImageCube::NeedsNullMap() const {
+	return false;
+}
+
+string
+Pds4ImageCube::Property(const string& name) const {
+	// Look in the array itself first and then in the enclosing parts of the
+	// label, e.g. the observation area.
+	for( const TiXmlNode* node = element; node != NULL; node = node->Parent() ) {
+		if( node->ToElement() == NULL )
+			break;
+		const TiXmlElement* found = Find(node, name);
+		if( found != NULL )
+			return Text(found);
+	}
+	return string();
+}
+
+void
+Pds4ImageCube::Properties(ostream& stream, const string& prefix) const {
+	for( const TiXmlElement* child = element->FirstChildElement(); 
+		child != NULL; child = child->NextSiblingElement() ) {
+		if( child->FirstChildElement() == NULL )
+			stream << prefix << LocalName(child) << "\t= " << Text(child) << newline;
+	}
+}
+
+ImageCube::RowOrdering
+Pds4ImageCube::RowOrder() const {
+	// Display_Direction is part of the display dictionary; without it the 
+	// first line is displayed at the top.
+	if( Property("vertical_display_direction") == "Bottom to Top" )
+		return ImageCube::BottomUp;
+	return ImageCube::TopDown;
+}
+
+void
+Pds4ImageCube::Access(ImageCube::AccessPattern pattern) const {
+	file->Sequential(pattern == ImageCube::SequentialAccess);
+}
+
+void 
+Pds4ImageCube::Read(ImageCube::size_type plane, 
+					const Rectangle& bounds, void* buffer) const {
+	assert(buffer != 0);
+	assert(plane < Planes());
+	assert(bounds.left >= 0 && bounds.top >= 0 && 
+		bounds.right <= (Int)Width() && bounds.bottom <= (Int)Height() );	
+
+	if( bounds.getArea() == 0 )
+		return;
+	file->Read(layout, plane, bounds, buffer);
+}
+
+void
+Pds4ImageCube::Read(ImageCube::size_type plane, void* buffer) const {
+	Read(plane, Rectangle(0, 0, Width(), Height()), buffer);
+}
+
+bool
+Pds4ImageCube::Read(ImageCube::size_type plane, 
+					const Rectangle& bounds, void* buffer, unsigned char* /*nullMap*/) const {
+	Read(plane, bounds, buffer);
+	// Special constants are not applied, so the null map is left untouched.
+	return false;
+}
+
+bool
+Pds4ImageCube::Read(ImageCube::size_type plane, 
+					void* buffer, unsigned char* /*nullMap*/) const {
+	Read(plane, buffer);
+	return false;
+}
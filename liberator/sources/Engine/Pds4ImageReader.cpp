@@ -0,0 +1,178 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party library
+    TinyXML. This file implements the class Engine::Pds4ImageReader. */
+
+#include <fstream>
+#include "Pds4ImageReader.hpp"
+#include "Text.hpp"
+
+using std::string;
+
+using FitsLiberator::indent;
+using FitsLiberator::newline;
+
+using FitsLiberator::Engine::ImageReader;
+using FitsLiberator::Engine::ImageReaderException;
+using FitsLiberator::Engine::MappedFile;
+using FitsLiberator::Engine::Pds4ImageReader;
+using FitsLiberator::Engine::Pds4ImageCube;
+
+Pds4ImageReader::Pds4ImageReader(const string& fileName) 
+  : super(fileName) {
+
+	if( !document.LoadFile(fileName.c_str()) )
+		throw ImageReaderException(fileName);
+	const TiXmlElement* product = document.RootElement();
+	if( product == NULL || Pds4ImageCube::LocalName(product).compare(0, 8, "Product_") != 0 )
+		throw ImageReaderException(fileName);
+
+	// Data files are named relative to the directory of the label.
+	string directory;
+	string::size_type separator = fileName.find_last_of("/\\");
+	if( separator != string::npos )
+		directory = fileName.substr(0, separator + 1);
+
+	// Each file area describes one data file and the arrays stored in it. We
+	// may not find any, but that is not considered an exceptional error.
+	for( const TiXmlElement* area = product->FirstChildElement(); 
+		area != NULL; area = area->NextSiblingElement() ) {
+		if( Pds4ImageCube::LocalName(area).compare(0, 9, "File_Area") != 0 )
+			continue;
+		const TiXmlElement* file = Pds4ImageCube::Child(area, "File");
+		const TiXmlElement* name = file != NULL ? Pds4ImageCube::Child(file, "file_name") : NULL;
+		if( name == NULL )
+			continue;
+		MappedFile* mapping = NULL;
+		for( const TiXmlElement* array = area->FirstChildElement(); 
+			array != NULL; array = array->NextSiblingElement() ) {
+			if( Pds4ImageCube::LocalName(array).compare(0, 5, "Array") != 0 )
+				continue;
+			if( mapping == NULL )
+				mapping = Map(directory + Pds4ImageCube::Text(name));
+			Pds4ImageCube* image = Pds4ImageCube::FromElement(this, array, mapping);
+			if( image != NULL )
+				insert(image);
+		}
+	}
+}
+
+Pds4ImageReader::~Pds4ImageReader() {
+	// The images only use the mappings for reading, so they can be released
+	// before the base class deletes the images.
+	for( FileMap::iterator i = files.begin(); i != files.end(); ++i )
+		delete i->second;
+}
+
+MappedFile*
+Pds4ImageReader::Map(const string& path) {
+	FileMap::iterator i = files.find(path);
+	if( i != files.end() )
+		return i->second;
+	MappedFile* mapping = MappedFile::Open(path);
+	files[path] = mapping;
+	return mapping;
+}
+
+bool
+Pds4ImageReader::CanRead(const string& filename) {
+	// A label is an XML document whose root element is a product. Only the
+	// beginning is inspected so large binary files are rejected quickly.
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if( !file )
+		return false;
+	char buffer[4096];
+	file.read(buffer, sizeof(buffer));
+	string start(buffer, (size_t)file.gcount());
+
+	string::size_type first = start.find_first_not_of(" \t\r\n\xEF\xBB\xBF");
+	if( first == string::npos || start[first] != '<' )
+		return false;
+	return start.find("<Product_") != string::npos || 
+		start.find(":Product_") != string::npos;
+}
+
+void
+Pds4ImageReader::Print(std::ostream& stream, const TiXmlNode* node, int level) const {
+	for( const TiXmlElement* child = node->FirstChildElement(); 
+		child != NULL; child = child->NextSiblingElement() ) {
+		string name = Pds4ImageCube::LocalName(child);
+		if( child->FirstChildElement() != NULL ) {
+			indent(stream, level) << name << newline;
+			Print(stream, child, level + 1);
+		}
+		else {
+			indent(stream, level) << name << " = " << Pds4ImageCube::Text(child);
+			const char* unit = child->Attribute("unit");
+			if( unit != NULL )
+				stream << " <" << unit << ">";
+			stream << newline;
+		}
+	}
+}
+
+void
+Pds4ImageReader::header(std::ostream& stream) const {
+	const TiXmlElement* product = document.RootElement();
+	if( product != NULL ) {
+		stream << Pds4ImageCube::LocalName(product) << newline;
+		Print(stream, product, 1);
+	}
+}
+
+ImageReader::ImageFormat
+Pds4ImageReader::format() const {
+	return ImageReader::PDS4;
+}
@@ -62,9 +62,12 @@
 	@author        Kaspar Kirstein Nielsen <kaspar@barmave.dk>
 	@author        Lars Holm Nielsen <lars@hankat.dk> */
 
+#include <algorithm>
 #include <sstream>
+#include <string.h>
 #include "PdsImageCube.hpp"
 #include "ImageReader.hpp"
+#include "MappedFile.hpp"
 #include "Text.hpp"
 
 using std::string;
@@ -76,16 +79,106 @@ using FitsLiberator::Engine::ImageReader;
 using FitsLiberator::Engine::ImageReaderException;
 using FitsLiberator::Engine::ImageCube;
 using FitsLiberator::Engine::PdsImageCube;
+using FitsLiberator::Engine::MappedFile;
+using FitsLiberator::Engine::ArrayLayout;
+
+struct PdsImageCube::Layout : public ArrayLayout {
+    string      dataFile;
+    UInt64      extent;         ///< Offset of the end of the last pixel.
+
+    /** Creates the layout of an uncompressed binary image.
+        @return The layout or NULL if the pixels are not stored contiguously
+            in a fixed length or stream file. */
+    static Layout* FromNode(OBJDESC* imageNode, long lines, long samples, 
+        long sampleBits, long bands, int bandStorage, long prefixBytes, 
+        long suffixBytes, int dataType);
+};
+
+PdsImageCube::Layout*
+PdsImageCube::Layout::FromNode(OBJDESC* imageNode, long lines, long samples, 
+    long sampleBits, long bands, int bandStorage, long prefixBytes, 
+    long suffixBytes, int dataType) {
+    
+    if( sampleBits % 8 != 0 || (bands > 1 && (prefixBytes != 0 || suffixBytes != 0)) )
+        return NULL;
+
+    char* labelFile = NULL;
+    char* dataFile  = NULL;
+    int   recordType;
+    long  recordBytes;
+    long  fileRecords;
+    long  fileOffset;
+    int   interchangeFormat;
+    if( OaGetFileKeywords(imageNode, &labelFile, &dataFile, &recordType, 
+        &recordBytes, &fileRecords, &fileOffset, &interchangeFormat) != 0 )
+        return NULL;
+
+    Layout* layout = NULL;
+    // Variable length records are interleaved with record lengths.
+    if( dataFile != NULL && recordType != OA_VARIABLE_LENGTH ) {
+        UInt64 sampleBytes = sampleBits / 8;
+        UInt64 lineBytes   = samples * sampleBytes;
+
+        layout = new Layout();
+        layout->dataFile     = dataFile;
+        layout->offset       = fileOffset + prefixBytes;
+        layout->sampleBytes  = (size_t)sampleBytes;
+        layout->sampleStride = sampleBytes;
+        layout->lineStride   = lineBytes;
+        layout->planeStride  = lines * lineBytes;
+
+        if( bands <= 1 ) {
+            layout->lineStride = prefixBytes + lineBytes + suffixBytes;
+        } else if( bandStorage == OA_LINE_INTERLEAVED ) {
+            layout->lineStride   = bands * lineBytes;
+            layout->planeStride  = lineBytes;
+        } else if( bandStorage == OA_SAMPLE_INTERLEAVED ) {
+            layout->lineStride   = bands * lineBytes;
+            layout->sampleStride = bands * sampleBytes;
+            layout->planeStride  = sampleBytes;
+        } else if( bandStorage != OA_BAND_SEQUENTIAL ) {
+            delete layout;
+            layout = NULL;
+        }
+    }
+    LemmeGo(labelFile);
+    LemmeGo(dataFile);
+
+    if( layout != NULL ) {
+        layout->extent = layout->Extent(samples, lines, bands);
+
+        bool littleEndian = MappedFile::IsLittleEndian();
+        switch( dataType ) {
+            case OA_MSB_INTEGER:
+            case OA_MSB_UNSIGNED_INTEGER:
+            case OA_IEEE_REAL:
+                layout->swap = littleEndian && layout->sampleBytes > 1;
+                break;
+            default:
+                layout->swap = !littleEndian && layout->sampleBytes > 1;
+        }
+    }
+    return layout;
+}
 
 PdsImageCube::PdsImageCube(OBJDESC *imageNode, 
 	unsigned int width, unsigned int height, unsigned int planes, 
 	ImageCube::PixelFormat format,
 	ImageReader* owner
-	) : super(width, height, planes, format, owner) {
+	) : super(width, height, planes, format, owner),
+        layout(NULL), mapping(NULL), mappingOpened(false), handle(NULL), 
+        handlePlane(0) {
 		
 	  this->imageNode = imageNode;
 }
 
+PdsImageCube::~PdsImageCube() {
+    if( handle != NULL )
+        OaCloseImage(handle);
+    delete mapping;
+    delete layout;
+}
+
 PdsImageCube*
 PdsImageCube::FromObjectDescription(ImageReader* owner, OBJDESC *imageNode) {
 	long  lines;				// LINES = height
@@ -109,9 +202,15 @@ PdsImageCube::FromObjectDescription(ImageReader* owner, OBJDESC *imageNode) {
 		    // TODO: Verify the datatype
             ImageCube::PixelFormat format = MapDataType(sample_bits, sample_format, sample_type_str);
             if(format != ImageCube::Invalid) {
-			    return new PdsImageCube(imageNode, 
+			    PdsImageCube* image = new PdsImageCube(imageNode, 
 				    line_samples, lines, bands, format,
 				    owner);
+                if( encoding_type == OA_UNCOMPRESSED && sample_format == OA_BINARY_INTERCHANGE_FORMAT ) {
+                    image->layout = Layout::FromNode(imageNode, lines, line_samples, 
+                        sample_bits, bands, band_storage_type, line_prefix_bytes, 
+                        line_suffix_bytes, OaStrtoPDSDataType(sample_type_str, sample_format));
+                }
+                return image;
 		    }
         }
 	}
@@ -231,50 +330,103 @@ PdsImageCube::Read(ImageCube::size_type plane,
     assert(buffer != 0);
 	assert(plane < Planes());
 	assert(bounds.left >= 0 && bounds.top >= 0 && 
-	    bounds.right <= Width() && bounds.bottom <= Height() );	
-
-	OA_OBJECT handle = OaOpenImage(imageNode, plane);
-    if(handle == 0) throw ImageReaderException(Owner()->FileName());
-	OA_OBJECT block  = OaReadPartialImage(handle, bounds.top + 1, 
-		bounds.bottom, bounds.left + 1, bounds.right);
-    if(block == 0) throw ImageReaderException(Owner()->FileName());
+	    bounds.right <= (Int)Width() && bounds.bottom <= (Int)Height() );	
 
-	unsigned char* dst = reinterpret_cast<unsigned char*>(buffer);
-	unsigned char* src = reinterpret_cast<unsigned char*>(block->data_ptr);
-	size_t bytes = SizeOf(bounds.right - bounds.left, 
-		bounds.bottom - bounds.top);
-	std::copy(src, src + bytes, dst);
-    
-	OaDeleteObject(block);
-	OaCloseImage(handle);
+    if( bounds.getArea() == 0 )
+        return;
+    if( !ReadMapped(plane, bounds, buffer) )
+        ReadDecoded(plane, bounds, buffer);
 }
 
 void
 PdsImageCube::Read(ImageCube::size_type plane, void* buffer) const {
-    assert(buffer != 0);
+    Read(plane, Rectangle(0, 0, Width(), Height()), buffer);
+}
 
-	OA_OBJECT block = OaReadImage(Node(), plane);
-    
-    unsigned char* dst = reinterpret_cast<unsigned char*>(buffer);
-    unsigned char* src = reinterpret_cast<unsigned char*>(block->data_ptr);
-    size_t bytes = SizeOf(0);
-    std::copy(src, src + bytes, dst);
-    
-    OaDeleteObject(block);
+const MappedFile*
+PdsImageCube::Mapping() const {
+    if( layout == NULL )
+        return NULL;
+
+    boost::mutex::scoped_lock guard(lock);
+    if( !mappingOpened ) {
+        mappingOpened = true;
+        mapping = MappedFile::Open(layout->dataFile);
+        // A truncated file is left to the PDS library to report.
+        if( mapping != NULL && mapping->Size() < layout->extent ) {
+            delete mapping;
+            mapping = NULL;
+        }
+    }
+    return mapping;
+}
+
+bool
+PdsImageCube::ReadMapped(ImageCube::size_type plane, 
+                         const Rectangle& bounds, void* buffer) const {
+    const MappedFile* mapped = Mapping();
+    if( mapped == NULL )
+        return false;
+
+    return mapped->Read(*layout, plane, bounds, buffer);
 }
 
 void
+PdsImageCube::Access(ImageCube::AccessPattern pattern) const {
+    const MappedFile* mapped = Mapping();
+    if( mapped != NULL )
+        mapped->Sequential(pattern == ImageCube::SequentialAccess);
+}
+
+void 
+PdsImageCube::ReadDecoded(ImageCube::size_type plane, 
+				          const Rectangle& bounds, void* buffer) const {
+    boost::mutex::scoped_lock guard(lock);
+
+    // Opening an image parses its label, so the handle is kept for the 
+    // following reads of the same plane.
+    if( handle == NULL || handlePlane != plane ) {
+        if( handle != NULL )
+            OaCloseImage(handle);
+        handle = OaOpenImage(imageNode, plane + 1);   // Bands are numbered from 1.
+        handlePlane = plane;
+        if( handle == NULL ) 
+            throw ImageReaderException(Owner()->FileName());
+    }
+
+	unsigned char* dst = reinterpret_cast<unsigned char*>(buffer);
+    size_t sampleBytes = SizeOf(1, 1);
+
+    // OaReadImagePixels decodes a line and returns the samples from the 
+    // requested one to the end of the line, or fewer for some encodings.
+    for( Int line = bounds.top; line < bounds.bottom; line++ ) {
+        Int sample = bounds.left;
+        while( sample < bounds.right ) {
+            int count = OaReadImagePixels(handle, line + 1, sample + 1);
+            if( count <= 0 ) {
+                OaCloseImage(handle);
+                handle = NULL;
+                throw ImageReaderException(Owner()->FileName());
+            }
+            size_t bytes = std::min(count, bounds.right - sample) * sampleBytes;
+            memcpy(dst, handle->data_ptr, bytes);
+            dst    += bytes;
+            sample += count;
+        }
+    }
+}
+
+bool
 PdsImageCube::Read(ImageCube::size_type plane, 
-                   const Rectangle& bounds, void* buffer, char* valid) const {
+                   const Rectangle& bounds, void* buffer, unsigned char* /*nullMap*/) const {
 	Read(plane, bounds, buffer);
-	//is used for making sure the null map is zero
-    std::fill( valid, valid + bounds.getArea(), 0 );
+	// PDS images never contain null pixels, so the null map is left untouched.
+	return false;
 }
 
-void
+bool
 PdsImageCube::Read(ImageCube::size_type plane, 
-                   void* buffer, char* valid) const {
+                   void* buffer, unsigned char* /*nullMap*/) const {
 	Read(plane, buffer);
-	//is used for making sure the null map is zero
-    std::fill( valid, valid + PixelsPerPlane(), 0 );
+	return false;
 }
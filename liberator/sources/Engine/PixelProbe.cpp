@@ -0,0 +1,189 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "PixelProbe.h"
+#include "FitsEngine.h"
+#include "FitsMath.h"
+
+#include <algorithm>
+
+using namespace FitsLiberator::Engine;
+
+namespace
+{
+	/** Places a block of size pixels along an axis of length extent so it 
+		covers [begin;end[, aligned to its size if possible. */
+	Void place( Int begin, Int end, Int size, Int extent, Int* first, Int* last )
+	{
+		if ( end - begin > size )
+		{
+			*first = begin;
+			*last = end;
+			return;
+		}
+
+		*first = ( begin / size ) * size;
+		if ( *first + size < end )
+			*first = std::max( 0, end - size );
+		*last = std::min( *first + size, extent );
+	}
+}
+
+PixelProbe::PixelProbe()
+{
+	Clear();
+}
+
+Void PixelProbe::Clear()
+{
+	cube = NULL;
+	plane = Plane();
+	block = Rectangle( 0, 0, 0, 0 );
+	Vector<Byte>().swap( pixels );
+	Vector<Byte>().swap( nullMap );
+	hasNulls = false;
+	encoded = false;
+}
+
+Bool PixelProbe::Read( const ImageCube* cube, const Plane& plane, Int x, Int y,
+	const Stretch& stretch, Double* linear, Double* stretched )
+{
+	return Read( cube, plane, Rectangle( x, y, x + 1, y + 1 ), stretch, linear, stretched );
+}
+
+Bool PixelProbe::Read( const ImageCube* cube, const Plane& plane, const Rectangle& window,
+	const Stretch& stretch, Double* linear, Double* stretched )
+{
+	if ( cube == NULL || window.left < 0 || window.top < 0 
+		|| window.right > (Int)cube->Width() || window.bottom > (Int)cube->Height() 
+		|| window.right <= window.left || window.bottom <= window.top )
+	{
+		return false;
+	}
+
+	if ( cube != this->cube || plane.imageIndex != this->plane.imageIndex 
+		|| plane.planeIndex != this->plane.planeIndex 
+		|| window.left < block.left || window.top < block.top 
+		|| window.right > block.right || window.bottom > block.bottom )
+	{
+		Load( cube, plane, window );
+	}
+
+	Stretch identity;
+	identity.scaleBackground = 0.0;
+
+	ImageCube::PixelFormat format = cube->Format();
+	UInt sampleSize = ImageCube::SizeOf( encoded ? encoding.format : format, 1, 1 );
+	UInt width = window.getWidth();
+
+	for ( Int y = window.top; y < window.bottom; y++ )
+	{
+		UInt first = ( y - block.top ) * block.getWidth() + ( window.left - block.left );
+		Void* row = &pixels[first * sampleSize];
+		UInt offset = ( y - window.top ) * width;
+
+		if ( encoded )
+		{
+			FitsEngine::stretchEncoded( identity, encoding, row, linear + offset, width, 1 );
+			if ( stretched != NULL )
+				FitsEngine::stretchEncoded( stretch, encoding, row, stretched + offset, width, 1 );
+			continue;
+		}
+
+		FitsEngine::stretch( identity, format, row, NULL, linear + offset, width, 1 );
+		if ( stretched != NULL )
+			FitsEngine::stretch( stretch, format, row, NULL, stretched + offset, width, 1 );
+
+		if ( hasNulls )
+		{
+			for ( UInt x = 0; x < width; x++ )
+			{
+				if ( ImageCube::IsNull( &nullMap[0], first + x ) )
+				{
+					linear[offset + x] = FitsMath::NaN;
+					if ( stretched != NULL )
+						stretched[offset + x] = FitsMath::NaN;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+Void PixelProbe::Load( const ImageCube* cube, const Plane& plane, const Rectangle& window )
+{
+	Clear();
+
+	place( window.left, window.right, blockWidth, cube->Width(), &block.left, &block.right );
+	place( window.top, window.bottom, blockHeight, cube->Height(), &block.top, &block.bottom );
+
+	pixels.resize( cube->SizeOf( block.getWidth(), block.getHeight() ) );
+	// Stored samples need no conversion, blank ones become NaN when stretched
+	encoded = cube->Encoded( &encoding );
+	if ( encoded )
+	{
+		cube->ReadEncoded( plane.planeIndex, block, &pixels[0] );
+	}
+	else if ( cube->NeedsNullMap() )
+	{
+		nullMap.assign( ImageCube::NullMapSize( block.getArea() ), 0 );
+		hasNulls = cube->Read( plane.planeIndex, block, &pixels[0], &nullMap[0] );
+	}
+	else
+	{
+		cube->Read( plane.planeIndex, block, &pixels[0] );
+	}
+
+	this->cube = cube;
+	this->plane = plane;
+}
@@ -0,0 +1,479 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "RegionStatistics.h"
+#include "FitsMath.h"
+
+#include <algorithm>
+
+using namespace FitsLiberator::Engine;
+
+namespace
+{
+	/** Merges the moments of a part of a region into those of the region. */
+	Void merge( UInt* count, Double* mean, Double* m2, 
+		UInt partCount, Double partMean, Double partM2 )
+	{
+		if ( partCount == 0 )
+			return;
+
+		if ( *count == 0 )
+		{
+			*count = partCount;
+			*mean = partMean;
+			*m2 = partM2;
+			return;
+		}
+
+		Double n = (Double)*count + partCount;
+		Double delta = partMean - *mean;
+		*mean += delta * partCount / n;
+		*m2 += partM2 + delta * delta * ( (Double)*count * partCount / n );
+		*count += partCount;
+	}
+}
+
+RegionStatistics::RegionStatistics()
+{
+	Reset();
+}
+
+RegionStatistics::~RegionStatistics()
+{
+}
+
+Void RegionStatistics::Reset()
+{
+	cube = NULL;
+	plane = Plane();
+	collecting = false;
+	complete = false;
+	width = 0;
+	height = 0;
+	bytes = 0;
+	blocksX = 0;
+	blocksY = 0;
+	levelsX = 0;
+	levelsY = 0;
+
+	Vector<Tile>().swap( tiles );
+	Vector<Float>().swap( values );
+	Vector<Float>().swap( blockMin );
+	Vector<Float>().swap( blockMax );
+}
+
+Bool RegionStatistics::Begin( const ImageCube* cube, const Plane& plane )
+{
+	boost::mutex::scoped_lock lock( mutex );
+	Reset();
+
+	UInt w = cube->Width();
+	UInt h = cube->Height();
+	if ( w == 0 || h == 0 )
+		return false;
+
+	UInt bx = ( w + blockSize - 1 ) / blockSize;
+	UInt by = ( h + blockSize - 1 ) / blockSize;
+	UInt lx = Log2( bx ) + 1;
+	UInt ly = Log2( by ) + 1;
+
+	//the pixels and the sparse tables; the sums and squares of the tiles
+	//are counted as they are added, as are the counts of tiles with nulls
+	UInt64 pixels = (UInt64)w * h;
+	UInt64 tableBytes = pixels * sizeof(Float) + (UInt64)bx * by * lx * ly * 2 * sizeof(Float);
+	if ( tableBytes + pixels * 2 * sizeof(Float) > memoryBudget )
+		return false;
+
+	try
+	{
+		values.assign( (std::size_t)pixels, FitsMath::NaN );
+		blockMin.assign( (std::size_t)bx * by * lx * ly, FloatMax );
+		blockMax.assign( blockMin.size(), -FloatMax );
+	}
+	catch ( std::bad_alloc& )
+	{
+		Reset();
+		return false;
+	}
+
+	this->cube = cube;
+	this->plane = plane;
+	width = w;
+	height = h;
+	bytes = tableBytes;
+	blocksX = bx;
+	blocksY = by;
+	levelsX = lx;
+	levelsY = ly;
+	collecting = true;
+	return true;
+}
+
+Void RegionStatistics::Add( const Rectangle& bounds, const Double* pixels )
+{
+	boost::mutex::scoped_lock lock( mutex );
+	if ( !collecting )
+		return;
+
+	UInt w = bounds.getWidth();
+	UInt h = bounds.getHeight();
+	UInt n = w * h;
+
+	//the sums are taken relative to the mean of the tile
+	UInt count = 0;
+	Double reference = 0.0;
+	for ( UInt i = 0; i < n; i++ )
+	{
+		if ( FitsMath::isFinite( pixels[i] ) )
+		{
+			reference += pixels[i];
+			count++;
+		}
+	}
+	if ( count > 0 )
+		reference /= count;
+
+	//the squares are stored less the mean square of the tile times the
+	//number of pixels, which keeps them small enough for single precision
+	Double spread = 0.0;
+	for ( UInt i = 0; i < n; i++ )
+	{
+		if ( FitsMath::isFinite( pixels[i] ) )
+			spread += ( pixels[i] - reference ) * ( pixels[i] - reference );
+	}
+	if ( count > 0 )
+		spread /= count;
+
+	UInt entries = ( w + 1 ) * ( h + 1 );
+	bytes += (UInt64)entries * ( 2 * sizeof(Float) + ( count < n ? sizeof(UInt) : 0 ) );
+	if ( bytes > memoryBudget )
+	{
+		Reset();
+		return;
+	}
+
+	//the sums of the rows above, in double precision
+	Vector<Double> sumsAbove;
+	Vector<Double> squaresAbove;
+	Vector<UInt> countsAbove;
+	try
+	{
+		tiles.push_back( Tile() );
+		Tile& tile = tiles.back();
+		tile.bounds = bounds;
+		tile.reference = reference;
+		tile.spread = spread;
+		tile.sums.assign( entries, 0.0f );
+		tile.squares.assign( entries, 0.0f );
+		if ( count < n )
+			tile.counts.assign( entries, 0 );
+		sumsAbove.assign( w + 1, 0.0 );
+		squaresAbove.assign( w + 1, 0.0 );
+		countsAbove.assign( w + 1, 0 );
+	}
+	catch ( std::bad_alloc& )
+	{
+		Reset();
+		return;
+	}
+
+	Tile& tile = tiles.back();
+	UInt stride = w + 1;
+	Float* level = Level( blockMin, 0, 0 );
+	Float* levelMax = Level( blockMax, 0, 0 );
+
+	for ( UInt y = 0; y < h; y++ )
+	{
+		const Double* row = pixels + y * w;
+		Float* sums = &tile.sums[( y + 1 ) * stride];
+		Float* squares = &tile.squares[( y + 1 ) * stride];
+		Float* copy = &values[( bounds.top + y ) * width + bounds.left];
+		UInt blockRow = ( ( bounds.top + y ) / blockSize ) * blocksX;
+
+		Double rowSum = 0.0;
+		Double rowSquares = 0.0;
+		UInt rowCount = 0;
+		for ( UInt x = 0; x < w; x++ )
+		{
+			Double value = row[x];
+			if ( FitsMath::isFinite( value ) )
+			{
+				Double d = value - reference;
+				rowSum += d;
+				rowSquares += d * d;
+				rowCount++;
+
+				Float f = (Float)value;
+				UInt block = blockRow + ( bounds.left + x ) / blockSize;
+				level[block] = std::min( level[block], f );
+				levelMax[block] = std::max( levelMax[block], f );
+			}
+			copy[x] = (Float)value;
+			sumsAbove[x + 1] += rowSum;
+			squaresAbove[x + 1] += rowSquares;
+			countsAbove[x + 1] += rowCount;
+			sums[x + 1] = (Float)sumsAbove[x + 1];
+			squares[x + 1] = (Float)( squaresAbove[x + 1] - spread * countsAbove[x + 1] );
+			if ( !tile.counts.empty() )
+				tile.counts[( y + 1 ) * stride + x + 1] = countsAbove[x + 1];
+		}
+	}
+}
+
+Void RegionStatistics::Finish()
+{
+	boost::mutex::scoped_lock lock( mutex );
+	if ( !collecting )
+		return;
+
+	//level (kx,ky) combines two ranges of level (kx-1,ky) side by side or
+	//two of level (kx,ky-1) on top of each other
+	for ( UInt ky = 0; ky < levelsY; ky++ )
+	{
+		for ( UInt kx = ( ky == 0 ) ? 1 : 0; kx < levelsX; kx++ )
+		{
+			Vector<Float>* tables[] = { &blockMin, &blockMax };
+			for ( UInt t = 0; t < 2; t++ )
+			{
+				Vector<Float>& table = *tables[t];
+				Float* out = Level( table, kx, ky );
+				const Float* in;
+				UInt step;
+				UInt spanX = 1 << kx;
+				UInt spanY = 1 << ky;
+				if ( ky == 0 )
+				{
+					in = Level( table, kx - 1, 0 );
+					step = spanX / 2;
+				}
+				else
+				{
+					in = Level( table, kx, ky - 1 );
+					step = ( spanY / 2 ) * blocksX;
+				}
+
+				for ( UInt by = 0; by + spanY <= blocksY; by++ )
+				{
+					for ( UInt bx = 0; bx + spanX <= blocksX; bx++ )
+					{
+						UInt b = by * blocksX + bx;
+						out[b] = ( t == 0 ) ? std::min( in[b], in[b + step] )
+							: std::max( in[b], in[b + step] );
+					}
+				}
+			}
+		}
+	}
+
+	collecting = false;
+	complete = true;
+}
+
+Void RegionStatistics::Clear()
+{
+	boost::mutex::scoped_lock lock( mutex );
+	Reset();
+}
+
+Bool RegionStatistics::IsValid( const ImageCube* cube, const Plane& plane ) const
+{
+	boost::mutex::scoped_lock lock( mutex );
+	return complete && this->cube == cube 
+		&& this->plane.imageIndex == plane.imageIndex
+		&& this->plane.planeIndex == plane.planeIndex;
+}
+
+Bool RegionStatistics::Query( const Rectangle& region, RegionSummary* summary ) const
+{
+	boost::mutex::scoped_lock lock( mutex );
+	if ( !complete )
+		return false;
+
+	Rectangle r( std::max( region.left, 0 ), std::max( region.top, 0 ),
+		std::min( region.right, (Int)width ), std::min( region.bottom, (Int)height ) );
+
+	summary->count = 0;
+	summary->mean = 0.0;
+	summary->variance = 0.0;
+	summary->min = FitsMath::NaN;
+	summary->max = FitsMath::NaN;
+	if ( r.right <= r.left || r.bottom <= r.top )
+		return true;
+
+	Double mean = 0.0;
+	Double m2 = 0.0;
+	for ( UInt i = 0; i < tiles.size(); i++ )
+		Accumulate( tiles[i], r, &summary->count, &mean, &m2 );
+	if ( summary->count == 0 )
+		return true;
+	summary->mean = mean;
+	summary->variance = m2 / summary->count;
+
+	//the blocks lying entirely inside the region; the last block of a row
+	//or column may be cut by the edge of the image
+	UInt bx0 = ( r.left + blockSize - 1 ) / blockSize;
+	UInt by0 = ( r.top + blockSize - 1 ) / blockSize;
+	UInt bx1 = ( (UInt)r.right == width ) ? blocksX : r.right / blockSize;
+	UInt by1 = ( (UInt)r.bottom == height ) ? blocksY : r.bottom / blockSize;
+
+	Float min = FloatMax;
+	Float max = -FloatMax;
+	if ( bx0 < bx1 && by0 < by1 )
+	{
+		BlockRange( bx0, by0, bx1, by1, &min, &max );
+
+		Int x0 = bx0 * blockSize;
+		Int y0 = by0 * blockSize;
+		Int x1 = std::min( (Int)( bx1 * blockSize ), r.right );
+		Int y1 = std::min( (Int)( by1 * blockSize ), r.bottom );
+		Scan( Rectangle( r.left, r.top, r.right, y0 ), &min, &max );
+		Scan( Rectangle( r.left, y1, r.right, r.bottom ), &min, &max );
+		Scan( Rectangle( r.left, y0, x0, y1 ), &min, &max );
+		Scan( Rectangle( x1, y0, r.right, y1 ), &min, &max );
+	}
+	else
+	{
+		Scan( r, &min, &max );
+	}
+	summary->min = min;
+	summary->max = max;
+
+	return true;
+}
+
+Void RegionStatistics::Accumulate( const Tile& tile, const Rectangle& region, 
+	UInt* count, Double* mean, Double* m2 ) const
+{
+	Int left = std::max( region.left, tile.bounds.left );
+	Int top = std::max( region.top, tile.bounds.top );
+	Int right = std::min( region.right, tile.bounds.right );
+	Int bottom = std::min( region.bottom, tile.bounds.bottom );
+	if ( right <= left || bottom <= top )
+		return;
+
+	UInt stride = tile.bounds.getWidth() + 1;
+	UInt x0 = left - tile.bounds.left;
+	UInt x1 = right - tile.bounds.left;
+	UInt i00 = ( top - tile.bounds.top ) * stride;
+	UInt i10 = ( bottom - tile.bounds.top ) * stride;
+
+	UInt n = ( right - left ) * ( bottom - top );
+	if ( !tile.counts.empty() )
+	{
+		const UInt* c = &tile.counts[0];
+		n = c[i10 + x1] - c[i10 + x0] - c[i00 + x1] + c[i00 + x0];
+	}
+	if ( n == 0 )
+		return;
+
+	const Float* s = &tile.sums[0];
+	const Float* q = &tile.squares[0];
+	Double sum = (Double)s[i10 + x1] - s[i10 + x0] - s[i00 + x1] + s[i00 + x0];
+	Double squares = (Double)q[i10 + x1] - q[i10 + x0] - q[i00 + x1] + q[i00 + x0]
+		+ tile.spread * n;
+
+	merge( count, mean, m2, n, tile.reference + sum / n, 
+		std::max( squares - sum * sum / n, 0.0 ) );
+}
+
+Void RegionStatistics::Scan( const Rectangle& region, Float* min, Float* max ) const
+{
+	for ( Int y = region.top; y < region.bottom; y++ )
+	{
+		const Float* row = &values[y * width];
+		for ( Int x = region.left; x < region.right; x++ )
+		{
+			//NaN fails both comparisons
+			if ( row[x] < *min ) *min = row[x];
+			if ( row[x] > *max ) *max = row[x];
+		}
+	}
+}
+
+Void RegionStatistics::BlockRange( UInt left, UInt top, UInt right, UInt bottom,
+	Float* min, Float* max ) const
+{
+	UInt kx = Log2( right - left );
+	UInt ky = Log2( bottom - top );
+	UInt x[] = { left, right - ( 1 << kx ) };
+	UInt y[] = { top, bottom - ( 1 << ky ) };
+
+	const Float* mins = Level( blockMin, kx, ky );
+	const Float* maxs = Level( blockMax, kx, ky );
+	for ( UInt j = 0; j < 2; j++ )
+	{
+		for ( UInt i = 0; i < 2; i++ )
+		{
+			UInt b = y[j] * blocksX + x[i];
+			*min = std::min( *min, mins[b] );
+			*max = std::max( *max, maxs[b] );
+		}
+	}
+}
+
+Float* RegionStatistics::Level( Vector<Float>& table, UInt kx, UInt ky )
+{
+	return &table[( kx * levelsY + ky ) * blocksX * blocksY];
+}
+
+const Float* RegionStatistics::Level( const Vector<Float>& table, UInt kx, UInt ky ) const
+{
+	return &table[( kx * levelsY + ky ) * blocksX * blocksY];
+}
+
+UInt RegionStatistics::Log2( UInt value )
+{
+	UInt log = 0;
+	while ( value >>= 1 )
+		log++;
+	return log;
+}
@@ -0,0 +1,442 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+/** @file
+    Implements the virtual image cube resampling an image onto the WCS pixel
+    grid of another. This file implements the class 
+    Engine::ReprojectedImageCube.
+*/
+
+#include "ReprojectedImageCube.hpp"
+#include "FitsEngine.h"
+#include "FitsMath.h"
+#include "Parallelism.h"
+#include "Instrumentation.h"
+#include "Exception.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <string.h>
+
+#ifdef USE_TBB
+	#include <tbb/parallel_for.h>
+	#include <tbb/blocked_range.h>
+#endif
+
+using std::string;
+using std::ostream;
+using std::vector;
+using std::numeric_limits;
+
+using FitsLiberator::Rectangle;
+using FitsLiberator::Engine::ImageCube;
+using FitsLiberator::Engine::FitsEngine;
+using FitsLiberator::Engine::Parallelism;
+using FitsLiberator::Engine::BusyTimer;
+using FitsLiberator::Engine::Stretch;
+using FitsLiberator::Engine::WcsMapper;
+using FitsLiberator::Engine::ReprojectedImageCube;
+
+namespace {
+	/** Number of blocks whose coordinates are kept. */
+	const size_t cacheSize = 32;
+
+	const double pi = 3.14159265358979323846;
+
+	/** Interpolates between the 2 x 2 nearest pixels. */
+	struct BilinearKernel {
+		enum { taps = 2, first = 0 };
+
+		static inline void Weights(double f, double* w) {
+			w[0] = 1.0 - f;
+			w[1] = f;
+		}
+	};
+
+	/** Interpolates with the Lanczos kernel of three lobes, 
+		sinc(d) sinc(d / 3), over the 6 x 6 nearest pixels. */
+	struct LanczosKernel {
+		enum { taps = 6, first = -2 };
+
+		static inline void Weights(double f, double* w) {
+			// cos(k pi / 3) and sin(k pi / 3) for the taps k = -2..3
+			static const double cosk[taps] = { -0.5, 0.5, 1.0, 0.5, -0.5, -1.0 };
+			static const double sink[taps] = { -0.86602540378443865, -0.86602540378443865, 0.0, 
+				0.86602540378443865, 0.86602540378443865, 0.0 };
+
+			if( f < 1e-9 ) {
+				for( int k = 0; k < taps; k++ )
+					w[k] = (k == -first) ? 1.0 : 0.0;
+				return;
+			}
+
+			// The sines of all taps follow from those of the fraction:
+			// sin(pi (f - k)) = (-1)^k sin(pi f) and 
+			// sin(pi (f - k) / 3) = sin(a) cos(k pi / 3) - cos(a) sin(k pi / 3)
+			double a = pi * f / 3.0;
+			double sinf = sin(3.0 * a);
+			double sina = sin(a);
+			double cosa = cos(a);
+			double sum = 0.0;
+
+			for( int k = 0; k < taps; k++ ) {
+				double d = f - (k + first);
+				double sign = ((k + first) & 1) ? -1.0 : 1.0;
+				w[k] = 3.0 * sign * sinf * (sina * cosk[k] - cosa * sink[k]) 
+					/ (pi * pi * d * d);
+				sum += w[k];
+			}
+			for( int k = 0; k < taps; k++ )
+				w[k] /= sum;
+		}
+	};
+
+	/** Resamples rows of a block from the source window. */
+	template<typename Kernel>
+	struct Resampler {
+		const ReprojectedImageCube::Coordinates&	coordinates;
+		const double*								window;
+		double*										out;
+
+		Resampler(const ReprojectedImageCube::Coordinates& c, const double* w, double* o)
+			: coordinates(c), window(w), out(o) {}
+
+		void Rows(int begin, int end) const {
+			BusyTimer busy;
+			const double nan = numeric_limits<double>::quiet_NaN();
+			const int width = coordinates.bounds.getWidth();
+			const int windowLeft = coordinates.window.left;
+			const int windowTop = coordinates.window.top;
+			const int windowWidth = coordinates.window.getWidth();
+			const int windowHeight = coordinates.window.getHeight();
+
+			double wx[Kernel::taps];
+			double wy[Kernel::taps];
+			int columns[Kernel::taps];
+
+			for( int row = begin; row < end; row++ ) {
+				for( int i = row * width; i < (row + 1) * width; i++ ) {
+					double x = coordinates.x[i];
+					double y = coordinates.y[i];
+					if( x != x || y != y ) {
+						out[i] = nan;
+						continue;
+					}
+
+					double fx = floor(x);
+					double fy = floor(y);
+					Kernel::Weights(x - fx, wx);
+					Kernel::Weights(y - fy, wy);
+
+					// Taps beyond the edge of the source repeat the edge
+					int left = (int)fx + Kernel::first - windowLeft;
+					int top = (int)fy + Kernel::first - windowTop;
+					for( int k = 0; k < Kernel::taps; k++ )
+						columns[k] = std::min(std::max(left + k, 0), windowWidth - 1);
+
+					double value = 0.0;
+					for( int j = 0; j < Kernel::taps; j++ ) {
+						int r = std::min(std::max(top + j, 0), windowHeight - 1);
+						const double* line = window + (size_t)r * windowWidth;
+						double sum = 0.0;
+						for( int k = 0; k < Kernel::taps; k++ )
+							sum += wx[k] * line[columns[k]];
+						value += wy[j] * sum;
+					}
+					out[i] = value;
+				}
+			}
+		}
+
+#ifdef USE_TBB
+		void operator()(const tbb::blocked_range<int>& range) const {
+			Rows(range.begin(), range.end());
+		}
+#endif
+	};
+
+	template<typename Kernel>
+	void resample(const ReprojectedImageCube::Coordinates& coordinates, const double* window, 
+		double* out, Parallelism::PixelCost cost) {
+		Resampler<Kernel> body(coordinates, window, out);
+		int rows = coordinates.bounds.getHeight();
+
+		if( !Parallelism::Worth(coordinates.bounds.getArea(), cost) ) {
+			body.Rows(0, rows);
+			return;
+		}
+#ifdef USE_TBB
+		int width = coordinates.bounds.getWidth();
+		int grain = std::max(1, (int)Parallelism::Grain(cost) / std::max(width, 1));
+		Parallelism::Initialize();
+		tbb::parallel_for(tbb::blocked_range<int>(0, rows, grain), body, tbb::auto_partitioner());
+#else
+		#ifdef USE_OPENMP
+			#pragma omp parallel for
+		#endif // USE_OPENMP
+		for( int row = 0; row < rows; row++ )
+			body.Rows(row, row + 1);
+#endif
+	}
+}
+
+ReprojectedImageCube::ReprojectedImageCube(const ImageCube* s, const ImageCube* reference, Resampling r)
+  : super(reference->Width(), reference->Height(), s->Planes(), ImageCube::Float64, s->Owner()),
+	source(s), sourceWcs(s), grid(reference), rowOrder(reference->RowOrder()), resampling(r) {
+	if( !sourceWcs.Valid() || !grid.Valid() )
+		throw FitsLiberator::Exception("The images have no WCS coordinates");
+}
+
+ReprojectedImageCube::ReprojectedImageCube(const ImageCube* s, const WcsMapper& g, 
+	size_type width, size_type height, Resampling r)
+  : super(width, height, s->Planes(), ImageCube::Float64, s->Owner()),
+	source(s), sourceWcs(s), grid(g), rowOrder(s->RowOrder()), resampling(r) {
+	if( !sourceWcs.Valid() || !grid.Valid() )
+		throw FitsLiberator::Exception("The images have no WCS coordinates");
+}
+
+const WcsMapper&
+ReprojectedImageCube::Grid() const {
+	return grid;
+}
+
+const ImageCube*
+ReprojectedImageCube::Source() const {
+	return source;
+}
+
+ReprojectedImageCube::CoordinatesPointer
+ReprojectedImageCube::Map(const Rectangle& bounds) const {
+	{
+		boost::mutex::scoped_lock lock(cacheMutex);
+		for( std::list<CoordinatesPointer>::iterator i = cache.begin(); i != cache.end(); ++i ) {
+			const Rectangle& b = (*i)->bounds;
+			if( b.left == bounds.left && b.top == bounds.top 
+				&& b.right == bounds.right && b.bottom == bounds.bottom ) {
+				CoordinatesPointer coordinates = *i;
+				cache.erase(i);
+				cache.push_front(coordinates);
+				return coordinates;
+			}
+		}
+	}
+
+	// Blocks read at the same time by different threads may both be
+	// transformed, which is harmless
+	CoordinatesPointer coordinates = Transform(bounds);
+
+	boost::mutex::scoped_lock lock(cacheMutex);
+	cache.push_front(coordinates);
+	if( cache.size() > cacheSize )
+		cache.pop_back();
+	return coordinates;
+}
+
+/**
+ * Maps the pixels of a block to the source, one row at a time: from the 
+ * grid to WCS coordinates and on to the pixels of the source.
+ */
+ReprojectedImageCube::CoordinatesPointer
+ReprojectedImageCube::Transform(const Rectangle& bounds) const {
+	const double nan = numeric_limits<double>::quiet_NaN();
+	const size_type width = bounds.getWidth();
+	const double sourceWidth = source->Width();
+	const double sourceHeight = source->Height();
+
+	Coordinates* coordinates = new Coordinates;
+	CoordinatesPointer pointer(coordinates);
+	coordinates->bounds = bounds;
+	coordinates->x.resize(bounds.getArea());
+	coordinates->y.resize(bounds.getArea());
+
+	vector<double> ra(width);
+	vector<double> dec(width);
+
+	int first = (resampling == Lanczos3) ? (int)LanczosKernel::first : (int)BilinearKernel::first;
+	int taps = (resampling == Lanczos3) ? (int)LanczosKernel::taps : (int)BilinearKernel::taps;
+	int left = source->Width();
+	int top = source->Height();
+	int right = 0;
+	int bottom = 0;
+
+	for( Int row = bounds.top; row < bounds.bottom; row++ ) {
+		double* x = &coordinates->x[(row - bounds.top) * width];
+		double* y = &coordinates->y[(row - bounds.top) * width];
+
+		// FITS pixel coordinates start at 1
+		grid.MapRow(bounds.left + 1, row + 1, width, &ra[0], &dec[0]);
+		sourceWcs.Unmap(&ra[0], &dec[0], width, x, y);
+
+		for( size_type i = 0; i < width; i++ ) {
+			double sx = x[i] - 1.0;
+			double sy = y[i] - 1.0;
+			// NaN fails the comparisons as well
+			if( !(sx >= -0.5 && sx <= sourceWidth - 0.5 && sy >= -0.5 && sy <= sourceHeight - 0.5) ) {
+				x[i] = y[i] = nan;
+				continue;
+			}
+			x[i] = sx;
+			y[i] = sy;
+
+			int fx = (int)floor(sx) + first;
+			int fy = (int)floor(sy) + first;
+			left = std::min(left, fx);
+			top = std::min(top, fy);
+			right = std::max(right, fx + taps);
+			bottom = std::max(bottom, fy + taps);
+		}
+	}
+
+	// The window is limited to the source, taps beyond it repeat the edge
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, (int)source->Width());
+	bottom = std::min(bottom, (int)source->Height());
+	if( left < right && top < bottom )
+		coordinates->window = Rectangle(left, top, right, bottom);
+	else
+		coordinates->window = Rectangle(0, 0, 0, 0);
+
+	return pointer;
+}
+
+bool
+ReprojectedImageCube::NeedsNullMap() const {
+	return true;
+}
+
+string
+ReprojectedImageCube::Property(const string& name) const {
+	return source->Property(name);
+}
+
+void
+ReprojectedImageCube::Properties(ostream& stream, const string& prefix) const {
+	source->Properties(stream, prefix);
+}
+
+bool
+ReprojectedImageCube::NumericProperty(const string& name, double* out) const {
+	return source->NumericProperty(name, out);
+}
+
+ImageCube::RowOrdering
+ReprojectedImageCube::RowOrder() const {
+	return rowOrder;
+}
+
+void
+ReprojectedImageCube::Read(ImageCube::size_type plane, const Rectangle& bounds, void* buffer) const {
+	Read(plane, bounds, buffer, NULL);
+}
+
+bool
+ReprojectedImageCube::Read(ImageCube::size_type plane, const Rectangle& bounds, 
+						   void* buffer, unsigned char* nullMap) const {
+	CoordinatesPointer coordinates = Map(bounds);
+	const Rectangle& window = coordinates->window;
+	const size_type count = bounds.getArea();
+	double* out = (double*)buffer;
+
+	if( window.getArea() == 0 ) {
+		std::fill(out, out + count, numeric_limits<double>::quiet_NaN());
+	} else {
+		// The part of the source the block needs, converted to doubles with
+		// its null pixels set to NaN by a linear stretch of unit scale
+		const size_type windowCount = window.getArea();
+		vector<unsigned char> raw(source->SizeOf(window.getWidth(), window.getHeight()));
+		vector<unsigned char> nulls;
+		vector<double> samples(windowCount);
+		bool hasNulls = false;
+
+		if( source->NeedsNullMap() ) {
+			nulls.resize(NullMapSize(windowCount));
+			hasNulls = source->Read(plane, window, &raw[0], &nulls[0]);
+		} else {
+			source->Read(plane, window, &raw[0]);
+		}
+
+		Stretch identity;
+		identity.scaleBackground = 0.0;
+		FitsEngine::stretch(identity, source->Format(), &raw[0], 
+			hasNulls ? &nulls[0] : NULL, &samples[0], windowCount, 1);
+
+		if( resampling == Lanczos3 )
+			resample<LanczosKernel>(*coordinates, &samples[0], out, Parallelism::costTranscendental);
+		else
+			resample<BilinearKernel>(*coordinates, &samples[0], out, Parallelism::costRoot);
+	}
+
+	bool hasNulls = false;
+	if( nullMap != NULL )
+		memset(nullMap, 0, NullMapSize(count));
+	for( size_type i = 0; i < count; i++ ) {
+		if( out[i] != out[i] ) {
+			hasNulls = true;
+			if( nullMap == NULL )
+				break;
+			nullMap[i >> 3] |= (unsigned char)(1 << (i & 7));
+		}
+	}
+	return hasNulls;
+}
+
+void
+ReprojectedImageCube::Read(ImageCube::size_type plane, void* buffer) const {
+	Read(plane, Rectangle(0, 0, Width(), Height()), buffer, NULL);
+}
+
+bool
+ReprojectedImageCube::Read(ImageCube::size_type plane, void* buffer, unsigned char* nullMap) const {
+	return Read(plane, Rectangle(0, 0, Width(), Height()), buffer, nullMap);
+}
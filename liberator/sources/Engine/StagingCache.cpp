@@ -0,0 +1,632 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Contains definitions for the wrapper layer above the 3rd party I/O library
+    CFITSIO. This file implements the class Engine::StagingCache. */
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fitsio.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#ifdef WINDOWS
+	#include <windows.h>
+	#include <sys/utime.h>
+#else
+	#include <dirent.h>
+	#include <unistd.h>
+	#include <utime.h>
+#endif
+
+#include "StagingCache.hpp"
+
+using std::string;
+using std::map;
+using std::vector;
+
+using FitsLiberator::Engine::StagingCache;
+
+// fitsio2.h cannot be included from C++, so the driver registration 
+// function is declared here.
+extern "C" int fits_register_driver(char* prefix,
+	int (*init)(void),
+	int (*shutdown)(void),
+	int (*setoptions)(int option),
+	int (*getoptions)(int* options),
+	int (*getversion)(int* version),
+	int (*checkfile)(char* urltype, char* infile, char* outfile),
+	int (*open)(char* filename, int rwmode, int* driverhandle),
+	int (*create)(char* filename, int* driverhandle),
+	int (*truncate)(int driverhandle, LONGLONG filesize),
+	int (*close)(int driverhandle),
+	int (*fremove)(char* filename),
+	int (*size)(int driverhandle, LONGLONG* size),
+	int (*flush)(int driverhandle),
+	int (*seek)(int driverhandle, LONGLONG offset),
+	int (*read)(int driverhandle, void* buffer, long nbytes),
+	int (*write)(int driverhandle, void* buffer, long nbytes));
+
+const char StagingCache::Prefix[] = "staged://";
+
+namespace {
+	/** Size of the reads from the original file. */
+	const size_t chunkSize = 1 << 23;
+	/** Extension of the copies in the cache directory. */
+	const char extension[] = ".stage";
+
+	/** A file that is, or has been, staged in this session. */
+	struct Entry {
+		string	source;			///< Name of the original file.
+		string	path;			///< Name of the copy.
+		Int64	size;			///< Size of the original file.
+		Int64	staged;			///< Number of bytes written to the copy so far.
+		bool	done;			///< The copy is complete.
+		bool	failed;			///< The copy was canceled or could not be written.
+		bool	cancel;			///< Asks the worker to stop.
+		UInt	generation;		///< Incremented each time the file is staged again.
+		boost::thread* worker;
+	};
+
+	/** Entries by name of the original file. */
+	map<string, Entry*> entries;
+	/** Workers of entries that have been staged again. */
+	vector<boost::thread*> retired;
+	boost::mutex cacheLock;
+
+	string cacheDirectory;
+	Int64 sizeLimit = (Int64)2048 << 20;
+	Int64 throttle = 0;
+	bool (*slowPathTest)(const string&) = NULL;
+
+	int SeekFile(FILE* file, Int64 offset) {
+	#ifdef WINDOWS
+		return _fseeki64(file, offset, SEEK_SET);
+	#else
+		return fseeko(file, (off_t)offset, SEEK_SET);
+	#endif
+	}
+
+	bool Status(const string& path, Int64& size, Int64& modified) {
+	#ifdef WINDOWS
+		struct _stati64 status;
+		if( _stati64(path.c_str(), &status) != 0 )
+			return false;
+	#else
+		struct stat status;
+		if( stat(path.c_str(), &status) != 0 )
+			return false;
+	#endif
+		size = (Int64)status.st_size;
+		modified = (Int64)status.st_mtime;
+		return true;
+	}
+
+	/** Marks a copy as recently used. */
+	void Touch(const string& path) {
+	#ifdef WINDOWS
+		_utime(path.c_str(), NULL);
+	#else
+		utime(path.c_str(), NULL);
+	#endif
+	}
+
+	/** Waits long enough for a read of count bytes to stay below the 
+		throttled rate. */
+	void Throttle(size_t count) {
+		if( throttle <= 0 )
+			return;
+		Int64 milliseconds = (Int64)count * 1000 / throttle;
+	#ifdef WINDOWS
+		::Sleep((DWORD)milliseconds);
+	#else
+		for( ; milliseconds > 0; milliseconds -= 500 )
+			usleep((useconds_t)(std::min(milliseconds, (Int64)500) * 1000));
+	#endif
+	}
+
+	/** 64-bit FNV-1a hash, used to give copies of equally named files
+		in different directories distinct names. */
+	UInt64 Hash(const string& text) {
+		UInt64 hash = 14695981039346656037ULL;
+		for( string::size_type i = 0; i < text.size(); i++ ) {
+			hash ^= (unsigned char)text[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	string CacheFile(const string& name) {
+		string path = cacheDirectory;
+		char last = path[path.size() - 1];
+		if( last != '/' && last != '\\' ) {
+		#ifdef WINDOWS
+			path += '\\';
+		#else
+			path += '/';
+		#endif
+		}
+		return path + name;
+	}
+
+	/** Name of the copy of a file with the given size and modification time. */
+	string CachePath(const string& filename, Int64 size, Int64 modified) {
+		string::size_type separator = filename.find_last_of("/\\");
+		string name = (separator == string::npos) ? filename : filename.substr(separator + 1);
+
+		char key[64];
+		sprintf(key, "|%lld|%lld", (long long)size, (long long)modified);
+		char hash[17];
+		sprintf(hash, "%016llx", (unsigned long long)Hash(filename + key));
+
+		return CacheFile(name + "." + hash + extension);
+	}
+
+	/** A copy found in the cache directory. */
+	struct CachedFile {
+		string	path;
+		Int64	size;
+		Int64	used;
+
+		bool operator<(const CachedFile& rhs) const {
+			return used < rhs.used;
+		}
+	};
+
+	/** Lists the copies in the cache directory. */
+	void ListCache(vector<CachedFile>& files) {
+	#ifdef WINDOWS
+		WIN32_FIND_DATA data;
+		HANDLE find = ::FindFirstFile(CacheFile(string("*") + extension).c_str(), &data);
+		if( find == INVALID_HANDLE_VALUE )
+			return;
+		do {
+			CachedFile file;
+			file.path = CacheFile(data.cFileName);
+			file.size = ((Int64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+			file.used = ((Int64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+			files.push_back(file);
+		} while( ::FindNextFile(find, &data) );
+		::FindClose(find);
+	#else
+		DIR* directory = opendir(cacheDirectory.c_str());
+		if( directory == NULL )
+			return;
+		size_t length = strlen(extension);
+		for( struct dirent* item = readdir(directory); item != NULL; item = readdir(directory) ) {
+			string name = item->d_name;
+			if( name.size() <= length || name.compare(name.size() - length, length, extension) != 0 )
+				continue;
+			CachedFile file;
+			file.path = CacheFile(name);
+			if( Status(file.path, file.size, file.used) )
+				files.push_back(file);
+		}
+		closedir(directory);
+	#endif
+	}
+
+	/** Deletes the least recently used copies until the cache is within its
+		size limit. Copies being written are kept. */
+	void Evict() {
+		vector<CachedFile> files;
+		ListCache(files);
+		std::sort(files.begin(), files.end());
+
+		Int64 total = 0;
+		for( size_t i = 0; i < files.size(); i++ )
+			total += files[i].size;
+
+		boost::mutex::scoped_lock guard(cacheLock);
+		for( size_t i = 0; i < files.size() && total > sizeLimit; i++ ) {
+			bool active = false;
+			for( map<string, Entry*>::const_iterator it = entries.begin(); it != entries.end(); ++it ) {
+				if( it->second->path == files[i].path && !it->second->done && !it->second->failed )
+					active = true;
+			}
+			// Copies still opened by a reader cannot be deleted on Windows.
+			if( !active && remove(files[i].path.c_str()) == 0 )
+				total -= files[i].size;
+		}
+	}
+
+	/** Body of the background thread copying a file to the cache. */
+	void Stage(Entry* entry) {
+		string source, path;
+		{
+			boost::mutex::scoped_lock guard(cacheLock);
+			source = entry->source;
+			path = entry->path;
+		}
+		FILE* input = fopen(source.c_str(), "rb");
+		FILE* output = fopen(path.c_str(), "wb");
+		bool ok = (input != NULL && output != NULL);
+
+		if( ok ) {
+			setvbuf(input, NULL, _IONBF, 0);
+			vector<char> chunk(chunkSize);
+			while( true ) {
+				{
+					boost::mutex::scoped_lock guard(cacheLock);
+					if( entry->cancel ) {
+						ok = false;
+						break;
+					}
+				}
+				size_t count = fread(&chunk[0], 1, chunk.size(), input);
+				if( count == 0 )
+					break;
+				Throttle(count);
+				// Readers only look at the staged bytes after they are flushed.
+				if( fwrite(&chunk[0], 1, count, output) != count || fflush(output) != 0 ) {
+					ok = false;
+					break;
+				}
+				boost::mutex::scoped_lock guard(cacheLock);
+				entry->staged += count;
+			}
+		}
+		if( input != NULL )
+			fclose(input);
+		if( output != NULL )
+			fclose(output);
+
+		{
+			boost::mutex::scoped_lock guard(cacheLock);
+			if( ok && entry->staged == entry->size ) {
+				entry->done = true;
+			} else {
+				entry->failed = true;
+				entry->staged = 0;
+			}
+		}
+		if( ok )
+			Evict();
+		else
+			remove(path.c_str());
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CFITSIO driver
+//-----------------------------------------------------------------------------
+
+namespace {
+	/** Open file of the "staged://" driver. */
+	struct DriverHandle {
+		string	name;		///< Name of the original file, the key of its entry.
+		string	path;		///< Name of the copy of the file as it was opened.
+		FILE*	source;		///< The original file.
+		FILE*	copy;		///< The copy, opened on the first staged read.
+		UInt	generation;	///< Staging run the copy was opened during.
+		Int64	size;
+		Int64	position;
+	};
+
+	vector<DriverHandle> handles;
+	boost::mutex handleLock;
+	bool driverRegistered = false;
+	bool driverAttempted = false;
+
+	int DriverInit() {
+		return 0;
+	}
+
+	int DriverShutdown() {
+		return 0;
+	}
+
+	int DriverSetOptions(int) {
+		return 0;
+	}
+
+	int DriverGetOptions(int* options) {
+		*options = 0;
+		return 0;
+	}
+
+	int DriverGetVersion(int* version) {
+		*version = 10;
+		return 0;
+	}
+
+	int DriverOpen(char* filename, int rwmode, int* handle) {
+		if( rwmode != READONLY )
+			return READONLY_FILE;
+
+		DriverHandle entry = { filename, "", NULL, NULL, 0, 0, 0 };
+		Int64 modified;
+		if( !Status(filename, entry.size, modified) )
+			return FILE_NOT_OPENED;
+		entry.source = fopen(filename, "rb");
+		if( entry.source == NULL )
+			return FILE_NOT_OPENED;
+		{
+			// Only a copy of the file as it is now is read from.
+			boost::mutex::scoped_lock guard(cacheLock);
+			if( !cacheDirectory.empty() )
+				entry.path = CachePath(filename, entry.size, modified);
+		}
+
+		boost::mutex::scoped_lock guard(handleLock);
+		for( size_t i = 0; i < handles.size(); i++ ) {
+			if( handles[i].source == NULL ) {
+				handles[i] = entry;
+				*handle = (int)i;
+				return 0;
+			}
+		}
+		handles.push_back(entry);
+		*handle = (int)handles.size() - 1;
+		return 0;
+	}
+
+	int DriverClose(int handle) {
+		boost::mutex::scoped_lock guard(handleLock);
+		fclose(handles[handle].source);
+		if( handles[handle].copy != NULL )
+			fclose(handles[handle].copy);
+		handles[handle].source = NULL;
+		handles[handle].copy = NULL;
+		handles[handle].name.clear();
+		handles[handle].path.clear();
+		return 0;
+	}
+
+	int DriverSize(int handle, LONGLONG* size) {
+		boost::mutex::scoped_lock guard(handleLock);
+		*size = handles[handle].size;
+		return 0;
+	}
+
+	int DriverFlush(int) {
+		return 0;
+	}
+
+	int DriverSeek(int handle, LONGLONG offset) {
+		boost::mutex::scoped_lock guard(handleLock);
+		handles[handle].position = offset;
+		return 0;
+	}
+
+	int DriverRead(int handle, void* buffer, long nbytes) {
+		DriverHandle current;
+		{
+			boost::mutex::scoped_lock guard(handleLock);
+			current = handles[handle];
+		}
+		if( current.position + nbytes > current.size )
+			return END_OF_FILE;
+
+		Int64 staged = 0;
+		UInt generation = 0;
+		{
+			boost::mutex::scoped_lock guard(cacheLock);
+			map<string, Entry*>::const_iterator it = entries.find(current.name);
+			if( it != entries.end() && it->second->path == current.path ) {
+				staged = it->second->staged;
+				generation = it->second->generation;
+			}
+		}
+
+		// Ranges that have been staged are read from the local copy. A copy
+		// that has been staged again since it was opened is a new file.
+		FILE* file = NULL;
+		if( current.position + nbytes <= staged ) {
+			if( current.copy == NULL || current.generation != generation ) {
+				if( current.copy != NULL )
+					fclose(current.copy);
+				current.copy = fopen(current.path.c_str(), "rb");
+				current.generation = generation;
+				boost::mutex::scoped_lock guard(handleLock);
+				handles[handle].copy = current.copy;
+				handles[handle].generation = generation;
+			}
+			file = current.copy;
+		}
+		if( file == NULL ) {
+			Throttle(nbytes);
+			file = current.source;
+		}
+
+		if( SeekFile(file, current.position) != 0 
+			|| fread(buffer, 1, nbytes, file) != (size_t)nbytes )
+			return READ_ERROR;
+
+		boost::mutex::scoped_lock guard(handleLock);
+		handles[handle].position = current.position + nbytes;
+		return 0;
+	}
+}
+
+bool
+StagingCache::RegisterDriver() {
+	boost::mutex::scoped_lock guard(handleLock);
+	if( !driverAttempted ) {
+		driverAttempted = true;
+		driverRegistered = 0 == fits_register_driver(const_cast<char*>(Prefix),
+			DriverInit, DriverShutdown, DriverSetOptions, DriverGetOptions,
+			DriverGetVersion, NULL, DriverOpen, NULL, NULL, DriverClose, 
+			NULL, DriverSize, DriverFlush, DriverSeek, DriverRead, NULL);
+	}
+	return driverRegistered;
+}
+
+//-----------------------------------------------------------------------------
+// StagingCache
+//-----------------------------------------------------------------------------
+
+void
+StagingCache::SetCacheDirectory(const string& directory) {
+	boost::mutex::scoped_lock guard(cacheLock);
+	cacheDirectory = directory;
+}
+
+void
+StagingCache::SetSizeLimit(Int64 bytes) {
+	boost::mutex::scoped_lock guard(cacheLock);
+	sizeLimit = bytes;
+}
+
+void
+StagingCache::SetSlowPathTest(bool (*test)(const string&)) {
+	boost::mutex::scoped_lock guard(cacheLock);
+	slowPathTest = test;
+}
+
+void
+StagingCache::SetThrottle(Int64 bytesPerSecond) {
+	throttle = bytesPerSecond;
+}
+
+string
+StagingCache::Lookup(const string& filename) {
+	// The slow path test and the status of the original may both go to the
+	// network, so they are done without holding the lock.
+	bool (*test)(const string&) = NULL;
+	{
+		boost::mutex::scoped_lock guard(cacheLock);
+		if( !cacheDirectory.empty() )
+			test = slowPathTest;
+	}
+	Int64 size, modified;
+	if( test == NULL || !test(filename) || !Status(filename, size, modified) )
+		return filename;
+
+	boost::mutex::scoped_lock guard(cacheLock);
+	if( cacheDirectory.empty() )
+		return filename;
+	string path = CachePath(filename, size, modified);
+
+	Entry* entry = NULL;
+	map<string, Entry*>::iterator it = entries.find(filename);
+	if( it != entries.end() ) {
+		entry = it->second;
+		// Still being copied.
+		if( !entry->done && !entry->failed )
+			return filename;
+		// Copies that failed are not retried in the same session, unless
+		// they were canceled by Shutdown.
+		if( entry->failed && entry->worker != NULL && entry->path == path )
+			return filename;
+	}
+
+	// A complete copy, possibly from an earlier session.
+	Int64 copySize, copyModified;
+	if( Status(path, copySize, copyModified) && copySize == size ) {
+		Touch(path);
+		return path;
+	}
+	if( size > sizeLimit )
+		return filename;
+
+	if( entry == NULL ) {
+		entry = new Entry();
+		entry->generation = 0;
+		entries[filename] = entry;
+	} else if( entry->worker != NULL ) {
+		// The worker may still be evicting, it is joined by Shutdown.
+		retired.push_back(entry->worker);
+	}
+	entry->source = filename;
+	entry->path = path;
+	entry->size = size;
+	entry->staged = 0;
+	entry->done = false;
+	entry->failed = false;
+	entry->cancel = false;
+	entry->generation++;
+	entry->worker = new boost::thread(boost::bind(&Stage, entry));
+	return filename;
+}
+
+bool
+StagingCache::IsStaging(const string& filename) {
+	boost::mutex::scoped_lock guard(cacheLock);
+	map<string, Entry*>::const_iterator it = entries.find(filename);
+	return it != entries.end() && !it->second->done && !it->second->failed;
+}
+
+void
+StagingCache::Shutdown() {
+	vector<boost::thread*> workers;
+	{
+		boost::mutex::scoped_lock guard(cacheLock);
+		for( map<string, Entry*>::iterator it = entries.begin(); it != entries.end(); ++it ) {
+			if( it->second->worker != NULL ) {
+				it->second->cancel = true;
+				workers.push_back(it->second->worker);
+				it->second->worker = NULL;
+			}
+		}
+		workers.insert(workers.end(), retired.begin(), retired.end());
+		retired.clear();
+	}
+	for( size_t i = 0; i < workers.size(); i++ ) {
+		workers[i]->join();
+		delete workers[i];
+	}
+
+	// Open driver handles find their entry by name, so none refer to these.
+	boost::mutex::scoped_lock guard(cacheLock);
+	for( map<string, Entry*>::iterator it = entries.begin(); it != entries.end(); ++it )
+		delete it->second;
+	entries.clear();
+}
@@ -102,6 +102,7 @@ Stretch::Stretch() {
     whiteLevel		= 0;
     outputMax		= 255;
 	peakLevel		= kFITSDefaultRescaleFactor;
+	precision		= precisionExact;
 	//scalePeakLevel	= kFITSDefa
 }
 
@@ -110,6 +111,7 @@ Int Stretch::operator!=(const Stretch& rhs) {
     return (
         function   != rhs.function   ||
         scale      != rhs.scale      ||
-        offset     != rhs.offset
+        offset     != rhs.offset     ||
+        precision  != rhs.precision
     );
 }
\ No newline at end of file
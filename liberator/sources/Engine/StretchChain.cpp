@@ -0,0 +1,386 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "StretchChain.h"
+#include "StretchKernels.h"
+#include "FitsMath.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace FitsLiberator::Engine;
+
+namespace
+{
+	/** Number of values the derivative of a chain is evaluated for at a time. */
+	const UInt derivativeBlock = 256;
+
+	/** Applies the inverse of a step to an array of values in place. */
+	Void inverseStep( const StretchChain::Step& step, Double* values, UInt count )
+	{
+		Double a = step.a;
+		Double b = step.b;
+
+		switch ( step.operation )
+		{
+			case StretchChain::operationAffine:
+				for ( UInt i = 0; i < count; i++ )
+					values[i] = ( values[i] - b ) / a;
+				break;
+			case StretchChain::operationLog:
+				for ( UInt i = 0; i < count; i++ )
+					values[i] = ::pow( 10.0, values[i] ) - 1;
+				break;
+			case StretchChain::operationAsinh:
+				for ( UInt i = 0; i < count; i++ )
+					values[i] = ::sinh( values[i] );
+				break;
+			case StretchChain::operationPower:
+				for ( UInt i = 0; i < count; i++ )
+					values[i] = FitsMath::signof( values[i] ) * ::pow( ::fabs( values[i] ), 1.0 / a );
+				break;
+			case StretchChain::operationRaise:
+				// odd powers are defined for negative values, so are their roots
+				if ( ::fmod( a, 2.0 ) == 1.0 )
+				{
+					for ( UInt i = 0; i < count; i++ )
+						values[i] = FitsMath::signof( values[i] ) * ::pow( ::fabs( values[i] ), 1.0 / a );
+				}
+				else
+				{
+					for ( UInt i = 0; i < count; i++ )
+						values[i] = ::pow( values[i], 1.0 / a );
+				}
+				break;
+			case StretchChain::operationExp:
+				for ( UInt i = 0; i < count; i++ )
+					values[i] = ::log( values[i] );
+				break;
+			case StretchChain::operationClip:
+				break;
+		}
+	}
+
+	/** Multiplies slopes by the derivative of a step at values and applies
+		the step to the values. */
+	Void derivativeStep( const StretchChain::Step& step, Double* values, Double* slopes, UInt count )
+	{
+		Double a = step.a;
+		Double b = step.b;
+
+		switch ( step.operation )
+		{
+			case StretchChain::operationAffine:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					slopes[i] *= a;
+					values[i] = a * values[i] + b;
+				}
+				break;
+			case StretchChain::operationLog:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					slopes[i] *= 1.0 / ( ( values[i] + 1 ) * 2.302585092994046 );
+					values[i] = ::log10( values[i] + 1 );
+				}
+				break;
+			case StretchChain::operationAsinh:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					Double root = ::sqrt( values[i] * values[i] + 1 );
+					slopes[i] *= 1.0 / root;
+					values[i] = ::log( values[i] + root );
+				}
+				break;
+			case StretchChain::operationPower:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					Double magnitude = ::fabs( values[i] );
+					slopes[i] *= a * ::pow( magnitude, a - 1 );
+					values[i] = FitsMath::signof( values[i] ) * ::pow( magnitude, a );
+				}
+				break;
+			case StretchChain::operationRaise:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					slopes[i] *= a * ::pow( values[i], a - 1 );
+					values[i] = ::pow( values[i], a );
+				}
+				break;
+			case StretchChain::operationExp:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					values[i] = ::exp( values[i] );
+					slopes[i] *= values[i];
+				}
+				break;
+			case StretchChain::operationClip:
+				for ( UInt i = 0; i < count; i++ )
+				{
+					if ( values[i] < a || values[i] > b )
+						slopes[i] = 0.0;
+					values[i] = ( values[i] < a ) ? a : ( ( values[i] > b ) ? b : values[i] );
+				}
+				break;
+		}
+	}
+}
+
+StretchChain::StretchChain()
+{
+	precision = precisionExact;
+}
+
+StretchChain::StretchChain( const Stretch& stretch )
+{
+	precision = stretch.precision;
+
+	// scale * ( x - offset ) + scaleBackground
+	Affine( stretch.scale, stretch.scaleBackground - stretch.scale * stretch.offset );
+
+	switch ( stretch.function )
+	{
+		case stretchLog:
+			Log();
+			break;
+		case stretchSqrt:
+			Power( 0.5 );
+			break;
+		case stretchLogSqrt:
+			Power( 0.5 ).Log();
+			break;
+		case stretchLogLog:
+			Log().Log();
+			break;
+		case stretchCubeR:
+			Power( 1.0/3.0 );
+			break;
+		case stretchAsinh:
+			Asinh();
+			break;
+		case stretchAsinhAsinh:
+			Asinh().Asinh();
+			break;
+		case stretchAsinhSqrt:
+			Power( 0.5 ).Asinh();
+			break;
+		case stretchRoot4:
+			Power( 0.25 );
+			break;
+		case stretchRoot5:
+			Power( 0.20 );
+			break;
+		case stretchPow15:
+			Raise( 1.5 );
+			break;
+		case stretchPow2:
+			Raise( 2.0 );
+			break;
+		case stretchPow3:
+			Raise( 3.0 );
+			break;
+		case stretchPow4:
+			Raise( 4.0 );
+			break;
+		case stretchPow5:
+			Raise( 5.0 );
+			break;
+		case stretchExp:
+			Exp();
+			break;
+		default:
+			break;
+	}
+}
+
+StretchChain& StretchChain::Append( Operation operation, Double a, Double b )
+{
+	Step step;
+	step.operation	= operation;
+	step.a			= a;
+	step.b			= b;
+	steps.push_back( step );
+	return *this;
+}
+
+StretchChain& StretchChain::Affine( Double a, Double b )
+{
+	return Append( operationAffine, a, b );
+}
+
+StretchChain& StretchChain::Log()
+{
+	return Append( operationLog, 0.0, 0.0 );
+}
+
+StretchChain& StretchChain::Asinh()
+{
+	return Append( operationAsinh, 0.0, 0.0 );
+}
+
+StretchChain& StretchChain::Power( Double exponent )
+{
+	return Append( operationPower, exponent, 0.0 );
+}
+
+StretchChain& StretchChain::Raise( Double exponent )
+{
+	return Append( operationRaise, exponent, 0.0 );
+}
+
+StretchChain& StretchChain::Exp()
+{
+	return Append( operationExp, 0.0, 0.0 );
+}
+
+StretchChain& StretchChain::Clip( Double low, Double high )
+{
+	return Append( operationClip, low, high );
+}
+
+Void StretchChain::SetPrecision( StretchPrecision p )
+{
+	precision = p;
+}
+
+StretchPrecision StretchChain::Precision() const
+{
+	return precision;
+}
+
+UInt StretchChain::Size() const
+{
+	return (UInt)steps.size();
+}
+
+const StretchChain::Step& StretchChain::operator[]( UInt index ) const
+{
+	return steps[index];
+}
+
+Double StretchChain::Forward( Double value ) const
+{
+	for ( Vector<Step>::const_iterator step = steps.begin(); step != steps.end(); step++ )
+	{
+		switch ( step->operation )
+		{
+			case operationAffine:
+				value = step->a * value + step->b;
+				break;
+			case operationLog:
+				value = ::log10( value + 1 );
+				break;
+			case operationAsinh:
+				value = ::log( value + ::sqrt( value * value + 1 ) );
+				break;
+			case operationPower:
+				value = FitsMath::signof( value ) * ::pow( ::fabs( value ), step->a );
+				break;
+			case operationRaise:
+				value = ::pow( value, step->a );
+				break;
+			case operationExp:
+				value = ::exp( value );
+				break;
+			case operationClip:
+				value = ( value < step->a ) ? step->a : ( ( value > step->b ) ? step->b : value );
+				break;
+		}
+	}
+	return value;
+}
+
+Double StretchChain::Inverse( Double value ) const
+{
+	Inverse( &value, &value, 1 );
+	return value;
+}
+
+Double StretchChain::Derivative( Double value ) const
+{
+	Double slope = 1.0;
+	Derivative( &value, &slope, 1 );
+	return slope;
+}
+
+Void StretchChain::Forward( const Double* in, Double* out, UInt count ) const
+{
+	if ( in != out )
+		::memcpy( out, in, count * sizeof( Double ) );
+	stretchSteps( *this, 0, out, (Int)count, 1 );
+}
+
+Void StretchChain::Inverse( const Double* in, Double* out, UInt count ) const
+{
+	if ( in != out )
+		::memcpy( out, in, count * sizeof( Double ) );
+	for ( Vector<Step>::const_reverse_iterator step = steps.rbegin(); step != steps.rend(); step++ )
+		inverseStep( *step, out, count );
+}
+
+Void StretchChain::Derivative( const Double* in, Double* out, UInt count ) const
+{
+	// the steps need the values they are applied to, which are carried
+	// through the chain a block at a time next to the slopes
+	Double values[derivativeBlock];
+
+	for ( UInt start = 0; start < count; start += derivativeBlock )
+	{
+		UInt size = std::min( derivativeBlock, count - start );
+		::memcpy( values, in + start, size * sizeof( Double ) );
+		std::fill( out + start, out + start + size, 1.0 );
+
+		for ( Vector<Step>::const_iterator step = steps.begin(); step != steps.end(); step++ )
+			derivativeStep( *step, values, out + start, size );
+	}
+}
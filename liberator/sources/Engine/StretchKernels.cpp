@@ -0,0 +1,204 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "StretchKernels.h"
+
+#include <math.h>
+#include <algorithm>
+
+
+using namespace FitsLiberator::Engine;
+
+namespace
+{
+    /** Number of pixels passed through a chain at a time. A block of this 
+        many doubles stays in the level 1 cache. */
+    const Int chainBlock = 1024;
+
+    template<typename Function>
+    inline void stretchBlock(Double* pixels, Int count, const Function& stretch) {
+        for(Int i = 0; i < count; i++) {
+            pixels[i] = stretch(pixels[i]);
+        }
+    }
+
+    /** Applies the steps of a chain from first on to a block of pixels. */
+    template<typename Math>
+    void stretchBlockSteps(const StretchChain& chain, UInt first, Double* pixels, Int count) {
+        const Identity identity;
+
+        for(UInt s = first; s < chain.Size(); s++) {
+            const StretchChain::Step& step = chain[s];
+            switch(step.operation) {
+                case StretchChain::operationAffine:
+                    stretchBlock(pixels, count, Linear(step.a, 0.0, step.b));
+                    break;
+                case StretchChain::operationLog:
+                    stretchBlock(pixels, count, Log<Math, Identity>(identity));
+                    break;
+                case StretchChain::operationAsinh:
+                    stretchBlock(pixels, count, AsinH<Math, Identity>(identity));
+                    break;
+                case StretchChain::operationPower:
+                    if( step.a == 0.5 )
+                        stretchBlock(pixels, count, Sqrt<Identity>(identity));
+                    else
+                        stretchBlock(pixels, count, Power<Math, Identity>(step.a, identity));
+                    break;
+                case StretchChain::operationRaise:
+                    // The approximate power is undefined for negative numbers,
+                    // which integer powers are defined for
+                    if( step.a == 2.0 )
+                        stretchBlock(pixels, count, Square<Identity>(identity));
+                    else if( step.a == ::floor(step.a) )
+                        stretchBlock(pixels, count, Raise<ExactMath, Identity>(step.a, identity));
+                    else
+                        stretchBlock(pixels, count, Raise<Math, Identity>(step.a, identity));
+                    break;
+                case StretchChain::operationExp:
+                    stretchBlock(pixels, count, Exp<Math, Identity>(identity));
+                    break;
+                case StretchChain::operationClip:
+                    stretchBlock(pixels, count, Clip<Identity>(step.a, step.b, identity));
+                    break;
+            }
+        }
+    }
+
+    /** Returns the cost of a pixel passing the steps of a chain from first 
+        on, see Parallelism. */
+    UInt chainCost(const StretchChain& chain, UInt first) {
+        UInt cost = 0;
+        for(UInt s = first; s < chain.Size(); s++) {
+            switch(chain[s].operation) {
+                case StretchChain::operationAffine:
+                    cost += Parallelism::costCopy;
+                    break;
+                case StretchChain::operationClip:
+                    cost += Parallelism::costCompare;
+                    break;
+                default:
+                    cost += Parallelism::costTranscendental;
+                    break;
+            }
+        }
+        return cost;
+    }
+
+#ifdef USE_TBB
+    /** Passes the blocks of a range through a chain, called by the TBB runtime. */
+    template<typename Math>
+    struct ChainStretcher {
+        const StretchChain& chain;
+        UInt                first;
+        Double*             pixels;
+        Int                 count;
+    public:
+        ChainStretcher(const StretchChain& c, UInt f, Double* p, Int n)
+          : chain(c), first(f), pixels(p), count(n) {}
+
+        void operator()(const tbb::blocked_range<Int>& range) const {
+            BusyTimer busy;
+            for(Int block = range.begin(); block != range.end(); ++block) {
+                Int start = block * chainBlock;
+                stretchBlockSteps<Math>(chain, first, pixels + start, std::min(chainBlock, count - start));
+            }
+        }
+    };
+
+    template<typename Math>
+    void stretchBlocks(const StretchChain& chain, UInt first, Double* pixels, Int count, Int /*nCpus*/) {
+        Int blocks = (count + chainBlock - 1) / chainBlock;
+        ChainStretcher<Math> body(chain, first, pixels, count);
+
+        if( !Parallelism::Worth(count, chainCost(chain, first)) ) {
+            body(tbb::blocked_range<Int>(0, blocks));
+            return;
+        }
+        Parallelism::Initialize();
+        tbb::parallel_for(tbb::blocked_range<Int>(0, blocks), body);
+    }
+#elif defined(USE_OPENMP)
+    template<typename Math>
+    void stretchBlocks(const StretchChain& chain, UInt first, Double* pixels, Int count, Int nCpus) {
+        Int blocks = (count + chainBlock - 1) / chainBlock;
+
+        #pragma omp parallel num_threads( nCpus ) if( Parallelism::Worth(count, chainCost(chain, first)) )
+        {
+            BusyTimer busy;
+            #pragma omp for
+            for(Int block = 0; block < blocks; block++) {
+                Int start = block * chainBlock;
+                stretchBlockSteps<Math>(chain, first, pixels + start, std::min(chainBlock, count - start));
+            }
+        }
+    }
+#else
+    template<typename Math>
+    void stretchBlocks(const StretchChain& chain, UInt first, Double* pixels, Int count, Int /*nCpus*/) {
+        for(Int start = 0; start < count; start += chainBlock) {
+            stretchBlockSteps<Math>(chain, first, pixels + start, std::min(chainBlock, count - start));
+        }
+    }
+#endif // USE_TBB
+}
+
+Void FitsLiberator::Engine::stretchFast(const Stretch& stretch, Double* pixels, Int count, Int nCpus) {
+    stretchWith<FastMath>(stretch, (const Double*)pixels, pixels, count, nCpus);
+}
+
+Void FitsLiberator::Engine::stretchSteps(const StretchChain& chain, UInt first, Double* pixels, Int count, Int nCpus) {
+    if( chain.Precision() == precisionFast )
+        stretchBlocks<FastMath>(chain, first, pixels, count, nCpus);
+    else
+        stretchBlocks<ExactMath>(chain, first, pixels, count, nCpus);
+}
@@ -0,0 +1,148 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+#include "StretchTable.h"
+
+#include <list>
+#include <boost/thread/mutex.hpp>
+
+using namespace FitsLiberator::Engine;
+
+namespace
+{
+	/** Number of tables kept by StretchTable::Insert. A few tables cover
+		the statistics and the preview of the current plane while the 
+		stretch is being changed. */
+	const UInt cacheSize = 4;
+
+	std::list<StretchTable::Pointer>	cache;
+	boost::mutex						cacheLock;
+}
+
+StretchTable::StretchTable( const Stretch& s, ImageCube::PixelFormat f, const ImageCube::Encoding* e )
+	: stretch( s ), format( f ), encoded( e != NULL ), values( Entries( f ) )
+{
+	if ( encoded )
+		encoding = *e;
+}
+
+UInt StretchTable::Entries( ImageCube::PixelFormat format )
+{
+	switch ( format )
+	{
+		case ImageCube::Unsigned8:
+		case ImageCube::Signed8:
+			return 1 << 8;
+		case ImageCube::Signed16:
+		case ImageCube::Unsigned16:
+			return 1 << 16;
+		default:
+			return 0;
+	}
+}
+
+StretchTable::Pointer StretchTable::Find( const Stretch& stretch, ImageCube::PixelFormat format,
+										 const ImageCube::Encoding* encoding )
+{
+	boost::mutex::scoped_lock guard( cacheLock );
+	for ( std::list<Pointer>::iterator i = cache.begin(); i != cache.end(); ++i )
+	{
+		if ( (*i)->Matches( stretch, format, encoding ) )
+		{
+			//keep the most recently used table at the front
+			Pointer table = *i;
+			cache.erase( i );
+			cache.push_front( table );
+			return table;
+		}
+	}
+	return Pointer();
+}
+
+Void StretchTable::Insert( const Pointer& table )
+{
+	boost::mutex::scoped_lock guard( cacheLock );
+	cache.push_front( table );
+	if ( cache.size() > cacheSize )
+		cache.pop_back();
+}
+
+UInt StretchTable::Size() const
+{
+	return values.size();
+}
+
+Double* StretchTable::Values()
+{
+	return &values[0];
+}
+
+const Double* StretchTable::Values() const
+{
+	return &values[0];
+}
+
+/**
+Only the parameters used by FitsEngine::stretch are compared; the black and
+white levels are applied afterwards.
+*/
+Bool StretchTable::Matches( const Stretch& s, ImageCube::PixelFormat f, const ImageCube::Encoding* e ) const
+{
+	if ( stretch.function != s.function || stretch.scale != s.scale ||
+		stretch.offset != s.offset || stretch.scaleBackground != s.scaleBackground ||
+		stretch.precision != s.precision ||
+		format != f || encoded != ( e != NULL ) )
+		return false;
+
+	return !encoded || ( encoding.swap == e->swap && encoding.scale == e->scale &&
+		encoding.zero == e->zero && encoding.hasBlank == e->hasBlank && encoding.blank == e->blank );
+}
@@ -51,6 +51,7 @@
 //
 // =============================================================================
 #include "TileControl.h"
+#include "Instrumentation.h"
 
 #include "omp.h"
 #include <time.h>
@@ -79,6 +80,7 @@ TileControl::TileControl( UInt mmUsg )
 
 	oldMaxMemUsage = 0;
 	nMaxAllocTiles = -1;
+	collectRegionStatistics = false;
 }
 
 TileControl::~TileControl()
@@ -179,11 +181,12 @@ ImageTile* TileControl::getTile( const Int tile, const ImageCube* cube,
 				Int cTile = allocatedTiles[0].front();				
 				
 				tiles[cTile].deallocatePixels();
+				Instrumentation::add( counterTilesEvicted, 1 );
 				//remove the old tile from the queue
 				allocatedTiles[0].pop();
 			}
 			//allocate the new tile and load the pixels
-			tiles[tile].allocatePixels( cube->SizeOf(1,1) );
+			tiles[tile].allocatePixels( cube->SizeOf(1,1), cube->NeedsNullMap() );
 			
 			//add the new tile to the queue
 			allocatedTiles[0].push( tile );
@@ -194,8 +197,7 @@ ImageTile* TileControl::getTile( const Int tile, const ImageCube* cube,
 #endif
 			if ( lock ) tiles[tile].locked = true;
 			//load the pixels from the file
-			cube->Read( plane.planeIndex, tiles[tile].getBounds(),
-				tiles[tile].rawPixels, tiles[tile].nullPixels);
+			readTile( tiles[tile], cube, plane );
 			
 #ifdef USE_OPENMP
 			}
@@ -214,6 +216,44 @@ ImageTile* TileControl::getTile( const Int tile, const ImageCube* cube,
 	}
 }
 
+/**
+Loads the pixels of an allocated tile from the image. Images that can be
+read in their stored encoding are, and are converted while being stretched.
+Otherwise the null map is only read for images that may contain null pixels
+and ImageTile::hasNulls is set according to whether any were found.
+@param tile the tile to load
+@param cube the image cube containing the current image
+@param plane the current plane
+*/
+Void TileControl::readTile( ImageTile& tile, const ImageCube* cube, const Plane& plane )
+{
+	ScopedTimer timer( stageRead );
+	Instrumentation::add( counterTilesLoaded, 1 );
+
+	ImageCube::Encoding encoding;
+	tile.encoded = cube->Encoded( &encoding );
+	if ( tile.encoded )
+	{
+		Instrumentation::add( counterBytesRead, ImageCube::SizeOf( encoding.format, tile.width, tile.height ) );
+		cube->ReadEncoded( plane.planeIndex, tile.getBounds(), tile.rawPixels );
+		tile.hasNulls = false;
+		return;
+	}
+
+	Instrumentation::add( counterBytesRead, cube->SizeOf( tile.width, tile.height ) );
+	if ( tile.nullPixels != NULL )
+	{
+		tile.hasNulls = cube->Read( plane.planeIndex, tile.getBounds(),
+			tile.rawPixels, tile.nullPixels );
+		Instrumentation::add( counterBytesRead, ImageCube::NullMapSize( tile.width * tile.height ) );
+	}
+	else
+	{
+		cube->Read( plane.planeIndex, tile.getBounds(), tile.rawPixels );
+		tile.hasNulls = false;
+	}
+}
+
 /**
 Returns true if the two tiles overlap, false if not
 */
@@ -251,7 +291,7 @@ preferred tile size, number of cpu's, available memory etc.
 		pixels no matter if they are stretched or whatever, i.e. they are directly used
 		for preview generation, statistics etc
 	- A nullmap containing a map of which pixels are defined as null in the image. This is a
-		byte array
+		bit array and is only needed for images which may contain null pixels
 
 	Calculate the tiling of the image based on how much memory there is available.
 	We define a minimum tile size through the local constants tile_min_width and
@@ -261,7 +301,7 @@ preferred tile size, number of cpu's, available memory etc.
 	@param imgHeight the height of the image
 	@param minWidth the requested minimum width of the tile
 	@param minHeight the requested minimum height of the tile
-	@param bytesPrPixel the total number of bytes per pixel (=8+1+bitDepth)
+	@param bytesPrPixel the total number of bytes per pixel (=8+bitDepth)
 	@param totalBytes the total amount of bytes allocatable
 	@param *nTls pointer to be filled out by this function with the total number of tiles
 	@param *nAlcTls pointer to be filled out by this function with the number of allocatable tiles
@@ -327,22 +367,20 @@ Bool TileControl::distributeTiles( const Int imgWidth, const Int imgHeight,
 			{		
 				for ( Int i = 0; i < nTilesXDirection; i++ )
 				{			
-					Int curWidth = 0;
-					Int curHeight = 0;
+					Int curWidth = minWidth;
+					Int curHeight = minHeight;
 					
-					curWidth = imgWidth / nTilesXDirection;					
-										
-					curHeight = imgHeight / nTilesYDirection;					
-					
-					//set the upper left corner of the current tile
-					tiles[j * nTilesXDirection + i].setX( i * curWidth );
-					tiles[j * nTilesXDirection + i].setY( j * curHeight );
+					//set the upper left corner of the current tile. The tiles
+					//are placed on a grid of the requested size so that they
+					//stay aligned with the storage blocks of the image
+					tiles[j * nTilesXDirection + i].setX( i * minWidth );
+					tiles[j * nTilesXDirection + i].setY( j * minHeight );
 					
-					//Should be corrected if the division is not clean
+					//the last row and column of tiles take what is left
 					if ( i == nTilesXDirection - 1 )
-						curWidth += imgWidth % nTilesXDirection;
+						curWidth = imgWidth - i * minWidth;
 					if ( j == nTilesYDirection - 1 )								
-						curHeight += imgHeight % nTilesYDirection;
+						curHeight = imgHeight - j * minHeight;
 
 					//set the width and height of the current tile
 					tiles[j * nTilesXDirection + i].setWidth( curWidth );
@@ -359,11 +397,10 @@ Bool TileControl::distributeTiles( const Int imgWidth, const Int imgHeight,
 			tiles[0].height = imgHeight;
 			//try to actually allocate the tile.
 			//if not possible then return false
-			if ( tiles[0].allocatePixels( bitDepth ) == ImageTile::AllocOk )
+			if ( tiles[0].allocatePixels( bitDepth, cube->NeedsNullMap() ) == ImageTile::AllocOk )
 			{
 				//load the pixels from the file
-				cube->Read( plane.planeIndex, tiles[0].getBounds(),
-					tiles[0].rawPixels, tiles[0].nullPixels);
+				readTile( tiles[0], cube, plane );
 				return true;
 			}
 			else
@@ -375,6 +412,71 @@ Bool TileControl::distributeTiles( const Int imgWidth, const Int imgHeight,
 	
 }
 
+/**
+	Chooses the shape of the small tiles from the storage layout of the image.
+	Images stored row by row are cut into full-width strips, since a strip is
+	read with a single contiguous request while a 256 pixel wide tile costs a
+	request per row. Strips are at least minStripHeight rows high, so very
+	wide images get strips narrower than the image rather than strips of a
+	single row. Images stored in blocks get tiles made of whole blocks.
+	In both cases the tile holds about tileTargetPixels pixels, which keeps
+	the raw and stretched pixels of a tile within a typical L2 cache while the
+	stretch, statistics and preview kernels pass over it.
+	@param cube the current imagecube
+	@param width receives the width of the tiles
+	@param height receives the height of the tiles
+*/
+Void TileControl::planTile( const ImageCube* cube, UInt* width, UInt* height )
+{
+	ImageCube::size_type blockWidth = 0;
+	ImageCube::size_type blockHeight = 0;
+	cube->StorageBlock( &blockWidth, &blockHeight );
+	if ( blockWidth < 1 ) blockWidth = 1;
+	if ( blockHeight < 1 ) blockHeight = 1;
+
+	if ( blockWidth >= cube->Width() )
+	{
+		//row-major storage
+		*width = FitsMath::minimum( (UInt)cube->Width(), (UInt)( tileTargetPixels / minStripHeight ) );
+		*height = FitsMath::maximum( (UInt)minStripHeight, (UInt)( tileTargetPixels / *width ) );
+	}
+	else
+	{
+		//block storage, aim for square tiles of whole blocks
+		UInt side = (UInt)FitsMath::squareroot( (Double)tileTargetPixels );
+		*width = FitsMath::maximum( (UInt)1, side / blockWidth ) * blockWidth;
+		*height = FitsMath::maximum( (UInt)1, (UInt)( tileTargetPixels / *width ) );
+	}
+
+	if ( *width > cube->Width() ) *width = cube->Width();
+	if ( *height > cube->Height() ) *height = cube->Height();
+}
+
+/**
+	Rounds the tile size to whole storage blocks so that no block is read
+	by more than one tile. The height is rounded down but never below a
+	single block.
+	@param cube the current imagecube
+	@param width the width of the tiles, updated in place
+	@param height the height of the tiles, updated in place
+*/
+Void TileControl::alignTile( const ImageCube* cube, UInt* width, UInt* height )
+{
+	ImageCube::size_type blockWidth = 0;
+	ImageCube::size_type blockHeight = 0;
+	cube->StorageBlock( &blockWidth, &blockHeight );
+
+	if ( blockWidth > 1 && *width < cube->Width() )
+		*width = FitsMath::maximum( (UInt)1, *width / blockWidth ) * blockWidth;
+	if ( blockHeight > 1 && *height < cube->Height() )
+		*height = FitsMath::maximum( (UInt)1, *height / blockHeight ) * blockHeight;
+
+	if ( *width > cube->Width() ) *width = cube->Width();
+	if ( *height > cube->Height() ) *height = cube->Height();
+	if ( *width < 1 ) *width = 1;
+	if ( *height < 1 ) *height = 1;
+}
+
 /**
 	This method performs the tiling of the image.
 	If the image is small enough to fit in memory the
@@ -387,6 +489,7 @@ Bool TileControl::distributeTiles( const Int imgWidth, const Int imgHeight,
 */
 Void TileControl::reTile( const ImageCube* cube, const Int tileSize, const Plane& plane )
 {
+	TraceSpan span( "reTile" );
 
 	//first check if the tiling has already been done based on the width and height of the cube
 	if ( ( cube->Width() != this->oldCubeWidth || cube->Height() != this->oldCubeHeight ) ||
@@ -415,9 +518,9 @@ Void TileControl::reTile( const ImageCube* cube, const Int tileSize, const Plane
 				pixels no matter if they are stretched or whatever, i.e. they are directly used
 				for preview generation, statistics etc
 			- A nullmap containing a map of which pixels are defined as null in the image. This is a
-				byte array
+				bit array, so at most 1/8 byte per pixel which is not included below
 			*/
-			Int bytesPrPixel = cube->SizeOf(1,1) + sizeof( Double ) + sizeof( Byte );
+			Int bytesPrPixel = cube->SizeOf(1,1) + sizeof( Double );
 
 			/*
 				Calculate the tiling of the image based on how much memory there is available.
@@ -461,8 +564,7 @@ Void TileControl::reTile( const ImageCube* cube, const Int tileSize, const Plane
 			switch( tileSize )
 			{
 			case TileControl::tileSizeSmall:
-				tile_min_width = ImageTile::tile_small_min_width;
-				tile_min_height = ImageTile::tile_small_min_height;
+				planTile( cube, &tile_min_width, &tile_min_height );
 				//important to set this to be != 1 since distributeTiles() then
 				// makes the number of currently allocated tiles increase
 				nAllocTiles = 0;
@@ -509,13 +611,14 @@ Void TileControl::reTile( const ImageCube* cube, const Int tileSize, const Plane
 					tile_min_height = cube->Height();
 				break;
 			default:
-				tile_min_width = ImageTile::tile_small_min_width;
-				tile_min_height = ImageTile::tile_small_min_height;
+				planTile( cube, &tile_min_width, &tile_min_height );
 				//important to set this to be != 1 since distributeTiles() then
 				// makes the number of currently allocated tiles increase
 				nAllocTiles = 0;
 				break;
 			}
+			//make sure strips start on a storage block boundary
+			alignTile( cube, &tile_min_width, &tile_min_height );
 			//either the image can be fully loaded into memory or
 			//it has to be tiled up		
 			
@@ -574,12 +677,33 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 	UInt width = 0;
 	UInt height = 0;
 	UInt bitDepth = cube->SizeOf(1,1);
+
+	//8- and 16-bit images are stretched through a lookup table. Their
+	//statistics are computed from how often each sample occurs, so the
+	//tiles are read only once and need not be stretched for it.
+	ImageCube::Encoding encoding;
+	Bool encoded = cube->Encoded( &encoding );
+	ImageCube::PixelFormat format = encoded ? encoding.format : cube->Format();
+	StretchTable::Pointer table = FitsEngine::getTable( stretch, format, encoded ? &encoding : NULL );
+	Vector<UInt> counts;
+	if ( table )
+		counts.assign( table->Size(), 0 );
+
+	//the region statistics hold the linear values and so only need to be
+	//collected once for each plane
+	Bool collectRegions = collectRegionStatistics 
+		&& !regionStatistics.IsValid( cube, plane ) 
+		&& regionStatistics.Begin( cube, plane );
+	Vector<Double> linearPixels;
+	Stretch identity;
+	identity.scaleBackground = 0.0;
+
 	//temporary pointers for the pixels
 	//this is an ugly hack and it should probably
 	//be re-flowed in a new version
 	Double* stretchedPixels = NULL;
 	Void* rawPixels = NULL;
-	char* nullPixels = NULL;
+	Byte* nullPixels = NULL;
 	//if the number of tiles is greater than 1 then we
 	//should try and allocate the pixels locally
 	if ( getNumberOfTiles() > 1 )
@@ -596,7 +720,8 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 		{
 			stretchedPixels = new Double [width * height];
 			rawPixels = (Void*)new Byte[width*height*bitDepth];
-			nullPixels = new char [width * height];		
+			if ( cube->NeedsNullMap() )
+				nullPixels = new Byte [ImageCube::NullMapSize( width * height )];
 		}
 		catch ( std::bad_alloc ba )
 		{
@@ -614,6 +739,7 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 	}
 	for ( Int i = 0; i < getNumberOfTiles(); i++ )
 	{
+		TraceSpan tileSpan( "range tile" );
 		ImageTile* tile = NULL;
 
 		//set the pointers
@@ -624,7 +750,7 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 			tile->stretchedPixels = stretchedPixels;
 			tile->nullPixels = nullPixels;
 			//load the pixels
-			cube->Read( plane.planeIndex, tile->getBounds(), tile->rawPixels, tile->nullPixels );
+			readTile( *tile, cube, plane );
 		}
 		else
 		{
@@ -634,11 +760,34 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 		}
 	
 
-		//stretch the tile in parallel
-		stretchTile_par( *tile, stretch, cube );
-		//accumulate the range
-		FitsStatisticsTools::getRange_par( tile->stretchedPixels, tile->width*tile->height,
-			&globalPixelCount, globalMin, globalMax, globalMean, this->getNumberOfThreads() );
+		if ( collectRegions )
+		{
+			UInt n = tile->width * tile->height;
+			linearPixels.resize( n );
+			if ( tile->encoded && encoded )
+				FitsEngine::stretchEncoded( identity, encoding, tile->rawPixels,
+					&linearPixels[0], n, this->getNumberOfThreads() );
+			else
+				FitsEngine::stretch( identity, cube->Format(), tile->rawPixels,
+					tile->getNullMap(), &linearPixels[0], n, this->getNumberOfThreads() );
+			regionStatistics.Add( tile->getBounds(), &linearPixels[0] );
+		}
+
+		if ( table )
+		{
+			FitsStatisticsTools::countSamples( tile->rawPixels, ImageCube::SizeOf( format, 1, 1 ),
+				tile->width*tile->height, tile->getNullMap(), counts );
+			if ( doPreview )
+				stretchTile_par( *tile, stretch, cube );
+		}
+		else
+		{
+			//stretch the tile in parallel
+			stretchTile_par( *tile, stretch, cube );
+			//accumulate the range
+			FitsStatisticsTools::getRange_par( tile->stretchedPixels, tile->width*tile->height,
+				&globalPixelCount, globalMin, globalMax, globalMean, this->getNumberOfThreads() );
+		}
 
 		//generate preview
 		if ( doPreview )
@@ -663,6 +812,9 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 				
 				if ( stretchedPixels != NULL ) delete[] stretchedPixels;
 				stretchedPixels = NULL;
+
+				if ( collectRegions )
+					regionStatistics.Clear();
 				return ImageTile::OperationCanceled;				
 			}
 		}
@@ -677,6 +829,13 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 
 	}
 
+	if ( collectRegions )
+		regionStatistics.Finish();
+
+	if ( table )
+		FitsStatisticsTools::getRange( counts, table->Values(), &globalPixelCount,
+			globalMin, globalMax, globalMean );
+
 	//now only one thread exists and we can calculate the mean
 	*globalMean = *globalMean / globalPixelCount;
 	
@@ -691,9 +850,28 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 
 	*maxBinCount = 0.;
 
+	//the histogram of counted samples needs no second pass over the tiles
+	Int histogramTiles = getNumberOfTiles();
+	if ( table )
+	{
+		FitsStatisticsTools::getHistogram( counts, table->Values(), globalStdev, *globalMean,
+			*globalMin, invBinSize, histogram );
+		if ( progressModel != NULL )
+		{
+			for ( Int i = 0; i < histogramTiles; i++ )
+				progressModel->Increment();
+		}
+		histogramTiles = 0;
+	}
+
+	//this is the last time the tiles are read, so the reader may drop
+	//them from the page cache as it goes
+	SequentialPass pass( cube );
+
 	//do the histogram and mean
-	for ( Int i = 0; i < getNumberOfTiles(); i++ )
+	for ( Int i = 0; i < histogramTiles; i++ )
 	{
+		TraceSpan tileSpan( "histogram tile" );
 		//first get the tile
 		ImageTile* tile = NULL;
 
@@ -705,7 +883,7 @@ Int TileControl::doStatistics3( const ImageCube* cube, Bool stretched, Double* g
 			tile->stretchedPixels = stretchedPixels;
 			tile->nullPixels = nullPixels;		
 			//load the pixels
-			cube->Read( plane.planeIndex, tile->getBounds(), tile->rawPixels, tile->nullPixels );
+			readTile( *tile, cube, plane );
 		}
 		else
 		{
@@ -778,7 +956,7 @@ Bool TileControl::canProduceThumb( const ImageCube* cube )
 	// Figure out how many bytes we will need:
 	// total = sizeof(pixels) + sizeof(stretched) + sizeof(null_map)
 	UInt bytesNeeded	= cube->SizeOf(0) + 
-		cube->PixelsPerPlane() * (sizeof(double) + sizeof(unsigned char));
+		cube->PixelsPerPlane() * sizeof(double) + ImageCube::NullMapSize( cube->PixelsPerPlane() );
 	
 	if ( bytesNeeded > 100000000 ) //maxMemUsage )
 	{
@@ -796,8 +974,13 @@ Void TileControl::stretchTile( ImageTile& tile, Stretch& stretch, const ImageCub
 	{
 		if ( tile.isAllocated() )
 		{
-			FitsEngine::stretch( stretch, cube->Format(), (Void*)(tile.rawPixels),
-				(Byte*)tile.nullPixels, tile.stretchedPixels, tile.width*tile.height, 1 );
+			ImageCube::Encoding encoding;
+			if ( tile.encoded && cube->Encoded( &encoding ) )
+				FitsEngine::stretchEncoded( stretch, encoding, tile.rawPixels,
+					tile.stretchedPixels, tile.width*tile.height, 1 );
+			else
+				FitsEngine::stretch( stretch, cube->Format(), (Void*)(tile.rawPixels),
+					tile.getNullMap(), tile.stretchedPixels, tile.width*tile.height, 1 );
 			tile.stretched = true;
 			tile.stretch = stretch;
 		}
@@ -817,8 +1000,13 @@ Void TileControl::stretchTile_par( ImageTile& tile, Stretch& stretch, const Imag
 	{
 		if ( tile.isAllocated() )
 		{
-			FitsEngine::stretch( stretch, cube->Format(), (Void*)(tile.rawPixels),
-				(Byte*)tile.nullPixels, tile.stretchedPixels, tile.width*tile.height, this->getNumberOfThreads() );
+			ImageCube::Encoding encoding;
+			if ( tile.encoded && cube->Encoded( &encoding ) )
+				FitsEngine::stretchEncoded( stretch, encoding, tile.rawPixels,
+					tile.stretchedPixels, tile.width*tile.height, this->getNumberOfThreads() );
+			else
+				FitsEngine::stretch( stretch, cube->Format(), (Void*)(tile.rawPixels),
+					tile.getNullMap(), tile.stretchedPixels, tile.width*tile.height, this->getNumberOfThreads() );
 			tile.stretched = true;
 			tile.stretch = stretch;
 		}
@@ -854,4 +1042,22 @@ Void TileControl::deallocateTiles()
 		for ( Int i = 0; i < nTiles; i++ )
 			tiles[i].deallocatePixels();
 	}
+	clearRegionStatistics();
+}
+
+const RegionStatistics& TileControl::getRegionStatistics() const
+{
+	return regionStatistics;
+}
+
+Void TileControl::clearRegionStatistics()
+{
+	regionStatistics.Clear();
+}
+
+Void TileControl::setCollectRegionStatistics( Bool collect )
+{
+	collectRegionStatistics = collect;
+	if ( !collect )
+		regionStatistics.Clear();
 }
@@ -51,6 +51,7 @@
 //
 // =============================================================================
 #include "TilePusher.h"
+#include "Instrumentation.h"
 
 using namespace FitsLiberator::Engine;
 
@@ -115,6 +116,7 @@ ImageTile* TilePusher::getNextTile()
 		if ( tiles[i].isAllocated() && tilesReturned[i] )
 		{
 			tiles[i].deallocatePixels();
+			Instrumentation::add( counterTilesEvicted, 1 );
 			//escape the loop
 			break;
 		}
@@ -57,19 +57,38 @@
 
 #include "WcsMapper.hpp"
 #include "FitsImageReader.hpp"
+#include "ReprojectedImageCube.hpp"
 
 #include <fitsio.h>
+#include <math.h>
+#include <string.h>
 #include <limits>
 
 using std::numeric_limits;
 
 using FitsLiberator::Engine::ImageReader;
 using FitsLiberator::Engine::ImageCube;
+using FitsLiberator::Engine::ReprojectedImageCube;
 using FitsLiberator::Engine::WcsMapper;
 
+namespace {
+    // The constants of CFITSIO's worldpos and xypix, so the batch methods
+    // return the coordinates of fits_pix_to_world and fits_world_to_pix.
+    const double cond2r = 1.745329252e-2;
+    const double twopi  = 6.28318530717959;
+}
+
 WcsMapper::WcsMapper(const ImageCube* image) {
+    const ReprojectedImageCube* reprojected = dynamic_cast<const ReprojectedImageCube*>(image);
+
+    if(reprojected != nullptr) {
+        // The pixels of a reprojected image lie on the grid it was created with
+        *this = reprojected->Grid();
+        return;
+    }
+
     // We only support FITS images right now
-    if(image->Owner()->format() == ImageReader::FITS) {
+    if(image->Owner() != nullptr && image->Owner()->format() == ImageReader::FITS) {
         const FitsImageCube* cube = dynamic_cast<const FitsImageCube*>(image);
         FitsImageReader* reader = dynamic_cast<FitsImageReader*>(cube->Owner());
 
@@ -85,8 +104,37 @@ WcsMapper::WcsMapper(const ImageCube* image) {
     } else {
         valid = false;
     }
+    Prepare();
+}
+
+/**
+ * Precomputes the terms of the projection shared by all coordinates.
+ */
+void
+WcsMapper::Prepare() {
+    projection = projectionOther;
+    if(!valid)
+        return;
+
+    if(strncmp(coordtype, "-CAR", 4) == 0)
+        projection = projectionLinear;
+    else if(strncmp(coordtype, "-TAN", 4) == 0)
+        projection = projectionTangent;
+
+    cosr   = cos(rot * cond2r);
+    sinr   = sin(rot * cond2r);
+    ra0    = xrefval * cond2r;
+    dec0   = yrefval * cond2r;
+    cos0   = cos(dec0);
+    sin0   = sin(dec0);
+    cosRa0 = cos(ra0);
+    sinRa0 = sin(ra0);
 }
 
+bool
+WcsMapper::Valid() const {
+    return valid;
+}
 bool
 WcsMapper::Map(double x, double y, double* ra, double* dec) const {
     bool success = false;
@@ -105,3 +153,160 @@ WcsMapper::Map(double x, double y, double* ra, double* dec) const {
 
     return success;
 }
+
+bool
+WcsMapper::Map(const double* x, const double* y, ImageCube::size_type count, double* ra, double* dec) const {
+    const double nan = numeric_limits<double>::quiet_NaN();
+    bool success = valid;
+
+    if(!valid) {
+        for(ImageCube::size_type i = 0; i < count; i++)
+            ra[i] = dec[i] = nan;
+    } else if(projection == projectionOther) {
+        for(ImageCube::size_type i = 0; i < count; i++) {
+            int status = 0;
+            fits_pix_to_world(x[i], y[i], xrefval, yrefval, xrefpix, yrefpix, 
+                xinc, yinc, rot, (char*)coordtype, &ra[i], &dec[i], &status);
+            if(status != 0) {
+                ra[i] = dec[i] = nan;
+                success = false;
+            }
+        }
+    } else {
+        // Offsets from the reference pixel in radians, ra and dec are used
+        // for the intermediate l and m
+        for(ImageCube::size_type i = 0; i < count; i++) {
+            double dx = (x[i] - xrefpix) * xinc;
+            double dy = (y[i] - yrefpix) * yinc;
+            ra[i]  = (dx * cosr - dy * sinr) * cond2r;
+            dec[i] = (dy * cosr + dx * sinr) * cond2r;
+        }
+
+        if(projection == projectionTangent) {
+            for(ImageCube::size_type i = 0; i < count; i++) {
+                double l = ra[i];
+                double m = dec[i];
+                double px = cos0 * cosRa0 - l * sinRa0 - m * cosRa0 * sin0;
+                double py = cos0 * sinRa0 + l * cosRa0 - m * sinRa0 * sin0;
+                double pz = sin0                       + m *          cos0;
+                ra[i]  = atan2(py, px);
+                dec[i] = atan(pz / sqrt(px * px + py * py));
+            }
+        } else {
+            for(ImageCube::size_type i = 0; i < count; i++) {
+                ra[i]  += ra0;
+                dec[i] += dec0;
+            }
+        }
+
+        for(ImageCube::size_type i = 0; i < count; i++) {
+            double r = ra[i];
+            if(r - ra0 > twopi / 2.0) r -= twopi;
+            if(r - ra0 < -twopi / 2.0) r += twopi;
+            if(r < 0.0) r += twopi;
+            ra[i]   = r / cond2r;
+            dec[i] /= cond2r;
+        }
+    }
+
+    return success;
+}
+
+bool
+WcsMapper::MapRow(double x, double y, ImageCube::size_type count, double* ra, double* dec) const {
+    // ra and dec hold the image coordinates until they are mapped
+    for(ImageCube::size_type i = 0; i < count; i++) {
+        ra[i]  = x + i;
+        dec[i] = y;
+    }
+    return Map(ra, dec, count, ra, dec);
+}
+
+bool
+WcsMapper::Unmap(double ra, double dec, double* x, double* y) const {
+    return Unmap(&ra, &dec, 1, x, y);
+}
+
+bool
+WcsMapper::Unmap(const double* ra, const double* dec, ImageCube::size_type count, double* x, double* y) const {
+    const double nan = numeric_limits<double>::quiet_NaN();
+    bool success = valid && xinc != 0.0 && yinc != 0.0;
+
+    if(!success) {
+        for(ImageCube::size_type i = 0; i < count; i++)
+            x[i] = y[i] = nan;
+        return false;
+    }
+
+    if(projection == projectionOther) {
+        for(ImageCube::size_type i = 0; i < count; i++) {
+            int status = 0;
+            fits_world_to_pix(ra[i], dec[i], xrefval, yrefval, xrefpix, yrefpix, 
+                xinc, yinc, rot, (char*)coordtype, &x[i], &y[i], &status);
+            if(status != 0) {
+                x[i] = y[i] = nan;
+                success = false;
+            }
+        }
+        return success;
+    }
+
+    for(ImageCube::size_type i = 0; i < count; i++) {
+        // 0h wrap-around
+        double xpos = ra[i];
+        double dt = xpos - xrefval;
+        if(dt > 180) xpos -= 360;
+        if(dt < -180) xpos += 360;
+        x[i] = xpos;
+    }
+
+    if(projection == projectionTangent) {
+        // x and y receive l and m in degrees
+        for(ImageCube::size_type i = 0; i < count; i++) {
+            double a    = x[i] * cond2r;
+            double d    = dec[i] * cond2r;
+            double coss = cos(d);
+            double sins = sin(d);
+            double cosa = cos(a - ra0);
+            double sint = sins * sin0 + coss * cos0 * cosa;
+            double l, m;
+
+            if(cos0 < 0.001) {
+                // First order expansion around the pole
+                m = (coss * cosa) / (sins * sin0);
+                m = (-m + cos0 * (1.0 + m * m)) / sin0;
+            } else {
+                m = (sins / sint - sin0) / cos0;
+            }
+            if(fabs(sinRa0) < 0.3) {
+                l  = coss * sin(a) / sint - cos0 * sinRa0 + m * sinRa0 * sin0;
+                l /= cosRa0;
+            } else {
+                l  = coss * cos(a) / sint - cos0 * cosRa0 + m * cosRa0 * sin0;
+                l /= -sinRa0;
+            }
+
+            if(sint <= 0.0) {
+                // Behind the tangent plane
+                l = m = nan;
+                success = false;
+            }
+            x[i] = l / cond2r;
+            y[i] = m / cond2r;
+        }
+    } else {
+        for(ImageCube::size_type i = 0; i < count; i++) {
+            x[i] = x[i] - xrefval;
+            y[i] = dec[i] - yrefval;
+        }
+    }
+
+    for(ImageCube::size_type i = 0; i < count; i++) {
+        double dx = x[i] * cosr + y[i] * sinr;
+        double dy = y[i] * cosr - x[i] * sinr;
+        x[i] = dx / xinc + xrefpix;
+        y[i] = dy / yinc + yrefpix;
+    }
+
+    return success;
+}
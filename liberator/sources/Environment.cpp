@@ -570,7 +570,7 @@ String Environment::LoadFileDialog( String fileName, UInt mode, HWND owner )
 
 	if ( mode == FILEMODE_OPEN )
 	{
-		filter = "Fits files\0*.FITS;*.FIT;*.FTS;*.IMG;*.LBL;\0\0";
+		filter = "Fits files\0*.FITS;*.FIT;*.FTS;*.IMG;*.LBL;*.XML;\0\0";
 		opf.lpstrDefExt = "fit";
 		
 		
@@ -56,11 +56,11 @@
 using namespace FitsLiberator::Mac;
 
 static const char* const OPEN_EXTENSIONS[] = {
-	"FITS", "FIT", "FTS", "IMG", "LBL",
+	"FITS", "FIT", "FTS", "IMG", "LBL", "XML",
 };
 
 static const CFStringRef OPEN_EXTENSIONS_CF[] = {
-	CFSTR("FITS"), CFSTR("FIT"), CFSTR("FTS"), CFSTR("IMG"), CFSTR("LBL"),
+	CFSTR("FITS"), CFSTR("FIT"), CFSTR("FTS"), CFSTR("IMG"), CFSTR("LBL"), CFSTR("XML"),
 };
 
 static const char* const SAVE_EXTENSIONS[] = {
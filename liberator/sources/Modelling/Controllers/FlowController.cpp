@@ -53,9 +53,11 @@
 #include "FlowController.h"
 #include "omp.h"
 #include <time.h>
+#include <stdlib.h>
 #include "TextUtils.h"
 #include "Environment.h"
 #include "TilePusher.h"
+#include "Instrumentation.h"
 
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
@@ -126,7 +128,20 @@ FlowController::FlowController(
 				repositoryController(repControl)
 {
 	currentState = NULL;
+	operationStart = 0.0;
 	prefs = new FitsLiberator::Preferences::Preferences(Environment::getPreferencesPath());
+
+	//the region statistics are only used by the mean background guess
+	tileControl.setCollectRegionStatistics( !kFITSBackgroundGuessMedian );
+
+	//developer aid: dump the pipeline counters after each operation
+	const Char* statsFile = getenv( "FITSLIBERATOR_STATS" );
+	if ( statsFile != NULL )
+		Instrumentation::setDumpFile( statsFile );
+	//developer aid: write a trace of all operations, see TraceLog
+	const Char* traceFile = getenv( "FITSLIBERATOR_TRACE" );
+	if ( traceFile != NULL )
+		TraceLog::setFile( traceFile );
 }
 
 FlowController::~FlowController()
@@ -156,7 +171,7 @@ Void FlowController::imageChanged( Int imageIndex, Int planeIndex, Bool newFile
 	else
 		histogramModel.setNumberOfBins( size.getArea() );
 
-	if ( Begin() )
+	if ( Begin( "imageChanged" ) )
 	{
 		
 		boost::thread worker(boost::bind(&FlowController::imageChanged_, this, imageIndex, 
@@ -173,12 +188,16 @@ Void FlowController::imageChanged_( Int imageIndex, Int planeIndex, Bool newFile
 	//update the plane
 	if ( planeModel.updateModel( imageIndex, planeIndex ) )
 		tileControl.deallocateTiles();
+	else if ( newFile )
+		tileControl.clearRegionStatistics();
+	pixelProbe.Clear();
 
 	//get the FitsImage
 	const ImageCube* cube = (*imageReader)[imageIndex];
 	
     wcs.reset(new WcsMapper(cube));
 	Stretch defStr;	
+	defStr.precision = precisionFast;
 	
 	//Generate preview
 	Size size;
@@ -248,6 +267,7 @@ Void FlowController::imageChanged_( Int imageIndex, Int planeIndex, Bool newFile
 
 Void FlowController::flushPreview()
 {
+	TraceSpan span( "flushPreview" );
 	Stretch& stretch = getStretch();
 	Plane& plane = planeModel.getPlane();
 	PreviewImage& previewImage			= previewModel.getPreviewImage();
@@ -302,16 +322,48 @@ Void FlowController::setCoordinates( const FitsLiberator::Point& p )
 	
 	const Stretch& stretch = getStretch();
 
-	Double real = previewController.getRealValueAtPos( p, rawSize, stretch, flipped );
+	Double real = 0;
+	Double scl = 0;
+	Double str = 0;
+	if ( probePixel( p, &real, &str ) )
+	{
+		scl = FitsEngine::getLinearValWithoutStretch( stretch, str );
+	}
+	else
+	{
+		real = previewController.getRealValueAtPos( p, rawSize, stretch, flipped );
 
-	Double scl = previewController.getScaledValueAtPos( p, rawSize, stretch, flipped );
+		scl = previewController.getScaledValueAtPos( p, rawSize, stretch, flipped );
 
-	Double str = previewController.getStretchedValueAtPos( p );
+		str = previewController.getStretchedValueAtPos( p );
+	}
 
 	pixelValueModel.setPosition( point, real, str, scl, ra, dec );
 	SendNotifications();
 }
 
+/**
+	Reads the pixel of the image under a point of the preview rather than
+	the preview pixel, which is resampled unless the zoom is 100%. The 
+	image is only read while no operation is running, as the operations
+	read it from other threads.
+*/
+Bool FlowController::probePixel( const FitsLiberator::Point& p, Double* real, Double* stretched )
+{
+	if ( !globalSettingsModel.getPreviewEnabled() || progressModel.QueryBusy() )
+		return false;
+
+	const FitsLiberator::Rectangle& area = previewModel.getImageArea();
+	if ( p.x < area.left || p.x >= area.right || p.y < area.top || p.y >= area.bottom )
+		return false;
+
+	const Point point = previewModel.getImageCoordinates( p, planeModel.getFlipped().flipped );
+	const Plane& plane = planeModel.getPlane();
+	const ImageCube* cube = (*imageReader)[plane.imageIndex];
+
+	return pixelProbe.Read( cube, plane, point.x, point.y, getStretch(), real, stretched );
+}
+
 
 /**
 	Picks the black level 
@@ -320,7 +372,10 @@ Void FlowController::pickBlackLevel( const FitsLiberator::Point& p )
 {
 	if ( globalSettingsModel.getPreviewEnabled() )
 	{
-		setBlackLevel( previewController.getStretchedValueAtPos( p ) );
+		Double real, stretched;
+		if ( !probePixel( p, &real, &stretched ) )
+			stretched = previewController.getStretchedValueAtPos( p );
+		setBlackLevel( stretched );
 	}
 }
 /**
@@ -330,7 +385,10 @@ Void FlowController::pickWhiteLevel( const FitsLiberator::Point& p )
 {
 	if ( globalSettingsModel.getPreviewEnabled() )
 	{			
-		setWhiteLevel( previewController.getStretchedValueAtPos( p ) );
+		Double real, stretched;
+		if ( !probePixel( p, &real, &stretched ) )
+			stretched = previewController.getStretchedValueAtPos( p );
+		setWhiteLevel( stretched );
 	}
 }
 
@@ -355,6 +413,16 @@ Double FlowController::makeGuess( const FitsLiberator::Point& p )
 	rawSize.width = cube->Width();
 	rawSize.height = cube->Height();
 
+	//the mean is taken over all of the pixels of the image under the window
+	//rather than over the pixels of the preview if the tables are available
+	RegionSummary summary;
+	if ( !kFITSBackgroundGuessMedian && globalSettingsModel.getPreviewEnabled() &&
+		getRegionStatistics( previewController.getImageRegion( p, kFITSBackgroundGuessWidth, 
+			kFITSBackgroundGuessHeight, flipped ), &summary ) && summary.count > 0 )
+	{
+		return summary.mean;
+	}
+
 	const Stretch& stretch = getStretch();
 
 	Double guess = previewController.getPixelGuess( p, rawSize, stretch, flipped );
@@ -362,9 +430,18 @@ Double FlowController::makeGuess( const FitsLiberator::Point& p )
 	return guess;
 }
 
+Bool FlowController::getRegionStatistics( const FitsLiberator::Rectangle& region, RegionSummary* summary )
+{
+	const Plane& plane = planeModel.getPlane();
+	const ImageCube* cube = (*imageReader)[plane.imageIndex];
+	const RegionStatistics& statistics = tileControl.getRegionStatistics();
+
+	return statistics.IsValid( cube, plane ) && statistics.Query( region, summary );
+}
+
 Void FlowController::toggleFlip()
 {
-	if ( Begin() )
+	if ( Begin( "toggleFlip" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::toggleFlip_, this ));
 	}
@@ -389,7 +466,7 @@ Void FlowController::toggleFlip_()
 
 Void FlowController::resetFlip()
 {
-	if ( Begin() )
+	if ( Begin( "resetFlip" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::resetFlip_, this ));
 	}
@@ -436,7 +513,7 @@ Void FlowController::stretchFunctionSelected( const StretchFunction f )
 	if ( f == stretchNoStretch )	
 		return;
 
-	if ( Begin() )
+	if ( Begin( "stretchFunctionSelected" ) )
 	{
 		boost::thread worker(boost::bind(&FlowController::stretchFunctionSelected_, this, f));
 	}
@@ -456,30 +533,23 @@ Void FlowController::stretchFunctionSelected_( const StretchFunction f )
 	tileControl.reTile( cube, TileControl::tileSizeLarge, planeModel.getPlane() );
 
 	//First find the linear values based on the old stretch
-	Double bl = histogramModel.getBlackLevel();
-	Double wl = histogramModel.getWhiteLevel();
-	Double rangeMin = histogramModel.getRangeMin();
-	Double rangeMax = histogramModel.getRangeMax();
+	Double rawPixels[4];
+	Double out[4];
+
+	rawPixels[0] = histogramModel.getBlackLevel();
+	rawPixels[1] = histogramModel.getWhiteLevel();
+	rawPixels[2] = histogramModel.getRangeMin();
+	rawPixels[3] = histogramModel.getRangeMax();
 
 	Stretch stretch = getStretch();
 
-	bl			= FitsEngine::getLinearVal( stretch, bl);
-	wl			= FitsEngine::getLinearVal( stretch, wl);
-	rangeMin	= FitsEngine::getLinearVal( stretch, rangeMin);
-	rangeMax	= FitsEngine::getLinearVal( stretch, rangeMax);
+	FitsEngine::getLinearValues( stretch, rawPixels, rawPixels, 4 );
 
 	//sets the new stretch function
 	stretchModel.setFunction( f );
 
 	stretch = getStretch();
 	
-	Double rawPixels[4];
-   Double out[4];	
-
-	rawPixels[0] = bl;
-	rawPixels[1] = wl;
-	rawPixels[2] = rangeMin;
-	rawPixels[3] = rangeMax;
 	//stretch the values
 	FitsEngine::stretchRealValues( stretch, rawPixels, out, 4 );
 	
@@ -531,7 +601,7 @@ Sets the background level (thread safe)
 */
 Void FlowController::setBackgroundLevel( Double level )
 {
-	if ( Begin() )
+	if ( Begin( "setBackgroundLevel" ) )
 	{
 		boost::thread worker(boost::bind(&FlowController::setBackgroundLevel_, this, level));
 	}
@@ -592,7 +662,7 @@ Void FlowController::setBackgroundLevel_( Double level )
 */
 Void FlowController::setBackgroundPeakScaledPeakLevels( Double bg, Double pl, Double sPl )
 {
-	if ( Begin() )
+	if ( Begin( "setBackgroundPeakScaledPeakLevels" ) )
 	{
 		boost::thread worker(boost::bind(&FlowController::setBackgroundPeakScaledPeakLevels_,
 			this, bg, pl, sPl));
@@ -676,22 +746,22 @@ Converts the values to their linear mode
 */
 Void FlowController::getLinearLevels( Double* blackLevel, Double* whiteLevel)
 {
-	Double bl		= this->histogramModel.getBlackLevel();
-	Double wl		= this->histogramModel.getWhiteLevel();
+	Double levels[2];
+	levels[0]		= this->histogramModel.getBlackLevel();
+	levels[1]		= this->histogramModel.getWhiteLevel();
 
 	const Stretch& stretch	= getStretch();
 	//gets the linear values of the stretched levels
-	bl				= FitsEngine::getLinearVal( stretch, bl);
-	wl				= FitsEngine::getLinearVal( stretch, wl);
+	FitsEngine::getLinearValues( stretch, levels, levels, 2 );
 
-	*blackLevel = bl;
-	*whiteLevel = wl;
+	*blackLevel = levels[0];
+	*whiteLevel = levels[1];
 	
 }
 
 Void FlowController::setPeakLevel( Double d )
 {
-	if ( Begin() )
+	if ( Begin( "setPeakLevel" ) )
 	{			
 		boost::thread worker(boost::bind(&FlowController::setPeakLevel_, this, d));
 	}
@@ -743,7 +813,7 @@ Void FlowController::setPeakLevel_( Double d )
 
 Void FlowController::setRescaleFactor( Double d )
 {
-	if ( Begin() )
+	if ( Begin( "setRescaleFactor" ) )
 	{
 		//do the tough stuff in a separate thread
 		boost::thread worker(boost::bind(&FlowController::setRescaleFactor_, this, d));			
@@ -789,7 +859,7 @@ Resets to the default values
 */
 Void FlowController::defaultValues()
 {
-    if ( Begin() )
+    if ( Begin( "defaultValues" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::defaultValues_, this ));
 	}
@@ -868,7 +938,7 @@ Auto scale and background
 */
 Void FlowController::automaticBackgroundScale()
 {
-    if ( Begin() )
+    if ( Begin( "automaticBackgroundScale" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::automaticBackgroundScale_, this ));
 	}
@@ -887,16 +957,18 @@ Void FlowController::automaticBackgroundScale_()
 	//get the image
 	const ImageCube* cube = (*imageReader)[plane.imageIndex];
 
-	Double bg			= histogramModel.getBlackLevel();
-	Double top			= histogramModel.getWhiteLevel();
+	Double levels[2];
+	levels[0]			= histogramModel.getBlackLevel();
+	levels[1]			= histogramModel.getWhiteLevel();
 	
 	Double rescale		= optionsModel.ScaledPeak();
 	Double bgScale		= stretchModel.getScaleBackground();
 
 	Stretch& stretch = getStretch();
 
-	bg					= FitsEngine::getLinearVal( stretch, bg );
-	top					= FitsEngine::getLinearVal( stretch, top );
+	FitsEngine::getLinearValues( stretch, levels, levels, 2 );
+	Double bg			= levels[0];
+	Double top			= levels[1];
 
 	Double scale		= ( rescale - bgScale) / ( top - bg );
 
@@ -936,7 +1008,7 @@ Void FlowController::automaticBackgroundScale_()
 
 Void FlowController::zoomRectangle( FitsLiberator::Rectangle& rect )
 {
-	if ( Begin() )
+	if ( Begin( "zoomRectangle" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::zoomRectangle_, this, rect ));
 	}
@@ -969,7 +1041,7 @@ Void FlowController::zoomRectangle_( FitsLiberator::Rectangle& rect )
 
 Void FlowController::fitToPreview()
 {
-	if ( Begin() )
+	if ( Begin( "fitToPreview" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::fitToPreview_, this ));
 	}
@@ -997,7 +1069,7 @@ Void FlowController::fitToPreview_()
 
 Void FlowController::setUnityZoom()
 {
-	if ( Begin() )
+	if ( Begin( "setUnityZoom" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::setUnityZoom_, this ));
 	}
@@ -1024,7 +1096,7 @@ Void FlowController::setUnityZoom_()
 
 Void FlowController::centerPreview()
 {
-	if ( Begin() )
+	if ( Begin( "centerPreview" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::centerPreview_, this ));
 	}
@@ -1050,7 +1122,7 @@ Void FlowController::centerPreview_()
 
 Void FlowController::incrementZoom( FitsLiberator::Point p )
 {
-	if ( Begin() )
+	if ( Begin( "incrementZoom" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::incrementZoom_, this, p ));
 	}
@@ -1081,7 +1153,7 @@ Void FlowController::incrementZoom_( FitsLiberator::Point p )
 
 Void FlowController::decrementZoom( FitsLiberator::Point p )
 {
-	if ( Begin() )
+	if ( Begin( "decrementZoom" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::decrementZoom_, this, p ));
 	}
@@ -1115,7 +1187,7 @@ Sets the zoom index
 */
 Void FlowController::setZoomIndex( Int index )
 {
-	if ( Begin() )
+	if ( Begin( "setZoomIndex" ) )
 	{
 		boost::thread worker(boost::bind( &FlowController::setZoomIndex_, this, index ));
 	}
@@ -1311,6 +1383,7 @@ Void FlowController::rollBackState()
 		Vector<Double>& hist = histogramModel.getRawBins();
 		for ( UInt i = 0; i < hist.size(); i++ )
 			hist[i] = currentState->histBins[i];
+		histogramModel.rawBinsChanged();
 
 		//copy the preview image
 		PreviewImage& pImg = previewModel.getPreviewImage();
@@ -1353,6 +1426,7 @@ Void FlowController::rollBackState()
 
 Int FlowController::doStatistics( const ImageCube* cube, Bool stretched, Bool doPreview )
 {
+	TraceSpan span( "doStatistics" );
 	Double min;
 	Double max;
 	Double mean;
@@ -1386,7 +1460,10 @@ Int FlowController::doStatistics( const ImageCube* cube, Bool stretched, Bool do
 			if ( err == ImageTile::AllocErr ) 
 				tileControl.decreaseMaxMem();				
 			else if ( err == ImageTile::OperationCanceled )
+			{
+				histogramModel.rawBinsChanged();
 				return err;
+			}
 		}
 		else
 		{
@@ -1412,6 +1489,7 @@ Int FlowController::doStatistics( const ImageCube* cube, Bool stretched, Bool do
 									max, min, mean, median, stdev);
 	}	
 	
+	histogramModel.rawBinsChanged();
 	histogramModel.setMaxBin( maxBinCount );		
 	
 	
@@ -1430,6 +1508,7 @@ This method needs a lot of testing
 */
 Void FlowController::makePreview( const ImageCube* cube )
 {
+	TraceSpan span( "makePreview" );
 	Stretch& stretch = getStretch();
 	Plane& plane = planeModel.getPlane();
 	
@@ -1462,11 +1541,10 @@ Void FlowController::makePreview( const ImageCube* cube )
 					if ( !( tile->isAllocated() ) )
 					{
 						//allocate and load from disk
-						if ( tile->allocatePixels( cube->SizeOf(1,1) ) == ImageTile::AllocOk )
+						if ( tile->allocatePixels( cube->SizeOf(1,1), cube->NeedsNullMap() ) == ImageTile::AllocOk )
 						{
 						
-							cube->Read( plane.planeIndex, tile->getBounds(), 
-								tile->rawPixels, tile->nullPixels );
+							tileControl.readTile( *tile, cube, plane );
 						}
 						else
 						{
@@ -1522,6 +1600,7 @@ Void FlowController::makePreview( const ImageCube* cube )
 
 Void FlowController::makePreview2( const ImageCube* cube )
 {
+	TraceSpan span( "makePreview2" );
 	Stretch& stretch = getStretch();
 	Plane& plane = planeModel.getPlane();
 	
@@ -1551,10 +1630,9 @@ Void FlowController::makePreview2( const ImageCube* cube )
 					if ( !( tile->isAllocated() ) )
 					{
 						//allocate and load from disk
-						tile->allocatePixels( cube->SizeOf(1,1) );
+						tile->allocatePixels( cube->SizeOf(1,1), cube->NeedsNullMap() );
 						
-						cube->Read( plane.planeIndex, tile->getBounds(), 
-							tile->rawPixels, tile->nullPixels );
+						tileControl.readTile( *tile, cube, plane );
 					}
 					tileControl.stretchTile_par( *tile, stretch, cube );
 					previewController.zoomTile( *tile, planeModel.getFlipped().flipped );
@@ -1739,7 +1817,7 @@ Void FlowController::saveFile( Bool invokeEditor, String fileName )
 {	
 	if ( fileName != "" )
 	{
-		if ( Begin() )
+		if ( Begin( "saveFile" ) )
 		{
 			makeSession( &session );
 			boost::thread worker(boost::bind(&FlowController::saveFile_, this, fileName, invokeEditor ));			
@@ -1818,13 +1896,18 @@ Stretch& FlowController::getStretch()
 	this->stretch.scalePeakLevel	= this->stretchModel.getRescaleFactor();
 	this->stretch.peakLevel			= this->stretchModel.getPeakLevel();
 	this->stretch.scaleBackground	= this->stretchModel.getScaleBackground();
+	//the preview and the statistics use the fast approximations, exports
+	//are stretched with the exact functions of their own session stretch
+	this->stretch.precision			= precisionFast;
 	return this->stretch;
 }
 
-Bool FlowController::Begin() {
+Bool FlowController::Begin( const String& name ) {
 
 	if ( ! ( progressModel.QueryBusy() ) )
 	{	
+		operation = name;
+		operationStart = Instrumentation::now();
 		SendNotifications();
 		progressModel.Begin();		
 		SendNotifications();	
@@ -1844,6 +1927,12 @@ void FlowController::End() {
 
 	progressModel.End();
 	
+	Instrumentation::operationFinished( operation );
+	if ( TraceLog::isEnabled() )
+	{
+		TraceLog::addSpan( operation, "operation", operationStart, Instrumentation::now() );
+		TraceLog::flush();
+	}
 	
     SendNotifications();
 	
@@ -52,6 +52,8 @@
 // =============================================================================
 #include "HistogramController.h"
 
+#include <algorithm>
+
 using namespace FitsLiberator::Modelling;
 
 
@@ -351,7 +353,6 @@ Void HistogramController::generateHistogramBins( Double stretchMin, Double stret
 	FitsLiberator::Size& histoSize	= histoModel.getHistogramSize();
 
 	//counters
-	UInt i = 0;
 	UInt j = 0;
 
 	//defines the interval of raw bins to be averaged
@@ -377,16 +378,8 @@ Void HistogramController::generateHistogramBins( Double stretchMin, Double stret
 			to		= (Int)FitsLiberator::Engine::FitsMath::round((Double)(j+1) / (Double)output.size() * (Double)(rightBin-leftBin) + leftBin);
 			Int outVal = 0;
 			
-			avVal = input[from];
-			for (i = from; i < to; i++)
-			{
-				//scales the current bin and sums the values
-				if ( avVal < input[i] )
-				{
-				//	avVal += input[i];
-					avVal = input[i];
-				}
-			}
+			//the largest of the raw bins, from the max mipmap of the model
+			avVal = histoModel.getRawBinMax( from, std::max( to, from + 1 ) );
 			
 			outVal = (Int)FitsLiberator::Engine::FitsMath::round(scale * avVal);
 			output[j] = outVal;
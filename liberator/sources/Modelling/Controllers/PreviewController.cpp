@@ -52,6 +52,8 @@
 // =============================================================================
 #include "Environment.h"
 #include "PreviewController.h"
+#include "Instrumentation.h"
+#include "Parallelism.h"
 #include <algorithm>
 #ifdef USE_OPENMP
 #include <omp.h>
@@ -139,6 +141,9 @@ preview image from the given tile
 */
 Void PreviewController::zoomTile( ImageTile& tile, const Bool flip )
 {
+	ScopedTimer timer( stagePreview );
+	Instrumentation::add( counterTilesResampled, 1 );
+
 	if ( tile.isAllocated() )
 	{
 
@@ -296,6 +301,9 @@ on Windows; not Mac). The method works without OMP enabled as well
 */
 Void PreviewController::zoomTile_par( ImageTile& tile, const Bool flip, UInt nCpus )
 {
+	ScopedTimer timer( stagePreview );
+	Instrumentation::add( counterTilesResampled, 1 );
+
 	if ( tile.isAllocated() )
 	{
 
@@ -321,8 +329,10 @@ Void PreviewController::zoomTile_par( ImageTile& tile, const Bool flip, UInt nCp
 			Int lowY  = (Int)( FitsMath::round( imgHeight - z * ( tile.effBottom - anchor.y ) ) );
 
 			#ifdef USE_OPENMP	
-            #pragma omp parallel num_threads( nCpus )
+            #pragma omp parallel num_threads( nCpus ) \
+				if( Parallelism::Worth( (size_t)FitsMath::maximum<Int>( highX - lowX, 0 ) * FitsMath::maximum<Int>( highY - lowY, 0 ), Parallelism::costRoot ) )
 	        {
+			BusyTimer busy;
 			#pragma omp for
 			#endif // USE_OPENMP  
 			for ( Int i = lowX; i < highX; i++ )
@@ -365,8 +375,10 @@ Void PreviewController::zoomTile_par( ImageTile& tile, const Bool flip, UInt nCp
 			Int highY = (Int)( FitsMath::round( z * ( tile.effBottom - anchor.y ) ) );			
 			Int lowY = (Int)( FitsMath::round( z * ( tile.effTop - anchor.y ) ) );
 			#ifdef USE_OPENMP	
-            #pragma omp parallel num_threads( nCpus )
+            #pragma omp parallel num_threads( nCpus ) \
+				if( Parallelism::Worth( (size_t)FitsMath::maximum<Int>( highX - lowX, 0 ) * FitsMath::maximum<Int>( highY - lowY, 0 ), Parallelism::costRoot ) )
 	        {
+			BusyTimer busy;
 			#pragma omp for
 			#endif // USE_OPENMP  
 			for ( Int i = lowX; i < highX; i++ )
@@ -474,6 +486,27 @@ Double PreviewController::getPixelGuess( const FitsLiberator::Point& p, FitsLibe
 
 
 
+/**
+	Returns the pixels of the full image covered by the window of the preview
+	centred on p, right and bottom exclusive. The region has at least one pixel.
+*/
+FitsLiberator::Rectangle PreviewController::getImageRegion( const FitsLiberator::Point& p, 
+														   Int width, Int height, const Bool flip )
+{
+	const FitsLiberator::Point a = previewModel.getImageCoordinates( 
+		FitsLiberator::Point( p.x - width / 2, p.y - height / 2 ), flip );
+	const FitsLiberator::Point b = previewModel.getImageCoordinates( 
+		FitsLiberator::Point( p.x + width / 2, p.y + height / 2 ), flip );
+
+	FitsLiberator::Rectangle region( std::min( a.x, b.x ), std::min( a.y, b.y ),
+		std::max( a.x, b.x ), std::max( a.y, b.y ) );
+	if ( region.right == region.left )
+		region.right++;
+	if ( region.bottom == region.top )
+		region.bottom++;
+	return region;
+}
+
 /**
 	Decrement zoom...
 */
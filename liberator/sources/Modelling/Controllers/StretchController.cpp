@@ -136,8 +136,10 @@ Void StretchController::transferLevels( Double* blackLevel, Double* whiteLevel,
 	//we should transfer the values of the black and white levels,
 	//which are in the default linear regime.
 
-    FitsEngine::stretchRealValues(stretch, blackLevel, blackLevel, 1);
-    FitsEngine::stretchRealValues(stretch, whiteLevel, whiteLevel, 1);
+    Double levels[2] = { *blackLevel, *whiteLevel };
+    FitsEngine::stretchRealValues(stretch, levels, levels, 2);
+    *blackLevel = levels[0];
+    *whiteLevel = levels[1];
 }
 
 //returns the background level
@@ -51,8 +51,13 @@
 //
 // =============================================================================
 
+#include <stdlib.h>
 #include "Environment.h"
 #include "ModelFramework.h"
+#include "GzipIndex.hpp"
+#include "StagingCache.hpp"
+#include "MappedFile.hpp"
+#include "Parallelism.h"
 
 
 using namespace FitsLiberator::Modelling;
@@ -90,6 +95,27 @@ ModelFramework::ModelFramework(
 	
 	this->tileControl = NULL;
 	this->reader = NULL;
+	//start the scheduler of the main thread and measure the cost of parallel
+	//loops before any of them run, see Parallelism
+	FitsLiberator::Engine::Parallelism::Initialize();
+	//keep the seek indices of gzip-compressed files between sessions, see GzipIndex
+	const Char* indexCache = getenv( "FITSLIBERATOR_INDEX_CACHE" );
+	if ( indexCache != NULL )
+		FitsLiberator::Engine::GzipIndex::SetCacheDirectory( indexCache );
+	//copy files opened from network drives to a local directory, see StagingCache
+	const Char* stagingCache = getenv( "FITSLIBERATOR_STAGING_CACHE" );
+	if ( stagingCache != NULL )
+	{
+		FitsLiberator::Engine::StagingCache::SetCacheDirectory( stagingCache );
+		FitsLiberator::Engine::StagingCache::SetSlowPathTest( &Environment::isNetworkPath );
+		//the size limit is given in megabytes
+		const Char* stagingLimit = getenv( "FITSLIBERATOR_STAGING_LIMIT" );
+		if ( stagingLimit != NULL && atol( stagingLimit ) > 0 )
+			FitsLiberator::Engine::StagingCache::SetSizeLimit( (Int64)atol( stagingLimit ) << 20 );
+	}
+	//read mapped files with direct I/O during full passes, see MappedFile
+	if ( getenv( "FITSLIBERATOR_DIRECT_IO" ) != NULL )
+		FitsLiberator::Engine::MappedFile::SetDirectIO( true );
 	//first try to open the possible supplied user input file
 	try
 	{	
@@ -415,7 +441,8 @@ ModelFramework::~ModelFramework()
 		delete reader;
 	if ( mainModel != NULL )
 		delete mainModel;
-
+	//stop copying to the staging cache before the plug-in is unloaded
+	FitsLiberator::Engine::StagingCache::Shutdown();
 
 }
 
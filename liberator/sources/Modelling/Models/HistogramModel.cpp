@@ -52,6 +52,8 @@
 // =============================================================================
 #include "HistogramModel.h"
 
+#include <algorithm>
+
 using namespace FitsLiberator::Modelling;
 
 /**
@@ -63,6 +65,7 @@ HistogramModel::HistogramModel(ChangeManager * chman) : Model( chman )
 	//the offset should be inited to zero
 	this->offset = 0;
 	this->rawBins.resize( kFITSHistogramBins );
+	this->binMaximaValid = false;
 	this->zoomMax	= 1.0;
 	this->zoomMin	= 1.0;
 	this->blackLevel = 0.0;
@@ -251,6 +254,7 @@ Double HistogramModel::getVal(UInt coord)
 Void HistogramModel::setNumberOfBins( UInt nBins )
 {
 	this->rawBins.assign( nBins, 0. );
+	this->binMaximaValid = false;
 	this->setZoom();
 }
 
@@ -369,6 +373,54 @@ Vector<Double>& HistogramModel::getRawBins()
 	return this->rawBins;
 }
 
+Void HistogramModel::rawBinsChanged()
+{
+	this->binMaximaValid = false;
+}
+
+/**
+	Returns the largest of the raw bins [from;to[. The range is split into the
+	whole blocks of the max mipmap it covers, taking at most two per level.
+*/
+Double HistogramModel::getRawBinMax(UInt from, UInt to)
+{
+	if ( !binMaximaValid )
+	{
+		//each level halves the one below it, the last bin of an odd level
+		//is carried up on its own
+		binMaxima.clear();
+		for ( UInt size = rawBins.size(); size > 1; size = ( size + 1 ) / 2 )
+			binMaxima.push_back( Vector<Double>( ( size + 1 ) / 2 ) );
+
+		for ( UInt k = 0; k < binMaxima.size(); k++ )
+		{
+			const Vector<Double>& below = ( k == 0 ) ? rawBins : binMaxima[k - 1];
+			Vector<Double>& level = binMaxima[k];
+			for ( UInt i = 0; i < level.size(); i++ )
+			{
+				UInt j = 2 * i;
+				level[i] = ( j + 1 < below.size() ) ? std::max( below[j], below[j + 1] ) : below[j];
+			}
+		}
+		binMaximaValid = true;
+	}
+
+	Double result = ( from < to ) ? rawBins[from] : 0.0;
+	const Vector<Double>* level = &rawBins;
+	for ( UInt k = 0; from < to; k++ )
+	{
+		if ( from & 1 )
+			result = std::max( result, (*level)[from++] );
+		if ( to & 1 )
+			result = std::max( result, (*level)[--to] );
+		from >>= 1;
+		to >>= 1;
+		if ( k < binMaxima.size() )
+			level = &binMaxima[k];
+	}
+	return result;
+}
+
 
 Void HistogramModel::setMaxBin(Double d)
 {
@@ -172,6 +172,8 @@ Bool RepositoryModel::readRules( const TiXmlElement* parent ) {
         ruleSet = ImageReader::FITS;
     } else if(strcmp(formatAttribute, "PDS") == 0) {
         ruleSet = ImageReader::PDS;
+    } else if(strcmp(formatAttribute, "PDS4") == 0) {
+        ruleSet = ImageReader::PDS4;
     }
 
     if( ruleSet >= 0 && ruleSet <= sizeof(rules)/sizeof(rules[0]) ) {
@@ -509,7 +511,7 @@ RepositoryModel::getRules() const {
 const RuleList&
 RepositoryModel::getRules(ImageReader::ImageFormat format) const {
     assert(format >= 0);
-    assert(format <= ImageReader::PDS);
+    assert(format <= ImageReader::PDS4);
 
     return rules[format];
 }
\ No newline at end of file
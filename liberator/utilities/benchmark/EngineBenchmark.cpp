@@ -0,0 +1,524 @@
+// The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+//
+// Copyright (c) 2004-2010, ESA/ESO/NASA.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the names of the European Space Agency (ESA), the European 
+//       Southern Observatory (ESO) and the National Aeronautics and Space 
+//       Administration (NASA) nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without specific
+//       prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+// ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// =============================================================================
+//
+// The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+// TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+// Building Blocks.
+//
+// =============================================================================
+//
+// Project Executive:
+//   Lars Lindberg Christensen
+//
+// Technical Project Manager:
+//   Lars Holm Nielsen
+//
+// Developers:
+//   Kaspar Kirstein Nielsen & Teis Johansen
+// 
+// Technical, scientific support and testing: 
+//   Robert Hurt
+//   Davide De Martin
+//
+// =============================================================================
+
+/** @file
+    Micro-benchmark for the engine kernels. Generates synthetic FITS images 
+    for every ImageCube::PixelFormat (with and without BSCALE/BZERO scaling 
+    and null pixels), times the stretch, scale, statistics, preview and TIFF
+    export kernels on them and writes the results as JSON.
+
+    The benchmark is a console application and is built from this file 
+    together with the sources in sources/Engine, sources/Modelling and
+    sources/Cache, linked against CFITSIO, libtiff, the OAL and TBB (if 
+    USE_TBB is defined). Build it with the same USE_TBB / USE_OPENMP 
+    settings as the application to compare the two backends; build_mac.sh
+    next to this file does this for Mac OS X.
+
+    Usage:
+        EngineBenchmark [-w width] [-h height] [-r repeats] [-t threads]
+                        [-n nullFraction] [-d directory] [-o output.json]
+*/
+
+#include "FitsLiberator.h"
+#include "FitsBehavior.h"
+#include "ImageReader.hpp"
+#include "FitsEngine.h"
+#include "Instrumentation.h"
+#include "Parallelism.h"
+#include "FitsStatisticsTools.h"
+#include "TileControl.h"
+#include "FileLoader.h"
+#include "PreviewController.h"
+#include "GlobalSettingsModel.h"
+#include "PreviewModel.h"
+#include "ProgressModel.h"
+#include "fitsio.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef USE_OPENMP
+	#include <omp.h>
+#endif
+
+using namespace FitsLiberator;
+using namespace FitsLiberator::Engine;
+using namespace FitsLiberator::Modelling;
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+
+/** Wall clock timer with sub-millisecond resolution. */
+class Timer {
+public:
+	Timer() { start = Instrumentation::now(); }
+	/** Returns the number of seconds since the timer was created. */
+	Double elapsed() const { return Instrumentation::now() - start; }
+private:
+	Double start;
+};
+
+/** Change manager which ignores all notifications. The models used by the
+	benchmark have no views attached. */
+class NullChangeManager : public ChangeManager {
+public:
+	Void Register( Model*, Observer* ) {}
+	Void Unregister( Model*, Observer* ) {}
+	Void Notify( Model* ) {}
+};
+
+/** Describes one synthetic image. */
+struct ImageSpec {
+	const char* name;		///< Name used in the report.
+	Int			bitpix;		///< CFITSIO image type passed to fits_create_img.
+	Bool		scaled;		///< Write BSCALE/BZERO keywords.
+	LONGLONG	blank;		///< Raw BLANK value used for integer images.
+};
+
+static const ImageSpec imageSpecs[] = {
+	{ "Unsigned8",		BYTE_IMG,		false,	255 },
+	{ "Signed8",		SBYTE_IMG,		false,	0 },
+	{ "Signed16",		SHORT_IMG,		false,	-32768 },
+	{ "Unsigned16",		USHORT_IMG,		false,	-32768 },
+	{ "Signed32",		LONG_IMG,		false,	-2147483647 - 1 },
+	{ "Unsigned32",		ULONG_IMG,		false,	-2147483647 - 1 },
+	{ "Signed64",		LONGLONG_IMG,	false,	-2147483647 - 1 },
+	{ "Float32",		FLOAT_IMG,		false,	0 },
+	{ "Float64",		DOUBLE_IMG,		false,	0 },
+	{ "Signed16Scaled",	SHORT_IMG,		true,	-32768 },
+	{ "Signed32Scaled",	LONG_IMG,		true,	-2147483647 - 1 }
+};
+
+static const Int imageSpecCount = sizeof( imageSpecs ) / sizeof( imageSpecs[0] );
+
+static const char* stretchNames[] = {
+	"Linear", "Log", "Sqrt", "LogSqrt", "LogLog", "CubeR", "Asinh", "Root4",
+	"Root5", "Pow15", "Pow2", "Pow3", "Pow4", "Pow5", "Exp", "AsinhAsinh",
+	"AsinhSqrt"
+};
+
+static const char* backendName() {
+#if defined(USE_TBB)
+	return "tbb";
+#elif defined(USE_OPENMP)
+	return "openmp";
+#else
+	return "serial";
+#endif
+}
+
+/** Options given on the command line. */
+struct Options {
+	UInt	width;
+	UInt	height;
+	Int		repeats;
+	Int		threads;
+	Double	nullFraction;
+	String	directory;
+	String	output;
+
+	Options() : width( 4096 ), height( 4096 ), repeats( 5 ), threads( 1 ),
+		nullFraction( 0.01 ), directory( "." ) {
+	#ifdef USE_OPENMP
+		threads = omp_get_num_procs();
+	#endif
+	}
+};
+
+/** Collects the timings of a single benchmark run and formats them as 
+	JSON objects. */
+class Report {
+public:
+	Report( const Options& o ) : options( o ), first( true ) {}
+
+	/** Adds a result.
+		@param image Name of the synthetic image.
+		@param kernel Name of the kernel measured.
+		@param variant Additional parameter such as the stretch function.
+		@param pixels Number of pixels processed per repetition.
+		@param times Time of each repetition in seconds. */
+	Void add( const String& image, const String& kernel, const String& variant,
+		Double pixels, const std::vector<Double>& times ) {
+		Double best = times[0];
+		Double mean = 0.0;
+		for( size_t i = 0; i < times.size(); i++ ) {
+			if( times[i] < best )
+				best = times[i];
+			mean += times[i];
+		}
+		mean /= times.size();
+
+		std::ostringstream s;
+		s << (first ? "" : ",\n") << "    {\"image\": \"" << image
+		  << "\", \"kernel\": \"" << kernel
+		  << "\", \"variant\": \"" << variant
+		  << "\", \"pixels\": " << (Int64)pixels
+		  << ", \"best_s\": " << best
+		  << ", \"mean_s\": " << mean
+		  << ", \"mpixels_per_s\": " << (best > 0.0 ? pixels / best / 1e6 : 0.0)
+		  << "}";
+		results += s.str();
+		first = false;
+	}
+
+	Void write( std::ostream& out ) const {
+		out << "{\n"
+			<< "  \"backend\": \"" << backendName() << "\",\n"
+			<< "  \"threads\": " << options.threads << ",\n"
+			<< "  \"width\": " << options.width << ",\n"
+			<< "  \"height\": " << options.height << ",\n"
+			<< "  \"repeats\": " << options.repeats << ",\n"
+			<< "  \"null_fraction\": " << options.nullFraction << ",\n"
+			<< "  \"results\": [\n" << results << "\n  ]\n"
+			<< "}\n";
+	}
+private:
+	const Options& options;
+	Bool first;
+	String results;
+};
+
+//-----------------------------------------------------------------------------
+// Synthetic data
+//-----------------------------------------------------------------------------
+
+/** Writes a header keyword. CFITSIO takes the keyword name as a non-const
+	string, although it never modifies it. */
+static Int writeKey( fitsfile* file, Int type, const char* name, Void* value, Int* status ) {
+	return fits_write_key( file, type, const_cast<char*>( name ), value, NULL, status );
+}
+
+/** Writes a synthetic image to disk. The pixel values are a smooth gradient
+	with superimposed noise in the interval [0;100], which is representable 
+	by all pixel formats.
+	@param fileName Path of the file to create. Existing files are replaced.
+	@param spec Image type to write.
+	@param width Width of the image.
+	@param height Height of the image.
+	@param nullFraction Fraction of pixels to mark as null. */
+static Void writeImage( const String& fileName, const ImageSpec& spec, 
+	UInt width, UInt height, Double nullFraction ) {
+
+	const Double nullValue = -1.0;
+	Int status = 0;
+	fitsfile* file = NULL;
+	String path = "!" + fileName;	// Leading ! tells CFITSIO to overwrite.
+
+	long axes[2] = { width, height };
+	if( fits_create_file( &file, const_cast<char*>( path.c_str() ), &status ) ||
+		fits_create_img( file, spec.bitpix, 2, axes, &status ) )
+		throw Exception( "Could not create " + fileName );
+
+	if( spec.scaled ) {
+		Double bscale = 0.01;
+		Double bzero  = 50.0;
+		writeKey( file, TDOUBLE, "BSCALE", &bscale, &status );
+		writeKey( file, TDOUBLE, "BZERO", &bzero, &status );
+		fits_set_bscale( file, bscale, bzero, &status );
+	}
+	Bool isFloat = ( spec.bitpix == FLOAT_IMG || spec.bitpix == DOUBLE_IMG );
+	if( nullFraction > 0.0 && !isFloat ) {
+		writeKey( file, TLONGLONG, "BLANK", const_cast<LONGLONG*>( &spec.blank ), &status );
+		fits_set_imgnull( file, spec.blank, &status );
+	}
+
+	std::vector<Double> row( width );
+	UInt seed = 12345;
+	for( UInt y = 0; y < height; y++ ) {
+		for( UInt x = 0; x < width; x++ ) {
+			seed = seed * 1103515245 + 12345;
+			Double noise = ( ( seed >> 16 ) & 0x7FFF ) / 32767.0;
+			if( noise < nullFraction ) {
+				row[x] = nullValue;
+			} else {
+				row[x] = 90.0 * ( x + y ) / ( width + height ) + 10.0 * noise;
+			}
+		}
+		long first[2] = { 1, y + 1 };
+		fits_write_pixnull( file, TDOUBLE, first, width, &row[0], 
+			const_cast<Double*>( &nullValue ), &status );
+	}
+
+	fits_close_file( file, &status );
+	if( status != 0 )
+		throw Exception( "Could not write " + fileName );
+}
+
+//-----------------------------------------------------------------------------
+// Benchmarks
+//-----------------------------------------------------------------------------
+
+/** Runs all kernel benchmarks on a single image.
+	@param fileName Path of the synthetic image.
+	@param name Name of the image in the report. */
+static Void benchmarkImage( const String& fileName, const String& name, 
+	const Options& options, Report& report ) {
+
+	ImageReader* reader = ImageReader::FromFile( fileName );
+	const ImageCube* cube = (*reader)[0];
+	UInt count = cube->PixelsPerPlane();
+
+	std::vector<Byte>	raw( cube->SizeOf( 0 ) );
+	std::vector<Byte>	nullMap( ImageCube::NullMapSize( count ) );
+	std::vector<Double>	stretched( count );
+	std::vector<Double>	scaled( count );
+	std::vector<Double>	times( options.repeats );
+	Bool hasNulls = false;
+
+	// I/O
+	for( Int r = 0; r < options.repeats; r++ ) {
+		Timer t;
+		if( cube->NeedsNullMap() )
+			hasNulls = cube->Read( 0, &raw[0], &nullMap[0] );
+		else
+			cube->Read( 0, &raw[0] );
+		times[r] = t.elapsed();
+	}
+	report.add( name, "ImageCube::Read", "", count, times );
+	Byte* nulls = hasNulls ? &nullMap[0] : NULL;
+
+	// Stretches
+	Stretch stretch;
+	for( Int f = stretchLinear; f < stretchNoStretch; f++ ) {
+		stretch.function = (StretchFunction)f;
+		for( Int r = 0; r < options.repeats; r++ ) {
+			Timer t;
+			FitsEngine::stretch( stretch, cube->Format(), &raw[0], nulls, 
+				&stretched[0], count, options.threads );
+			times[r] = t.elapsed();
+		}
+		report.add( name, "FitsEngine::stretch", stretchNames[f], count, times );
+	}
+	stretch.function = stretchLinear;
+	FitsEngine::stretch( stretch, cube->Format(), &raw[0], nulls, 
+		&stretched[0], count, options.threads );
+
+	// Statistics
+	UInt pixelCount = 0;
+	Double min = DoubleMax, max = DoubleMin, mean = 0.0;
+	for( Int r = 0; r < options.repeats; r++ ) {
+		pixelCount = 0;
+		min = DoubleMax;
+		max = DoubleMin;
+		mean = 0.0;
+		Timer t;
+		FitsStatisticsTools::getRange_par( &stretched[0], count, &pixelCount, 
+			&min, &max, &mean, options.threads );
+		times[r] = t.elapsed();
+	}
+	report.add( name, "FitsStatisticsTools::getRange_par", "", count, times );
+	mean /= pixelCount;
+
+	Vector<Double> histogram( count < kFITSHistogramBins ? count : kFITSHistogramBins );
+	Double invBinSize = ( histogram.size() - 1.0 ) / ( max - min );
+	Double stdev = 0.0;
+	for( Int r = 0; r < options.repeats; r++ ) {
+		std::fill( histogram.begin(), histogram.end(), 0.0 );
+		stdev = 0.0;
+		Timer t;
+		FitsStatisticsTools::getHistogram_par( &stretched[0], count, &stdev, 
+			mean, min, invBinSize, histogram, options.threads );
+		times[r] = t.elapsed();
+	}
+	report.add( name, "FitsStatisticsTools::getHistogram_par", "", count, times );
+
+	Vector<Double> rawHistogram( histogram );
+	Double median = 0.0, maxBinCount = 0.0;
+	for( Int r = 0; r < options.repeats; r++ ) {
+		histogram = rawHistogram;
+		Timer t;
+		FitsStatisticsTools::scaleHistogram( histogram, &median, min, max, 
+			&maxBinCount, pixelCount );
+		times[r] = t.elapsed();
+	}
+	report.add( name, "FitsStatisticsTools::scaleHistogram", "", histogram.size(), times );
+
+	// Scaling
+	stretch.blackLevel = min;
+	stretch.whiteLevel = max;
+	stretch.outputMax  = 0xFF;
+	for( Int r = 0; r < options.repeats; r++ ) {
+		std::copy( stretched.begin(), stretched.end(), scaled.begin() );
+		Timer t;
+		FitsEngine::scale_par( stretch, &scaled[0], count, options.threads );
+		times[r] = t.elapsed();
+	}
+	report.add( name, "FitsEngine::scale_par", "", count, times );
+
+	// Preview resampling of the whole image into a 512x512 preview.
+	NullChangeManager changeManager;
+	GlobalSettingsModel globalSettingsModel( &changeManager );
+	PreviewModel previewModel( &changeManager, globalSettingsModel );
+	PreviewController previewController( previewModel, globalSettingsModel );
+	Size previewSize( 512, 512 );
+	Size rawSize( cube->Width(), cube->Height() );
+	previewModel.setPreviewSize( previewSize );
+	previewModel.generateZoomFit( rawSize );
+	previewController.fitToPreview( rawSize, false );
+
+	ImageTile tile;
+	tile.setX( 0 );
+	tile.setY( 0 );
+	tile.setWidth( cube->Width() );
+	tile.setHeight( cube->Height() );
+	tile.rawPixels = &raw[0];
+	tile.stretchedPixels = &stretched[0];
+	previewController.prepareTile( tile, false );
+	for( Int r = 0; r < options.repeats; r++ ) {
+		Timer t;
+		previewController.zoomTile_par( tile, false, options.threads );
+		times[r] = t.elapsed();
+	}
+	report.add( name, "PreviewController::zoomTile_par", "", 
+		previewSize.getArea(), times );
+	// The tile does not own the buffers.
+	tile.rawPixels = NULL;
+	tile.stretchedPixels = NULL;
+
+	// TIFF export
+	static const ChannelSettings channels[] = { channel8, channel16, channel32 };
+	static const char* channelNames[] = { "8bit", "16bit", "32bit" };
+	ProgressModel progressModel( &changeManager );
+	for( Int c = 0; c < 3; c++ ) {
+		FitsSession session;
+		session.plane.imageIndex = 0;
+		session.plane.planeIndex = 0;
+		session.stretch = stretch;
+		session.importSettings.channelSettings = channels[c];
+		session.importSettings.undefinedSettings = undefinedBlack;
+		session.flip.flipped = false;
+		session.applyStretchValues = true;
+
+		String tiffName = fileName + ".tif";
+		for( Int r = 0; r < options.repeats; r++ ) {
+			TileControl tileControl( 256 * 1024 * 1024 );
+			tileControl.reTile( cube, TileControl::tileSizeImport, session.plane );
+			Timer t;
+			FileLoader loader( tileControl, *reader, &session, tiffName );
+			loader.ReadStart();
+			loader.ReadContinue( progressModel );
+			times[r] = t.elapsed();
+		}
+		std::remove( tiffName.c_str() );
+		report.add( name, "FileLoader", channelNames[c], count, times );
+	}
+
+	delete reader;
+}
+
+static Void usage() {
+	std::cerr << "Usage: EngineBenchmark [-w width] [-h height] [-r repeats] "
+		"[-t threads] [-n nullFraction] [-d directory] [-o output.json]" << std::endl;
+}
+
+int main( int argc, char* argv[] ) {
+	Options options;
+	for( Int i = 1; i < argc; i++ ) {
+		if( i + 1 >= argc || argv[i][0] != '-' || std::strlen( argv[i] ) != 2 ) {
+			usage();
+			return 1;
+		}
+		const char* value = argv[++i];
+		switch( argv[i - 1][1] ) {
+			case 'w': options.width = std::atoi( value ); break;
+			case 'h': options.height = std::atoi( value ); break;
+			case 'r': options.repeats = std::atoi( value ); break;
+			case 't': options.threads = std::atoi( value ); break;
+			case 'n': options.nullFraction = std::atof( value ); break;
+			case 'd': options.directory = value; break;
+			case 'o': options.output = value; break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if( options.width == 0 || options.height == 0 || options.repeats < 1 || options.threads < 1 ) {
+		usage();
+		return 1;
+	}
+
+	Parallelism::Initialize();
+	Report report( options );
+	try {
+		for( Int i = 0; i < imageSpecCount; i++ ) {
+			for( Int withNulls = 0; withNulls < 2; withNulls++ ) {
+				String name = String( imageSpecs[i].name ) + ( withNulls ? "Nulls" : "" );
+				String fileName = options.directory + "/benchmark-" + name + ".fits";
+				std::cerr << "Benchmarking " << name << "..." << std::endl;
+
+				writeImage( fileName, imageSpecs[i], options.width, options.height, 
+					withNulls ? options.nullFraction : 0.0 );
+				benchmarkImage( fileName, name, options, report );
+				std::remove( fileName.c_str() );
+			}
+		}
+	} catch( Exception& e ) {
+		std::cerr << "Benchmark failed: " << e.getMessage() << std::endl;
+		return 1;
+	}
+
+	if( options.output.size() != 0 ) {
+		std::ofstream out( options.output.c_str() );
+		report.write( out );
+	} else {
+		report.write( std::cout );
+	}
+	return 0;
+}
@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# The ESA/ESO/NASA FITS Liberator - http://code.google.com/p/fitsliberator
+#
+# Copyright (c) 2004-2010, ESA/ESO/NASA.
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+# 
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the names of the European Space Agency (ESA), the European 
+#       Southern Observatory (ESO) and the National Aeronautics and Space 
+#       Administration (NASA) nor the names of its contributors may be used to
+#       endorse or promote products derived from this software without specific
+#       prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+# ARE DISCLAIMED. IN NO EVENT SHALL ESA/ESO/NASA BE LIABLE FOR ANY DIRECT, 
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# =============================================================================
+#
+# The ESA/ESO/NASA FITS Liberator uses NASA's CFITSIO library, libtiff, 
+# TinyXML, Boost C++ Libraries, Object Access Library and Intel Threading 
+# Building Blocks.
+#
+# =============================================================================
+#
+# Project Executive:
+#   Lars Lindberg Christensen
+#
+# Technical Project Manager:
+#   Lars Holm Nielsen
+#
+# Developers:
+#   Kaspar Kirstein Nielsen & Teis Johansen
+# 
+# Technical, scientific support and testing: 
+#   Robert Hurt
+#   Davide De Martin
+#
+#
+# Script for compiling the engine benchmark (EngineBenchmark.cpp) as a 
+# console application.
+#
+# Usage:
+# - Build CFITSIO, libtiff and zlib with their build_mac.sh scripts.
+# - Run this script from the same directory as the script. Set USE_TBB=1 to
+#   link against TBB or USE_OPENMP=1 to use OpenMP (both off by default).
+# - The benchmark is written to build/EngineBenchmark.
+#
+ROOT=../../..
+LIB=$ROOT/liberator
+PDS=$ROOT/pds_toolbox/library
+SDK="-mmacosx-version-min=10.5 -isysroot /Developer/SDKs/MacOSX10.5.sdk -arch i386"
+DEFINES="-DTIXML_USE_STL -DOSX=1 -DPDS_TOOLBOX=1"
+LIBS="$ROOT/cfitsio/binaries/libcfitsio.a $ROOT/libtiff/binaries/libtiff.a $ROOT/zlib/binaries/libz.a $ROOT/boost/binaries/libboost_thread-mt-1_35.a"
+
+if [ "$USE_TBB" = "1" ]; then
+	DEFINES="$DEFINES -DUSE_TBB=1"
+	LIBS="$LIBS -L$ROOT/tbb/binaries -ltbb"
+fi
+if [ "$USE_OPENMP" = "1" ]; then
+	DEFINES="$DEFINES -DUSE_OPENMP=1 -fopenmp"
+fi
+
+INCLUDES="-I$LIB/headers -I$LIB/headers/Engine -I$LIB/headers/Cache -I$LIB/headers/Mac -I$LIB/headers/Modelling -I$LIB/headers/Modelling/Models -I$LIB/headers/Modelling/Controllers -I$LIB/headers/Modelling/Views -I$LIB/headers/Preferences -I$ROOT/tinyxml/library -I$ROOT/cfitsio/library -I$ROOT/libtiff/library/libtiff -I$ROOT/zlib/library -I$ROOT/boost/library -I$ROOT/tbb/library/include -I$PDS/oal -I$PDS/lablib -I$PDS/lablib3 -I$PDS/odlc"
+
+# FitsStatistics.cpp is not part of the plug-in projects and is left out.
+SOURCES="EngineBenchmark.cpp `ls $LIB/sources/Engine/*.cpp | grep -v /FitsStatistics.cpp`"
+SOURCES="$SOURCES $LIB/sources/Cache/*.cpp"
+SOURCES="$SOURCES $LIB/sources/Image.cpp $LIB/sources/Exception.cpp $LIB/sources/TextUtils.cpp $LIB/sources/Environment.cpp $LIB/sources/Mac/BundleFactory.cpp"
+SOURCES="$SOURCES $LIB/sources/Modelling/Observer.cpp $LIB/sources/Modelling/AccumulatingChangeManager.cpp"
+SOURCES="$SOURCES $LIB/sources/Modelling/Controllers/PreviewController.cpp"
+SOURCES="$SOURCES $LIB/sources/Modelling/Models/PreviewModel.cpp $LIB/sources/Modelling/Models/ProgressModel.cpp $LIB/sources/Modelling/Models/GlobalSettingsModel.cpp"
+SOURCES="$SOURCES $ROOT/tinyxml/library/tinyxml.cpp $ROOT/tinyxml/library/tinyxmlparser.cpp $ROOT/tinyxml/library/tinyxmlerror.cpp $ROOT/tinyxml/library/tinystr.cpp"
+
+CSOURCES="$PDS/lablib/*.c $PDS/lablib3/lablib3.c $PDS/odlc/*.c"
+for f in binrep clmdcmp1 clmdcmp2 decomp oa_gif oal oamalloc obj_l1 obj_l2 odlutils rprt_err stream_l struct_l writegif; do
+	CSOURCES="$CSOURCES $PDS/oal/$f.c"
+done
+
+mkdir -p build/objects
+for f in $CSOURCES; do
+	gcc-4.2 $SDK -O2 $DEFINES $INCLUDES -c $f -o build/objects/`basename $f .c`.o || exit 1
+done
+g++-4.2 $SDK -O2 $DEFINES $INCLUDES $SOURCES build/objects/*.o $LIBS -framework Carbon -framework ApplicationServices -o build/EngineBenchmark